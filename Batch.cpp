@@ -0,0 +1,864 @@
+// -*- tab-width: 4; mode: c++ -*-
+//  Batch.cpp
+//
+//  Usage: webcamoo-batch [-t threshold] [-b brightness] [-c contrast]
+//                        [-g gamma] [-l black,white] [-m luma]
+//                        [-r strength[,motion]] [-d size]
+//                        [-s radius[,passes]] [-u amount]
+//                        [-j threads] [-o dir] [-a|-e|-k inks]
+//                        [-Q level] [-n] [-q] [-T] file ...
+//         webcamoo-batch -M [-d size] [-r strength[,motion]]
+//
+//  Every input file is thresholded and written as "name-bw.ext".
+//  Still images are processed one per task. The frames of a video
+//  are split into chunks, which are processed in parallel, only
+//  when no frame depends on the previous ones (a fixed threshold
+//  in B/W, without the temporal average); otherwise each video is
+//  processed in order as one task, in parallel with the others.
+//  Videos (Y4M or raw) are read through a shared memory mapping
+//  and always written as Y4M.
+//  In the CLAHE (-e) and ink (-k) modes, each frame is also split
+//  over the threads.
+//  With "-m all", the inputs are run once per luma model and the
+//  throughput of each is reported; nothing is written.
+//  With -T, the reading, processing and writing of every frame are
+//  timed and their percentiles reported.
+//  With -M, the median filter is checked against a plain sort on
+//  synthetic frames, and it and the temporal average are timed at
+//  a few frame sizes. Every output mode is also checked to give the
+//  same frames in place (src = dst) as into another buffer.
+//  With -Q, the frames are processed at a lower quality level, as
+//  the filter does when it falls behind, to see what each saves.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Batch.h"
+#include "FiltaaCore.h"
+#include "FrameTiming.h"
+#include "ImageFile.h"
+#include "Ink.h"
+#include "MedianFilter.h"
+#include "QualityControl.h"
+#include "StageTimer.h"
+#include "TemporalFilter.h"
+#include "ThreadPool.h"
+#include "TraceLog.h"
+#include "VideoFile.h"
+
+//  Constants
+//
+static const char PROGRAM_NAME[] = "webcamoo-batch";
+static const int FRAMES_PER_TASK = 8;
+static const int DEFAULT_SHARPEN_RADIUS = 2;
+// The frames of the filter benchmarks.
+static const int FILTER_BENCH_SIZES[][2] = {
+    { 1280, 720 }, { 1920, 1080 }, { 3840, 2160 },
+};
+static const int FILTER_BENCH_FRAMES = 20;
+static const int DEFAULT_TEMPORAL = 2;
+static const int TIMING_CHECK_FRAMES = 600;
+static const int TIMING_CHECK_LOST = 300; // the first of 3 lost frames.
+// The simulated load of the quality check, in frames.
+static const int QUALITY_CHECK_CALM = 300;
+static const int QUALITY_CHECK_BUSY = 300;
+static const int QUALITY_CHECK_FRAMES = 1200;
+static const int QUALITY_CHECK_STEPS = 10;
+// The frames of the in-place check.
+static const int IN_PLACE_CHECK_WIDTH = 640;
+static const int IN_PLACE_CHECK_HEIGHT = 480;
+static const int IN_PLACE_CHECK_FRAMES = 8;
+
+
+//  BatchOptions
+//
+struct BatchOptions
+{
+    int threshold;              // -1 = automatic.
+    ToneParams tone;
+    FilterParams filter;
+    int lumaModel;              // -1 = every model in turn.
+    int nthreads;               // 0 = one per CPU.
+    const char* outdir;         // NULL = next to the input.
+    OutputMode output;
+    int inks;                   // colors of the ink mode.
+    QualityLevel quality;
+    bool nooutput;
+    bool quiet;
+    bool timing;
+    const char* trace;          // NULL = no trace.
+};
+
+//  BatchStats
+//
+struct BatchStats
+{
+    std::atomic<uint64_t> frames;
+    std::atomic<uint64_t> bytes;
+    std::atomic<int> errors;
+    StageTimers timers;
+};
+
+// usage: show the command line syntax.
+static int usage()
+{
+    fprintf(stderr,
+            "usage: %s [-t threshold] [-b brightness] [-c contrast] [-g gamma]\n"
+            "       [-l black,white] [-m luma] [-r strength[,motion]] [-d size]\n"
+            "       [-s radius[,passes]] [-u amount] [-j threads] [-o dir]"
+            " [-a|-e|-k inks] [-Q level]\n"
+            "       [-n] [-q] [-T] [-x trace.json] file ...\n"
+            "       %s -M [-d size] [-r strength[,motion]]\n"
+            "  -t threshold  fixed threshold (0-255); default is automatic.\n"
+            "  -b brightness added to luma (-255 to 255).\n"
+            "  -c contrast   in percent around mid gray (-100 to 100).\n"
+            "  -g gamma      in percent; 100 is linear.\n"
+            "  -l black,white  input levels stretched to 0-255.\n"
+            "  -m luma       bt601 (default), bt709, green or max;\n"
+            "                all benchmarks each of them.\n"
+            "  -r strength[,motion]  average the luma over 2^strength (1-4)\n"
+            "                frames; a change of motion levels restarts it.\n"
+            "  -d size       median of 3x3 or 5x5 pixels against noise.\n"
+            "  -s radius[,passes]  blur the luma; 3 passes (default) are\n"
+            "                about a Gaussian of sigma radius.\n"
+            "  -u amount     sharpen by amount percent (unsharp mask).\n"
+            "  -j threads    number of threads; default is one per CPU.\n"
+            "  -o dir        output directory; default is next to the input.\n"
+            "  -a            auto-levels gray instead of black and white.\n"
+            "  -e            adaptive equalized (CLAHE) gray.\n"
+            "  -k inks       board and 1-4 ink colors (black, red, blue, green).\n"
+            "  -Q level      process at a lower quality: 1 keeps the threshold,\n"
+            "                2 also samples the histogram, 3 also halves the\n"
+            "                height.\n"
+            "  -n            do not write the results (benchmark only).\n"
+            "  -q            do not report the throughput.\n"
+            "  -T            report the time of each stage per frame.\n"
+            "  -x trace.json write the stages of the last frames of each\n"
+            "                thread as Chrome trace events (of the last\n"
+            "                luma model with -m all).\n"
+            "  -M            check the median (both sizes by default) against\n"
+            "                a plain sort, and time it and the temporal average\n"
+            "                at 720p, 1080p and 4K; check the frame timing\n"
+            "                with a simulated clock, the quality levels\n"
+            "                with a simulated load, and every output mode\n"
+            "                in place.\n"
+            "Inputs can be PPM (P6), 24-bit BMP, YUV4MPEG2 or raw video\n"
+            "(.bgr, .rgb, .yuy2 with the size in the name as in \"a_640x480.bgr\").\n",
+            PROGRAM_NAME, PROGRAM_NAME);
+    return 100;
+}
+
+// getOutputPath: returns "dir/name-bw.ext" for an input path.
+//   suffix is appended when given, as in "name-bw.bgr.y4m".
+static std::string getOutputPath(
+    const char* path, const char* outdir, const char* suffix=NULL)
+{
+    std::string s(path);
+    size_t slash = s.find_last_of("/\\");
+    size_t start = (slash == std::string::npos)? 0 : slash+1;
+    size_t dot = s.rfind('.');
+    if (dot == std::string::npos || dot < start) {
+        dot = s.size();
+    }
+    std::string name = s.substr(start, dot-start) + "-bw" + s.substr(dot);
+    if (suffix != NULL) {
+        name += suffix;
+    }
+    if (outdir == NULL) {
+        return s.substr(0, start) + name;
+    }
+    std::string dir(outdir);
+    if (!dir.empty() && dir[dir.size()-1] != '/' && dir[dir.size()-1] != '\\') {
+        dir += '/';
+    }
+    return dir + name;
+}
+
+// processImage: thresholds a still image.
+static void processImage(
+    ThreadPool* pool, const BatchOptions* opts, BatchStats* stats,
+    const std::string& src, const std::string& dst, ImageFormat format)
+{
+    Image img;
+    if (!readImage(src.c_str(), &img)) {
+        fprintf(stderr, "%s: cannot read: %s\n", PROGRAM_NAME, src.c_str());
+        stats->errors++;
+        return;
+    }
+
+    FiltaaCore core;
+    core.SetThreshold(opts->threshold);
+    core.SetTone(&opts->tone);
+    core.SetFilter(&opts->filter);
+    core.SetLumaModel((LumaModel)opts->lumaModel);
+    core.SetOutputMode(opts->output);
+    core.SetQuality(opts->quality);
+    if (opts->output == OUTPUT_INK) {
+        InkPalette palette;
+        initInkPalette(&palette);
+        palette.count = 1 + opts->inks;
+        core.SetInkPalette(&palette);
+    }
+    core.SetPool(pool);
+    StageTimers* timers = (opts->timing || opts->trace != NULL)? &stats->timers : NULL;
+    core.SetTimers(timers);
+    if (opts->output == OUTPUT_CLAHE || 0 < opts->filter.radius ||
+        0 < opts->filter.median || 0 < opts->filter.temporal) {
+        core.Setup(img.width, img.height);
+    }
+    if (opts->threshold < 0 || opts->output != OUTPUT_BW) {
+        core.Prime(img.data, img.stride, img.width, img.height);
+    }
+    {
+        StageScope transform(timers, STAGE_TRANSFORM);
+        core.Process(img.data, img.stride, img.data, img.stride,
+                     img.width, img.height);
+    }
+    stats->frames++;
+    stats->bytes += img.stride * img.height;
+
+    if (!opts->nooutput && !writeImage(dst.c_str(), &img, format)) {
+        fprintf(stderr, "%s: cannot write: %s\n", PROGRAM_NAME, dst.c_str());
+        stats->errors++;
+    }
+    freeImage(&img);
+}
+
+// isFrameIndependent: checks if the output of a frame does not
+//   depend on the frames before it.
+static bool isFrameIndependent(const BatchOptions* opts)
+{
+    return (0 <= opts->threshold && opts->output == OUTPUT_BW &&
+            opts->filter.temporal == 0);
+}
+
+// processFrames: thresholds frames [begin,end) of a video.
+//   As in live video, the automatic threshold of a frame comes
+//   from the previous one; the first frame is primed. Unless the
+//   frames are independent, begin must be the first frame of the
+//   video so that the output is that of live video.
+static void processFrames(
+    ThreadPool* pool, const BatchOptions* opts, BatchStats* stats,
+    std::shared_ptr<const VideoFile> video, const std::string& dst,
+    int begin, int end)
+{
+    int width = video->GetWidth();
+    int height = video->GetHeight();
+    Y4MWriter out;
+    if (!opts->nooutput && !out.Attach(dst.c_str(), width, height)) {
+        fprintf(stderr, "%s: cannot write: %s\n", PROGRAM_NAME, dst.c_str());
+        stats->errors++;
+        return;
+    }
+    Image img;
+    if (!allocImage(&img, width, height)) {
+        stats->errors++;
+        return;
+    }
+
+    FiltaaCore core;
+    core.SetThreshold(opts->threshold);
+    core.SetTone(&opts->tone);
+    core.SetFilter(&opts->filter);
+    core.SetLumaModel((LumaModel)opts->lumaModel);
+    core.SetOutputMode(opts->output);
+    core.SetQuality(opts->quality);
+    if (opts->output == OUTPUT_INK) {
+        InkPalette palette;
+        initInkPalette(&palette);
+        palette.count = 1 + opts->inks;
+        core.SetInkPalette(&palette);
+    }
+    core.SetPool(pool);
+    StageTimers* timers = (opts->timing || opts->trace != NULL)? &stats->timers : NULL;
+    core.SetTimers(timers);
+    if (opts->output == OUTPUT_CLAHE || 0 < opts->filter.radius ||
+        0 < opts->filter.median || 0 < opts->filter.temporal) {
+        core.Setup(width, height);
+    }
+    for (int i = begin; i < end; i++) {
+        StageScope whole(timers, STAGE_FRAME);
+        // B,G,R frames are read straight from the mapping.
+        const uint8_t* src = img.data;
+        VideoFrame frame;
+        if (video->GetFormat() == VIDEO_BGR24) {
+            video->GetFrame(i, &frame);
+            src = frame.planes[0];
+        } else {
+            StageScope copy(timers, STAGE_COPY);
+            video->ReadFrame(i, img.data, img.stride);
+        }
+        if (i == begin && (opts->threshold < 0 || opts->output != OUTPUT_BW)) {
+            core.Prime(src, img.stride, width, height);
+        }
+        {
+            StageScope transform(timers, STAGE_TRANSFORM);
+            core.Process(src, img.stride, img.data, img.stride, width, height);
+        }
+        stats->frames++;
+        stats->bytes += video->GetFrameSize();
+        if (!opts->nooutput) {
+            StageScope deliver(timers, STAGE_DELIVER);
+            if (!out.WriteFrame(i, &img)) {
+                fprintf(stderr, "%s: cannot write: %s\n",
+                        PROGRAM_NAME, dst.c_str());
+                stats->errors++;
+                break;
+            }
+        }
+    }
+    freeImage(&img);
+}
+
+// submitFile: queues the tasks for an input file.
+static void submitFile(
+    ThreadPool* pool, const BatchOptions* opts, BatchStats* stats,
+    const char* path)
+{
+    ImageFormat format = getImageFormat(path);
+    if (format == IMAGE_PPM || format == IMAGE_BMP) {
+        std::string src(path);
+        std::string dst = getOutputPath(path, opts->outdir);
+        pool->Submit([=]{
+            processImage(pool, opts, stats, src, dst, format);
+        });
+        return;
+    }
+
+    std::shared_ptr<VideoFile> video(new VideoFile());
+    if (!video->Open(path)) {
+        fprintf(stderr, "%s: cannot read: %s\n", PROGRAM_NAME, path);
+        stats->errors++;
+        return;
+    }
+    std::string dst = getOutputPath(
+        path, opts->outdir, (format == IMAGE_Y4M)? NULL : ".y4m");
+    if (!opts->nooutput) {
+        // Write the header; the frames are filled in by the tasks.
+        Y4MWriter out;
+        if (!out.Create(dst.c_str(), video->GetWidth(), video->GetHeight(),
+                        video->GetRateNum(), video->GetRateDen())) {
+            fprintf(stderr, "%s: cannot write: %s\n",
+                    PROGRAM_NAME, dst.c_str());
+            stats->errors++;
+            return;
+        }
+    }
+    std::shared_ptr<const VideoFile> shared(video);
+    int nframes = video->GetFrameCount();
+    // The state carried from frame to frame (the threshold, the
+    //   stretch, the temporal average...) would restart in every chunk.
+    int chunk = isFrameIndependent(opts)? FRAMES_PER_TASK : nframes;
+    for (int i = 0; i < nframes; i += chunk) {
+        int end = (nframes < i+chunk)? nframes : i+chunk;
+        pool->Submit([=]{
+            processFrames(pool, opts, stats, shared, dst, i, end);
+        });
+    }
+}
+
+// reportStages: prints the percentiles of each stage and what the
+//   timing itself costs.
+static void reportStages(StageTimers* timers)
+{
+    uint64_t scopes = 0;
+    StageStats frame;
+    if (!timers->GetStats(STAGE_FRAME, &frame)) {
+        fprintf(stderr, "%s: the stage timers are compiled out\n", PROGRAM_NAME);
+        return;
+    }
+    for (int i = 0; i < STAGES; i++) {
+        StageStats st;
+        timers->GetStats((Stage)i, &st);
+        if (st.count == 0) continue;
+        scopes += st.count;
+        fprintf(stderr, "%s:   %-9s %8llu times, p50 %.3f, p95 %.3f, "
+                "p99 %.3f, max %.3f ms\n",
+                PROGRAM_NAME, getStageName((Stage)i), (unsigned long long)st.count,
+                st.p50/1e6, st.p95/1e6, st.p99/1e6, st.max/1e6);
+    }
+    if (frame.count == 0 || frame.p50 == 0) return;
+    double overhead = measureStageOverhead();
+    double share = overhead * scopes / frame.count / frame.p50;
+    fprintf(stderr, "%s:   timing costs %.0f ns a stage, %.4f%% of a frame\n",
+            PROGRAM_NAME, overhead, share*100);
+}
+
+// makeNoisyBoard: a synthetic luma frame: an unevenly lit board
+//   with dark strokes, grain and salt-and-pepper noise.
+static void makeNoisyBoard(uint8_t* lum, int width, int height, uint32_t seed)
+{
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            seed = seed*1103515245 + 12345;
+            int v = 200 + x*40/width;
+            if ((x/7 + y/11) % 23 == 0) {
+                v = 40;
+            }
+            v += (int)((seed >> 16) & 15) - 8;
+            int r = (int)(seed >> 24);
+            if (r < 3) {
+                v = 0;
+            } else if (252 < r) {
+                v = 255;
+            }
+            *lum++ = (uint8_t)((v < 0)? 0 : (255 < v)? 255 : v);
+        }
+    }
+}
+
+// benchMedian: checks MedianFilter against getMedianReference()
+//   and reports the throughput of both. Returns the exit status.
+static int benchMedian(int size)
+{
+    int errors = 0;
+    int n = (int)(sizeof(FILTER_BENCH_SIZES) / sizeof(FILTER_BENCH_SIZES[0]));
+    for (int i = 0; i < n; i++) {
+        int width = FILTER_BENCH_SIZES[i][0];
+        int height = FILTER_BENCH_SIZES[i][1];
+        size_t pixels = (size_t)width*height;
+        std::vector<uint8_t> src(pixels), ref(pixels), out(pixels);
+        makeNoisyBoard(&src[0], width, height, 12345);
+
+        std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+        getMedianReference(&ref[0], &src[0], width, width, height, size);
+        double refSecs = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - t0).count();
+
+        MedianFilter filter;
+        if (!filter.Setup(width)) return 1;
+        filter.Configure(size);
+        int y = 0;
+        auto put = [&](const uint8_t* row) {
+            memcpy(&out[(size_t)width*y], row, width);
+            y++;
+        };
+        t0 = std::chrono::steady_clock::now();
+        for (int frame = 0; frame < FILTER_BENCH_FRAMES; frame++) {
+            y = 0;
+            filter.Begin();
+            for (int j = 0; j < height; j++) {
+                filter.Push(&src[(size_t)width*j], put);
+            }
+            filter.Finish(put);
+        }
+        double secs = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - t0).count() / FILTER_BENCH_FRAMES;
+
+        bool exact = (y == height && memcmp(&out[0], &ref[0], pixels) == 0);
+        if (!exact) {
+            errors++;
+        }
+        fprintf(stderr, "%s: median %dx%d, %dx%d, %s, %.2f ms, %.1f fps, "
+                "%.1f Mpixels/s (reference %.1f Mpixels/s)\n",
+                PROGRAM_NAME, size, size, width, height,
+                exact? "exact" : "MISMATCH", secs*1e3,
+                (0 < secs)? 1/secs : 0.0,
+                (0 < secs)? pixels/secs/1e6 : 0.0,
+                (0 < refSecs)? pixels/refSecs/1e6 : 0.0);
+    }
+    return (errors == 0)? 0 : 1;
+}
+
+// benchTemporal: reports the memory and the time per frame of
+//   TemporalFilter. Returns the exit status.
+static int benchTemporal(int strength, int motion)
+{
+    int n = (int)(sizeof(FILTER_BENCH_SIZES) / sizeof(FILTER_BENCH_SIZES[0]));
+    for (int i = 0; i < n; i++) {
+        int width = FILTER_BENCH_SIZES[i][0];
+        int height = FILTER_BENCH_SIZES[i][1];
+        size_t pixels = (size_t)width*height;
+        // Two frames with different noise, in turn.
+        std::vector<uint8_t> src(2*pixels), row(width);
+        makeNoisyBoard(&src[0], width, height, 12345);
+        makeNoisyBoard(&src[pixels], width, height, 54321);
+
+        TemporalFilter filter;
+        if (!filter.Setup(width, height)) return 1;
+        filter.Configure(strength, motion);
+        double secs = 0;
+        for (int frame = 0; frame <= FILTER_BENCH_FRAMES; frame++) {
+            const uint8_t* lum = &src[pixels*(frame % 2)];
+            std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+            for (int y = 0; y < height; y++) {
+                memcpy(&row[0], lum + (size_t)width*y, width);
+                filter.Blend(&row[0], y);
+            }
+            filter.End();
+            // The first frame only fills the accumulators.
+            if (0 < frame) {
+                secs += std::chrono::duration<double>(
+                    std::chrono::steady_clock::now() - t0).count();
+            }
+        }
+        secs /= FILTER_BENCH_FRAMES;
+
+        fprintf(stderr, "%s: temporal 1/%d, %dx%d, %.1f MB, %.2f ms, %.1f fps, "
+                "%.1f Mpixels/s\n",
+                PROGRAM_NAME, 1 << strength, width, height,
+                filter.GetMemorySize()/1e6, secs*1e3,
+                (0 < secs)? 1/secs : 0.0,
+                (0 < secs)? pixels/secs/1e6 : 0.0);
+    }
+    return 0;
+}
+
+// checkFrameTiming: runs FrameTiming on a simulated 30 fps capture
+//   with known latencies, jitter and a gap, with the rate given and
+//   then estimated. Returns the exit status.
+static int checkFrameTiming()
+{
+    const int64_t MS = 1000000;
+    const int64_t interval = 1000*MS/30;
+    int errors = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        FrameTiming timing;
+        timing.Reset((pass == 0)? interval : 0);
+        uint32_t seed = 12345;
+        int frames = 0;
+        for (int i = 0; i < TIMING_CHECK_FRAMES; i++) {
+            if (TIMING_CHECK_LOST <= i && i < TIMING_CHECK_LOST+3) continue;
+            // The time stamps and the capture latency (10ms) are each
+            // off by up to 1ms; the processing takes 5ms.
+            seed = seed*1103515245 + 12345;
+            int64_t stamp = ((int64_t)((seed >> 8) % 2001) - 1000) * 1000;
+            seed = seed*1103515245 + 12345;
+            int64_t capture = ((int64_t)((seed >> 8) % 2001) - 1000) * 1000;
+            int64_t start = i*interval + stamp;
+            int64_t now = start + 10*MS + capture;
+            timing.Arrive(start, now, false);
+            timing.Deliver(start, now + 5*MS);
+            frames++;
+        }
+
+        FrameTimingStats stats;
+        if (!timing.GetStats(&stats)) {
+            fprintf(stderr, "%s: the frame timing is compiled out\n", PROGRAM_NAME);
+            return 0;
+        }
+        // The percentiles are within 1/16.
+        int64_t arrival = (int64_t)stats.arrival.p50;
+        int64_t delivery = (int64_t)stats.delivery.p50;
+        int64_t drift = stats.interval - interval;
+        bool ok = (stats.frames == (uint64_t)frames &&
+                   stats.gaps == 1 && stats.missing == 3 &&
+                   stats.early == 0 &&
+                   llabs(arrival - 10*MS) <= MS + 10*MS/16 &&
+                   llabs(delivery - 15*MS) <= MS + 15*MS/16 &&
+                   llabs(drift) < MS &&
+                   (int64_t)stats.jitter.max <= 2*MS + 2*MS/16 + llabs(drift));
+        if (!ok) {
+            errors++;
+        }
+        fprintf(stderr, "%s: frame timing (%s rate), %llu frames, "
+                "%llu gaps, %llu missing, arrival %.2f ms, delivery %.2f ms, "
+                "jitter p99 %.2f ms, interval %.2f ms, %s\n",
+                PROGRAM_NAME, (pass == 0)? "nominal" : "estimated",
+                (unsigned long long)stats.frames,
+                (unsigned long long)stats.gaps,
+                (unsigned long long)stats.missing,
+                arrival/1e6, delivery/1e6, stats.jitter.p99/1e6,
+                stats.interval/1e6, ok? "ok" : "MISMATCH");
+    }
+    return (errors == 0)? 0 : 1;
+}
+
+// checkQualityPolicy: runs QualityPolicy on a simulated 30 fps
+//   stream that takes 60% of the frame time, then 160% for a while,
+//   then 60% again, with the renderer falling behind by whatever does
+//   not fit. It should step down while it is busy, keep up there, and
+//   come back to the full quality after. Returns the exit status.
+static int checkQualityPolicy()
+{
+    const int64_t MS = 1000000;
+    const int64_t interval = 1000*MS/30;
+    // The time left at each level, in percent of the full one.
+    static const int COST_PERCENT[QUALITY_LEVELS] = { 100, 99, 95, 55, 55 };
+    QualityPolicy policy;
+    uint32_t seed = 12345;
+    int64_t late = 0;
+    int64_t busyLate = 0;           // lateness at the end of the load.
+    int busyLevel = QUALITY_FULL;
+    int deepest = QUALITY_FULL;
+    for (int i = 0; i < QUALITY_CHECK_FRAMES; i++) {
+        int level = policy.GetLevel();
+        if (deepest < level) deepest = level;
+        if (QUALITY_HALF_RATE <= level && (i & 1)) {
+            // A dropped frame leaves its time.
+            late = (interval < late)? late-interval : 0;
+        } else {
+            bool busy = (QUALITY_CHECK_CALM <= i &&
+                         i < QUALITY_CHECK_CALM+QUALITY_CHECK_BUSY);
+            // Off by up to 5%.
+            seed = seed*1103515245 + 12345;
+            int load = (busy? 160 : 60) + (int)((seed >> 8) % 11) - 5;
+            int64_t time = interval*load/100 * COST_PERCENT[level]/100;
+            late += time - interval;
+            if (late < 0) late = 0;
+            policy.Update(time, late, interval);
+        }
+        if (i == QUALITY_CHECK_CALM+QUALITY_CHECK_BUSY-1) {
+            busyLevel = level;
+            busyLate = late;
+        }
+    }
+
+    int steps = (int)policy.GetSteps();
+    bool ok = (QUALITY_HALF_HEIGHT <= busyLevel && busyLate < interval &&
+               policy.GetLevel() == QUALITY_FULL &&
+               steps <= QUALITY_CHECK_STEPS);
+    fprintf(stderr, "%s: quality policy, %s under load (%.2f ms late), "
+            "%s at most, %s after, %d steps, %s\n",
+            PROGRAM_NAME, getQualityName((QualityLevel)busyLevel),
+            busyLate/1e6, getQualityName((QualityLevel)deepest),
+            getQualityName(policy.GetLevel()), steps, ok? "ok" : "MISMATCH");
+    return ok? 0 : 1;
+}
+
+// makeColorBoard: a synthetic B,G,R frame: a board under warm
+//   light with black, red and blue strokes and grain.
+static void makeColorBoard(uint8_t* rgb, int width, int height, uint32_t seed)
+{
+    static const uint8_t INKS[4][3] = {
+        { 30, 30, 30 }, { 40, 40, 200 }, { 190, 60, 30 }, { 170, 195, 215 },
+    };
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            int stroke = (x/5 + y/9) % 19;
+            const uint8_t* color = INKS[(stroke < 3)? stroke : 3];
+            for (int c = 0; c < 3; c++) {
+                seed = seed*1103515245 + 12345;
+                int v = color[c] + x*30/width + (int)((seed >> 16) & 15) - 8;
+                *rgb++ = (uint8_t)((v < 0)? 0 : (255 < v)? 255 : v);
+            }
+        }
+    }
+}
+
+// checkInPlace: runs every output mode on a few frames both in
+//   place and into another buffer, which must give the same frames.
+//   Returns the exit status.
+static int checkInPlace()
+{
+    static const OutputMode MODES[] = {
+        OUTPUT_BW, OUTPUT_GRAY, OUTPUT_CLAHE, OUTPUT_INK,
+    };
+    static const char* const NAMES[] = { "B/W", "gray", "CLAHE", "ink" };
+    const int width = IN_PLACE_CHECK_WIDTH;
+    const int height = IN_PLACE_CHECK_HEIGHT;
+    size_t stride = (size_t)width*3;
+    size_t size = stride*height;
+    std::vector<uint8_t> src(size), dst(size), buf(size);
+    ThreadPool pool(2);
+    InkPalette palette;
+    initInkPalette(&palette);
+    int errors = 0;
+    for (size_t m = 0; m < sizeof(MODES)/sizeof(MODES[0]); m++) {
+        FiltaaCore cores[2];
+        for (int k = 0; k < 2; k++) {
+            cores[k].SetOutputMode(MODES[m]);
+            cores[k].SetInkPalette(&palette);
+            cores[k].SetPool(&pool);
+            if (!cores[k].Setup(width, height)) return 1;
+        }
+        int mismatch = -1;
+        for (int frame = 0; frame < IN_PLACE_CHECK_FRAMES; frame++) {
+            makeColorBoard(&src[0], width, height, 12345 + frame);
+            memcpy(&buf[0], &src[0], size);
+            cores[0].Process(&src[0], stride, &dst[0], stride, width, height);
+            cores[1].Process(&buf[0], stride, &buf[0], stride, width, height);
+            if (mismatch < 0 && memcmp(&dst[0], &buf[0], size) != 0) {
+                mismatch = frame;
+            }
+        }
+        if (0 <= mismatch) {
+            errors++;
+            fprintf(stderr, "%s: in place, %s, MISMATCH at frame %d\n",
+                    PROGRAM_NAME, NAMES[m], mismatch);
+        } else {
+            fprintf(stderr, "%s: in place, %s, %d frames, ok\n",
+                    PROGRAM_NAME, NAMES[m], IN_PLACE_CHECK_FRAMES);
+        }
+    }
+    return (errors == 0)? 0 : 1;
+}
+
+int BatchMain(int argc, char* argv[])
+{
+    BatchOptions opts;
+    opts.threshold = -1;
+    initToneParams(&opts.tone);
+    initFilterParams(&opts.filter);
+    opts.lumaModel = LUMA_BT601;
+    opts.nthreads = 0;
+    opts.outdir = NULL;
+    opts.output = OUTPUT_BW;
+    opts.inks = 4;
+    opts.quality = QUALITY_FULL;
+    opts.nooutput = false;
+    opts.quiet = false;
+    opts.timing = false;
+    opts.trace = NULL;
+    bool bench = false;
+
+    int i;
+    for (i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        if (arg[0] != '-' || arg[1] == 0) break;
+        if (strcmp(arg, "--") == 0) {
+            i++;
+            break;
+        }
+        if (strcmp(arg, "-a") == 0) {
+            opts.output = OUTPUT_GRAY;
+        } else if (strcmp(arg, "-e") == 0) {
+            opts.output = OUTPUT_CLAHE;
+        } else if (i+1 < argc && strcmp(arg, "-k") == 0) {
+            opts.output = OUTPUT_INK;
+            opts.inks = atoi(argv[++i]);
+            if (opts.inks < 1 || 4 < opts.inks) return usage();
+        } else if (strcmp(arg, "-n") == 0) {
+            opts.nooutput = true;
+        } else if (strcmp(arg, "-q") == 0) {
+            opts.quiet = true;
+        } else if (strcmp(arg, "-T") == 0) {
+            opts.timing = true;
+        } else if (strcmp(arg, "-M") == 0) {
+            bench = true;
+        } else if (i+1 < argc && strcmp(arg, "-Q") == 0) {
+            int level = atoi(argv[++i]);
+            if (level < QUALITY_FULL || QUALITY_HALF_HEIGHT < level) return usage();
+            opts.quality = (QualityLevel)level;
+        } else if (i+1 < argc && strcmp(arg, "-t") == 0) {
+            opts.threshold = atoi(argv[++i]);
+            if (opts.threshold < 0 || 255 < opts.threshold) return usage();
+        } else if (i+1 < argc && strcmp(arg, "-b") == 0) {
+            opts.tone.brightness = atoi(argv[++i]);
+            if (opts.tone.brightness < -255 || 255 < opts.tone.brightness) return usage();
+        } else if (i+1 < argc && strcmp(arg, "-c") == 0) {
+            opts.tone.contrast = atoi(argv[++i]);
+            if (opts.tone.contrast < -100 || 100 < opts.tone.contrast) return usage();
+        } else if (i+1 < argc && strcmp(arg, "-g") == 0) {
+            opts.tone.gamma = atoi(argv[++i]);
+            if (opts.tone.gamma < 10 || 1000 < opts.tone.gamma) return usage();
+        } else if (i+1 < argc && strcmp(arg, "-l") == 0) {
+            if (sscanf(argv[++i], "%d,%d", &opts.tone.black, &opts.tone.white) != 2 ||
+                opts.tone.black < 0 || opts.tone.white <= opts.tone.black ||
+                255 < opts.tone.white) return usage();
+        } else if (i+1 < argc && strcmp(arg, "-m") == 0) {
+            const char* name = argv[++i];
+            opts.lumaModel = (strcmp(name, "all") == 0)? -1 : findLumaModel(name);
+            if (opts.lumaModel < 0 && strcmp(name, "all") != 0) return usage();
+        } else if (i+1 < argc && strcmp(arg, "-r") == 0) {
+            int n = sscanf(argv[++i], "%d,%d",
+                           &opts.filter.temporal, &opts.filter.motion);
+            if (n < 1 || opts.filter.temporal < 1 ||
+                TemporalFilter::MAX_STRENGTH < opts.filter.temporal ||
+                opts.filter.motion < 0 || 255 < opts.filter.motion) return usage();
+        } else if (i+1 < argc && strcmp(arg, "-d") == 0) {
+            opts.filter.median = atoi(argv[++i]);
+            if (opts.filter.median != 3 && opts.filter.median != 5) return usage();
+        } else if (i+1 < argc && strcmp(arg, "-s") == 0) {
+            int n = sscanf(argv[++i], "%d,%d",
+                           &opts.filter.radius, &opts.filter.passes);
+            if (n < 1 || opts.filter.radius < 0 ||
+                LumaFilter::MAX_RADIUS < opts.filter.radius ||
+                opts.filter.passes < 1 ||
+                LumaFilter::MAX_PASSES < opts.filter.passes) return usage();
+        } else if (i+1 < argc && strcmp(arg, "-u") == 0) {
+            opts.filter.amount = atoi(argv[++i]);
+            if (opts.filter.amount <= 0 || 500 < opts.filter.amount) return usage();
+        } else if (i+1 < argc && strcmp(arg, "-j") == 0) {
+            opts.nthreads = atoi(argv[++i]);
+            if (opts.nthreads < 0) return usage();
+        } else if (i+1 < argc && strcmp(arg, "-o") == 0) {
+            opts.outdir = argv[++i];
+        } else if (i+1 < argc && strcmp(arg, "-x") == 0) {
+            opts.trace = argv[++i];
+        } else {
+            return usage();
+        }
+    }
+    if (bench) {
+        if (i < argc) return usage();
+        int status = 0;
+        if (opts.filter.median != 0) {
+            status |= benchMedian(opts.filter.median);
+        } else {
+            status |= benchMedian(3) | benchMedian(5);
+        }
+        int temporal = (0 < opts.filter.temporal)? opts.filter.temporal : DEFAULT_TEMPORAL;
+        status |= benchTemporal(temporal, opts.filter.motion);
+        status |= checkFrameTiming();
+        status |= checkQualityPolicy();
+        status |= checkInPlace();
+        return status;
+    }
+    if (argc <= i) return usage();
+    if (0 < opts.filter.amount && opts.filter.radius == 0) {
+        opts.filter.radius = DEFAULT_SHARPEN_RADIUS;
+    }
+
+    int first = opts.lumaModel, last = opts.lumaModel;
+    if (opts.lumaModel < 0) {
+        first = 0;
+        last = LUMA_MODELS-1;
+        opts.nooutput = true;
+    }
+    int errors = 0;
+    for (int model = first; model <= last; model++) {
+        opts.lumaModel = model;
+        BatchStats stats;
+        stats.frames = 0;
+        stats.bytes = 0;
+        stats.errors = 0;
+
+        std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+        int nthreads;
+        {
+            ThreadPool pool(opts.nthreads);
+            for (int j = i; j < argc; j++) {
+                submitFile(&pool, &opts, &stats, argv[j]);
+            }
+            pool.Wait();
+            nthreads = pool.GetThreadCount();
+        }
+        double secs = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - t0).count();
+        // Before the timing report adds its own scopes.
+        if (opts.trace != NULL && !writeTrace(opts.trace)) {
+            fprintf(stderr, "%s: cannot write: %s\n", PROGRAM_NAME, opts.trace);
+            stats.errors++;
+        }
+
+        if (!opts.quiet) {
+            uint64_t frames = stats.frames.load();
+            uint64_t bytes = stats.bytes.load();
+            fprintf(stderr, "%s: %s, %d threads, %llu frames, %.3f sec, "
+                    "%.1f fps, %.1f MB/s\n",
+                    PROGRAM_NAME, getLumaModelName((LumaModel)model),
+                    nthreads, (unsigned long long)frames, secs,
+                    (0 < secs)? frames/secs : 0.0,
+                    (0 < secs)? bytes/secs/1e6 : 0.0);
+            if (opts.timing) {
+                reportStages(&stats.timers);
+            }
+        }
+        errors += stats.errors.load();
+    }
+    return (errors == 0)? 0 : 1;
+}
+
+#ifndef WINDOWS
+int main(int argc, char* argv[])
+{
+    return BatchMain(argc, argv);
+}
+#endif
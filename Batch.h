@@ -0,0 +1,11 @@
+// -*- tab-width: 4; mode: c++ -*-
+//  Batch.h
+//
+//  Headless processing of image and video files.
+//
+
+#pragma once
+
+// BatchMain: runs the batch mode with command line arguments.
+//   argv[0] is the program name. Returns the exit status.
+int BatchMain(int argc, char* argv[]);
@@ -0,0 +1,897 @@
+// -*- tab-width: 4; mode: c++ -*-
+//  BenchTool.cpp
+//
+//  Usage: webcamoo-bench [-s size,...] [-k kernel,...] [-t msec]
+//                        [-j threads] [-r runs] [-o file.json]
+//                        [-b baseline.json] [-p percent] [-m usec]
+//                        [-w file.ppm]
+//         webcamoo-bench -l | -c
+//
+//  Times every kernel of the processing on synthetic whiteboard
+//  frames (see WhiteboardGenerator) at 480p, 720p, 1080p and 4K,
+//  and then the whole pipeline as the filter runs it. Each one is
+//  run on a few different frames for at least msec (200 by default)
+//  and the median time per frame is reported, with the ns per pixel
+//  and the bytes per pixel it reads and writes.
+//
+//  The results are printed, and with -o written as JSON, one result
+//  per line.
+//
+//  Every frame of a kernel is followed by a reference pass, a fixed
+//  loop over the frame, and the kernel is also timed relative to it.
+//  The speed of a shared machine drifts by far more than a change of
+//  a kernel, and for minutes at a time; the relative time does not.
+//
+//  With -r, the suite is run several times; the median of the runs
+//  and their median absolute deviation (MAD) are reported. With -b,
+//  the relative times are compared with those of a baseline written
+//  by -o, and the exit status is 1 if any kernel got slower by more
+//  than -p percent (10 by default), by more than -m microseconds (50
+//  by default) and by more than its noise, both in the runs and when
+//  run again. Baselines are kept per CPU class (see -c), as
+//  bench/class.json.
+//
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "FiltaaCore.h"
+#include "ImageFile.h"
+#include "Ink.h"
+#include "LumaFilter.h"
+#include "MedianFilter.h"
+#include "TemporalFilter.h"
+#include "ThreadPool.h"
+#include "Whiteboard.h"
+
+static const char PROGRAM_NAME[] = "webcamoo-bench";
+static const int BENCH_FRAMES = 4;      // different frames to run on.
+static const int BENCH_MIN_REPS = 5;
+static const int BENCH_MAX_REPS = 100000;
+static const int DEFAULT_MIN_MSEC = 200;
+static const int BENCH_THRESHOLD = 128;
+static const int DEFAULT_TOLERANCE = 10;  // percent.
+static const int DEFAULT_MIN_DELTA = 50;  // usec.
+// A change within this many standard errors is noise.
+static const int NOISE_ERRORS = 3;
+
+//  BenchSize
+//
+struct BenchSize
+{
+    const char* name;
+    int width;
+    int height;
+};
+
+static const BenchSize BENCH_SIZES[] = {
+    { "480p", 640, 480 },
+    { "720p", 1280, 720 },
+    { "1080p", 1920, 1080 },
+    { "4k", 3840, 2160 },
+};
+static const int BENCH_NSIZES = (int)(sizeof(BENCH_SIZES) / sizeof(BENCH_SIZES[0]));
+
+
+//  BenchFrames: the input of the kernels at one size.
+//
+struct BenchFrames
+{
+    const BenchSize* size;
+    size_t stride;
+    size_t bitsStride;
+    std::vector<uint8_t> frames[BENCH_FRAMES];
+    std::vector<uint8_t> lumas[BENCH_FRAMES];
+    std::vector<uint8_t> dst;
+    std::vector<uint8_t> lum;
+    std::vector<uint8_t> bits;
+    uint32_t hist[256];
+    int sink;                   // keeps the results of the small kernels.
+    ThreadPool* pool;
+
+    int Width()
+        { return size->width; }
+    int Height()
+        { return size->height; }
+    const uint8_t* Frame(uint32_t n)
+        { return &frames[n % BENCH_FRAMES][0]; }
+    const uint8_t* Luma(uint32_t n)
+        { return &lumas[n % BENCH_FRAMES][0]; }
+};
+
+// refSink: keeps the result of referencePass().
+static uint8_t refSink;
+
+// referencePass: the loop the kernels are timed relative to: the
+//   average of two frames. It must not change, or the baselines are
+//   to be made again.
+static void referencePass(BenchFrames* f, uint32_t n)
+{
+    // Not frame n+1, which the kernel reads next.
+    const uint8_t* p = f->Frame(n);
+    const uint8_t* q = f->Frame(n+2);
+    uint8_t* dst = &f->dst[0];
+    size_t size = f->stride*f->Height();
+    for (size_t i = 0; i < size; i++) {
+        dst[i] = (uint8_t)((p[i] + q[i] + 1) >> 1);
+    }
+    refSink += dst[n % size];
+}
+
+// Runs a kernel on frame n.
+typedef std::function<void(uint32_t n)> FrameFunc;
+
+//  BenchKernel
+//
+struct BenchKernel
+{
+    const char* name;
+    double bytes;               // read and written per pixel.
+    FrameFunc (*prepare)(BenchFrames* f);
+};
+
+// usage: show the command line syntax.
+static int usage()
+{
+    fprintf(stderr,
+            "usage: %s [-s size,...] [-k kernel,...] [-t msec] [-j threads]\n"
+            "       [-r runs] [-o file.json] [-b baseline.json] [-p percent]\n"
+            "       [-m usec] [-w file.ppm]\n"
+            "       %s -l | -c\n"
+            "  -s size,...   480p, 720p, 1080p and/or 4k; default is all.\n"
+            "  -k kernel,... the kernels to run (see -l); default is all.\n"
+            "  -t msec       minimum time of each benchmark (default %d).\n"
+            "  -j threads    threads of the CLAHE and ink modes; default is\n"
+            "                one per CPU.\n"
+            "  -r runs       run everything runs times (default 1) and take\n"
+            "                the median.\n"
+            "  -o file.json  write the results as JSON (- for stdout).\n"
+            "  -b baseline.json  compare with the results of -o; fail if a\n"
+            "                kernel is slower by more than the tolerance.\n"
+            "  -p percent    the tolerance of -b (default %d).\n"
+            "  -m usec       the smallest slowdown -b fails on (default %d).\n"
+            "  -w file.ppm   save the first frame of the first size.\n"
+            "  -l            list the kernels.\n"
+            "  -c            print the CPU class, the name of its baseline.\n",
+            PROGRAM_NAME, PROGRAM_NAME, DEFAULT_MIN_MSEC, DEFAULT_TOLERANCE,
+            DEFAULT_MIN_DELTA);
+    return 100;
+}
+
+// getCpuName: returns the model name of the CPU, or "unknown".
+static std::string getCpuName()
+{
+    std::string name = "unknown";
+    FILE* fp = fopen("/proc/cpuinfo", "r");
+    if (fp == NULL) return name;
+    char line[256];
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (strncmp(line, "model name", 10) != 0) continue;
+        const char* p = strchr(line, ':');
+        if (p == NULL) continue;
+        p++;
+        while (*p == ' ' || *p == '\t') p++;
+        name = p;
+        while (!name.empty() && (name.back() == '\n' || name.back() == ' ')) {
+            name.erase(name.size()-1);
+        }
+        break;
+    }
+    fclose(fp);
+    // It goes in a JSON string.
+    for (size_t i = 0; i < name.size(); i++) {
+        if (name[i] == '"' || name[i] == '\\' || (unsigned char)name[i] < 0x20) {
+            name[i] = ' ';
+        }
+    }
+    return name;
+}
+
+// getCpuClass: returns the CPU name in lower case, with dashes
+//   for everything but letters and digits.
+static std::string getCpuClass()
+{
+    std::string name = getCpuName();
+    std::string cls;
+    for (size_t i = 0; i < name.size(); i++) {
+        char c = name[i];
+        if ('A' <= c && c <= 'Z') c += 'a'-'A';
+        if (('a' <= c && c <= 'z') || ('0' <= c && c <= '9')) {
+            cls += c;
+        } else if (!cls.empty() && cls[cls.size()-1] != '-') {
+            cls += '-';
+        }
+    }
+    while (!cls.empty() && cls[cls.size()-1] == '-') {
+        cls.erase(cls.size()-1);
+    }
+    return cls;
+}
+
+
+//  The kernels
+//
+
+// prepareLuma: the luma of every pixel, as the pixel loops take it.
+template <class Luma>
+static FrameFunc prepareLuma(BenchFrames* f)
+{
+    return [f](uint32_t n) {
+        const uint8_t* src = f->Frame(n);
+        uint8_t* q = &f->lum[0];
+        for (int y = 0; y < f->Height(); y++) {
+            const uint8_t* p = src + f->stride*y;
+            for (int x = 0; x < f->Width(); x++) {
+                *q++ = (uint8_t)Luma::Get(p);
+                p += 3;
+            }
+        }
+    };
+}
+
+static FrameFunc prepareHistogram(BenchFrames* f)
+{
+    return [f](uint32_t n) {
+        getHistogram(f->hist, f->Frame(n), f->stride, f->Width(), f->Height());
+    };
+}
+
+static FrameFunc prepareOtsu(BenchFrames* f)
+{
+    getHistogram(f->hist, f->Frame(0), f->stride, f->Width(), f->Height());
+    return [f](uint32_t n) {
+        f->sink += getAutoThreshold(f->hist);
+    };
+}
+
+// makeCore: a FiltaaCore for the frames, primed with the first.
+static std::shared_ptr<FiltaaCore> makeCore(
+    BenchFrames* f, OutputMode mode, int threshold, const FilterParams* filter)
+{
+    std::shared_ptr<FiltaaCore> core(new FiltaaCore());
+    core->SetThreshold(threshold);
+    core->SetOutputMode(mode);
+    core->SetPool(f->pool);
+    if (mode == OUTPUT_INK) {
+        InkPalette palette;
+        initInkPalette(&palette);
+        core->SetInkPalette(&palette);
+    }
+    if (filter != NULL) {
+        core->SetFilter(filter);
+    }
+    core->Setup(f->Width(), f->Height());
+    core->Prime(f->Frame(0), f->stride, f->Width(), f->Height());
+    return core;
+}
+
+// processFunc: runs a FiltaaCore, packing the bits if asked.
+static FrameFunc processFunc(BenchFrames* f, std::shared_ptr<FiltaaCore> core,
+                             bool bits)
+{
+    return [f, core, bits](uint32_t n) {
+        core->Process(f->Frame(n), f->stride, &f->dst[0], f->stride,
+                      f->Width(), f->Height(),
+                      bits? &f->bits[0] : NULL, bits? f->bitsStride : 0);
+    };
+}
+
+// prepareThreshold: the B/W pass: luma, histogram and threshold.
+static FrameFunc prepareThreshold(BenchFrames* f)
+{
+    return processFunc(f, makeCore(f, OUTPUT_BW, BENCH_THRESHOLD, NULL), false);
+}
+
+static FrameFunc prepareThresholdBits(BenchFrames* f)
+{
+    return processFunc(f, makeCore(f, OUTPUT_BW, BENCH_THRESHOLD, NULL), true);
+}
+
+static FrameFunc prepareGray(BenchFrames* f)
+{
+    return processFunc(f, makeCore(f, OUTPUT_GRAY, -1, NULL), false);
+}
+
+static FrameFunc prepareClahe(BenchFrames* f)
+{
+    return processFunc(f, makeCore(f, OUTPUT_CLAHE, -1, NULL), false);
+}
+
+static FrameFunc prepareInk(BenchFrames* f)
+{
+    return processFunc(f, makeCore(f, OUTPUT_INK, -1, NULL), false);
+}
+
+template <int Size>
+static FrameFunc prepareMedian(BenchFrames* f)
+{
+    std::shared_ptr<MedianFilter> filter(new MedianFilter());
+    filter->Setup(f->Width());
+    filter->Configure(Size);
+    return [f, filter](uint32_t n) {
+        uint8_t* q = &f->lum[0];
+        int width = f->Width();
+        auto put = [&](const uint8_t* row) {
+            memcpy(q, row, width);
+            q += width;
+        };
+        const uint8_t* lum = f->Luma(n);
+        filter->Begin();
+        for (int y = 0; y < f->Height(); y++) {
+            filter->Push(lum + (size_t)width*y, put);
+        }
+        filter->Finish(put);
+    };
+}
+
+// prepareLumaFilter: the blur (or with amount, the unsharp mask).
+template <int Amount>
+static FrameFunc prepareLumaFilter(BenchFrames* f)
+{
+    std::shared_ptr<LumaFilter> filter(new LumaFilter());
+    filter->Setup(f->Width());
+    FilterParams params;
+    initFilterParams(&params);
+    params.radius = 2;
+    params.passes = LumaFilter::MAX_PASSES;
+    params.amount = Amount;
+    filter->Configure(&params);
+    return [f, filter](uint32_t n) {
+        uint8_t* q = &f->lum[0];
+        int width = f->Width();
+        auto put = [&](const uint8_t* row) {
+            memcpy(q, row, width);
+            q += width;
+        };
+        const uint8_t* lum = f->Luma(n);
+        filter->Begin();
+        for (int y = 0; y < f->Height(); y++) {
+            filter->Push(lum + (size_t)width*y, put);
+        }
+        filter->Finish(put);
+    };
+}
+
+static FrameFunc prepareTemporal(BenchFrames* f)
+{
+    std::shared_ptr<TemporalFilter> filter(new TemporalFilter());
+    filter->Setup(f->Width(), f->Height());
+    FilterParams params;
+    initFilterParams(&params);
+    filter->Configure(2, params.motion);
+    return [f, filter](uint32_t n) {
+        int width = f->Width();
+        const uint8_t* lum = f->Luma(n);
+        for (int y = 0; y < f->Height(); y++) {
+            uint8_t* row = &f->lum[(size_t)width*y];
+            memcpy(row, lum + (size_t)width*y, width);
+            filter->Blend(row, y);
+        }
+        filter->End();
+    };
+}
+
+// preparePipeline: the filter as it runs by default: the automatic
+//   threshold, with the bits packed for the other outputs.
+static FrameFunc preparePipeline(BenchFrames* f)
+{
+    return processFunc(f, makeCore(f, OUTPUT_BW, -1, NULL), true);
+}
+
+// preparePipelineFiltered: also with a 3x3 median and a temporal
+//   average of 4 frames.
+static FrameFunc preparePipelineFiltered(BenchFrames* f)
+{
+    FilterParams params;
+    initFilterParams(&params);
+    params.median = 3;
+    params.temporal = 2;
+    return processFunc(f, makeCore(f, OUTPUT_BW, -1, &params), true);
+}
+
+static const BenchKernel BENCH_KERNELS[] = {
+    { "luma-bt601", 4, prepareLuma<LumaBT601> },
+    { "luma-bt709", 4, prepareLuma<LumaBT709> },
+    { "luma-green", 4, prepareLuma<LumaGreen> },
+    { "luma-max", 4, prepareLuma<LumaMax> },
+    { "histogram", 3, prepareHistogram },
+    { "otsu", 0, prepareOtsu },
+    { "threshold", 6, prepareThreshold },
+    { "threshold-bits", 6.125, prepareThresholdBits },
+    { "gray", 6, prepareGray },
+    { "clahe", 6, prepareClahe },
+    { "ink", 6, prepareInk },
+    { "median3", 2, prepareMedian<3> },
+    { "median5", 2, prepareMedian<5> },
+    { "blur", 2, prepareLumaFilter<0> },
+    { "unsharp", 2, prepareLumaFilter<100> },
+    { "temporal", 6, prepareTemporal },
+    { "pipeline", 6.125, preparePipeline },
+    { "pipeline-filtered", 10.125, preparePipelineFiltered },
+};
+static const int BENCH_NKERNELS = (int)(sizeof(BENCH_KERNELS) / sizeof(BENCH_KERNELS[0]));
+
+
+//  BenchResult
+//
+struct BenchResult
+{
+    const BenchKernel* kernel;
+    const BenchSize* size;
+    int runs;
+    int reps;                   // of all the runs.
+    double nsPerFrame;          // the median of the runs.
+    double madNs;               // their median absolute deviation.
+    double relative;            // the median of the runs, to the reference.
+    double madRelative;
+    double nsPerPixel;
+    double fps;
+};
+
+// getMedian: sorts the values and returns their median.
+static double getMedian(std::vector<double>* values)
+{
+    if (values->empty()) return 0;
+    std::sort(values->begin(), values->end());
+    size_t mid = values->size()/2;
+    return (values->size() & 1)? (*values)[mid] :
+        ((*values)[mid-1] + (*values)[mid])/2;
+}
+
+// setupFrames: draws the frames of a size.
+static bool setupFrames(BenchFrames* f, const BenchSize* size, ThreadPool* pool)
+{
+    f->size = size;
+    f->stride = (size_t)size->width*3;
+    f->bitsStride = (size_t)(size->width+7) >> 3;
+    f->pool = pool;
+    f->sink = 0;
+    size_t pixels = (size_t)size->width*size->height;
+    WhiteboardGenerator board;
+    if (!board.Setup(size->width, size->height)) return false;
+    for (int i = 0; i < BENCH_FRAMES; i++) {
+        f->frames[i].resize(f->stride*size->height);
+        f->lumas[i].resize(pixels);
+        // Frames a second apart, so the presenter has moved.
+        board.Draw(&f->frames[i][0], f->stride, (uint32_t)i*30);
+        const uint8_t* p = &f->frames[i][0];
+        for (size_t j = 0; j < pixels; j++, p += 3) {
+            f->lumas[i][j] = (uint8_t)getLuma(p);
+        }
+    }
+    f->dst.resize(f->stride*size->height);
+    f->lum.resize(pixels);
+    f->bits.resize(f->bitsStride*size->height);
+    return true;
+}
+
+// runKernel: runs a kernel, each frame followed by the reference
+//   pass, until minSecs have passed; returns the median time of a
+//   frame, and of a frame over the reference pass after it.
+static double runKernel(const BenchKernel* kernel, BenchFrames* f,
+                        double minSecs, int* reps, double* relative)
+{
+    FrameFunc func = kernel->prepare(f);
+    func(0);
+    std::vector<double> times;
+    std::vector<double> ratios;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (uint32_t n = 1; ; n++) {
+        std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+        func(n);
+        std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+        referencePass(f, n);
+        std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
+        double ns = std::chrono::duration<double, std::nano>(t1 - t0).count();
+        double refNs = std::chrono::duration<double, std::nano>(t2 - t1).count();
+        times.push_back(ns);
+        ratios.push_back((0 < refNs)? ns/refNs : 0);
+        if (BENCH_MAX_REPS <= (int)times.size()) break;
+        if (BENCH_MIN_REPS <= (int)times.size() &&
+            minSecs <= std::chrono::duration<double>(t2 - start).count()) break;
+    }
+    *reps += (int)times.size();
+    *relative = getMedian(&ratios);
+    return getMedian(&times);
+}
+
+// getMad: returns the median absolute deviation from a median.
+static double getMad(const std::vector<double>& values, double median)
+{
+    std::vector<double> deviations;
+    for (size_t i = 0; i < values.size(); i++) {
+        deviations.push_back(fabs(values[i] - median));
+    }
+    return getMedian(&deviations);
+}
+
+// setResult: takes the medians and the MADs of the runs.
+static void setResult(BenchResult* result, const BenchKernel* kernel,
+                      const BenchSize* size, std::vector<double>* runs,
+                      std::vector<double>* relatives, int reps)
+{
+    double median = getMedian(runs);
+    result->kernel = kernel;
+    result->size = size;
+    result->runs = (int)runs->size();
+    result->reps = reps;
+    result->nsPerFrame = median;
+    result->madNs = getMad(*runs, median);
+    result->relative = getMedian(relatives);
+    result->madRelative = getMad(*relatives, result->relative);
+    result->nsPerPixel = median / ((double)size->width*size->height);
+    result->fps = (0 < median)? 1e9/median : 0;
+}
+
+// writeJson: writes the results, one per line.
+static bool writeJson(const char* path, const std::vector<BenchResult>& results,
+                      int threads, int minMsec)
+{
+    FILE* fp = (strcmp(path, "-") == 0)? stdout : fopen(path, "w");
+    if (fp == NULL) return false;
+    fprintf(fp, "{\"program\":\"%s\",\"cpu\":\"%s\",\"threads\":%d,"
+            "\"min_msec\":%d,\"results\":[\n",
+            PROGRAM_NAME, getCpuName().c_str(), threads, minMsec);
+    // The kernel and the size come first on each line; see readBaseline().
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult* r = &results[i];
+        fprintf(fp, "{\"kernel\":\"%s\",\"size\":\"%s\",\"width\":%d,"
+                "\"height\":%d,\"runs\":%d,\"reps\":%d,\"ns_per_frame\":%.0f,"
+                "\"mad_ns\":%.0f,\"relative\":%.4f,\"mad_relative\":%.4f,"
+                "\"ns_per_pixel\":%.4f,\"bytes_per_pixel\":%.3f,"
+                "\"fps\":%.1f}%s\n",
+                r->kernel->name, r->size->name, r->size->width, r->size->height,
+                r->runs, r->reps, r->nsPerFrame, r->madNs, r->relative,
+                r->madRelative, r->nsPerPixel,
+                r->kernel->bytes, r->fps, (i+1 < results.size())? "," : "");
+    }
+    fprintf(fp, "]}\n");
+    bool ok = (ferror(fp) == 0);
+    if (fp != stdout) {
+        if (fclose(fp) != 0) ok = false;
+    } else {
+        fflush(fp);
+    }
+    return ok;
+}
+
+//  BaselineEntry
+//
+struct BaselineEntry
+{
+    std::string kernel;
+    std::string size;
+    double nsPerFrame;
+    double madNs;
+    double relative;            // 0 in the baselines made before it.
+    double madRelative;
+    int runs;
+};
+
+// getStandardError: the standard error of a median of runs with a
+//   MAD, taking them as normal: the deviation is 1.4826 MADs, and
+//   the error of the median 1.2533 deviations over sqrt(runs).
+static double getStandardError(double mad, int runs)
+{
+    return (0 < runs)? 1.858*mad / sqrt((double)runs) : 0;
+}
+
+// getJsonValue: returns the text after "key": on a line, or NULL.
+static const char* getJsonValue(const char* line, const char* key)
+{
+    std::string pattern = std::string("\"") + key + "\":";
+    const char* p = strstr(line, pattern.c_str());
+    return (p != NULL)? p + pattern.size() : NULL;
+}
+
+// getJsonString: returns the string value of a key, or "".
+static std::string getJsonString(const char* line, const char* key)
+{
+    const char* p = getJsonValue(line, key);
+    if (p == NULL || *p != '"') return "";
+    const char* end = strchr(p+1, '"');
+    return (end != NULL)? std::string(p+1, end) : "";
+}
+
+// readBaseline: reads the results of writeJson(); only its own
+//   format, with one result per line, is understood.
+static bool readBaseline(const char* path, std::vector<BaselineEntry>* entries,
+                         std::string* cpu)
+{
+    FILE* fp = fopen(path, "r");
+    if (fp == NULL) return false;
+    char line[1024];
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (getJsonValue(line, "program") != NULL) {
+            *cpu = getJsonString(line, "cpu");
+        }
+        const char* ns = getJsonValue(line, "ns_per_frame");
+        if (ns == NULL) continue;
+        BaselineEntry entry;
+        entry.kernel = getJsonString(line, "kernel");
+        entry.size = getJsonString(line, "size");
+        entry.nsPerFrame = atof(ns);
+        const char* mad = getJsonValue(line, "mad_ns");
+        entry.madNs = (mad != NULL)? atof(mad) : 0;
+        const char* relative = getJsonValue(line, "relative");
+        entry.relative = (relative != NULL)? atof(relative) : 0;
+        const char* madRelative = getJsonValue(line, "mad_relative");
+        entry.madRelative = (madRelative != NULL)? atof(madRelative) : 0;
+        const char* runs = getJsonValue(line, "runs");
+        entry.runs = (runs != NULL)? atoi(runs) : 1;
+        entries->push_back(entry);
+    }
+    bool ok = (ferror(fp) == 0);
+    fclose(fp);
+    return ok;
+}
+
+// compareBaseline: prints the change of every kernel from the
+//   baseline; marks the ones that got slower and returns their number.
+static int compareBaseline(const std::vector<BenchResult>& results,
+                           const std::vector<BaselineEntry>& baseline,
+                           int tolerance, int minDelta, std::vector<bool>* slower)
+{
+    int nslower = 0;
+    slower->assign(results.size(), false);
+    fprintf(stderr, "%s: %-17s %-5s %12s %12s %8s\n", PROGRAM_NAME,
+            "kernel", "size", "baseline ms", "now ms", "relative");
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult* r = &results[i];
+        const BaselineEntry* base = NULL;
+        for (size_t j = 0; j < baseline.size(); j++) {
+            if (baseline[j].kernel == r->kernel->name &&
+                baseline[j].size == r->size->name) {
+                base = &baseline[j];
+                break;
+            }
+        }
+        if (base == NULL || base->relative <= 0) {
+            fprintf(stderr, "%s: %-17s %-5s %12s %12.3f %8s  new\n",
+                    PROGRAM_NAME, r->kernel->name, r->size->name, "-",
+                    r->nsPerFrame/1e6, "-");
+            continue;
+        }
+        // The change of the relative time, and what it makes of the
+        // time of the baseline.
+        double change = (r->relative - base->relative)*100 / base->relative;
+        double diff = base->nsPerFrame*change/100;
+        double e0 = getStandardError(base->madRelative, base->runs);
+        double e1 = getStandardError(r->madRelative, r->runs);
+        double noise = NOISE_ERRORS * sqrt(e0*e0 + e1*e1) * base->nsPerFrame /
+            base->relative;
+        // Below minDelta, a change is the jitter of the machine.
+        noise = std::max(noise, minDelta*1e3);
+        const char* status = "ok";
+        if (tolerance < change && noise < diff) {
+            status = "SLOWER";
+            (*slower)[i] = true;
+            nslower++;
+        } else if (change < -tolerance && noise < -diff) {
+            status = "faster";
+        }
+        fprintf(stderr, "%s: %-17s %-5s %12.3f %12.3f %+7.1f%%  %s\n",
+                PROGRAM_NAME, r->kernel->name, r->size->name,
+                base->nsPerFrame/1e6, r->nsPerFrame/1e6, change, status);
+    }
+    return nslower;
+}
+
+// runSuite: runs the selected kernels, selected[size*BENCH_NKERNELS
+//   + kernel], on the frames of their size, and adds their results.
+//   Each run goes through every size and kernel once, so the runs of
+//   a kernel are spread over the whole suite: a slow spell of the
+//   machine hits one run of many kernels rather than all the runs of
+//   one, and shows in their MAD.
+static void runSuite(BenchFrames* const* frames, const std::vector<bool>& selected,
+                     int runs, int minMsec, std::vector<BenchResult>* results)
+{
+    std::vector<std::vector<double> > times(selected.size());
+    std::vector<std::vector<double> > relatives(selected.size());
+    std::vector<int> reps(selected.size(), 0);
+    for (int run = 0; run < runs; run++) {
+        for (size_t i = 0; i < selected.size(); i++) {
+            if (!selected[i]) continue;
+            double relative;
+            times[i].push_back(runKernel(&BENCH_KERNELS[i % BENCH_NKERNELS],
+                                         frames[i / BENCH_NKERNELS],
+                                         minMsec/1e3, &reps[i], &relative));
+            relatives[i].push_back(relative);
+        }
+    }
+    for (size_t i = 0; i < selected.size(); i++) {
+        if (!selected[i]) continue;
+        BenchResult r;
+        setResult(&r, &BENCH_KERNELS[i % BENCH_NKERNELS],
+                  &BENCH_SIZES[i / BENCH_NKERNELS], &times[i], &relatives[i],
+                  reps[i]);
+        results->push_back(r);
+        fprintf(stderr, "%s: %-17s %-5s %10.3f ms %8.3f ns/px %6.3f B/px "
+                "%7.2f GB/s %9.1f fps",
+                PROGRAM_NAME, r.kernel->name, r.size->name,
+                r.nsPerFrame/1e6, r.nsPerPixel, r.kernel->bytes,
+                r.kernel->bytes/r.nsPerPixel, r.fps);
+        if (1 < runs) {
+            fprintf(stderr, "  +-%.1f%%", r.madNs*100/r.nsPerFrame);
+        }
+        fprintf(stderr, "\n");
+    }
+}
+
+// selectNames: marks the names in a comma separated list; returns
+//   false when one is unknown.
+template <class T>
+static bool selectNames(std::vector<bool>* selected, const char* list,
+                        const T* items, int n)
+{
+    std::string names(list);
+    size_t p = 0;
+    while (p <= names.size()) {
+        size_t q = names.find(',', p);
+        if (q == std::string::npos) q = names.size();
+        std::string name = names.substr(p, q-p);
+        int i;
+        for (i = 0; i < n; i++) {
+            if (strcmp(items[i].name, name.c_str()) == 0) break;
+        }
+        if (i == n) {
+            fprintf(stderr, "%s: unknown: %s\n", PROGRAM_NAME, name.c_str());
+            return false;
+        }
+        (*selected)[i] = true;
+        p = q+1;
+    }
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    std::vector<bool> sizes(BENCH_NSIZES, true);
+    std::vector<bool> kernels(BENCH_NKERNELS, true);
+    int minMsec = DEFAULT_MIN_MSEC;
+    int nthreads = 0;
+    int runs = 1;
+    int tolerance = DEFAULT_TOLERANCE;
+    int minDelta = DEFAULT_MIN_DELTA;
+    const char* json = NULL;
+    const char* baselinePath = NULL;
+    const char* framePath = NULL;
+
+    int i;
+    for (i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        if (arg[0] != '-' || arg[1] == 0) break;
+        if (strcmp(arg, "-l") == 0) {
+            for (int k = 0; k < BENCH_NKERNELS; k++) {
+                printf("%s\n", BENCH_KERNELS[k].name);
+            }
+            return 0;
+        } else if (strcmp(arg, "-c") == 0) {
+            printf("%s\n", getCpuClass().c_str());
+            return 0;
+        } else if (i+1 < argc && strcmp(arg, "-s") == 0) {
+            sizes.assign(BENCH_NSIZES, false);
+            if (!selectNames(&sizes, argv[++i], BENCH_SIZES, BENCH_NSIZES)) return usage();
+        } else if (i+1 < argc && strcmp(arg, "-k") == 0) {
+            kernels.assign(BENCH_NKERNELS, false);
+            if (!selectNames(&kernels, argv[++i], BENCH_KERNELS, BENCH_NKERNELS)) return usage();
+        } else if (i+1 < argc && strcmp(arg, "-t") == 0) {
+            minMsec = atoi(argv[++i]);
+            if (minMsec <= 0) return usage();
+        } else if (i+1 < argc && strcmp(arg, "-j") == 0) {
+            nthreads = atoi(argv[++i]);
+            if (nthreads < 0) return usage();
+        } else if (i+1 < argc && strcmp(arg, "-r") == 0) {
+            runs = atoi(argv[++i]);
+            if (runs <= 0) return usage();
+        } else if (i+1 < argc && strcmp(arg, "-o") == 0) {
+            json = argv[++i];
+        } else if (i+1 < argc && strcmp(arg, "-b") == 0) {
+            baselinePath = argv[++i];
+        } else if (i+1 < argc && strcmp(arg, "-p") == 0) {
+            tolerance = atoi(argv[++i]);
+            if (tolerance < 0) return usage();
+        } else if (i+1 < argc && strcmp(arg, "-m") == 0) {
+            minDelta = atoi(argv[++i]);
+            if (minDelta < 0) return usage();
+        } else if (i+1 < argc && strcmp(arg, "-w") == 0) {
+            framePath = argv[++i];
+        } else {
+            return usage();
+        }
+    }
+    if (i < argc) return usage();
+
+    // Read the baseline first, not to find it missing at the end.
+    std::vector<BaselineEntry> baseline;
+    std::string baselineCpu;
+    if (baselinePath != NULL &&
+        !readBaseline(baselinePath, &baseline, &baselineCpu)) {
+        fprintf(stderr, "%s: cannot read: %s (make one with make bench-baseline)\n",
+                PROGRAM_NAME, baselinePath);
+        return 1;
+    }
+
+    ThreadPool pool(nthreads);
+    fprintf(stderr, "%s: %s, %d threads\n", PROGRAM_NAME,
+            getCpuName().c_str(), pool.GetThreadCount());
+    // The frames of every size are made first, for the runs to go
+    // through all of them.
+    std::vector<std::unique_ptr<BenchFrames> > frames(BENCH_NSIZES);
+    std::vector<BenchFrames*> framePtrs(BENCH_NSIZES, (BenchFrames*)NULL);
+    std::vector<bool> selected(BENCH_NSIZES*BENCH_NKERNELS, false);
+    for (int s = 0; s < BENCH_NSIZES; s++) {
+        if (!sizes[s]) continue;
+        frames[s].reset(new BenchFrames());
+        BenchFrames* f = frames[s].get();
+        framePtrs[s] = f;
+        if (!setupFrames(f, &BENCH_SIZES[s], &pool)) {
+            fprintf(stderr, "%s: cannot make the frames\n", PROGRAM_NAME);
+            return 1;
+        }
+        if (framePath != NULL) {
+            Image img;
+            img.data = &f->frames[0][0];
+            img.width = f->Width();
+            img.height = f->Height();
+            img.stride = f->stride;
+            if (!writeImage(framePath, &img, getImageFormat(framePath))) {
+                fprintf(stderr, "%s: cannot write: %s\n", PROGRAM_NAME, framePath);
+                return 1;
+            }
+            framePath = NULL;
+        }
+        for (int k = 0; k < BENCH_NKERNELS; k++) {
+            selected[s*BENCH_NKERNELS + k] = kernels[k];
+        }
+    }
+    std::vector<BenchResult> results;
+    runSuite(&framePtrs[0], selected, runs, minMsec, &results);
+    if (json != NULL && !writeJson(json, results, pool.GetThreadCount(), minMsec)) {
+        fprintf(stderr, "%s: cannot write: %s\n", PROGRAM_NAME, json);
+        return 1;
+    }
+
+    if (baselinePath != NULL) {
+        if (baselineCpu != getCpuName()) {
+            fprintf(stderr, "%s: the baseline is of another CPU: %s\n",
+                    PROGRAM_NAME, baselineCpu.c_str());
+        }
+        std::vector<bool> slower;
+        int nslower = compareBaseline(results, baseline, tolerance, minDelta,
+                                      &slower);
+        if (0 < nslower) {
+            // Only the ones that are slower again, in twice the runs,
+            // count; a slow spell of the machine rarely lasts over both.
+            fprintf(stderr, "%s: running the %d slower ones again\n",
+                    PROGRAM_NAME, nslower);
+            selected.assign(selected.size(), false);
+            for (size_t j = 0; j < results.size(); j++) {
+                if (slower[j]) {
+                    selected[(results[j].size - BENCH_SIZES)*BENCH_NKERNELS +
+                             (results[j].kernel - BENCH_KERNELS)] = true;
+                }
+            }
+            std::vector<BenchResult> again;
+            runSuite(&framePtrs[0], selected, 2*runs, minMsec, &again);
+            nslower = compareBaseline(again, baseline, tolerance, minDelta,
+                                      &slower);
+        }
+        if (0 < nslower) {
+            fprintf(stderr, "%s: %d of %d slower than the baseline by more "
+                    "than %d%%\n", PROGRAM_NAME, nslower, (int)results.size(),
+                    tolerance);
+            return 1;
+        }
+        fprintf(stderr, "%s: no kernel slower than the baseline by more "
+                "than %d%%\n", PROGRAM_NAME, tolerance);
+    }
+    return 0;
+}
@@ -0,0 +1,626 @@
+// -*- tab-width: 4; mode: c++ -*-
+//  BoardFile.cpp
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include "BoardFile.h"
+
+
+// Run-length coding.
+//
+//  A frame is coded as a sequence of (zero run, literal count,
+//  literal bytes) tokens. Counts are LEB128 varints. Zero runs
+//  shorter than MIN_ZERO_RUN are kept inside literals, so that
+//  the output never grows much beyond the input.
+//
+static const size_t MIN_ZERO_RUN = 3;
+
+// putVarint: writes an unsigned LEB128 value.
+static inline uint8_t* putVarint(uint8_t* p, size_t v)
+{
+    while (0x80 <= v) {
+        *p++ = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+// getVarint: reads an unsigned LEB128 value.
+static inline const uint8_t* getVarint(
+    const uint8_t* p, const uint8_t* end, size_t* v)
+{
+    size_t x = 0;
+    int shift = 0;
+    while (p < end && shift < 64) {
+        uint8_t b = *p++;
+        x |= (size_t)(b & 0x7f) << shift;
+        if ((b & 0x80) == 0) {
+            *v = x;
+            return p;
+        }
+        shift += 7;
+    }
+    return NULL;
+}
+
+// skipZeros: returns the first position where (cur XOR prev) is non-zero.
+static inline size_t skipZeros(
+    const uint8_t* cur, const uint8_t* prev, size_t i, size_t n)
+{
+    if (prev == NULL) {
+        while (i+8 <= n) {
+            uint64_t a;
+            memcpy(&a, cur+i, 8);
+            if (a != 0) break;
+            i += 8;
+        }
+        while (i < n && cur[i] == 0) i++;
+    } else {
+        while (i+8 <= n) {
+            uint64_t a, b;
+            memcpy(&a, cur+i, 8);
+            memcpy(&b, prev+i, 8);
+            if (a != b) break;
+            i += 8;
+        }
+        while (i < n && cur[i] == prev[i]) i++;
+    }
+    return i;
+}
+
+size_t encodeBoardRuns(
+    uint8_t* dst, const uint8_t* cur, const uint8_t* prev, size_t n)
+{
+    uint8_t* out = dst;
+    size_t i = 0;
+    while (i < n) {
+        size_t start = i;
+        i = skipZeros(cur, prev, i, n);
+        size_t zrun = i - start;
+
+        // Extend the literal until a long enough zero run begins.
+        size_t lit = i;
+        size_t zeros = 0;
+        while (i < n) {
+            uint8_t b = (prev == NULL)? cur[i] : (uint8_t)(cur[i] ^ prev[i]);
+            if (b == 0) {
+                zeros++;
+                if (MIN_ZERO_RUN <= zeros) break;
+            } else {
+                zeros = 0;
+            }
+            i++;
+        }
+        size_t end = (i < n)? (i+1-zeros) : n;
+
+        out = putVarint(out, zrun);
+        out = putVarint(out, end-lit);
+        if (prev == NULL) {
+            memcpy(out, cur+lit, end-lit);
+            out += end-lit;
+        } else {
+            for (size_t j = lit; j < end; j++) {
+                *out++ = cur[j] ^ prev[j];
+            }
+        }
+        i = end;
+    }
+    return out - dst;
+}
+
+bool decodeBoardRuns(
+    uint8_t* dst, size_t n, const uint8_t* src, size_t size, bool delta)
+{
+    const uint8_t* end = src+size;
+    size_t i = 0;
+    while (i < n) {
+        size_t zrun, nlit;
+        src = getVarint(src, end, &zrun);
+        if (src == NULL || n-i < zrun) return false;
+        if (!delta) {
+            memset(dst+i, 0, zrun);
+        }
+        i += zrun;
+        src = getVarint(src, end, &nlit);
+        if (src == NULL || n-i < nlit || (size_t)(end-src) < nlit) return false;
+        if (!delta) {
+            memcpy(dst+i, src, nlit);
+        } else {
+            for (size_t j = 0; j < nlit; j++) {
+                dst[i+j] ^= src[j];
+            }
+        }
+        i += nlit;
+        src += nlit;
+    }
+    return true;
+}
+
+
+//  BoardRecorder
+//
+BoardRecorder::BoardRecorder()
+    : _head(0), _tail(0), _open(false), _producing(false), _closing(false),
+      _failed(false), _framesWritten(0), _framesDropped(0), _bytesWritten(0)
+{
+    _fp = NULL;
+    _width = 0;
+    _height = 0;
+    _keyInterval = 0;
+    _planeSize = 0;
+    for (int i = 0; i < NSLOTS; i++) {
+        _slots[i] = NULL;
+        _timestamps[i] = 0;
+    }
+    _prev = NULL;
+    _encoded = NULL;
+    _outbuf = NULL;
+    _outlen = 0;
+    _offset = 0;
+    _nframes = 0;
+    _index = NULL;
+    _nkeys = 0;
+    _maxkeys = 0;
+}
+
+BoardRecorder::~BoardRecorder()
+{
+    Close();
+}
+
+void BoardRecorder::ReleaseBuffers()
+{
+    for (int i = 0; i < NSLOTS; i++) {
+        free(_slots[i]);
+        _slots[i] = NULL;
+    }
+    free(_prev);
+    _prev = NULL;
+    free(_encoded);
+    _encoded = NULL;
+    free(_outbuf);
+    _outbuf = NULL;
+    free(_index);
+    _index = NULL;
+}
+
+bool BoardRecorder::Open(const char* path, int width, int height, int keyInterval)
+{
+    if (_open.load()) return false;
+    if (width <= 0 || height <= 0 || keyInterval <= 0) return false;
+
+    _width = width;
+    _height = height;
+    _keyInterval = keyInterval;
+    _planeSize = getBoardRowBytes(width) * height;
+    for (int i = 0; i < NSLOTS; i++) {
+        _slots[i] = (uint8_t*)malloc(_planeSize);
+    }
+    _prev = (uint8_t*)malloc(_planeSize);
+    _encoded = (uint8_t*)malloc(getBoardRunsBound(_planeSize));
+    _outbuf = (uint8_t*)malloc(OUTBUF_SIZE);
+    _maxkeys = 64;
+    _index = (BoardIndexEntry*)malloc(sizeof(BoardIndexEntry)*_maxkeys);
+    for (int i = 0; i < NSLOTS; i++) {
+        if (_slots[i] == NULL) {
+            ReleaseBuffers();
+            return false;
+        }
+    }
+    if (_prev == NULL || _encoded == NULL || _outbuf == NULL || _index == NULL) {
+        ReleaseBuffers();
+        return false;
+    }
+
+    _fp = fopen(path, "wb");
+    if (_fp == NULL) {
+        ReleaseBuffers();
+        return false;
+    }
+
+    _outlen = 0;
+    _offset = 0;
+    _nframes = 0;
+    _nkeys = 0;
+    _failed.store(false);
+    _head.store(0);
+    _tail.store(0);
+    _closing.store(false);
+    _framesWritten.store(0);
+    _framesDropped.store(0);
+    _bytesWritten.store(0);
+
+    BoardFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "WCB1", 4);
+    header.version = BOARD_FILE_VERSION;
+    header.width = width;
+    header.height = height;
+    header.keyInterval = keyInterval;
+    Output(&header, sizeof(header));
+
+    _writer = std::thread(&BoardRecorder::WriterLoop, this);
+    _open.store(true);
+    return true;
+}
+
+bool BoardRecorder::Close()
+{
+    if (!_open.load()) return true;
+
+    // Stop accepting frames and wait for the streaming thread
+    // to finish the one it is filling, if any.
+    _open.store(false);
+    while (_producing.load()) {
+        std::this_thread::yield();
+    }
+
+    _closing.store(true);
+    _cond.notify_one();
+    _writer.join();
+
+    BoardFileTrailer trailer;
+    memset(&trailer, 0, sizeof(trailer));
+    trailer.indexOffset = _offset;
+    trailer.nkeys = _nkeys;
+    trailer.nframes = _nframes;
+    memcpy(trailer.magic, "WCBI", 4);
+    Output(_index, sizeof(BoardIndexEntry)*_nkeys);
+    Output(&trailer, sizeof(trailer));
+    FlushOutput();
+
+    if (fclose(_fp) != 0) {
+        _failed.store(true);
+    }
+    _fp = NULL;
+    ReleaseBuffers();
+    return !_failed.load();
+}
+
+uint8_t* BoardRecorder::BeginFrame(int width, int height)
+{
+    _producing.store(true);
+    // The size is only read once open, as Open() sets it first.
+    if (!_open.load() || _width != width || _height != height) {
+        _producing.store(false);
+        return NULL;
+    }
+    uint32_t head = _head.load(std::memory_order_relaxed);
+    uint32_t tail = _tail.load(std::memory_order_acquire);
+    if (NSLOTS <= head - tail) {
+        // The writer is behind; drop this frame.
+        _framesDropped.fetch_add(1, std::memory_order_relaxed);
+        _producing.store(false);
+        return NULL;
+    }
+    return _slots[head % NSLOTS];
+}
+
+void BoardRecorder::CommitFrame(int64_t timestamp)
+{
+    uint32_t head = _head.load(std::memory_order_relaxed);
+    _timestamps[head % NSLOTS] = timestamp;
+    _head.store(head+1, std::memory_order_release);
+    _producing.store(false);
+    _cond.notify_one();
+}
+
+void BoardRecorder::WriterLoop()
+{
+    for (;;) {
+        uint32_t tail = _tail.load(std::memory_order_relaxed);
+        uint32_t head = _head.load(std::memory_order_acquire);
+        if (tail != head) {
+            int i = tail % NSLOTS;
+            WriteFrame(_slots[i], _timestamps[i]);
+            _tail.store(tail+1, std::memory_order_release);
+            continue;
+        }
+        if (_closing.load()) break;
+        // The producer never takes the lock, so a wakeup can be
+        // missed; the timeout bounds the delay.
+        std::unique_lock<std::mutex> lock(_mutex);
+        _cond.wait_for(lock, std::chrono::milliseconds(10));
+    }
+}
+
+void BoardRecorder::WriteFrame(const uint8_t* plane, int64_t timestamp)
+{
+    bool key = (_nframes % _keyInterval) == 0;
+    size_t size = encodeBoardRuns(
+        _encoded, plane, (key? NULL : _prev), _planeSize);
+
+    if (key) {
+        if (_maxkeys <= _nkeys) {
+            BoardIndexEntry* index = (BoardIndexEntry*)realloc(
+                _index, sizeof(BoardIndexEntry)*_maxkeys*2);
+            if (index == NULL) {
+                _failed.store(true);
+                return;
+            }
+            _index = index;
+            _maxkeys *= 2;
+        }
+        BoardIndexEntry* entry = &(_index[_nkeys++]);
+        memset(entry, 0, sizeof(*entry));
+        entry->offset = _offset;
+        entry->timestamp = timestamp;
+        entry->frame = _nframes;
+    }
+
+    BoardFrameHeader fh;
+    fh.size = (uint32_t)size;
+    fh.flags = (key)? BOARD_FRAME_KEY : 0;
+    fh.timestamp = timestamp;
+    Output(&fh, sizeof(fh));
+    Output(_encoded, size);
+
+    memcpy(_prev, plane, _planeSize);
+    _nframes++;
+    _framesWritten.fetch_add(1, std::memory_order_relaxed);
+}
+
+// Output: appends data to the file through a large buffer.
+void BoardRecorder::Output(const void* data, size_t size)
+{
+    if (OUTBUF_SIZE < _outlen+size) {
+        FlushOutput();
+    }
+    if (OUTBUF_SIZE <= size) {
+        if (!_failed.load() && fwrite(data, 1, size, _fp) != size) {
+            _failed.store(true);
+        }
+    } else {
+        memcpy(_outbuf+_outlen, data, size);
+        _outlen += size;
+    }
+    _offset += size;
+    _bytesWritten.store(_offset, std::memory_order_relaxed);
+}
+
+void BoardRecorder::FlushOutput()
+{
+    if (_outlen == 0) return;
+    if (!_failed.load() && fwrite(_outbuf, 1, _outlen, _fp) != _outlen) {
+        _failed.store(true);
+    }
+    _outlen = 0;
+}
+
+
+//  BoardPlayer
+//
+BoardPlayer::BoardPlayer()
+{
+    _header = NULL;
+    _index = NULL;
+    _nkeys = 0;
+    _nframes = 0;
+    _width = 0;
+    _height = 0;
+    _planeSize = 0;
+    _plane = NULL;
+    _current = -1;
+    _timestamp = 0;
+    _next = 0;
+    _realtime = true;
+    _position = 0;
+    _started = false;
+    _startTimestamp = 0;
+}
+
+BoardPlayer::~BoardPlayer()
+{
+    Close();
+}
+
+bool BoardPlayer::Open(const char* path)
+{
+    Close();
+    if (!_file.Open(path)) return false;
+
+    const uint8_t* data = _file.GetData();
+    size_t size = _file.GetSize();
+    if (size < sizeof(BoardFileHeader) + sizeof(BoardFileTrailer)) {
+        Close();
+        return false;
+    }
+    const BoardFileHeader* header = (const BoardFileHeader*)data;
+    const BoardFileTrailer* trailer =
+        (const BoardFileTrailer*)(data + size - sizeof(BoardFileTrailer));
+    if (memcmp(header->magic, "WCB1", 4) != 0 ||
+        memcmp(trailer->magic, "WCBI", 4) != 0 ||
+        header->version != BOARD_FILE_VERSION ||
+        header->width == 0 || 65536 < header->width ||
+        header->height == 0 || 65536 < header->height ||
+        header->keyInterval == 0 ||
+        trailer->indexOffset < sizeof(BoardFileHeader) ||
+        trailer->indexOffset +
+        (uint64_t)trailer->nkeys * sizeof(BoardIndexEntry) +
+        sizeof(BoardFileTrailer) != size) {
+        Close();
+        return false;
+    }
+
+    _width = header->width;
+    _height = header->height;
+    _planeSize = getBoardRowBytes(_width) * _height;
+    _plane = (uint8_t*)malloc(_planeSize);
+    if (_plane == NULL) {
+        Close();
+        return false;
+    }
+    _header = header;
+    _index = (const BoardIndexEntry*)(data + trailer->indexOffset);
+    _nkeys = trailer->nkeys;
+    _nframes = trailer->nframes;
+    _file.Advise(sizeof(BoardFileHeader), trailer->indexOffset);
+    Rewind(0);
+    return true;
+}
+
+void BoardPlayer::Close()
+{
+    free(_plane);
+    _plane = NULL;
+    _file.Close();
+    _header = NULL;
+    _index = NULL;
+    _nkeys = 0;
+    _nframes = 0;
+    _width = 0;
+    _height = 0;
+    _current = -1;
+}
+
+// FindKeyFrame: returns the index of the keyframe that precedes frame n.
+int BoardPlayer::FindKeyFrame(int n)
+{
+    uint32_t k = n / _header->keyInterval;
+    if (k < _nkeys && _index[k].frame == k * _header->keyInterval) return k;
+
+    // The index is irregular (e.g. a keyframe was lost); search it.
+    int i0 = 0, i1 = (int)_nkeys;
+    while (i0 < i1) {
+        int i = (i0+i1)/2;
+        if ((int)_index[i].frame <= n) {
+            i0 = i+1;
+        } else {
+            i1 = i;
+        }
+    }
+    return i0-1;
+}
+
+bool BoardPlayer::ReadFrameHeader(uint64_t offset, BoardFrameHeader* fh)
+{
+    uint64_t end = (const uint8_t*)_index - _file.GetData();
+    if (end < offset + sizeof(*fh)) return false;
+    memcpy(fh, _file.GetData() + offset, sizeof(*fh));
+    if (end < offset + sizeof(*fh) + fh->size) return false;
+    return true;
+}
+
+// DecodeAt: decodes the frame at offset on top of _plane.
+bool BoardPlayer::DecodeAt(uint64_t offset)
+{
+    BoardFrameHeader fh;
+    if (!ReadFrameHeader(offset, &fh)) return false;
+    const uint8_t* payload = _file.GetData() + offset + sizeof(fh);
+    bool delta = (fh.flags & BOARD_FRAME_KEY) == 0;
+    if (!decodeBoardRuns(_plane, _planeSize, payload, fh.size, delta)) return false;
+    _timestamp = fh.timestamp;
+    _next = offset + sizeof(fh) + fh.size;
+    return true;
+}
+
+const uint8_t* BoardPlayer::GetFrame(int n, int64_t* timestamp)
+{
+    if (_header == NULL) return NULL;
+    if (n < 0 || (int)_nframes <= n) return NULL;
+
+    if (n != _current) {
+        int k = FindKeyFrame(n);
+        if (k < 0) return NULL;
+        const BoardIndexEntry* entry = &(_index[k]);
+        if (_current < (int)entry->frame || n < _current) {
+            // Restart from the keyframe.
+            _current = -1;
+            if (!DecodeAt(entry->offset)) return NULL;
+            _current = entry->frame;
+        }
+        while (_current < n) {
+            if (!DecodeAt(_next)) {
+                _current = -1;
+                return NULL;
+            }
+            _current++;
+        }
+    }
+
+    if (timestamp != NULL) {
+        *timestamp = _timestamp;
+    }
+    return _plane;
+}
+
+int BoardPlayer::FindFrame(int64_t timestamp)
+{
+    if (_header == NULL || _nkeys == 0) return -1;
+
+    int i0 = 0, i1 = (int)_nkeys;
+    while (i0 < i1) {
+        int i = (i0+i1)/2;
+        if (_index[i].timestamp <= timestamp) {
+            i0 = i+1;
+        } else {
+            i1 = i;
+        }
+    }
+    if (i0 == 0) return 0;
+
+    // Walk the frame headers without decoding.
+    const BoardIndexEntry* entry = &(_index[i0-1]);
+    int n = entry->frame;
+    uint64_t offset = entry->offset;
+    BoardFrameHeader fh;
+    while (ReadFrameHeader(offset, &fh)) {
+        offset += sizeof(fh) + fh.size;
+        BoardFrameHeader next;
+        if (!ReadFrameHeader(offset, &next) || timestamp < next.timestamp) break;
+        n++;
+    }
+    return n;
+}
+
+void BoardPlayer::Rewind(int n)
+{
+    _position = n;
+    _started = false;
+}
+
+const uint8_t* BoardPlayer::NextFrame(int64_t* timestamp)
+{
+    int64_t t = 0;
+    const uint8_t* plane = GetFrame(_position, &t);
+    if (plane == NULL) return NULL;
+
+    if (_realtime) {
+        if (!_started) {
+            _started = true;
+            _startTimestamp = t;
+            _startTime = std::chrono::steady_clock::now();
+        } else {
+            // Timestamps are in 100ns units.
+            std::chrono::nanoseconds delay((t - _startTimestamp) * 100);
+            std::this_thread::sleep_until(_startTime + delay);
+        }
+    }
+
+    _position++;
+    if (timestamp != NULL) {
+        *timestamp = t;
+    }
+    return plane;
+}
+
+void expandBoardPlane(
+    uint8_t* dst, size_t stride, const uint8_t* plane,
+    int width, int height, const uint8_t fg[3], const uint8_t bg[3])
+{
+    size_t rowbytes = getBoardRowBytes(width);
+    for (int y = 0; y < height; y++) {
+        const uint8_t* row = plane + rowbytes*(height-1-y);
+        uint8_t* p = dst + stride*y;
+        for (int x = 0; x < width; x++) {
+            const uint8_t* c = (row[x >> 3] & (0x80 >> (x & 7)))? fg : bg;
+            p[0] = c[0];
+            p[1] = c[1];
+            p[2] = c[2];
+            p += 3;
+        }
+    }
+}
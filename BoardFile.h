@@ -0,0 +1,247 @@
+// -*- tab-width: 4; mode: c++ -*-
+//  BoardFile.h
+//
+//  Compact recording of thresholded (black/white) board frames.
+//
+//  A board file stores 1-bit frames, MSB first, (width+7)/8 bytes
+//  per row, top row first. A bit is set where there is ink.
+//  Every frame is run-length coded; frames between keyframes are
+//  XOR-ed with the previous frame before coding, so a static board
+//  costs only a few bytes per frame.
+//
+//  File layout (all fields little-endian):
+//    BoardFileHeader
+//    (BoardFrameHeader + payload)*
+//    BoardIndexEntry*        (one per keyframe)
+//    BoardFileTrailer
+//
+//  Keyframes are placed at every keyInterval frames, so the
+//  keyframe for frame n is index entry n/keyInterval.
+//
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "MappedFile.h"
+
+const uint32_t BOARD_FILE_VERSION = 1;
+const uint32_t BOARD_FRAME_KEY = 0x0001;
+
+struct BoardFileHeader
+{
+    char magic[4];              // "WCB1"
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t keyInterval;
+    uint32_t reserved;
+};
+
+struct BoardFrameHeader
+{
+    uint32_t size;              // payload size in bytes.
+    uint32_t flags;             // BOARD_FRAME_*
+    int64_t timestamp;          // in 100ns units.
+};
+
+struct BoardIndexEntry
+{
+    uint64_t offset;            // offset of the BoardFrameHeader.
+    int64_t timestamp;
+    uint32_t frame;
+    uint32_t reserved;
+};
+
+struct BoardFileTrailer
+{
+    uint64_t indexOffset;
+    uint32_t nkeys;
+    uint32_t nframes;
+    char magic[4];              // "WCBI"
+    uint32_t reserved;
+};
+
+// getBoardRowBytes: returns the size of a packed row.
+static inline size_t getBoardRowBytes(int width)
+{
+    return (size_t)((width+7) >> 3);
+}
+
+// getBoardRunsBound: returns the maximum size of encoded n bytes.
+static inline size_t getBoardRunsBound(size_t n)
+{
+    return n + n/8 + 32;
+}
+
+// encodeBoardRuns: encodes (cur XOR prev) as alternating zero runs
+//   and literals. prev can be NULL for a keyframe.
+//   Returns the number of bytes written to dst.
+size_t encodeBoardRuns(
+    uint8_t* dst, const uint8_t* cur, const uint8_t* prev, size_t n);
+
+// decodeBoardRuns: decodes a frame into dst.
+//   For a delta frame, dst must hold the previous frame and
+//   is updated in place. Returns false if the data is broken.
+bool decodeBoardRuns(
+    uint8_t* dst, size_t n, const uint8_t* src, size_t size, bool delta);
+
+
+//  BoardRecorder: writes board frames from a background thread.
+//
+//  The streaming thread calls BeginFrame() to obtain a pooled
+//  bit plane, fills it and calls CommitFrame(). It never waits:
+//  when the writer falls behind, BeginFrame() returns NULL and
+//  the frame is dropped.
+//
+//  A write error does not stop the recording, but the frames
+//  after it are lost; Close() and IsFailed() tell.
+//
+class BoardRecorder
+{
+private:
+    static const int NSLOTS = 8;
+    static const size_t OUTBUF_SIZE = 1024*1024;
+
+    FILE* _fp;
+    int _width;
+    int _height;
+    int _keyInterval;
+    size_t _planeSize;
+
+    uint8_t* _slots[NSLOTS];
+    int64_t _timestamps[NSLOTS];
+    std::atomic<uint32_t> _head;    // written by the streaming thread.
+    std::atomic<uint32_t> _tail;    // written by the writer thread.
+    std::atomic<bool> _open;
+    std::atomic<bool> _producing;
+    std::atomic<bool> _closing;
+
+    std::thread _writer;
+    std::mutex _mutex;
+    std::condition_variable _cond;
+
+    // Writer thread state.
+    uint8_t* _prev;
+    uint8_t* _encoded;
+    uint8_t* _outbuf;
+    size_t _outlen;
+    uint64_t _offset;
+    uint32_t _nframes;
+    BoardIndexEntry* _index;
+    uint32_t _nkeys;
+    uint32_t _maxkeys;
+    std::atomic<bool> _failed;
+
+    std::atomic<uint64_t> _framesWritten;
+    std::atomic<uint64_t> _framesDropped;
+    std::atomic<uint64_t> _bytesWritten;
+
+    void WriterLoop();
+    void WriteFrame(const uint8_t* plane, int64_t timestamp);
+    void Output(const void* data, size_t size);
+    void FlushOutput();
+    void ReleaseBuffers();
+
+public:
+    BoardRecorder();
+    ~BoardRecorder();
+
+    bool Open(const char* path, int width, int height, int keyInterval=300);
+    // Close: returns false if anything could not be written.
+    bool Close();
+    bool IsOpen()
+        { return _open.load(); }
+    bool IsFailed()
+        { return _failed.load(); }
+
+    // Streaming thread methods.
+    //   BeginFrame() returns NULL unless recording frames of this
+    //   size. The caller must fill the whole plane before
+    //   CommitFrame().
+    uint8_t* BeginFrame(int width, int height);
+    void CommitFrame(int64_t timestamp);
+
+    uint64_t GetFramesWritten()
+        { return _framesWritten.load(); }
+    uint64_t GetFramesDropped()
+        { return _framesDropped.load(); }
+    uint64_t GetBytesWritten()
+        { return _bytesWritten.load(); }
+};
+
+
+//  BoardPlayer: reads a board file through a memory mapping.
+//
+//  Frames are decoded on demand. Reading forward decodes one
+//  delta per frame; seeking backward or far ahead restarts from
+//  the nearest keyframe.
+//
+class BoardPlayer
+{
+private:
+    MappedFile _file;
+    const BoardFileHeader* _header;
+    const BoardIndexEntry* _index;
+    uint32_t _nkeys;
+    uint32_t _nframes;
+    int _width;
+    int _height;
+    size_t _planeSize;
+
+    uint8_t* _plane;
+    int _current;               // frame held in _plane, or -1.
+    int64_t _timestamp;         // timestamp of _current.
+    uint64_t _next;             // offset of the frame after _current.
+
+    // Pacing.
+    bool _realtime;
+    int _position;              // next frame for NextFrame().
+    bool _started;
+    int64_t _startTimestamp;
+    std::chrono::steady_clock::time_point _startTime;
+
+    int FindKeyFrame(int n);
+    bool ReadFrameHeader(uint64_t offset, BoardFrameHeader* fh);
+    bool DecodeAt(uint64_t offset);
+
+public:
+    BoardPlayer();
+    ~BoardPlayer();
+
+    bool Open(const char* path);
+    void Close();
+    bool IsOpen()
+        { return _header != NULL; }
+    int GetWidth()
+        { return _width; }
+    int GetHeight()
+        { return _height; }
+    int GetFrameCount()
+        { return (int)_nframes; }
+
+    // GetFrame: returns the bit plane of frame n (valid until the
+    //   next call), or NULL on error.
+    const uint8_t* GetFrame(int n, int64_t* timestamp=NULL);
+    // FindFrame: returns the last frame at or before timestamp.
+    int FindFrame(int64_t timestamp);
+
+    // Sequential playback.
+    //   In real-time mode, NextFrame() sleeps until the frame is due;
+    //   otherwise it returns frames as fast as they can be decoded.
+    void SetRealtime(bool realtime)
+        { _realtime = realtime; }
+    void Rewind(int n=0);
+    const uint8_t* NextFrame(int64_t* timestamp=NULL);
+};
+
+// expandBoardPlane: converts a bit plane into a bottom-up 24-bit DIB.
+//   Colors are in B, G, R order.
+void expandBoardPlane(
+    uint8_t* dst, size_t stride, const uint8_t* plane,
+    int width, int height, const uint8_t fg[3], const uint8_t bg[3]);
@@ -0,0 +1,724 @@
+// -*- tab-width: 4; mode: c++ -*-
+//  BoardSource.cpp
+
+#include <stdio.h>
+#include <windows.h>
+#include <dshow.h>
+#include "Filtaa.h"
+#include "BoardFile.h"
+#include "VideoFile.h"
+#include "BoardSource.h"
+
+
+// isMediaTypeCompatible: checks if a (partial) media type can be
+//   satisfied with ours. Zero fields are wildcards.
+static BOOL isMediaTypeCompatible(const AM_MEDIA_TYPE* mt, const AM_MEDIA_TYPE* ours)
+{
+    static const GUID zero = {0};
+    if (mt->majortype != zero && mt->majortype != ours->majortype) return FALSE;
+    if (mt->subtype != zero && mt->subtype != ours->subtype) return FALSE;
+    if (mt->formattype != zero) {
+        if (mt->formattype != ours->formattype) return FALSE;
+        if (mt->cbFormat != 0 && !isMediaTypeEqual(mt, ours)) return FALSE;
+    }
+    return TRUE;
+}
+
+
+//  IEnumPins object (single pin)
+//
+class BoardSourceEnumPins : public IEnumPins
+{
+private:
+    int _refCount;
+    IPin* _pin;
+    int _index;
+
+    virtual ~BoardSourceEnumPins() {
+        _pin->Release();
+    }
+
+public:
+    BoardSourceEnumPins(IPin* pin, int index=0) {
+        _refCount = 0;
+        _pin = pin;
+        _pin->AddRef();
+        _index = index;
+        AddRef();
+    }
+
+    // IUnknown methods
+    STDMETHODIMP QueryInterface(REFIID iid, void** ppvObject) {
+        if (ppvObject == NULL) return E_POINTER;
+        if (iid == IID_IUnknown) {
+            *ppvObject = this;
+        } else if (iid == IID_IEnumPins) {
+            *ppvObject = (IEnumPins*)this;
+        } else {
+            *ppvObject = NULL;
+            return E_NOINTERFACE;
+        }
+        AddRef();
+        return S_OK;
+    }
+    STDMETHODIMP_(ULONG) AddRef() {
+        _refCount++; return _refCount;
+    }
+    STDMETHODIMP_(ULONG) Release() {
+        _refCount--;
+        if (_refCount) return _refCount;
+        delete this;
+        return 0;
+    }
+
+    // IEnumPins methods
+    STDMETHODIMP Next(ULONG n, IPin** ppPins, ULONG* pFetched) {
+        if (ppPins == NULL) return E_POINTER;
+        if (n == 0) return E_INVALIDARG;
+        ULONG i = 0;
+        if (_index == 0) {
+            _pin->AddRef();
+            ppPins[i++] = _pin;
+            _index++;
+        }
+        if (pFetched != NULL) {
+            *pFetched = i;
+        }
+        return (i < n)? S_FALSE : S_OK;
+    }
+    STDMETHODIMP Skip(ULONG n) {
+        if (n == 0) return S_OK;
+        if (_index != 0) return S_FALSE;
+        _index++;
+        return (n == 1)? S_OK : S_FALSE;
+    }
+    STDMETHODIMP Reset() {
+        _index = 0;
+        return S_OK;
+    }
+    STDMETHODIMP Clone(IEnumPins** pEnum) {
+        if (pEnum == NULL) return E_POINTER;
+        *pEnum = new BoardSourceEnumPins(_pin, _index);
+        return S_OK;
+    }
+};
+
+
+//  IEnumMediaTypes object (single type)
+//
+class BoardSourceEnumMediaTypes : public IEnumMediaTypes
+{
+private:
+    int _refCount;
+    AM_MEDIA_TYPE _mt;
+    int _index;
+
+    virtual ~BoardSourceEnumMediaTypes() {
+        eraseMediaType(&_mt);
+    }
+
+public:
+    BoardSourceEnumMediaTypes(const AM_MEDIA_TYPE* mt, int index=0) {
+        _refCount = 0;
+        copyMediaType(&_mt, mt);
+        _index = index;
+        AddRef();
+    }
+
+    // IUnknown methods
+    STDMETHODIMP QueryInterface(REFIID iid, void** ppvObject) {
+        if (ppvObject == NULL) return E_POINTER;
+        if (iid == IID_IUnknown) {
+            *ppvObject = this;
+        } else if (iid == IID_IEnumMediaTypes) {
+            *ppvObject = (IEnumMediaTypes*)this;
+        } else {
+            *ppvObject = NULL;
+            return E_NOINTERFACE;
+        }
+        AddRef();
+        return S_OK;
+    }
+    STDMETHODIMP_(ULONG) AddRef() {
+        _refCount++; return _refCount;
+    }
+    STDMETHODIMP_(ULONG) Release() {
+        _refCount--;
+        if (_refCount) return _refCount;
+        delete this;
+        return 0;
+    }
+
+    // IEnumMediaTypes methods
+    STDMETHODIMP Next(ULONG n, AM_MEDIA_TYPE** ppMediaTypes, ULONG* pFetched) {
+        if (ppMediaTypes == NULL) return E_POINTER;
+        if (n == 0) return E_INVALIDARG;
+        ULONG i = 0;
+        if (_index == 0) {
+            AM_MEDIA_TYPE* dst = (AM_MEDIA_TYPE*)CoTaskMemAlloc(sizeof(AM_MEDIA_TYPE));
+            if (dst == NULL) return E_OUTOFMEMORY;
+            if (FAILED(copyMediaType(dst, &_mt))) return E_OUTOFMEMORY;
+            ppMediaTypes[i++] = dst;
+            _index++;
+        }
+        if (pFetched != NULL) {
+            *pFetched = i;
+        }
+        return (i < n)? S_FALSE : S_OK;
+    }
+    STDMETHODIMP Skip(ULONG n) {
+        if (n == 0) return S_OK;
+        if (_index != 0) return S_FALSE;
+        _index++;
+        return (n == 1)? S_OK : S_FALSE;
+    }
+    STDMETHODIMP Reset() {
+        _index = 0;
+        return S_OK;
+    }
+    STDMETHODIMP Clone(IEnumMediaTypes** pEnum) {
+        if (pEnum == NULL) return E_POINTER;
+        *pEnum = new BoardSourceEnumMediaTypes(&_mt, _index);
+        return S_OK;
+    }
+};
+
+
+//  BoardSourcePin object (output)
+//
+class BoardSourcePin : public IPin
+{
+private:
+    int _refCount;
+    BoardSource* _filter;
+    LPCWSTR _name;
+    IPin* _connected;
+
+    virtual ~BoardSourcePin() {
+        if (_connected != NULL) {
+            _connected->Release();
+            _connected = NULL;
+        }
+    }
+
+public:
+    BoardSourcePin(BoardSource* filter, LPCWSTR name) {
+        _refCount = 0;
+        _filter = filter;
+        _name = name;
+        _connected = NULL;
+        AddRef();
+    }
+
+    LPCWSTR Name() { return _name; }
+    IPin* Connected() { return _connected; }
+
+    // IUnknown methods
+    STDMETHODIMP QueryInterface(REFIID iid, void** ppvObject) {
+        if (ppvObject == NULL) return E_POINTER;
+        if (iid == IID_IUnknown) {
+            *ppvObject = this;
+        } else if (iid == IID_IPin) {
+            *ppvObject = (IPin*)this;
+        } else {
+            *ppvObject = NULL;
+            return E_NOINTERFACE;
+        }
+        AddRef();
+        return S_OK;
+    }
+    STDMETHODIMP_(ULONG) AddRef() {
+        _refCount++; return _refCount;
+    }
+    STDMETHODIMP_(ULONG) Release() {
+        _refCount--;
+        if (_refCount) return _refCount;
+        delete this;
+        return 0;
+    }
+
+    // IPin methods
+    STDMETHODIMP BeginFlush()
+        { return E_UNEXPECTED; }
+    STDMETHODIMP EndFlush()
+        { return E_UNEXPECTED; }
+    STDMETHODIMP EndOfStream()
+        { return E_UNEXPECTED; }
+    STDMETHODIMP NewSegment(REFERENCE_TIME tStart, REFERENCE_TIME tStop, double dRate)
+        { return S_OK; }
+    STDMETHODIMP ReceiveConnection(IPin* pConnector, const AM_MEDIA_TYPE* pmt)
+        { return E_UNEXPECTED; }
+    STDMETHODIMP QueryInternalConnections(IPin**, ULONG*)
+        { return E_NOTIMPL; }
+
+    STDMETHODIMP Connect(IPin* pReceivePin, const AM_MEDIA_TYPE* mt) {
+        HRESULT hr;
+        if (pReceivePin == NULL) return E_POINTER;
+        if (_connected != NULL) return VFW_E_ALREADY_CONNECTED;
+        hr = _filter->Connect(pReceivePin, mt);
+        if (FAILED(hr)) return hr;
+        _connected = pReceivePin;
+        _connected->AddRef();
+        return S_OK;
+    }
+    STDMETHODIMP ConnectedTo(IPin** ppPin) {
+        if (ppPin == NULL) return E_POINTER;
+        *ppPin = _connected;
+        if (_connected == NULL) return VFW_E_NOT_CONNECTED;
+        (*ppPin)->AddRef();
+        return S_OK;
+    }
+    STDMETHODIMP ConnectionMediaType(AM_MEDIA_TYPE* mt) {
+        if (mt == NULL) return E_POINTER;
+        if (_connected == NULL) return VFW_E_NOT_CONNECTED;
+        return copyMediaType(mt, _filter->GetMediaType());
+    }
+    STDMETHODIMP Disconnect() {
+        if (_connected == NULL) return S_FALSE;
+        _filter->Disconnect();
+        _connected->Release();
+        _connected = NULL;
+        return S_OK;
+    }
+    STDMETHODIMP EnumMediaTypes(IEnumMediaTypes** ppEnum) {
+        if (ppEnum == NULL) return E_POINTER;
+        const AM_MEDIA_TYPE* mt = _filter->GetMediaType();
+        if (mt == NULL) return VFW_E_NOT_CONNECTED;
+        *ppEnum = (IEnumMediaTypes*) new BoardSourceEnumMediaTypes(mt);
+        return S_OK;
+    }
+    STDMETHODIMP QueryId(LPWSTR* Id) {
+        if (Id == NULL) return E_POINTER;
+        size_t size = sizeof(WCHAR)*(lstrlen(_name)+1);
+        LPWSTR dst = (LPWSTR)CoTaskMemAlloc(size);
+        if (dst == NULL) return E_OUTOFMEMORY;
+        StringCbCopy(dst, size, _name);
+        *Id = dst;
+        return S_OK;
+    }
+    STDMETHODIMP QueryAccept(const AM_MEDIA_TYPE* mt) {
+        return _filter->QueryAccept(mt);
+    }
+    STDMETHODIMP QueryDirection(PIN_DIRECTION* pPinDir) {
+        if (pPinDir == NULL) return E_POINTER;
+        *pPinDir = PINDIR_OUTPUT;
+        return S_OK;
+    }
+    STDMETHODIMP QueryPinInfo(PIN_INFO* pInfo) {
+        if (pInfo == NULL) return E_POINTER;
+        ZeroMemory(pInfo, sizeof(*pInfo));
+        pInfo->pFilter = (IBaseFilter*)_filter;
+        pInfo->pFilter->AddRef();
+        pInfo->dir = PINDIR_OUTPUT;
+        StringCchCopy(pInfo->achName, _countof(pInfo->achName), _name);
+        return S_OK;
+    }
+};
+
+
+//  BoardSource
+//
+BoardSource::BoardSource()
+    : _streaming(false)
+{
+    const RGBTRIPLE BLACK = {0,0,0};
+    const RGBTRIPLE WHITE = {255,255,255};
+    _refCount = 0;
+    _name = L"BoardSource";
+    _state = State_Stopped;
+    _clock = NULL;
+    _graph = NULL;
+    _pOut = new BoardSourcePin(this, L"Out");
+    ZeroMemory(&_mediatype, sizeof(_mediatype));
+    _transport = NULL;
+    _allocator = NULL;
+    _player = new BoardPlayer();
+    _video = new VideoFile();
+    _realtime = TRUE;
+    _fgColor = BLACK;
+    _bgColor = WHITE;
+    AddRef();
+}
+
+BoardSource::~BoardSource()
+{
+    StopStreaming();
+    Disconnect();
+    delete _player;
+    delete _video;
+    eraseMediaType(&_mediatype);
+    if (_clock != NULL) {
+        _clock->Release();
+        _clock = NULL;
+    }
+    if (_graph != NULL) {
+        _graph->Release();
+        _graph = NULL;
+    }
+    if (_pOut != NULL) {
+        _pOut->Release();
+        _pOut = NULL;
+    }
+}
+
+// IUnknown methods
+
+STDMETHODIMP BoardSource::QueryInterface(REFIID iid, void** ppvObject)
+{
+    if (ppvObject == NULL) return E_POINTER;
+    if (iid == IID_IUnknown) {
+        *ppvObject = this;
+    } else if (iid == IID_IPersist) {
+        *ppvObject = (IPersist*)this;
+    } else if (iid == IID_IMediaFilter) {
+        *ppvObject = (IMediaFilter*)this;
+    } else if (iid == IID_IBaseFilter) {
+        *ppvObject = (IBaseFilter*)this;
+    } else {
+        *ppvObject = NULL;
+        return E_NOINTERFACE;
+    }
+
+    AddRef();
+    return S_OK;
+}
+
+// IBaseFilter methods
+
+STDMETHODIMP BoardSource::JoinFilterGraph(IFilterGraph* pGraph, LPCWSTR pName)
+{
+    if (pGraph != NULL) {
+        pGraph->AddRef();
+    }
+    if (_graph != NULL) {
+        _graph->Release();
+    }
+    _graph = pGraph;
+    return S_OK;
+}
+
+STDMETHODIMP BoardSource::EnumPins(IEnumPins** ppEnum)
+{
+    if (ppEnum == NULL) return E_POINTER;
+    *ppEnum = (IEnumPins*) new BoardSourceEnumPins((IPin*)_pOut);
+    return S_OK;
+}
+
+STDMETHODIMP BoardSource::FindPin(LPCWSTR Id, IPin** ppPin)
+{
+    if (Id == NULL) return E_POINTER;
+    if (ppPin == NULL) return E_POINTER;
+    if (lstrcmp(Id, _pOut->Name()) == 0) {
+        *ppPin = (IPin*)_pOut;
+        (*ppPin)->AddRef();
+    } else {
+        *ppPin = NULL;
+        return VFW_E_NOT_FOUND;
+    }
+    return S_OK;
+}
+
+STDMETHODIMP BoardSource::QueryFilterInfo(FILTER_INFO* pInfo)
+{
+    if (pInfo == NULL) return E_POINTER;
+    ZeroMemory(pInfo, sizeof(*pInfo));
+    pInfo->pGraph = _graph;
+    if (pInfo->pGraph != NULL) {
+        pInfo->pGraph->AddRef();
+    }
+    StringCchCopy(pInfo->achName, _countof(pInfo->achName), _name);
+    return S_OK;
+}
+
+STDMETHODIMP BoardSource::GetSyncSource(IReferenceClock** ppClock)
+{
+    if (ppClock == NULL) return E_POINTER;
+    (*ppClock) = _clock;
+    if (*ppClock != NULL) {
+        (*ppClock)->AddRef();
+    }
+    return S_OK;
+}
+
+STDMETHODIMP BoardSource::SetSyncSource(IReferenceClock* pClock)
+{
+    if (pClock != NULL) {
+        pClock->AddRef();
+    }
+    if (_clock != NULL) {
+        _clock->Release();
+    }
+    _clock = pClock;
+    return S_OK;
+}
+
+STDMETHODIMP BoardSource::Run(REFERENCE_TIME tStart)
+{
+    HRESULT hr;
+    if (_state == State_Stopped) {
+        hr = StartStreaming();
+        if (FAILED(hr)) return hr;
+    }
+    _state = State_Running;
+    return S_OK;
+}
+
+STDMETHODIMP BoardSource::Pause()
+{
+    HRESULT hr;
+    if (_state == State_Stopped) {
+        hr = StartStreaming();
+        if (FAILED(hr)) return hr;
+    }
+    _state = State_Paused;
+    return S_OK;
+}
+
+STDMETHODIMP BoardSource::Stop()
+{
+    if (_state != State_Stopped) {
+        StopStreaming();
+    }
+    _state = State_Stopped;
+    return S_OK;
+}
+
+// BoardSource methods
+
+HRESULT BoardSource::Open(const char* path)
+{
+    if (path == NULL) return E_POINTER;
+    if (_state != State_Stopped) return VFW_E_NOT_STOPPED;
+    if (_pOut->Connected() != NULL) return VFW_E_ALREADY_CONNECTED;
+    _player->Close();
+    _video->Close();
+
+    int width, height;
+    REFERENCE_TIME frameTime = 333333;
+    if (_player->Open(path)) {
+        width = _player->GetWidth();
+        height = _player->GetHeight();
+        // Estimate the frame rate from the first two frames.
+        int64_t t0, t1;
+        if (2 <= _player->GetFrameCount() &&
+            _player->GetFrame(0, &t0) != NULL &&
+            _player->GetFrame(1, &t1) != NULL &&
+            t0 < t1) {
+            frameTime = t1 - t0;
+        }
+    } else if (_video->Open(path)) {
+        width = _video->GetWidth();
+        height = _video->GetHeight();
+        frameTime = _video->GetFrameTime();
+    } else {
+        return E_FAIL;
+    }
+    size_t stride = (width*3 + 3) & ~3;
+
+    VIDEOINFOHEADER* vi = (VIDEOINFOHEADER*)CoTaskMemAlloc(sizeof(VIDEOINFOHEADER));
+    if (vi == NULL) return E_OUTOFMEMORY;
+    ZeroMemory(vi, sizeof(*vi));
+    vi->AvgTimePerFrame = frameTime;
+    vi->bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+    vi->bmiHeader.biWidth = width;
+    vi->bmiHeader.biHeight = height;
+    vi->bmiHeader.biPlanes = 1;
+    vi->bmiHeader.biBitCount = 24;
+    vi->bmiHeader.biCompression = BI_RGB;
+    vi->bmiHeader.biSizeImage = (DWORD)(stride*height);
+
+    eraseMediaType(&_mediatype);
+    ZeroMemory(&_mediatype, sizeof(_mediatype));
+    _mediatype.majortype = MEDIATYPE_Video;
+    _mediatype.subtype = MEDIASUBTYPE_RGB24;
+    _mediatype.bFixedSizeSamples = TRUE;
+    _mediatype.lSampleSize = vi->bmiHeader.biSizeImage;
+    _mediatype.formattype = FORMAT_VideoInfo;
+    _mediatype.cbFormat = sizeof(VIDEOINFOHEADER);
+    _mediatype.pbFormat = (BYTE*)vi;
+    return S_OK;
+}
+
+// Helper methods
+
+const AM_MEDIA_TYPE* BoardSource::GetMediaType()
+{
+    if (_mediatype.pbFormat == NULL) {
+        return NULL;
+    } else {
+        return &_mediatype;
+    }
+}
+
+HRESULT BoardSource::QueryAccept(const AM_MEDIA_TYPE* mt)
+{
+    if (mt == NULL) return E_POINTER;
+    if (_mediatype.pbFormat == NULL) return S_FALSE;
+    return (isMediaTypeEqual(mt, &_mediatype))? S_OK : S_FALSE;
+}
+
+HRESULT BoardSource::Connect(IPin* pReceivePin, const AM_MEDIA_TYPE* mt)
+{
+    HRESULT hr;
+    if (_state != State_Stopped) return VFW_E_NOT_STOPPED;
+    if (_mediatype.pbFormat == NULL) return VFW_E_NO_ACCEPTABLE_TYPES;
+    if (mt != NULL && !isMediaTypeCompatible(mt, &_mediatype)) return VFW_E_TYPE_NOT_ACCEPTED;
+
+    hr = pReceivePin->ReceiveConnection((IPin*)_pOut, &_mediatype);
+    if (FAILED(hr)) return hr;
+
+    hr = pReceivePin->QueryInterface(IID_PPV_ARGS(&_transport));
+    if (SUCCEEDED(hr)) {
+        hr = NegotiateAllocator();
+    }
+    if (FAILED(hr)) {
+        Disconnect();
+        pReceivePin->Disconnect();
+        return hr;
+    }
+
+    return S_OK;
+}
+
+// NegotiateAllocator: uses the downstream allocator if it has one.
+HRESULT BoardSource::NegotiateAllocator()
+{
+    HRESULT hr;
+    ALLOCATOR_PROPERTIES req = {0};
+    _transport->GetAllocatorRequirements(&req);
+    if (req.cBuffers < 2) {
+        req.cBuffers = 2;
+    }
+    if (req.cbBuffer < (long)_mediatype.lSampleSize) {
+        req.cbBuffer = _mediatype.lSampleSize;
+    }
+    if (req.cbAlign < 1) {
+        req.cbAlign = 1;
+    }
+
+    hr = _transport->GetAllocator(&_allocator);
+    if (FAILED(hr)) {
+        hr = CoCreateInstance(
+            CLSID_MemoryAllocator, 0, CLSCTX_INPROC_SERVER,
+            IID_PPV_ARGS(&_allocator));
+        if (FAILED(hr)) return hr;
+    }
+
+    ALLOCATOR_PROPERTIES given = {0};
+    hr = _allocator->SetProperties(&req, &given);
+    if (FAILED(hr)) return hr;
+    if (given.cbBuffer < (long)_mediatype.lSampleSize) return E_FAIL;
+
+    return _transport->NotifyAllocator(_allocator, FALSE);
+}
+
+HRESULT BoardSource::Disconnect()
+{
+    if (_allocator != NULL) {
+        _allocator->Release();
+        _allocator = NULL;
+    }
+    if (_transport != NULL) {
+        _transport->Release();
+        _transport = NULL;
+    }
+    return S_OK;
+}
+
+// Streaming
+
+HRESULT BoardSource::StartStreaming()
+{
+    HRESULT hr;
+    if (_allocator == NULL || _transport == NULL) return S_OK;
+    hr = _allocator->Commit();
+    if (FAILED(hr)) return hr;
+    _streaming.store(true);
+    _thread = std::thread(&BoardSource::StreamLoop, this);
+    return S_OK;
+}
+
+HRESULT BoardSource::StopStreaming()
+{
+    if (!_thread.joinable()) return S_OK;
+    _streaming.store(false);
+    // Decommit to unblock a pending GetBuffer.
+    if (_allocator != NULL) {
+        _allocator->Decommit();
+    }
+    _thread.join();
+    return S_OK;
+}
+
+void BoardSource::StreamLoop()
+{
+    HRESULT hr;
+    VIDEOINFOHEADER* vi = (VIDEOINFOHEADER*)_mediatype.pbFormat;
+    int width = vi->bmiHeader.biWidth;
+    int height = vi->bmiHeader.biHeight;
+    size_t stride = (width*3 + 3) & ~3;
+    long size = (long)_mediatype.lSampleSize;
+    BOOL realtime = _realtime;
+    int64_t t0 = 0;
+    BOOL first = TRUE;
+
+    // Pacing is left to the renderer, so decode without waiting.
+    BOOL video = _video->IsOpen();
+    _player->SetRealtime(false);
+    _player->Rewind(0);
+    _video->SetSpeed(0);
+    _video->Rewind(0);
+
+    while (_streaming.load()) {
+        int64_t t;
+        const uint8_t* plane = NULL;
+        VideoFrame frame;
+        if (video) {
+            if (_video->NextFrame(&frame)) {
+                t = frame.timestamp;
+                plane = frame.planes[0];
+            }
+        } else {
+            plane = _player->NextFrame(&t);
+        }
+        if (plane == NULL) {
+            IPin* pin = _pOut->Connected();
+            if (pin != NULL) {
+                pin->EndOfStream();
+            }
+            break;
+        }
+        if (first) {
+            t0 = t;
+            first = FALSE;
+        }
+
+        IMediaSample* pSample = NULL;
+        hr = _allocator->GetBuffer(&pSample, NULL, NULL, 0);
+        if (FAILED(hr)) break;  // decommitted.
+        BYTE* buf = NULL;
+        hr = pSample->GetPointer(&buf);
+        if (SUCCEEDED(hr) && size <= pSample->GetSize()) {
+            if (video) {
+                // The bitmap is bottom-up.
+                _video->ConvertFrame(&frame, buf + stride*(height-1),
+                                     -(ptrdiff_t)stride);
+            } else {
+                expandBoardPlane(buf, stride, plane, width, height,
+                                 (const uint8_t*)&_fgColor, (const uint8_t*)&_bgColor);
+            }
+            pSample->SetActualDataLength(size);
+            pSample->SetSyncPoint(TRUE);
+            if (realtime) {
+                REFERENCE_TIME tStart = t - t0;
+                REFERENCE_TIME tEnd = tStart + vi->AvgTimePerFrame;
+                pSample->SetTime(&tStart, &tEnd);
+            } else {
+                pSample->SetTime(NULL, NULL);
+            }
+            hr = _transport->Receive(pSample);
+        }
+        pSample->Release();
+        if (hr != S_OK) break;
+    }
+}
@@ -0,0 +1,100 @@
+// -*- tab-width: 4; mode: c++ -*-
+//  BoardSource.h
+//
+
+#pragma once
+#include <windows.h>
+#include <dshow.h>
+#include <atomic>
+#include <thread>
+
+class BoardSourcePin;
+class BoardPlayer;
+class VideoFile;
+
+//  BoardSource: replays a board file or an uncompressed video file
+//  (see VideoFile.h) as a DirectShow video source.
+//
+//  In real-time mode samples carry the recorded timestamps and the
+//  renderer paces them. Otherwise samples are untimed and pushed
+//  as fast as the downstream filters accept them.
+//
+class BoardSource : public IBaseFilter
+{
+private:
+    int _refCount;
+    LPCWSTR _name;
+    FILTER_STATE _state;
+    IReferenceClock* _clock;
+    IFilterGraph* _graph;
+    BoardSourcePin* _pOut;
+    AM_MEDIA_TYPE _mediatype;
+    IMemInputPin* _transport;
+    IMemAllocator* _allocator;
+    BoardPlayer* _player;
+    VideoFile* _video;
+    BOOL _realtime;
+    RGBTRIPLE _fgColor;
+    RGBTRIPLE _bgColor;
+
+    std::thread _thread;
+    std::atomic<bool> _streaming;
+
+    virtual ~BoardSource();
+    HRESULT NegotiateAllocator();
+    HRESULT StartStreaming();
+    HRESULT StopStreaming();
+    void StreamLoop();
+
+public:
+    BoardSource();
+
+    // IUnknown methods
+    STDMETHODIMP QueryInterface(REFIID iid, void** ppvObject);
+    STDMETHODIMP_(ULONG) AddRef() {
+        _refCount++; return _refCount;
+    }
+    STDMETHODIMP_(ULONG) Release() {
+        _refCount--;
+        if (_refCount) return _refCount;
+        delete this;
+        return 0;
+    }
+
+    // IPersist methods
+    STDMETHODIMP GetClassID(CLSID* pClassID)
+        { return E_FAIL; }
+
+    // IMediaFilter methods
+    STDMETHODIMP GetState(DWORD dwMilliSecsTimeout, FILTER_STATE* pState) {
+        if (pState == NULL) return E_POINTER;
+        *pState = _state; return S_OK;
+    }
+    STDMETHODIMP Run(REFERENCE_TIME tStart);
+    STDMETHODIMP Pause();
+    STDMETHODIMP Stop();
+
+    STDMETHODIMP GetSyncSource(IReferenceClock** ppClock);
+    STDMETHODIMP SetSyncSource(IReferenceClock* pClock);
+
+    // IBaseFilter methods
+    STDMETHODIMP QueryVendorInfo(LPWSTR* pVendorInfo)
+        { return E_NOTIMPL; }
+    STDMETHODIMP JoinFilterGraph(IFilterGraph* pGraph, LPCWSTR pName);
+    STDMETHODIMP EnumPins(IEnumPins** ppEnum);
+    STDMETHODIMP FindPin(LPCWSTR Id, IPin** ppPin);
+    STDMETHODIMP QueryFilterInfo(FILTER_INFO* pInfo);
+
+    // BoardSource Methods
+    HRESULT Open(const char* path);
+    void SetRealtime(BOOL realtime)
+        { _realtime = realtime; }
+    BOOL GetRealtime()
+        { return _realtime; }
+
+    // Helper Methods (for internal use)
+    const AM_MEDIA_TYPE* GetMediaType();
+    HRESULT QueryAccept(const AM_MEDIA_TYPE* mt);
+    HRESULT Connect(IPin* pReceivePin, const AM_MEDIA_TYPE* mt);
+    HRESULT Disconnect();
+};
@@ -0,0 +1,269 @@
+// -*- tab-width: 4; mode: c++ -*-
+//  Clahe.cpp
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include "Clahe.h"
+#include "ThreadPool.h"
+
+//  Constants
+//
+static const int DEFAULT_CLIP_LIMIT = 30;
+
+
+//  Clahe
+//
+Clahe::Clahe()
+{
+    _width = 0;
+    _height = 0;
+    _tileWidth = 0;
+    _tileHeight = 0;
+    _clipLimit = DEFAULT_CLIP_LIMIT;
+    _tileHists = NULL;
+    _luts = NULL;
+    _bandHists = NULL;
+    _colTile = NULL;
+    _colLeft = NULL;
+    _colRight = NULL;
+    _colWeight = NULL;
+}
+
+Clahe::~Clahe()
+{
+    Release();
+}
+
+bool Clahe::Setup(int width, int height)
+{
+    if (width == _width && height == _height) return true;
+    Release();
+    if (width <= 0 || height <= 0) return false;
+
+    _tileHists = (uint32_t*)malloc(sizeof(uint32_t)*NTILES*256);
+    _luts = (uint8_t*)malloc(NTILES*256);
+    _bandHists = (uint32_t*)malloc(sizeof(uint32_t)*TILES_Y*256);
+    _colTile = (uint8_t*)malloc(width);
+    _colLeft = (uint8_t*)malloc(width);
+    _colRight = (uint8_t*)malloc(width);
+    _colWeight = (uint16_t*)malloc(sizeof(uint16_t)*width);
+    if (_tileHists == NULL || _luts == NULL || _bandHists == NULL ||
+        _colTile == NULL || _colLeft == NULL || _colRight == NULL ||
+        _colWeight == NULL) {
+        Release();
+        return false;
+    }
+
+    _width = width;
+    _height = height;
+    _tileWidth = (width + TILES_X-1) / TILES_X;
+    _tileHeight = (height + TILES_Y-1) / TILES_Y;
+    for (int x = 0; x < width; x++) {
+        _colTile[x] = (uint8_t)(x / _tileWidth);
+        // The position in tiles, relative to the tile centers.
+        int pos = ((2*x + 1) * 256) / (2*_tileWidth) - 128;
+        int left = (pos < 0)? 0 : (pos >> 8);
+        int weight = (pos < 0)? 0 : (pos & 255);
+        if (TILES_X-1 <= left) {
+            left = TILES_X-1;
+            weight = 0;
+        }
+        _colLeft[x] = (uint8_t)left;
+        _colRight[x] = (uint8_t)((left < TILES_X-1)? left+1 : left);
+        _colWeight[x] = (uint16_t)weight;
+    }
+    Reset();
+    return true;
+}
+
+void Clahe::Release()
+{
+    free(_tileHists);
+    free(_luts);
+    free(_bandHists);
+    free(_colTile);
+    free(_colLeft);
+    free(_colRight);
+    free(_colWeight);
+    _tileHists = NULL;
+    _luts = NULL;
+    _bandHists = NULL;
+    _colTile = NULL;
+    _colLeft = NULL;
+    _colRight = NULL;
+    _colWeight = NULL;
+    _width = 0;
+    _height = 0;
+}
+
+void Clahe::Reset()
+{
+    if (_luts == NULL) return;
+    for (int t = 0; t < NTILES; t++) {
+        for (int i = 0; i < 256; i++) {
+            _luts[t*256+i] = (uint8_t)i;
+        }
+    }
+}
+
+// BuildLut: make the table of a tile from its clipped histogram.
+void Clahe::BuildLut(int tile)
+{
+    uint32_t* hist = _tileHists + tile*256;
+    uint8_t* lut = _luts + tile*256;
+    uint64_t total = 0;
+    for (int i = 0; i < 256; i++) {
+        total += hist[i];
+    }
+    if (total == 0) return;
+
+    // Clip the peaks and spread the excess over every level,
+    // which limits the slope of the table.
+    uint32_t clip = (uint32_t)(total * _clipLimit / (256*10));
+    if (clip < 1) {
+        clip = 1;
+    }
+    uint64_t excess = 0;
+    for (int i = 0; i < 256; i++) {
+        if (clip < hist[i]) {
+            excess += hist[i] - clip;
+            hist[i] = clip;
+        }
+    }
+    uint32_t step = (uint32_t)(excess / 256);
+    int extra = (int)(excess % 256);
+
+    uint64_t sum = 0;
+    for (int i = 0; i < 256; i++) {
+        sum += hist[i] + step + ((i < extra)? 1 : 0);
+        lut[i] = (uint8_t)((sum*255 + total/2) / total);
+    }
+}
+
+// ProcessBand: one row of tiles.
+template <class Luma>
+void Clahe::ProcessBand(
+    int band, const uint8_t* toneLut,
+    const uint8_t* src, ptrdiff_t srcStride,
+    uint8_t* dst, ptrdiff_t dstStride,
+    uint8_t* bits, ptrdiff_t bitsStride, int rawThreshold)
+{
+    uint32_t* rawHist = _bandHists + band*256;
+    uint32_t* tileHists = _tileHists + band*TILES_X*256;
+    memset(rawHist, 0, sizeof(uint32_t)*256);
+    memset(tileHists, 0, sizeof(uint32_t)*TILES_X*256);
+
+    size_t rowbytes = (_width+7) >> 3;
+    int y1 = (band+1)*_tileHeight;
+    if (_height < y1) {
+        y1 = _height;
+    }
+    for (int y = band*_tileHeight; y < y1; y++) {
+        const uint8_t* p = src + srcStride*y;
+        if (dst == NULL) {
+            for (int x = 0; x < _width; x++) {
+                int lum = Luma::Get(p);
+                rawHist[lum]++;
+                tileHists[_colTile[x]*256 + toneLut[lum]]++;
+                p += 3;
+            }
+            continue;
+        }
+
+        // The two rows of tables to blend.
+        int pos = ((2*y + 1) * 256) / (2*_tileHeight) - 128;
+        int top = (pos < 0)? 0 : (pos >> 8);
+        int wy = (pos < 0)? 0 : (pos & 255);
+        if (TILES_Y-1 <= top) {
+            top = TILES_Y-1;
+            wy = 0;
+        }
+        int bottom = (top < TILES_Y-1)? top+1 : top;
+        const uint8_t* lutTop = _luts + top*TILES_X*256;
+        const uint8_t* lutBottom = _luts + bottom*TILES_X*256;
+
+        uint8_t* q = dst + dstStride*y;
+        uint8_t* row = NULL;
+        if (bits != NULL) {
+            row = bits + bitsStride*y;
+            memset(row, 0, rowbytes);
+        }
+        for (int x = 0; x < _width; x++) {
+            int lum = Luma::Get(p);
+            rawHist[lum]++;
+            if (row != NULL && lum < rawThreshold) {
+                row[x >> 3] |= (0x80 >> (x & 7));
+            }
+            int v = toneLut[lum];
+            tileHists[_colTile[x]*256 + v]++;
+            int left = _colLeft[x]*256 + v;
+            int right = _colRight[x]*256 + v;
+            int wx = _colWeight[x];
+            int a = lutTop[left]*(256-wx) + lutTop[right]*wx;
+            int b = lutBottom[left]*(256-wx) + lutBottom[right]*wx;
+            uint8_t g = (uint8_t)((a*(256-wy) + b*wy + 32768) >> 16);
+            q[0] = g;
+            q[1] = g;
+            q[2] = g;
+            p += 3;
+            q += 3;
+        }
+    }
+}
+
+void Clahe::Process(
+    LumaModel model, const uint8_t* toneLut,
+    const uint8_t* src, ptrdiff_t srcStride,
+    uint8_t* dst, ptrdiff_t dstStride,
+    uint8_t* bits, ptrdiff_t bitsStride, int rawThreshold,
+    uint32_t* rawHist, ThreadPool* pool)
+{
+    auto bands = [&](int begin, int end) {
+        for (int band = begin; band < end; band++) {
+            switch (model) {
+            case LUMA_BT709:
+                ProcessBand<LumaBT709>(band, toneLut, src, srcStride,
+                                       dst, dstStride,
+                                       bits, bitsStride, rawThreshold);
+                break;
+            case LUMA_GREEN:
+                ProcessBand<LumaGreen>(band, toneLut, src, srcStride,
+                                       dst, dstStride,
+                                       bits, bitsStride, rawThreshold);
+                break;
+            case LUMA_MAX:
+                ProcessBand<LumaMax>(band, toneLut, src, srcStride,
+                                     dst, dstStride,
+                                     bits, bitsStride, rawThreshold);
+                break;
+            default:
+                ProcessBand<LumaBT601>(band, toneLut, src, srcStride,
+                                       dst, dstStride,
+                                       bits, bitsStride, rawThreshold);
+                break;
+            }
+        }
+    };
+    auto luts = [this](int begin, int end) {
+        for (int tile = begin; tile < end; tile++) {
+            BuildLut(tile);
+        }
+    };
+
+    // The tables of this frame are made once every band is done.
+    if (pool != NULL) {
+        pool->ParallelFor(TILES_Y, bands);
+        pool->ParallelFor(NTILES, luts, TILES_X);
+    } else {
+        bands(0, TILES_Y);
+        luts(0, NTILES);
+    }
+
+    memset(rawHist, 0, sizeof(uint32_t)*256);
+    for (int band = 0; band < TILES_Y; band++) {
+        for (int i = 0; i < 256; i++) {
+            rawHist[i] += _bandHists[band*256+i];
+        }
+    }
+}
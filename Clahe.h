@@ -0,0 +1,90 @@
+// -*- tab-width: 4; mode: c++ -*-
+//  Clahe.h
+//
+//  Contrast-limited adaptive histogram equalization (CLAHE).
+//
+//  The frame is divided into a fixed grid of tiles. Each tile has
+//  its own equalizing table made from its clipped histogram, and
+//  every pixel is blended from the tables of the four nearest tile
+//  centers. As with the threshold, the tables used for a frame are
+//  made from the previous one, so a frame takes a single pass.
+//
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "FiltaaCore.h"
+
+class ThreadPool;
+
+
+//  Clahe
+//
+//  All the buffers are allocated by Setup(), and the tasks are slots
+//  the pool already has (see ThreadPool), so Process() does not
+//  allocate. Each row of tiles is one task of the pool, which only
+//  writes its own tile histograms and rows.
+//
+class Clahe
+{
+private:
+    static const int TILES_X = 8;
+    static const int TILES_Y = 8;
+    static const int NTILES = TILES_X*TILES_Y;
+
+    int _width;
+    int _height;
+    int _tileWidth;
+    int _tileHeight;
+    int _clipLimit;             // in tenths of the mean bin count.
+
+    uint32_t* _tileHists;       // [NTILES][256] of the toned luma.
+    uint8_t* _luts;             // [NTILES][256]
+    uint32_t* _bandHists;       // [TILES_Y][256] of the raw luma.
+    // Per column: the tile, the two tables to blend and the weight.
+    uint8_t* _colTile;
+    uint8_t* _colLeft;
+    uint8_t* _colRight;
+    uint16_t* _colWeight;       // of the right table, in 1/256.
+
+    Clahe(const Clahe&);
+    Clahe& operator=(const Clahe&);
+
+    template <class Luma>
+    void ProcessBand(
+        int band, const uint8_t* toneLut,
+        const uint8_t* src, ptrdiff_t srcStride,
+        uint8_t* dst, ptrdiff_t dstStride,
+        uint8_t* bits, ptrdiff_t bitsStride, int rawThreshold);
+    void BuildLut(int tile);
+
+public:
+    Clahe();
+    ~Clahe();
+
+    // Setup: allocates the buffers for a frame size.
+    bool Setup(int width, int height);
+    void Release();
+    int GetWidth()
+        { return _width; }
+    int GetHeight()
+        { return _height; }
+
+    void SetClipLimit(int tenths)
+        { _clipLimit = tenths; }
+    int GetClipLimit()
+        { return _clipLimit; }
+
+    // Reset: forget the previous frame.
+    void Reset();
+    // Process: equalizes src into dst as gray B,G,R pixels, packing
+    //   the pixels below rawThreshold into bits as FiltaaCore does.
+    //   dst can be NULL to only take the histograms. The histogram
+    //   of the raw luma is returned in rawHist. pool can be NULL.
+    void Process(
+        LumaModel model, const uint8_t* toneLut,
+        const uint8_t* src, ptrdiff_t srcStride,
+        uint8_t* dst, ptrdiff_t dstStride,
+        uint8_t* bits, ptrdiff_t bitsStride, int rawThreshold,
+        uint32_t* rawHist, ThreadPool* pool);
+};
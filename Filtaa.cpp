@@ -5,6 +5,12 @@
 #include <windows.h>
 #include <dshow.h>
 #include "Filtaa.h"
+#include "BoardFile.h"
+#include "Snapshot.h"
+#include "FrameRing.h"
+#include "MjpegServer.h"
+#include "ThreadPool.h"
+#include "TraceLog.h"
 
 
 // DirectShow helper functions.
@@ -19,7 +25,7 @@ static BOOL isMediaTypeAcceptable(const AM_MEDIA_TYPE* mt)
 }
 
 // isMediaTypeEqual: checks if two media types are equal.
-static BOOL isMediaTypeEqual(const AM_MEDIA_TYPE* mt1, const AM_MEDIA_TYPE* mt2)
+BOOL isMediaTypeEqual(const AM_MEDIA_TYPE* mt1, const AM_MEDIA_TYPE* mt2)
 {
     if (mt1->majortype != mt2->majortype) return FALSE;
     if (mt1->subtype != mt2->subtype) return FALSE;
@@ -33,7 +39,7 @@ static BOOL isMediaTypeEqual(const AM_MEDIA_TYPE* mt1, const AM_MEDIA_TYPE* mt2)
 
 // copyMediaType: copy a media type.
 //   Note: pbFormat is newly allocated.
-static HRESULT copyMediaType(AM_MEDIA_TYPE* dst, const AM_MEDIA_TYPE* src)
+HRESULT copyMediaType(AM_MEDIA_TYPE* dst, const AM_MEDIA_TYPE* src)
 {
     if (src == NULL) return E_POINTER;
     if (dst == NULL) return E_POINTER;
@@ -49,7 +55,7 @@ static HRESULT copyMediaType(AM_MEDIA_TYPE* dst, const AM_MEDIA_TYPE* src)
 
 // eraseMediaType: erase a media type.
 //   Note: pbFormat is freed.
-static HRESULT eraseMediaType(AM_MEDIA_TYPE* mt)
+HRESULT eraseMediaType(AM_MEDIA_TYPE* mt)
 {
     if (mt == NULL) return E_POINTER;
     if (mt->pbFormat != NULL) {
@@ -358,7 +364,7 @@ public:
 
 //  FiltaaInputPin object
 //
-class FiltaaInputPin : public IPin, public IMemInputPin
+class FiltaaInputPin : public IPin, public IMemInputPin, public IQualityControl
 {
 private:
     int _refCount;
@@ -449,6 +455,14 @@ public:
         { return S_FALSE; }
     STDMETHODIMP ReceiveMultiple(IMediaSample** pSamples, long nSamples, long* nSamplesProcessed);
 
+    // IQualityControl methods (of the output pin)
+    STDMETHODIMP Notify(IBaseFilter* pSelf, Quality q) {
+        if (_direction != PINDIR_OUTPUT) return E_UNEXPECTED;
+        return _filter->NotifyQuality(&q);
+    }
+    STDMETHODIMP SetSink(IQualityControl* piqc)
+        { return S_OK; }
+
 };
 
 FiltaaInputPin::FiltaaInputPin(Filtaa* filter, LPCWSTR name, PIN_DIRECTION direction)
@@ -483,6 +497,9 @@ STDMETHODIMP FiltaaInputPin::QueryInterface(REFIID iid, void** ppvObject)
         *ppvObject = (IPin*)this;
     } else if (iid == IID_IMemInputPin) {
         *ppvObject = (IMemInputPin*)this;
+    } else if (iid == IID_IQualityControl && _direction == PINDIR_OUTPUT) {
+        // The renderer tells how late it is.
+        *ppvObject = (IQualityControl*)this;
     } else {
         *ppvObject = NULL;
         return E_NOINTERFACE;
@@ -632,6 +649,9 @@ Filtaa::Filtaa()
     _name = L"Filtaa";
     _state = State_Stopped;
     _clock = NULL;
+    _tStart = 0;
+    _frameInterval = 0;
+    _renderLate = 0;
     _graph = NULL;
     _pIn = new FiltaaInputPin(this, L"In", PINDIR_INPUT);
     _pOut = new FiltaaInputPin(this, L"Out", PINDIR_OUTPUT);
@@ -639,14 +659,28 @@ Filtaa::Filtaa()
     _transport = NULL;
     _allocatorIn = NULL;
     _allocatorOut = NULL;
-    _hist = (ULONG*)CoTaskMemAlloc(sizeof(ULONG)*256);
-    _threshold = -1;
+    _recorder = new BoardRecorder();
+    _snapshot = new SnapshotWriter();
+    _ring = new FrameRingWriter();
+    _server = new MjpegServer();
+    _pool = NULL;
+    _received = 0;
+    _processed = 0;
+    _dropped = 0;
+    _threshold = 0;
+    _bypass = false;
+    _switched = 0;
+    _switchLatency = 0;
     AddRef();
 }
 
 Filtaa::~Filtaa()
 {
-    CoTaskMemFree(_hist);
+    delete _recorder;
+    delete _snapshot;
+    delete _ring;
+    delete _server;
+    delete _pool;
     eraseMediaType(&_mediatype);
     if (_allocatorIn != NULL) {
         _allocatorIn->Release();
@@ -788,6 +822,9 @@ STDMETHODIMP Filtaa::Run(REFERENCE_TIME tStart)
         }
         BeginTransform();
     }
+    _tStart = tStart;
+    _frameTiming.Restart();
+    _renderLate = 0;
     _state = State_Running;
     return S_OK;
 }
@@ -882,14 +919,50 @@ HRESULT Filtaa::Receive(IMediaSample* pSample)
 {
     HRESULT hr;
     if (pSample == NULL) return E_POINTER;
+    if (_bypass.load(std::memory_order_relaxed)) {
+        return PassThrough(pSample);
+    }
+    StageScope frame(&_timers, STAGE_FRAME);
+    uint64_t serial = _received.fetch_add(1, std::memory_order_relaxed);
+
+    // The times are in 100ns units; FrameTiming takes nanoseconds.
+    REFERENCE_TIME tSample = 0, tSampleEnd = 0, tNow = 0;
+    bool timed = (GetStreamTime(&tNow) &&
+                  SUCCEEDED(pSample->GetTime(&tSample, &tSampleEnd)));
+    if (timed) {
+        _frameTiming.Arrive(tSample*100, tNow*100,
+                            pSample->IsDiscontinuity() == S_OK);
+    } else {
+        _frameTiming.Untimed();
+    }
+
+    // Shedding every other frame.
+    if (QUALITY_HALF_RATE <= _quality.GetLevel() && (serial & 1)) {
+        _dropped.fetch_add(1, std::memory_order_relaxed);
+        return S_OK;
+    }
 
     //fwprintf(stderr, L"Filtaa.Receive: %p\n", pSample);
     IMediaSample* pRWSample = NULL;
     if (_allocatorOut != NULL) {
-        hr = _allocatorOut->GetBuffer(&pRWSample, NULL, NULL, 0);
-        if (FAILED(hr)) return hr;
-        hr = copyMediaSample(pRWSample, pSample);
+        {
+            TraceScope wait("GetBuffer");
+            hr = _allocatorOut->GetBuffer(&pRWSample, NULL, NULL, 0);
+        }
         if (FAILED(hr)) {
+            _dropped.fetch_add(1, std::memory_order_relaxed);
+            return hr;
+        }
+    }
+    // The waits for the buffer and for the renderer are not our work.
+    uint64_t t0 = getTimerNanos();
+    if (pRWSample != NULL) {
+        {
+            StageScope copy(&_timers, STAGE_COPY);
+            hr = copyMediaSample(pRWSample, pSample);
+        }
+        if (FAILED(hr)) {
+            _dropped.fetch_add(1, std::memory_order_relaxed);
             pRWSample->Release();
             return hr;
         }
@@ -901,20 +974,133 @@ HRESULT Filtaa::Receive(IMediaSample* pSample)
     AM_MEDIA_TYPE* mt = NULL;
     hr = pRWSample->GetMediaType(&mt);
     if (mt == NULL || isMediaTypeEqual(&_mediatype, mt)) {
+        StageScope transform(&_timers, STAGE_TRANSFORM);
         TransformSample(pRWSample);
+        _processed.fetch_add(1, std::memory_order_relaxed);
+        _threshold.store(_core.GetLastThreshold(), std::memory_order_relaxed);
     }
+    int64_t busy = (int64_t)(getTimerNanos() - t0);
     if (mt != NULL) {
         eraseMediaType(mt);
         CoTaskMemFree(mt);
     }
     if (_transport != NULL) {
-        _transport->Receive(pRWSample);
+        StageScope deliver(&_timers, STAGE_DELIVER);
+        hr = _transport->Receive(pRWSample);
+        if (FAILED(hr)) {
+            _dropped.fetch_add(1, std::memory_order_relaxed);
+        }
     }
     pRWSample->Release();
+    EndSwitch(false);
+    if (timed && GetStreamTime(&tNow)) {
+        _frameTiming.Deliver(tSample*100, tNow*100);
+    }
+    _core.SetQuality(_quality.Update(
+        busy, _renderLate.load(std::memory_order_relaxed), GetFrameInterval()));
+
+    return S_OK;
+}
+
+// PassThrough: passes a sample on in bypass.
+//   When the renderer shares the upstream allocator, the sample
+//   goes as it is. Otherwise it was given ours, because the upstream
+//   samples are read-only or do not fit, and the sample is copied
+//   into one of ours as when processing. Only the copy is timed;
+//   the quality policy does not see these frames.
+HRESULT Filtaa::PassThrough(IMediaSample* pSample)
+{
+    HRESULT hr;
+    _received.fetch_add(1, std::memory_order_relaxed);
+    if (_transport == NULL) {
+        EndSwitch(true);
+        return S_OK;
+    }
+    IMediaSample* pOutSample = NULL;
+    if (_allocatorOut != NULL) {
+        hr = _allocatorOut->GetBuffer(&pOutSample, NULL, NULL, 0);
+        if (FAILED(hr)) {
+            _dropped.fetch_add(1, std::memory_order_relaxed);
+            return hr;
+        }
+        {
+            StageScope copy(&_timers, STAGE_COPY);
+            hr = copyMediaSample(pOutSample, pSample);
+        }
+        if (FAILED(hr)) {
+            _dropped.fetch_add(1, std::memory_order_relaxed);
+            pOutSample->Release();
+            return hr;
+        }
+    } else {
+        pOutSample = pSample;
+        pOutSample->AddRef();
+    }
+    hr = _transport->Receive(pOutSample);
+    if (FAILED(hr)) {
+        _dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+    pOutSample->Release();
+    EndSwitch(true);
+    return S_OK;
+}
+
+void Filtaa::SetBypass(BOOL bypass)
+{
+    bool on = (bypass != FALSE);
+    if (_bypass.load(std::memory_order_relaxed) == on) return;
+    if (!on) {
+        // The frames in bypass were not seen; not a gap.
+        _frameTiming.Restart();
+    }
+    _switched.store(getTimerNanos(), std::memory_order_relaxed);
+    _bypass.store(on, std::memory_order_relaxed);
+}
+
+// EndSwitch: a frame was passed on, in bypass or not; the first
+//   of the mode switched to gives the latency.
+void Filtaa::EndSwitch(bool bypassed)
+{
+    if (_switched.load(std::memory_order_relaxed) == 0) return;
+    if (_bypass.load(std::memory_order_relaxed) != bypassed) return;
+    uint64_t t0 = _switched.exchange(0, std::memory_order_relaxed);
+    if (t0 != 0) {
+        _switchLatency.store(getTimerNanos() - t0, std::memory_order_relaxed);
+    }
+}
 
+// GetFrameInterval: the interval of the media type, or as measured.
+int64_t Filtaa::GetFrameInterval()
+{
+    return (0 < _frameInterval)? _frameInterval : _frameTiming.GetInterval();
+}
+
+// NotifyQuality: the renderer is late (or early) by q->Late.
+//   Called by the renderer thread; the policy is updated per frame.
+HRESULT Filtaa::NotifyQuality(const Quality* q)
+{
+    _renderLate.store(q->Late*100, std::memory_order_relaxed);
     return S_OK;
 }
 
+// GetStreamTime: the time of the reference clock since Run().
+bool Filtaa::GetStreamTime(REFERENCE_TIME* pTime)
+{
+    if (_clock == NULL || _state != State_Running) return false;
+    REFERENCE_TIME now;
+    if (FAILED(_clock->GetTime(&now))) return false;
+    *pTime = now - _tStart;
+    return true;
+}
+
+void Filtaa::GetStats(FiltaaStats* stats)
+{
+    stats->received = _received.load(std::memory_order_relaxed);
+    stats->processed = _processed.load(std::memory_order_relaxed);
+    stats->dropped = _dropped.load(std::memory_order_relaxed);
+    stats->threshold = _threshold.load(std::memory_order_relaxed);
+}
+
 // Helper methods
 
 const AM_MEDIA_TYPE* Filtaa::GetMediaType()
@@ -978,7 +1164,29 @@ HRESULT Filtaa::ReceiveConnection(const AM_MEDIA_TYPE* mt)
 {
     if (_state != State_Stopped) return VFW_E_NOT_STOPPED;
     if (!isMediaTypeAcceptable(mt)) return VFW_E_TYPE_NOT_ACCEPTED;
-    return copyMediaType(&_mediatype, mt);
+    HRESULT hr = copyMediaType(&_mediatype, mt);
+    if (FAILED(hr)) return hr;
+
+    // Allocate the CLAHE and filter buffers here, not in the streaming
+    // thread.
+    VIDEOINFOHEADER* vi = (VIDEOINFOHEADER*)_mediatype.pbFormat;
+    if (_pool == NULL) {
+        _pool = new ThreadPool();
+    }
+    _core.SetPool(_pool);
+    _core.SetTimers(&_timers);
+    _timers.Reset();
+    _frameInterval = vi->AvgTimePerFrame*100;
+    _frameTiming.Reset(_frameInterval);
+    _quality.Reset();
+    _core.SetQuality(QUALITY_FULL);
+    _received = 0;
+    _processed = 0;
+    _dropped = 0;
+    if (!_core.Setup(vi->bmiHeader.biWidth, abs(vi->bmiHeader.biHeight))) {
+        return E_OUTOFMEMORY;
+    }
+    return S_OK;
 }
 
 HRESULT Filtaa::BeginFlush()
@@ -992,6 +1200,7 @@ HRESULT Filtaa::BeginFlush()
 
 HRESULT Filtaa::EndFlush()
 {
+    _frameTiming.Restart();
     IPin* pin = _pOut->Connected();
     if (pin != NULL) {
         pin->EndFlush();
@@ -1010,6 +1219,7 @@ HRESULT Filtaa::EndOfStream()
 
 HRESULT Filtaa::NewSegment(REFERENCE_TIME tStart, REFERENCE_TIME tStop, double dRate)
 {
+    _frameTiming.Restart();
     IPin* pin = _pOut->Connected();
     if (pin != NULL) {
         pin->NewSegment(tStart, tStop, dRate);
@@ -1022,54 +1232,12 @@ HRESULT Filtaa::NewSegment(REFERENCE_TIME tStart, REFERENCE_TIME tStop, double d
 // align32: fix the size for 32-bit boundary.
 static inline size_t align32(size_t x)
 {
-    return (((x+3) >> 4) << 4);
-}
-
-// getLuma: get the luminance value for a RGB pixel.
-static inline int getLuma(const RGBTRIPLE* p)
-{
-    return (p->rgbtRed*76 + p->rgbtGreen*150 + p->rgbtBlue*30) >> 8;
-}
-
-// getAutoThreshold: calculate the B/W threshold with the Otsu's method.
-static int getAutoThreshold(const ULONG* hist)
-{
-    ULONG total = 0, sum = 0;
-    for (int i = 0; i < 256; i++) {
-        total += hist[i];
-        sum += i*hist[i];
-    }
-
-    ULONG wb = 0, sb = 0;
-    double max = 0;
-    int threshold = 0;
-    for (int i = 0; i < 256; i++) {
-        wb += hist[i];
-        if (wb == 0) continue;
-        ULONG wf = total - wb;
-        if (wf == 0) break;
-        sb += i*hist[i];
-        ULONG sf = sum - sb;
-        // Note: these values can easily exceed 2^32.
-        double mb = (double)sb/(double)wb;
-        double mf = (double)sf/(double)wf;
-        double v = (double)wb*(double)wf*(mb-mf)*(mb-mf);
-        if (max < v) {
-            max = v;
-            threshold = i;
-        }
-    }
-
-    return threshold;
+    return (((x+3) >> 2) << 2);
 }
 
 HRESULT Filtaa::BeginTransform()
 {
-    const RGBTRIPLE BLACK = {0,0,0};
-    const RGBTRIPLE WHITE = {255,255,255};
-    _fgColor = BLACK;
-    _bgColor = WHITE;
-    _autoThreshold = 128;
+    _core.Reset();
     return S_OK;
 }
 
@@ -1079,6 +1247,8 @@ HRESULT Filtaa::EndTransform()
 }
 
 // TransformSample: modify the IMediaSample in-place.
+//   When recording or serving, the B/W bits are packed in the same
+//   pass. A requested snapshot and frame sharing cost one copy each.
 HRESULT Filtaa::TransformSample(IMediaSample* pSample)
 {
     HRESULT hr;
@@ -1087,28 +1257,150 @@ HRESULT Filtaa::TransformSample(IMediaSample* pSample)
     if (FAILED(hr)) return hr;
 
     VIDEOINFOHEADER* vi = (VIDEOINFOHEADER*)_mediatype.pbFormat;
-    BYTE* line = buf;
     int width = vi->bmiHeader.biWidth;
     int height = vi->bmiHeader.biHeight;
     size_t linesize = align32(width * 3);
-    int threshold = (0 <= _threshold)? _threshold : _autoThreshold;
-
-    memset(_hist, 0, sizeof(ULONG)*256);
-    for (int y = 0; y < height; y++) {
-        RGBTRIPLE* p = (RGBTRIPLE*)line;
-        for (int x = 0; x < width; x++) {
-            int lum = getLuma(p);
-            _hist[lum]++;
-            if (lum < threshold) {
-                *p = _fgColor;
-            } else {
-                *p = _bgColor;
-            }
-            p++;
+
+    REFERENCE_TIME tStart = 0, tEnd = 0;
+    pSample->GetTime(&tStart, &tEnd);
+
+    BYTE* bits = _recorder->BeginFrame(width, height);
+    BYTE* served = _server->BeginFrame(width, height);
+
+    // The bitmap is bottom-up; board rows are top-down.
+    ptrdiff_t rowbytes = getBoardRowBytes(width);
+    BYTE* plane = (bits != NULL)? bits : served;
+    if (plane != NULL) {
+        _core.Process(buf, linesize, buf, linesize, width, height,
+                      plane + rowbytes*(height-1), -rowbytes);
+    } else {
+        _core.Process(buf, linesize, buf, linesize, width, height);
+    }
+    if (bits != NULL) {
+        if (served != NULL) {
+            memcpy(served, bits, rowbytes*height);
         }
-        line += linesize;
+        _recorder->CommitFrame(tStart);
+    }
+    if (served != NULL) {
+        _server->CommitFrame();
+    }
+
+    if (_ring->IsOpen()) {
+        FrameInfo info;
+        info.timestamp = tStart;
+        info.threshold = _core.GetLastThreshold();
+        summarizeHistogram(&info, _core.GetHistogram(), info.threshold);
+        _ring->Publish(buf + linesize*(height-1), -(ptrdiff_t)linesize,
+                       width, height, &info);
+    }
+
+    if (_snapshot->IsRequested()) {
+        _snapshot->Capture(buf + linesize*(height-1), -(ptrdiff_t)linesize,
+                           width, height);
+    }
+
+    return S_OK;
+}
+
+// Recording
+
+HRESULT Filtaa::StartRecording(const char* path)
+{
+    if (path == NULL) return E_POINTER;
+    if (_pIn->Connected() == NULL) return VFW_E_NOT_CONNECTED;
+    if (_recorder->IsOpen()) return E_UNEXPECTED;
+
+    VIDEOINFOHEADER* vi = (VIDEOINFOHEADER*)_mediatype.pbFormat;
+    if (!_recorder->Open(path, vi->bmiHeader.biWidth, vi->bmiHeader.biHeight)) {
+        return E_FAIL;
+    }
+    return S_OK;
+}
+
+HRESULT Filtaa::StopRecording()
+{
+    // A full disk leaves the file short of frames.
+    if (!_recorder->Close()) return E_FAIL;
+    return S_OK;
+}
+
+BOOL Filtaa::IsRecording()
+{
+    return (_recorder->IsOpen())? TRUE : FALSE;
+}
+
+BOOL Filtaa::IsRecordingFailed()
+{
+    return (_recorder->IsFailed())? TRUE : FALSE;
+}
+
+// Snapshot
+
+HRESULT Filtaa::SaveSnapshot(const char* path)
+{
+    if (path == NULL) return E_POINTER;
+    if (_pIn->Connected() == NULL) return VFW_E_NOT_CONNECTED;
+
+    VIDEOINFOHEADER* vi = (VIDEOINFOHEADER*)_mediatype.pbFormat;
+    if (!_snapshot->Request(path, vi->bmiHeader.biWidth, vi->bmiHeader.biHeight)) {
+        return E_FAIL;
+    }
+    return S_OK;
+}
+
+uint64_t Filtaa::GetSnapshotCopyTime()
+{
+    return _snapshot->GetLastCopyTime();
+}
+
+// Sharing
+
+HRESULT Filtaa::StartSharing(const char* name)
+{
+    if (name == NULL) return E_POINTER;
+    if (_pIn->Connected() == NULL) return VFW_E_NOT_CONNECTED;
+    if (_ring->IsOpen()) return E_UNEXPECTED;
+
+    VIDEOINFOHEADER* vi = (VIDEOINFOHEADER*)_mediatype.pbFormat;
+    if (!_ring->Open(name, vi->bmiHeader.biWidth, vi->bmiHeader.biHeight)) {
+        return E_FAIL;
     }
-    _autoThreshold = getAutoThreshold(_hist);
+    return S_OK;
+}
 
+HRESULT Filtaa::StopSharing()
+{
+    _ring->Close();
     return S_OK;
 }
+
+BOOL Filtaa::IsSharing()
+{
+    return (_ring->IsOpen())? TRUE : FALSE;
+}
+
+// Serving
+
+HRESULT Filtaa::StartServing(int port)
+{
+    if (_pIn->Connected() == NULL) return VFW_E_NOT_CONNECTED;
+    if (_server->IsRunning()) return E_UNEXPECTED;
+
+    VIDEOINFOHEADER* vi = (VIDEOINFOHEADER*)_mediatype.pbFormat;
+    if (!_server->Start(port, vi->bmiHeader.biWidth, vi->bmiHeader.biHeight)) {
+        return E_FAIL;
+    }
+    return S_OK;
+}
+
+HRESULT Filtaa::StopServing()
+{
+    _server->Stop();
+    return S_OK;
+}
+
+BOOL Filtaa::IsServing()
+{
+    return (_server->IsRunning())? TRUE : FALSE;
+}
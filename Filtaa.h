@@ -5,9 +5,32 @@
 #pragma once
 #include <windows.h>
 #include <dshow.h>
+#include <atomic>
+#include "FiltaaCore.h"
+#include "FrameTiming.h"
 
 
 class FiltaaInputPin;
+class BoardRecorder;
+class SnapshotWriter;
+class FrameRingWriter;
+class MjpegServer;
+class ThreadPool;
+
+// DirectShow helper functions.
+BOOL isMediaTypeEqual(const AM_MEDIA_TYPE* mt1, const AM_MEDIA_TYPE* mt2);
+HRESULT copyMediaType(AM_MEDIA_TYPE* dst, const AM_MEDIA_TYPE* src);
+HRESULT eraseMediaType(AM_MEDIA_TYPE* mt);
+
+//  FiltaaStats: a snapshot of the stream counters.
+//
+struct FiltaaStats
+{
+    uint64_t received;          // samples from upstream.
+    uint64_t processed;         // samples transformed.
+    uint64_t dropped;           // samples not passed on.
+    int threshold;              // the last threshold used.
+};
 
 //  Filtaa: performs image manipulation on a DirectShow stream.
 //
@@ -18,6 +41,7 @@ private:
     LPCWSTR _name;
     FILTER_STATE _state;
     IReferenceClock* _clock;
+    REFERENCE_TIME _tStart;
     IFilterGraph* _graph;
     FiltaaInputPin* _pIn;
     FiltaaInputPin* _pOut;
@@ -25,17 +49,34 @@ private:
     IMemInputPin* _transport;
     IMemAllocator* _allocatorIn;
     IMemAllocator* _allocatorOut;
-    ULONG* _hist;
 
-    int _threshold;
-    int _autoThreshold;
-    RGBTRIPLE _fgColor;
-    RGBTRIPLE _bgColor;
+    FiltaaCore _core;
+    StageTimers _timers;
+    FrameTiming _frameTiming;
+    int64_t _frameInterval;     // nanoseconds, or 0.
+    QualityPolicy _quality;
+    std::atomic<int64_t> _renderLate;
+    std::atomic<uint64_t> _received;
+    std::atomic<uint64_t> _processed;
+    std::atomic<uint64_t> _dropped;
+    std::atomic<int> _threshold;
+    std::atomic<bool> _bypass;
+    std::atomic<uint64_t> _switched;      // when bypass changed, or 0.
+    std::atomic<uint64_t> _switchLatency;
+    BoardRecorder* _recorder;
+    SnapshotWriter* _snapshot;
+    FrameRingWriter* _ring;
+    MjpegServer* _server;
+    ThreadPool* _pool;
 
     virtual ~Filtaa();
     HRESULT BeginTransform();
     HRESULT EndTransform();
     HRESULT TransformSample(IMediaSample* pSample);
+    HRESULT PassThrough(IMediaSample* pSample);
+    void EndSwitch(bool bypassed);
+    bool GetStreamTime(REFERENCE_TIME* pTime);
+    int64_t GetFrameInterval();
 
 public:
     Filtaa();
@@ -78,11 +119,72 @@ public:
 
     // Filtaa Methods
     void SetThreshold(int threshold)
-        { _threshold = threshold; }
+        { _core.SetThreshold(threshold); }
     int GetThreshold()
-        { return _threshold; }
+        { return _core.GetThreshold(); }
     int GetAutoThreshold()
-        { return _autoThreshold; }
+        { return _core.GetAutoThreshold(); }
+    void SetTone(const ToneParams* tone)
+        { _core.SetTone(tone); }
+    void GetTone(ToneParams* tone)
+        { _core.GetTone(tone); }
+    void SetLumaModel(LumaModel model)
+        { _core.SetLumaModel(model); }
+    LumaModel GetLumaModel()
+        { return _core.GetLumaModel(); }
+    void SetOutputMode(OutputMode mode)
+        { _core.SetOutputMode(mode); }
+    OutputMode GetOutputMode()
+        { return _core.GetOutputMode(); }
+    void SetFilter(const FilterParams* params)
+        { _core.SetFilter(params); }
+    void GetFilter(FilterParams* params)
+        { _core.GetFilter(params); }
+    // SetBypass: passes the samples on as they are (no copy, no
+    //   transform) or not, from the next frame on. Filtaa can stay
+    //   in the graph while it is not wanted. Can be called from any
+    //   thread.
+    void SetBypass(BOOL bypass);
+    BOOL IsBypassing()
+        { return _bypass.load(std::memory_order_relaxed)? TRUE : FALSE; }
+    // GetSwitchLatency: returns the nanoseconds from the last switch
+    //   of SetBypass() to the first frame passed on after it, or 0.
+    uint64_t GetSwitchLatency()
+        { return _switchLatency.load(std::memory_order_relaxed); }
+    HRESULT StartRecording(const char* path);
+    // StopRecording: returns E_FAIL if the file could not be
+    //   written completely.
+    HRESULT StopRecording();
+    BOOL IsRecording();
+    // IsRecordingFailed: checks if a write of the recording failed.
+    BOOL IsRecordingFailed();
+    HRESULT SaveSnapshot(const char* path);
+    HRESULT StartSharing(const char* name);
+    HRESULT StopSharing();
+    BOOL IsSharing();
+    HRESULT StartServing(int port);
+    HRESULT StopServing();
+    BOOL IsServing();
+    uint64_t GetSnapshotCopyTime();
+    // GetStageStats: returns the timings of a stage since the input
+    //   was connected or ResetStageStats(), or FALSE when the timers
+    //   are compiled out. Can be called from any thread.
+    BOOL GetStageStats(Stage stage, StageStats* stats)
+        { return _timers.GetStats(stage, stats)? TRUE : FALSE; }
+    void ResetStageStats()
+        { _timers.Reset(); }
+    // GetFrameTiming: returns how late the samples were against the
+    //   graph clock when received and when passed on, their jitter
+    //   and the gaps in them, or FALSE when compiled out.
+    BOOL GetFrameTiming(FrameTimingStats* stats)
+        { return _frameTiming.GetStats(stats)? TRUE : FALSE; }
+    // GetQuality: returns how much work is being shed.
+    QualityLevel GetQuality()
+        { return _core.GetQuality(); }
+    // GetStats: takes the counters since the input was connected.
+    //   The streaming thread only does relaxed stores to them, so
+    //   this never makes it wait.
+    void GetStats(FiltaaStats* stats);
 
     // Helper Methods (for internal use)
     const AM_MEDIA_TYPE* GetMediaType();
@@ -95,6 +197,7 @@ public:
     HRESULT EndFlush();
     HRESULT EndOfStream();
     HRESULT NewSegment(REFERENCE_TIME tStart, REFERENCE_TIME tStop, double dRate);
+    HRESULT NotifyQuality(const Quality* q);
 
     HRESULT GetAllocatorRequirements(ALLOCATOR_PROPERTIES* pProp);
     HRESULT GetAllocator(IMemAllocator** ppAllocator);
@@ -0,0 +1,696 @@
+// -*- tab-width: 4; mode: c++ -*-
+//  FiltaaCore.cpp
+//
+
+#include <math.h>
+#include <string.h>
+#include "FiltaaCore.h"
+#include "Clahe.h"
+#include "Ink.h"
+#include "TraceLog.h"
+
+//  Constants
+//
+// The gray mode stretches these percentiles to black and white.
+static const int LEVELS_LOW_PERMILLE = 10;
+static const int LEVELS_HIGH_PERMILLE = 990;
+static const int LEVELS_MIN_RANGE = 32;
+// QUALITY_KEEP_THRESHOLD takes the automatic threshold this often.
+static const int OTSU_INTERVAL = 8;
+// QUALITY_SAMPLED_HISTOGRAM counts one row in 4.
+static const int SAMPLED_HIST_MASK = 3;
+
+
+int getAutoThreshold(const uint32_t* hist)
+{
+    uint64_t total = 0, sum = 0;
+    for (int i = 0; i < 256; i++) {
+        total += hist[i];
+        sum += (uint64_t)i*hist[i];
+    }
+
+    uint64_t wb = 0, sb = 0;
+    double max = 0;
+    int threshold = 0;
+    for (int i = 0; i < 256; i++) {
+        wb += hist[i];
+        if (wb == 0) continue;
+        uint64_t wf = total - wb;
+        if (wf == 0) break;
+        sb += (uint64_t)i*hist[i];
+        uint64_t sf = sum - sb;
+        // Note: these values can easily exceed 2^32.
+        double mb = (double)sb/(double)wb;
+        double mf = (double)sf/(double)wf;
+        double v = (double)wb*(double)wf*(mb-mf)*(mb-mf);
+        if (max < v) {
+            max = v;
+            // Values up to i belong to the dark class.
+            threshold = i+1;
+        }
+    }
+
+    return threshold;
+}
+
+static const char* LUMA_MODEL_NAMES[LUMA_MODELS] = {
+    "bt601", "bt709", "green", "max",
+};
+
+const char* getLumaModelName(LumaModel model)
+{
+    return (0 <= model && model < LUMA_MODELS)? LUMA_MODEL_NAMES[model] : "";
+}
+
+int findLumaModel(const char* name)
+{
+    for (int i = 0; i < LUMA_MODELS; i++) {
+        if (strcmp(name, LUMA_MODEL_NAMES[i]) == 0) return i;
+    }
+    return -1;
+}
+
+// countLuma: the histogram loop of one model.
+template <class Luma>
+static void countLuma(
+    uint32_t* hist, const uint8_t* src, size_t stride,
+    int width, int height)
+{
+    memset(hist, 0, sizeof(uint32_t)*256);
+    for (int y = 0; y < height; y++) {
+        const uint8_t* p = src + stride*y;
+        for (int x = 0; x < width; x++) {
+            hist[Luma::Get(p)]++;
+            p += 3;
+        }
+    }
+}
+
+void getHistogram(
+    uint32_t* hist, const uint8_t* src, size_t stride,
+    int width, int height, LumaModel model)
+{
+    switch (model) {
+    case LUMA_BT709:
+        countLuma<LumaBT709>(hist, src, stride, width, height);
+        break;
+    case LUMA_GREEN:
+        countLuma<LumaGreen>(hist, src, stride, width, height);
+        break;
+    case LUMA_MAX:
+        countLuma<LumaMax>(hist, src, stride, width, height);
+        break;
+    default:
+        countLuma<LumaBT601>(hist, src, stride, width, height);
+        break;
+    }
+}
+
+void initToneParams(ToneParams* tone)
+{
+    tone->black = 0;
+    tone->white = 255;
+    tone->gamma = 100;
+    tone->contrast = 0;
+    tone->brightness = 0;
+}
+
+bool isToneIdentity(const ToneParams* tone)
+{
+    return (tone->black == 0 && tone->white == 255 &&
+            tone->gamma == 100 && tone->contrast == 0 &&
+            tone->brightness == 0);
+}
+
+void buildToneLut(uint8_t* lut, const ToneParams* tone)
+{
+    int black = (tone->black < 0)? 0 : (254 < tone->black)? 254 : tone->black;
+    int white = (tone->white <= black)? black+1 : (255 < tone->white)? 255 : tone->white;
+    double gamma = (tone->gamma < 10)? 0.1 : tone->gamma / 100.0;
+    int contrast = (tone->contrast < -100)? -100 : (100 < tone->contrast)? 100 : tone->contrast;
+    for (int i = 0; i < 256; i++) {
+        double v = (double)(i - black) / (white - black);
+        v = (v < 0)? 0 : (1 < v)? 1 : v;
+        v = pow(v, 1.0/gamma) * 255.0;
+        v = (v - 128.0) * (100 + contrast) / 100.0 + 128.0;
+        v += tone->brightness;
+        int x = (int)floor(v + 0.5);
+        lut[i] = (uint8_t)((x < 0)? 0 : (255 < x)? 255 : x);
+    }
+}
+
+int getPercentile(const uint32_t* hist, int permille)
+{
+    uint64_t total = 0;
+    for (int i = 0; i < 256; i++) {
+        total += hist[i];
+    }
+    uint64_t limit = total * permille / 1000;
+    uint64_t n = 0;
+    for (int i = 0; i < 256; i++) {
+        n += hist[i];
+        if (limit < n) return i;
+    }
+    return 255;
+}
+
+
+//  FiltaaParams: a snapshot of the settings of FiltaaCore.
+//
+//  The filters and the palette are configured on the streaming
+//  thread, since they keep state; the serials tell when to.
+//
+struct FiltaaParams
+{
+    int threshold;              // -1 = automatic.
+    LumaModel lumaModel;
+    OutputMode outputMode;
+    uint8_t fgColor[3];
+    uint8_t bgColor[3];
+    ToneParams tone;
+    FilterParams filter;
+    uint32_t filterSerial;
+    InkPalette palette;
+    uint32_t paletteSerial;
+
+    // Built from the tone by buildDerived().
+    uint8_t toneLut[256];
+    uint16_t rawThresholds[257];    // by toned threshold.
+};
+
+// initParams: the settings that change nothing, in B/W.
+static void initParams(FiltaaParams* params)
+{
+    static const uint8_t BLACK[3] = {0,0,0};
+    static const uint8_t WHITE[3] = {255,255,255};
+    params->threshold = -1;
+    params->lumaModel = LUMA_BT601;
+    params->outputMode = OUTPUT_BW;
+    memcpy(params->fgColor, BLACK, 3);
+    memcpy(params->bgColor, WHITE, 3);
+    initToneParams(&params->tone);
+    initFilterParams(&params->filter);
+    params->filterSerial = 0;
+    initInkPalette(&params->palette);
+    params->paletteSerial = 0;
+}
+
+// buildDerived: builds the tables of a snapshot. Since the tone
+//   table is nondecreasing, the raw threshold of a toned one is the
+//   first raw level whose toned value reaches it.
+static void buildDerived(FiltaaParams* params)
+{
+    buildToneLut(params->toneLut, &params->tone);
+    int raw = 0;
+    for (int t = 0; t <= 256; t++) {
+        while (raw < 256 && params->toneLut[raw] < t) {
+            raw++;
+        }
+        params->rawThresholds[t] = (uint16_t)raw;
+    }
+}
+
+
+//  FiltaaCore
+//
+FiltaaCore::FiltaaCore()
+    : _autoThreshold(128), _lastThreshold(128), _quality(QUALITY_FULL)
+{
+    FiltaaParams params;
+    initParams(&params);
+    buildDerived(&params);
+    _params = new ParamBlock<FiltaaParams>(params);
+    _frame = NULL;
+    _clahe = NULL;
+    _ink = new InkClassifier();
+    _pool = NULL;
+    _timers = NULL;
+    _rowStep = 1;
+    _histMask = 0;
+    _otsu = true;
+    _otsuSkipped = 0;
+    _filterBuilt = 0;
+    _paletteBuilt = 0;
+    memset(_hist, 0, sizeof(_hist));
+    memset(_rawHist, 0, sizeof(_rawHist));
+    Reset();
+}
+
+FiltaaCore::~FiltaaCore()
+{
+    delete _clahe;
+    delete _ink;
+    delete _params;
+}
+
+void FiltaaCore::SetThreshold(int threshold)
+{
+    _params->Update([&](FiltaaParams* params) {
+        params->threshold = threshold;
+    });
+}
+
+int FiltaaCore::GetThreshold()
+{
+    FiltaaParams params;
+    _params->Get(&params);
+    return params.threshold;
+}
+
+void FiltaaCore::SetColors(const uint8_t fg[3], const uint8_t bg[3])
+{
+    _params->Update([&](FiltaaParams* params) {
+        memcpy(params->fgColor, fg, 3);
+        memcpy(params->bgColor, bg, 3);
+    });
+}
+
+void FiltaaCore::SetLumaModel(LumaModel model)
+{
+    _params->Update([&](FiltaaParams* params) {
+        params->lumaModel = model;
+    });
+}
+
+LumaModel FiltaaCore::GetLumaModel()
+{
+    FiltaaParams params;
+    _params->Get(&params);
+    return params.lumaModel;
+}
+
+void FiltaaCore::SetOutputMode(OutputMode mode)
+{
+    _params->Update([&](FiltaaParams* params) {
+        params->outputMode = mode;
+    });
+}
+
+OutputMode FiltaaCore::GetOutputMode()
+{
+    FiltaaParams params;
+    _params->Get(&params);
+    return params.outputMode;
+}
+
+void FiltaaCore::Reset()
+{
+    _autoThreshold.store(128, std::memory_order_relaxed);
+    _lastThreshold.store(128, std::memory_order_relaxed);
+    _levelsLow = 0;
+    _levelsHigh = 255;
+    if (_clahe != NULL) {
+        _clahe->Reset();
+    }
+    _ink->Reset();
+    _temporal.Reset();
+}
+
+void FiltaaCore::SetInkPalette(const InkPalette* palette)
+{
+    _params->Update([&](FiltaaParams* params) {
+        params->palette = *palette;
+        params->paletteSerial++;
+    });
+}
+
+void FiltaaCore::GetInkPalette(InkPalette* palette)
+{
+    FiltaaParams params;
+    _params->Get(&params);
+    *palette = params.palette;
+}
+
+bool FiltaaCore::Setup(int width, int height)
+{
+    if (_clahe == NULL) {
+        _clahe = new Clahe();
+    }
+    if (!_clahe->Setup(width, height)) return false;
+    if (!_temporal.Setup(width, height)) return false;
+    if (!_median.Setup(width)) return false;
+    if (!_filter.Setup(width)) return false;
+    _lumaRow.resize(width);
+    return true;
+}
+
+void FiltaaCore::SetFilter(const FilterParams* filter)
+{
+    _params->Update([&](FiltaaParams* params) {
+        params->filter = *filter;
+        params->filterSerial++;
+    });
+}
+
+void FiltaaCore::GetFilter(FilterParams* filter)
+{
+    FiltaaParams params;
+    _params->Get(&params);
+    *filter = params.filter;
+}
+
+// UseTemporal: checks if the frames are averaged.
+bool FiltaaCore::UseTemporal(int width, int height)
+{
+    return (_temporal.IsActive() &&
+            _temporal.GetWidth() == width && _temporal.GetHeight() == height);
+}
+
+// UseClahe: checks if a frame goes through the CLAHE mode.
+bool FiltaaCore::UseClahe(int width, int height)
+{
+    return (_frame->outputMode == OUTPUT_CLAHE && _clahe != NULL &&
+            _clahe->GetWidth() == width && _clahe->GetHeight() == height);
+}
+
+void FiltaaCore::SetTone(const ToneParams* tone)
+{
+    _params->Update([&](FiltaaParams* params) {
+        params->tone = *tone;
+        buildDerived(params);
+    });
+}
+
+void FiltaaCore::GetTone(ToneParams* tone)
+{
+    FiltaaParams params;
+    _params->Get(&params);
+    *tone = params.tone;
+}
+
+// Apply: configure the filters and the palette from the snapshot
+//   of the frame, if they have changed.
+void FiltaaCore::Apply()
+{
+    if (_frame->filterSerial != _filterBuilt) {
+        const FilterParams* filter = &_frame->filter;
+        _temporal.Configure(filter->temporal, filter->motion);
+        _median.Configure(filter->median);
+        _filter.Configure(filter);
+        _filterBuilt = _frame->filterSerial;
+    }
+    if (_frame->paletteSerial != _paletteBuilt) {
+        _ink->SetPalette(&_frame->palette);
+        _paletteBuilt = _frame->paletteSerial;
+    }
+}
+
+// FinishHistogram: map the raw histogram through the tone table
+//   and compute the next automatic threshold.
+void FiltaaCore::FinishHistogram()
+{
+    const uint8_t* toneLut = _frame->toneLut;
+    memset(_hist, 0, sizeof(_hist));
+    for (int i = 0; i < 256; i++) {
+        _hist[toneLut[i]] += _rawHist[i];
+    }
+    if (_otsu) {
+        StageScope scope(_timers, STAGE_OTSU);
+        _autoThreshold.store(getAutoThreshold(_hist), std::memory_order_relaxed);
+    }
+    _levelsLow = getPercentile(_hist, LEVELS_LOW_PERMILLE);
+    _levelsHigh = getPercentile(_hist, LEVELS_HIGH_PERMILLE);
+}
+
+// UpdateGrayLut: merge the tone table and the stretch.
+void FiltaaCore::UpdateGrayLut()
+{
+    int low = _levelsLow;
+    int range = _levelsHigh - low;
+    if (range < LEVELS_MIN_RANGE) {
+        // A blank frame: do not blow up the noise.
+        low = (low + _levelsHigh - LEVELS_MIN_RANGE) / 2;
+        range = LEVELS_MIN_RANGE;
+    }
+    const uint8_t* toneLut = _frame->toneLut;
+    for (int i = 0; i < 256; i++) {
+        int v = ((toneLut[i] - low) * 255 + range/2) / range;
+        _grayLut[i] = (uint8_t)((v < 0)? 0 : (255 < v)? 255 : v);
+    }
+}
+
+// GetRawThreshold: returns the first raw level whose toned value
+//   is not ink.
+int FiltaaCore::GetRawThreshold(int threshold)
+{
+    threshold = (threshold < 0)? 0 : (256 < threshold)? 256 : threshold;
+    return _frame->rawThresholds[threshold];
+}
+
+void FiltaaCore::Prime(const uint8_t* src, size_t stride, int width, int height)
+{
+    ParamScope<FiltaaParams> params(_params);
+    _frame = params.Get();
+    Apply();
+    LumaModel model = _frame->lumaModel;
+    if (UseClahe(width, height)) {
+        _clahe->Process(model, _frame->toneLut, src, stride, NULL, 0,
+                        NULL, 0, 0, _rawHist, _pool);
+    } else {
+        getHistogram(_rawHist, src, stride, width, height, model);
+    }
+    _otsu = true;
+    FinishHistogram();
+    if (_frame->outputMode == OUTPUT_INK) {
+        // Take the chroma of the board with the new threshold.
+        int threshold = (0 <= _frame->threshold)? _frame->threshold : GetAutoThreshold();
+        _ink->Process(model, GetRawThreshold(threshold),
+                      src, stride, NULL, 0, width, height, NULL, 0,
+                      _rawHist, _pool);
+    }
+}
+
+void FiltaaCore::Process(
+    const uint8_t* src, size_t srcStride,
+    uint8_t* dst, size_t dstStride,
+    int width, int height,
+    uint8_t* bits, ptrdiff_t bitsStride)
+{
+    ParamScope<FiltaaParams> params(_params);
+    _frame = params.Get();
+    Apply();
+    int threshold = (0 <= _frame->threshold)? _frame->threshold : GetAutoThreshold();
+    _lastThreshold.store(threshold, std::memory_order_relaxed);
+
+    int rawThreshold = GetRawThreshold(threshold);
+
+    int quality = GetQuality();
+    _rowStep = (QUALITY_HALF_HEIGHT <= quality)? 2 : 1;
+    _histMask = (QUALITY_SAMPLED_HISTOGRAM <= quality)? SAMPLED_HIST_MASK : 0;
+    _otsu = true;
+    if (QUALITY_KEEP_THRESHOLD <= quality) {
+        _otsu = (++_otsuSkipped % OTSU_INTERVAL == 0);
+    }
+
+    typedef void (FiltaaCore::*RowsFunc)(
+        const uint8_t*, size_t, uint8_t*, size_t, int, int,
+        uint8_t*, ptrdiff_t, int);
+    static const RowsFunc KERNELS[2][LUMA_MODELS] = {
+        { &FiltaaCore::ProcessRows<LumaBT601, false>,
+          &FiltaaCore::ProcessRows<LumaBT709, false>,
+          &FiltaaCore::ProcessRows<LumaGreen, false>,
+          &FiltaaCore::ProcessRows<LumaMax, false> },
+        { &FiltaaCore::ProcessRows<LumaBT601, true>,
+          &FiltaaCore::ProcessRows<LumaBT709, true>,
+          &FiltaaCore::ProcessRows<LumaGreen, true>,
+          &FiltaaCore::ProcessRows<LumaMax, true> },
+    };
+
+    int model = _frame->lumaModel;
+    OutputMode mode = _frame->outputMode;
+    if (UseClahe(width, height)) {
+        {
+            TraceScope scope("clahe");
+            _clahe->Process((LumaModel)model, _frame->toneLut, src, srcStride,
+                            dst, dstStride, bits, bitsStride, rawThreshold,
+                            _rawHist, _pool);
+        }
+        FinishHistogram();
+        return;
+    }
+    if (mode == OUTPUT_INK) {
+        {
+            TraceScope scope("ink");
+            _ink->Process((LumaModel)model, rawThreshold, src, srcStride,
+                          dst, dstStride, width, height, bits, bitsStride,
+                          _rawHist, _pool);
+        }
+        FinishHistogram();
+        return;
+    }
+    bool gray = (mode != OUTPUT_BW);
+    if (gray) {
+        UpdateGrayLut();
+    }
+    static const RowsFunc FILTERED[2][LUMA_MODELS] = {
+        { &FiltaaCore::ProcessFiltered<LumaBT601, false>,
+          &FiltaaCore::ProcessFiltered<LumaBT709, false>,
+          &FiltaaCore::ProcessFiltered<LumaGreen, false>,
+          &FiltaaCore::ProcessFiltered<LumaMax, false> },
+        { &FiltaaCore::ProcessFiltered<LumaBT601, true>,
+          &FiltaaCore::ProcessFiltered<LumaBT709, true>,
+          &FiltaaCore::ProcessFiltered<LumaGreen, true>,
+          &FiltaaCore::ProcessFiltered<LumaMax, true> },
+    };
+    bool filtered = ((UseTemporal(width, height) || _median.IsActive() ||
+                      _filter.IsActive()) && _filter.GetWidth() == width);
+    RowsFunc rows = (filtered? FILTERED : KERNELS)[gray][
+        (0 <= model && model < LUMA_MODELS)? model : 0];
+    {
+        TraceScope scope(filtered? "filtered rows" : "rows");
+        (this->*rows)(src, srcStride, dst, dstStride, width, height,
+                      bits, bitsStride, rawThreshold);
+    }
+    FinishHistogram();
+}
+
+// doubleRow: copies row y of the output (and the bits) over the
+//   next row, for the half height.
+static inline void doubleRow(
+    uint8_t* dst, size_t dstStride, int y, int width,
+    uint8_t* bits, ptrdiff_t bitsStride)
+{
+    memcpy(dst + dstStride*(y+1), dst + dstStride*y, (size_t)width*3);
+    if (bits != NULL) {
+        memcpy(bits + bitsStride*(y+1), bits + bitsStride*y, (width+7) >> 3);
+    }
+}
+
+// ProcessRows: the pixel loop of Process() for one luma model
+//   and output mode. It is scalar, gray included: the gray table
+//   has 256 arbitrary entries (the tone curve), which SSE2 cannot
+//   look up without a gather, and a pixel is one load from it.
+template <class Luma, bool Gray>
+void FiltaaCore::ProcessRows(
+    const uint8_t* src, size_t srcStride,
+    uint8_t* dst, size_t dstStride,
+    int width, int height,
+    uint8_t* bits, ptrdiff_t bitsStride, int rawThreshold)
+{
+    size_t rowbytes = (width+7) >> 3;
+    int step = _rowStep;
+    const uint8_t* fg = _frame->fgColor;
+    const uint8_t* bg = _frame->bgColor;
+    memset(_rawHist, 0, sizeof(_rawHist));
+    for (int y = 0; y < height; y += step) {
+        const uint8_t* p = src + srcStride*y;
+        uint8_t* q = dst + dstStride*y;
+        uint8_t* row = NULL;
+        if (bits != NULL) {
+            row = bits + bitsStride*y;
+            memset(row, 0, rowbytes);
+        }
+        uint32_t* hist = ((y & _histMask) == 0)? _rawHist : NULL;
+        for (int x = 0; x < width; x++) {
+            int lum = Luma::Get(p);
+            if (hist != NULL) {
+                hist[lum]++;
+            }
+            if (Gray) {
+                if (row != NULL && lum < rawThreshold) {
+                    row[x >> 3] |= (0x80 >> (x & 7));
+                }
+                uint8_t v = _grayLut[lum];
+                q[0] = v;
+                q[1] = v;
+                q[2] = v;
+            } else {
+                const uint8_t* c;
+                if (lum < rawThreshold) {
+                    c = fg;
+                    if (row != NULL) {
+                        row[x >> 3] |= (0x80 >> (x & 7));
+                    }
+                } else {
+                    c = bg;
+                }
+                q[0] = c[0];
+                q[1] = c[1];
+                q[2] = c[2];
+            }
+            p += 3;
+            q += 3;
+        }
+        if (1 < step && y+1 < height) {
+            doubleRow(dst, dstStride, y, width, bits, bitsStride);
+        }
+    }
+}
+
+// ProcessFiltered: Process() through the filters. The luma of each
+//   row is put in a buffer, averaged with the previous frames there,
+//   goes through the median and then the blur, and the rows coming
+//   out are written like in ProcessRows().
+template <class Luma, bool Gray>
+void FiltaaCore::ProcessFiltered(
+    const uint8_t* src, size_t srcStride,
+    uint8_t* dst, size_t dstStride,
+    int width, int height,
+    uint8_t* bits, ptrdiff_t bitsStride, int rawThreshold)
+{
+    size_t rowbytes = (width+7) >> 3;
+    int step = _rowStep;
+    const uint8_t* fg = _frame->fgColor;
+    const uint8_t* bg = _frame->bgColor;
+    memset(_rawHist, 0, sizeof(_rawHist));
+    int y = 0;
+    auto put = [&](const uint8_t* lum) {
+        uint8_t* q = dst + dstStride*y;
+        uint8_t* row = NULL;
+        if (bits != NULL) {
+            row = bits + bitsStride*y;
+            memset(row, 0, rowbytes);
+        }
+        uint32_t* hist = ((y & _histMask) == 0)? _rawHist : NULL;
+        for (int x = 0; x < width; x++) {
+            int v = lum[x];
+            if (hist != NULL) {
+                hist[v]++;
+            }
+            if (row != NULL && v < rawThreshold) {
+                row[x >> 3] |= (0x80 >> (x & 7));
+            }
+            const uint8_t* c;
+            uint8_t g[3];
+            if (Gray) {
+                g[0] = g[1] = g[2] = _grayLut[v];
+                c = g;
+            } else {
+                c = (v < rawThreshold)? fg : bg;
+            }
+            q[0] = c[0];
+            q[1] = c[1];
+            q[2] = c[2];
+            q += 3;
+        }
+        if (1 < step && y+1 < height) {
+            doubleRow(dst, dstStride, y, width, bits, bitsStride);
+        }
+        y += step;
+    };
+
+    auto blur = [&](const uint8_t* lum) {
+        _filter.Push(lum, put);
+    };
+
+    uint8_t* lum = &_lumaRow[0];
+    bool temporal = UseTemporal(width, height);
+    _median.Begin();
+    _filter.Begin();
+    for (int i = 0; i < height; i += step) {
+        const uint8_t* p = src + srcStride*i;
+        for (int x = 0; x < width; x++) {
+            lum[x] = (uint8_t)Luma::Get(p);
+            p += 3;
+        }
+        if (temporal) {
+            _temporal.Blend(lum, i);
+        }
+        _median.Push(lum, blur);
+    }
+    if (temporal) {
+        _temporal.End();
+    }
+    _median.Finish(blur);
+    _filter.Finish(put);
+}
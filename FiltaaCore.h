@@ -0,0 +1,275 @@
+// -*- tab-width: 4; mode: c++ -*-
+//  FiltaaCore.h
+//
+//  The portable image processing part of Filtaa.
+//  Pixels are 24-bit in B, G, R order (as RGBTRIPLE).
+//
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+#include "LumaFilter.h"
+#include "MedianFilter.h"
+#include "ParamBlock.h"
+#include "QualityControl.h"
+#include "StageTimer.h"
+#include "TemporalFilter.h"
+
+class Clahe;
+class InkClassifier;
+struct InkPalette;
+struct FiltaaParams;
+class ThreadPool;
+
+//  Luma models: policies turning a B,G,R pixel into 0..255.
+//
+//  The pixel loops are templates instantiated once per model,
+//  so the model is chosen per frame and never per pixel.
+//
+enum LumaModel {
+    LUMA_BT601,                 // SD video weights (the default).
+    LUMA_BT709,                 // HD video weights.
+    LUMA_GREEN,                 // green channel only.
+    LUMA_MAX,                   // the brightest channel.
+    LUMA_MODELS
+};
+
+struct LumaBT601
+{
+    static int Get(const uint8_t* p)
+        { return (p[2]*76 + p[1]*150 + p[0]*30) >> 8; }
+};
+
+struct LumaBT709
+{
+    static int Get(const uint8_t* p)
+        { return (p[2]*54 + p[1]*183 + p[0]*19) >> 8; }
+};
+
+// LumaGreen: blue and red ink both come out dark.
+struct LumaGreen
+{
+    static int Get(const uint8_t* p)
+        { return p[1]; }
+};
+
+// LumaMax: any colored ink on white counts, as long as it is not
+//   bright in every channel.
+struct LumaMax
+{
+    static int Get(const uint8_t* p)
+        {
+            int v = (p[0] < p[1])? p[1] : p[0];
+            return (v < p[2])? p[2] : v;
+        }
+};
+
+// getLuma: get the luminance value for a B,G,R pixel.
+static inline int getLuma(const uint8_t* p)
+{
+    return LumaBT601::Get(p);
+}
+
+// getLumaModelName: returns a short name such as "bt601".
+const char* getLumaModelName(LumaModel model);
+
+// findLumaModel: returns the model of a name, or -1.
+int findLumaModel(const char* name);
+
+// getAutoThreshold: calculate the B/W threshold with the Otsu's method.
+int getAutoThreshold(const uint32_t* hist);
+
+// getHistogram: count the luma values of an image.
+void getHistogram(
+    uint32_t* hist, const uint8_t* src, size_t stride,
+    int width, int height, LumaModel model=LUMA_BT601);
+
+
+//  ToneParams: grayscale controls applied to luma before the threshold.
+//
+//  The input levels black..white are stretched to 0..255, then
+//  gamma, contrast and brightness are applied in this order.
+//  Every step is monotonic, so the whole stage is a nondecreasing
+//  256-entry table.
+//
+struct ToneParams
+{
+    int black;                  // input level that becomes 0.
+    int white;                  // input level that becomes 255.
+    int gamma;                  // in percent; 100 is linear, more is brighter.
+    int contrast;               // in percent around mid gray (-100 to 100).
+    int brightness;             // added to the output (-255 to 255).
+};
+
+// initToneParams: set the parameters that change nothing.
+void initToneParams(ToneParams* tone);
+
+// isToneIdentity: checks if the parameters change nothing.
+bool isToneIdentity(const ToneParams* tone);
+
+// buildToneLut: compile the parameters into a table.
+void buildToneLut(uint8_t* lut, const ToneParams* tone);
+
+// getPercentile: returns the level below which there are
+//   permille/1000 of the pixels.
+int getPercentile(const uint32_t* hist, int permille);
+
+
+//  OutputMode: what Process() writes.
+//
+enum OutputMode {
+    OUTPUT_BW,                  // the foreground/background colors.
+    OUTPUT_GRAY,                // gray, stretched between percentiles.
+    OUTPUT_CLAHE,               // gray, equalized per tile (see Clahe).
+    OUTPUT_INK,                 // board and ink colors (see InkClassifier).
+};
+
+
+//  FiltaaCore: thresholds frames.
+//
+//  The automatic threshold of a frame is taken from the histogram
+//  of the previous frame, so each frame is processed in one pass.
+//  Call Prime() first for a still image.
+//
+//  The tone stage is folded into that pass at no per-pixel cost:
+//  since the tone table is nondecreasing, comparing the toned luma
+//  with the threshold is the same as comparing the raw luma with
+//  the first level whose toned value reaches it. The histogram of
+//  the raw luma is mapped through the table once per frame.
+//
+//  In the gray mode, the low and high percentiles of the previous
+//  frame are stretched to black and white. The tone table and the
+//  stretch are merged into one table of the raw luma, so a pixel
+//  still costs one lookup. The B/W bits are packed as usual.
+//
+//  The CLAHE mode needs Setup() for the frame size, and runs on
+//  the pool given by SetPool(); otherwise it falls back to gray.
+//  The ink mode runs on the pool too.
+//
+//  With SetFilter(), the luma is averaged over frames, denoised,
+//  blurred or sharpened before the B/W and gray modes. The frame
+//  average needs Setup() for the frame size. The filtered luma
+//  comes out a few rows behind, which is why src and dst can still
+//  be the same.
+//
+//  SetQuality() trades accuracy for time (see QualityLevel). The
+//  half height applies to the B/W and gray modes; the CLAHE and ink
+//  modes only keep the threshold.
+//
+//  The settings can be changed from another thread at any time.
+//  Each change publishes a new snapshot of them (see ParamBlock),
+//  with the tone table and the raw thresholds built there and not
+//  while streaming; Prime() and Process() take the latest snapshot
+//  once and use it for the whole frame.
+//
+class FiltaaCore
+{
+private:
+    ParamBlock<FiltaaParams>* _params;
+    const FiltaaParams* _frame;     // of the frame being processed.
+    std::atomic<int> _autoThreshold;
+    std::atomic<int> _lastThreshold;
+    uint32_t _hist[256];        // of the toned luma.
+    uint32_t _rawHist[256];
+    int _levelsLow;             // stretch of the gray mode.
+    int _levelsHigh;
+    uint8_t _grayLut[256];      // raw luma to stretched gray.
+    Clahe* _clahe;
+    TemporalFilter _temporal;
+    MedianFilter _median;
+    LumaFilter _filter;
+    std::vector<uint8_t> _lumaRow;
+    uint32_t _filterBuilt;
+    uint32_t _paletteBuilt;
+    InkClassifier* _ink;
+    ThreadPool* _pool;
+    StageTimers* _timers;
+
+    // Set from _quality for each frame.
+    std::atomic<int> _quality;
+    int _rowStep;               // 1 or 2.
+    int _histMask;              // rows y with (y & mask) == 0 are counted.
+    bool _otsu;                 // take a new automatic threshold.
+    uint32_t _otsuSkipped;
+
+    void Apply();
+    void FinishHistogram();
+    void UpdateGrayLut();
+    template <class Luma, bool Gray>
+    void ProcessRows(
+        const uint8_t* src, size_t srcStride,
+        uint8_t* dst, size_t dstStride,
+        int width, int height,
+        uint8_t* bits, ptrdiff_t bitsStride, int rawThreshold);
+    template <class Luma, bool Gray>
+    void ProcessFiltered(
+        const uint8_t* src, size_t srcStride,
+        uint8_t* dst, size_t dstStride,
+        int width, int height,
+        uint8_t* bits, ptrdiff_t bitsStride, int rawThreshold);
+
+    FiltaaCore(const FiltaaCore&);
+    FiltaaCore& operator=(const FiltaaCore&);
+
+    bool UseClahe(int width, int height);
+    bool UseTemporal(int width, int height);
+    int GetRawThreshold(int threshold);
+
+public:
+    FiltaaCore();
+    ~FiltaaCore();
+
+    // SetThreshold: sets the threshold, or -1 for the automatic one.
+    //   Like all the settings, it can be called from another thread
+    //   and takes effect at the next frame.
+    void SetThreshold(int threshold);
+    int GetThreshold();
+    int GetAutoThreshold()
+        { return _autoThreshold.load(std::memory_order_relaxed); }
+    // GetLastThreshold: returns the threshold used by Process().
+    int GetLastThreshold()
+        { return _lastThreshold.load(std::memory_order_relaxed); }
+    void SetColors(const uint8_t fg[3], const uint8_t bg[3]);
+    void SetTone(const ToneParams* tone);
+    void GetTone(ToneParams* tone);
+    void SetLumaModel(LumaModel model);
+    LumaModel GetLumaModel();
+    void SetOutputMode(OutputMode mode);
+    OutputMode GetOutputMode();
+    // Setup: allocates the buffers of the CLAHE mode and the
+    //   filters for a frame size. Not to be called while processing.
+    bool Setup(int width, int height);
+    void SetFilter(const FilterParams* params);
+    void GetFilter(FilterParams* params);
+    void SetInkPalette(const InkPalette* palette);
+    void GetInkPalette(InkPalette* palette);
+    // SetPool: sets the threads for the CLAHE and ink modes, or NULL.
+    void SetPool(ThreadPool* pool)
+        { _pool = pool; }
+    // SetTimers: sets where the automatic threshold is timed, or NULL.
+    void SetTimers(StageTimers* timers)
+        { _timers = timers; }
+    // SetQuality: can be called from another thread, like the settings.
+    void SetQuality(QualityLevel level)
+        { _quality.store(level, std::memory_order_relaxed); }
+    QualityLevel GetQuality()
+        { return (QualityLevel)_quality.load(std::memory_order_relaxed); }
+    // GetHistogram: returns the histogram of the last frame (toned).
+    const uint32_t* GetHistogram()
+        { return _hist; }
+
+    // Reset: forget the previous frame.
+    void Reset();
+    // Prime: compute the automatic threshold from a frame.
+    void Prime(const uint8_t* src, size_t stride, int width, int height);
+    // Process: threshold src into dst (which can be the same).
+    //   When bits is not NULL, the B/W result is also packed there,
+    //   MSB first, with bitsStride bytes between rows.
+    void Process(
+        const uint8_t* src, size_t srcStride,
+        uint8_t* dst, size_t dstStride,
+        int width, int height,
+        uint8_t* bits=NULL, ptrdiff_t bitsStride=0);
+};
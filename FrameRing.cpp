@@ -0,0 +1,392 @@
+// -*- tab-width: 4; mode: c++ -*-
+//  FrameRing.cpp
+//
+
+#ifdef WINDOWS
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include <string.h>
+#include <thread>
+#include "FrameRing.h"
+
+#ifdef WINDOWS
+const char FRAME_RING_NAME[] = "Local\\WebCamooFrames";
+#else
+const char FRAME_RING_NAME[] = "/webcamoo-frames";
+#endif
+
+static const char FRAME_RING_MAGIC[4] = {'W','C','F','R'};
+
+// align64: round up to a cache line.
+static inline size_t align64(size_t x)
+{
+    return (x + 63) & ~(size_t)63;
+}
+
+void summarizeHistogram(FrameInfo* info, const uint32_t* hist, int threshold)
+{
+    uint64_t total = 0, sum = 0, ink = 0;
+    memset(info->hist, 0, sizeof(info->hist));
+    for (int i = 0; i < 256; i++) {
+        total += hist[i];
+        sum += (uint64_t)i*hist[i];
+        if (i < threshold) {
+            ink += hist[i];
+        }
+        info->hist[i >> 4] += hist[i];
+    }
+    info->meanLuma = (uint32_t)((total)? sum/total : 0);
+    info->inkPixels = (uint32_t)ink;
+}
+
+
+//  SharedMemory
+//
+SharedMemory::SharedMemory()
+{
+    _data = NULL;
+    _size = 0;
+    _owner = false;
+#ifdef WINDOWS
+    _mapping = NULL;
+#else
+    _name[0] = 0;
+#endif
+}
+
+SharedMemory::~SharedMemory()
+{
+    Close();
+}
+
+#ifdef WINDOWS
+
+bool SharedMemory::Create(const char* name, size_t size)
+{
+    Close();
+    // If a reader still holds an old region, it is reused;
+    // mapping it fails when it is too small.
+    _mapping = CreateFileMappingA(
+        INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+        (DWORD)((uint64_t)size >> 32), (DWORD)size, name);
+    if (_mapping == NULL) return false;
+    _data = (uint8_t*)MapViewOfFile(_mapping, FILE_MAP_WRITE, 0, 0, size);
+    if (_data == NULL) {
+        Close();
+        return false;
+    }
+    _size = size;
+    _owner = true;
+    return true;
+}
+
+bool SharedMemory::Open(const char* name)
+{
+    Close();
+    _mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, name);
+    if (_mapping == NULL) return false;
+    _data = (uint8_t*)MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0);
+    MEMORY_BASIC_INFORMATION mbi;
+    if (_data == NULL || VirtualQuery(_data, &mbi, sizeof(mbi)) == 0) {
+        Close();
+        return false;
+    }
+    _size = mbi.RegionSize;
+    return true;
+}
+
+void SharedMemory::Close()
+{
+    if (_data != NULL) {
+        UnmapViewOfFile(_data);
+        _data = NULL;
+    }
+    if (_mapping != NULL) {
+        CloseHandle(_mapping);
+        _mapping = NULL;
+    }
+    _size = 0;
+    _owner = false;
+}
+
+#else
+
+bool SharedMemory::Create(const char* name, size_t size)
+{
+    Close();
+    // Readers of an old region keep their mapping until they detach.
+    shm_unlink(name);
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) return false;
+    if (ftruncate(fd, (off_t)size) != 0) {
+        close(fd);
+        shm_unlink(name);
+        return false;
+    }
+    void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        shm_unlink(name);
+        return false;
+    }
+    _data = (uint8_t*)p;
+    _size = size;
+    _owner = true;
+    strncpy(_name, name, sizeof(_name)-1);
+    _name[sizeof(_name)-1] = 0;
+    return true;
+}
+
+bool SharedMemory::Open(const char* name)
+{
+    Close();
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return false;
+    }
+    void* p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) return false;
+    _data = (uint8_t*)p;
+    _size = st.st_size;
+    return true;
+}
+
+void SharedMemory::Close()
+{
+    if (_data != NULL) {
+        munmap(_data, _size);
+        _data = NULL;
+    }
+    if (_owner) {
+        shm_unlink(_name);
+        _owner = false;
+    }
+    _size = 0;
+}
+
+#endif
+
+
+//  FrameRingWriter
+//
+FrameRingWriter::FrameRingWriter()
+    : _open(false), _producing(false)
+{
+    _header = NULL;
+    _width = 0;
+    _height = 0;
+    _written = 0;
+}
+
+FrameRingWriter::~FrameRingWriter()
+{
+    Close();
+}
+
+bool FrameRingWriter::Open(const char* name, int width, int height, int nslots)
+{
+    Close();
+    if (width <= 0 || height <= 0 || nslots < 2) return false;
+
+    size_t stride = (size_t)width * 3;
+    size_t slotSize = align64(align64(sizeof(FrameSlotHeader)) + stride*height);
+    size_t size = align64(sizeof(FrameRingHeader)) + slotSize*nslots;
+    if ((uint32_t)slotSize != slotSize) return false;
+    if (!_shm.Create(name, size)) return false;
+
+    // Publish the magic last.
+    FrameRingHeader* header = (FrameRingHeader*)_shm.GetData();
+    memset(header->magic, 0, 4);
+    std::atomic_thread_fence(std::memory_order_release);
+    header->version = FRAME_RING_VERSION;
+    header->nslots = nslots;
+    header->width = width;
+    header->height = height;
+    header->stride = (uint32_t)stride;
+    header->slotSize = (uint32_t)slotSize;
+#ifdef WINDOWS
+    header->writerPid = GetCurrentProcessId();
+#else
+    header->writerPid = (uint32_t)getpid();
+#endif
+    header->written.store(0);
+    header->closed.store(0);
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(header->magic, FRAME_RING_MAGIC, 4);
+
+    _header = header;
+    _width = width;
+    _height = height;
+    _written = 0;
+    _open.store(true);
+    return true;
+}
+
+void FrameRingWriter::Close()
+{
+    if (_open.load()) {
+        // Stop accepting frames and wait for the streaming thread
+        // to finish the one it is copying, if any.
+        _open.store(false);
+        while (_producing.load()) {
+            std::this_thread::yield();
+        }
+        _header->closed.store(1);
+    }
+    _header = NULL;
+    _shm.Close();
+}
+
+bool FrameRingWriter::Publish(
+    const uint8_t* src, ptrdiff_t srcStride,
+    int width, int height, FrameInfo* info)
+{
+    _producing.store(true);
+    if (!_open.load() || _width != width || _height != height) {
+        _producing.store(false);
+        return false;
+    }
+    uint32_t n = _written;
+    uint8_t* base = _shm.GetData() + align64(sizeof(FrameRingHeader));
+    FrameSlotHeader* slot = (FrameSlotHeader*)
+        (base + (size_t)_header->slotSize * (n % _header->nslots));
+    uint8_t* dst = (uint8_t*)slot + align64(sizeof(FrameSlotHeader));
+
+    uint32_t seq = slot->seq.load(std::memory_order_relaxed);
+    slot->seq.store(seq+1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    info->frame = n;
+    slot->info = *info;
+    size_t rowsize = (size_t)_header->width * 3;
+    for (uint32_t y = 0; y < _header->height; y++) {
+        memcpy(dst + rowsize*y, src + srcStride*(ptrdiff_t)y, rowsize);
+    }
+
+    slot->seq.store(seq+2, std::memory_order_release);
+    _written = n+1;
+    _header->written.store(n+1, std::memory_order_release);
+    _producing.store(false);
+    return true;
+}
+
+
+//  FrameRingReader
+//
+FrameRingReader::FrameRingReader()
+{
+    _header = NULL;
+    _nslots = 0;
+    _width = 0;
+    _height = 0;
+    _stride = 0;
+    _slotSize = 0;
+    _next = 0;
+    _lost = 0;
+}
+
+FrameRingReader::~FrameRingReader()
+{
+    Detach();
+}
+
+bool FrameRingReader::Attach(const char* name)
+{
+    Detach();
+    if (!_shm.Open(name)) return false;
+
+    const FrameRingHeader* header = (const FrameRingHeader*)_shm.GetData();
+    if (_shm.GetSize() < sizeof(FrameRingHeader) ||
+        memcmp(header->magic, FRAME_RING_MAGIC, 4) != 0 ||
+        header->version != FRAME_RING_VERSION ||
+        header->nslots < 2 ||
+        _shm.GetSize() < align64(sizeof(FrameRingHeader)) +
+        (size_t)header->slotSize * header->nslots) {
+        Detach();
+        return false;
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    _header = header;
+    _nslots = header->nslots;
+    _width = header->width;
+    _height = header->height;
+    _stride = header->stride;
+    _slotSize = header->slotSize;
+    if ((size_t)_slotSize < align64(sizeof(FrameSlotHeader)) + (size_t)_stride*_height) {
+        Detach();
+        return false;
+    }
+    uint32_t written = header->written.load(std::memory_order_acquire);
+    _next = (written == 0)? 0 : written-1;
+    _lost = 0;
+    return true;
+}
+
+void FrameRingReader::Detach()
+{
+    _header = NULL;
+    _nslots = _width = _height = _stride = _slotSize = 0;
+    _shm.Close();
+}
+
+bool FrameRingReader::IsClosed()
+{
+    if (_header == NULL) return true;
+    return (_header->closed.load() != 0 ||
+            _header->nslots != _nslots ||
+            _header->slotSize != _slotSize ||
+            _header->stride != _stride ||
+            _header->height != _height);
+}
+
+const FrameSlotHeader* FrameRingReader::GetSlot(uint32_t frame)
+{
+    const uint8_t* base = _shm.GetData() + align64(sizeof(FrameRingHeader));
+    return (const FrameSlotHeader*)
+        (base + (size_t)_slotSize * (frame % _nslots));
+}
+
+bool FrameRingReader::Read(uint8_t* dst, FrameInfo* info)
+{
+    if (IsClosed()) return false;
+    uint32_t nslots = _nslots;
+    size_t size = (size_t)_stride * _height;
+
+    for (;;) {
+        uint32_t written = _header->written.load(std::memory_order_acquire);
+        if (_next == written) return false;
+        // The slot after the newest one may be being rewritten.
+        uint32_t behind = written - _next;
+        if (nslots-1 < behind) {
+            _lost += behind - (nslots-1);
+            _next = written - (nslots-1);
+        }
+
+        const FrameSlotHeader* slot = GetSlot(_next);
+        uint32_t seq0 = slot->seq.load(std::memory_order_acquire);
+        if ((seq0 & 1) == 0) {
+            FrameInfo tmp = slot->info;
+            memcpy(dst, (const uint8_t*)slot + align64(sizeof(FrameSlotHeader)), size);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            uint32_t seq1 = slot->seq.load(std::memory_order_relaxed);
+            if (seq0 == seq1 && tmp.frame == _next) {
+                *info = tmp;
+                _next++;
+                return true;
+            }
+        }
+        // Overwritten while we were looking.
+        _lost++;
+        _next++;
+    }
+}
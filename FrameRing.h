@@ -0,0 +1,185 @@
+// -*- tab-width: 4; mode: c++ -*-
+//  FrameRing.h
+//
+//  Publishing output frames to other processes through shared memory.
+//
+//  Memory layout:
+//    FrameRingHeader
+//    (FrameSlotHeader + pixels) * nslots, each slotSize bytes
+//
+//  Pixels are 24-bit in B, G, R order, top row first, with
+//  stride bytes per row. Each slot is guarded by a sequence
+//  counter (seqlock): the writer makes it odd while it fills the
+//  slot and even again afterwards. A reader copies the slot and
+//  keeps the copy only if the counter was even and unchanged.
+//  The writer never waits for readers; a reader that falls more
+//  than nslots-1 frames behind skips ahead and counts the loss.
+//
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+const uint32_t FRAME_RING_VERSION = 1;
+const int FRAME_RING_SLOTS = 4;
+// The default name of the shared memory.
+extern const char FRAME_RING_NAME[];
+
+struct FrameRingHeader
+{
+    char magic[4];              // "WCFR"
+    uint32_t version;
+    uint32_t nslots;
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;
+    uint32_t slotSize;          // header + pixels, 64-byte aligned.
+    uint32_t writerPid;
+    std::atomic<uint32_t> written;  // frames published so far.
+    std::atomic<uint32_t> closed;   // set when the writer goes away.
+};
+
+//  FrameInfo: per-frame metadata.
+//
+struct FrameInfo
+{
+    uint32_t frame;             // serial number from 0.
+    uint32_t threshold;         // threshold used for the frame.
+    int64_t timestamp;          // in 100ns units.
+    uint32_t meanLuma;          // of the input.
+    uint32_t inkPixels;         // pixels below the threshold.
+    uint32_t hist[16];          // luma histogram in 16 bins.
+};
+
+struct FrameSlotHeader
+{
+    std::atomic<uint32_t> seq;  // odd while being written.
+    uint32_t reserved;
+    FrameInfo info;
+};
+
+// summarizeHistogram: fills the histogram part of FrameInfo.
+void summarizeHistogram(FrameInfo* info, const uint32_t* hist, int threshold);
+
+
+//  SharedMemory: a named shared memory region.
+//
+class SharedMemory
+{
+private:
+    uint8_t* _data;
+    size_t _size;
+    bool _owner;
+#ifdef WINDOWS
+    void* _mapping;
+#else
+    char _name[256];
+#endif
+
+    SharedMemory(const SharedMemory&);
+    SharedMemory& operator=(const SharedMemory&);
+
+public:
+    SharedMemory();
+    ~SharedMemory();
+
+    // Create: creates (or replaces) a region of size bytes.
+    bool Create(const char* name, size_t size);
+    // Open: maps an existing region.
+    bool Open(const char* name);
+    void Close();
+    bool IsOpen()
+        { return _data != NULL; }
+
+    uint8_t* GetData()
+        { return _data; }
+    size_t GetSize()
+        { return _size; }
+};
+
+
+//  FrameRingWriter: the producer side. Publish() never blocks.
+//
+//  Open() and Close() can be called from another thread than
+//  Publish(): Close() stops accepting frames and waits for the one
+//  being copied, if any, before unmapping the ring.
+//
+class FrameRingWriter
+{
+private:
+    SharedMemory _shm;
+    FrameRingHeader* _header;
+    // Set before _open, so only read once it is seen.
+    int _width;
+    int _height;
+    uint32_t _written;
+    std::atomic<bool> _open;
+    std::atomic<bool> _producing;
+
+    FrameRingWriter(const FrameRingWriter&);
+    FrameRingWriter& operator=(const FrameRingWriter&);
+
+public:
+    FrameRingWriter();
+    ~FrameRingWriter();
+
+    bool Open(const char* name, int width, int height,
+              int nslots=FRAME_RING_SLOTS);
+    void Close();
+    bool IsOpen()
+        { return _open.load(); }
+
+    // Publish: copies a frame into the next slot, unless the ring
+    //   is closed or for another frame size.
+    //   srcStride can be negative for a bottom-up bitmap.
+    //   info->frame is filled in here.
+    bool Publish(const uint8_t* src, ptrdiff_t srcStride,
+                 int width, int height, FrameInfo* info);
+};
+
+
+//  FrameRingReader: the consumer side.
+//
+class FrameRingReader
+{
+private:
+    SharedMemory _shm;
+    const FrameRingHeader* _header;
+    // Copied at Attach() so a rewritten header cannot change them.
+    uint32_t _nslots;
+    uint32_t _width;
+    uint32_t _height;
+    uint32_t _stride;
+    uint32_t _slotSize;
+    uint32_t _next;             // next frame to read.
+    uint64_t _lost;
+
+    const FrameSlotHeader* GetSlot(uint32_t frame);
+
+public:
+    FrameRingReader();
+    ~FrameRingReader();
+
+    // Attach: maps the ring; reading starts at the newest frame.
+    bool Attach(const char* name);
+    void Detach();
+    bool IsAttached()
+        { return _header != NULL; }
+    // IsClosed: true when the writer has gone; attach again to
+    //   follow a new writer.
+    bool IsClosed();
+    int GetWidth()
+        { return (int)_width; }
+    int GetHeight()
+        { return (int)_height; }
+    int GetStride()
+        { return (int)_stride; }
+    // GetLost: returns the frames skipped or overwritten so far.
+    uint64_t GetLost()
+        { return _lost; }
+
+    // Read: copies the next frame into dst (GetStride() bytes per row).
+    //   Returns false if there is no new frame yet.
+    bool Read(uint8_t* dst, FrameInfo* info);
+};
@@ -0,0 +1,96 @@
+// -*- tab-width: 4; mode: c++ -*-
+//  FrameTiming.cpp
+//
+
+#include "FrameTiming.h"
+
+//  Constants
+//
+static const int INTERVAL_SHIFT = 3; // estimate over about 8 intervals.
+
+
+#ifndef NO_STAGE_TIMING
+//  FrameTiming
+//
+FrameTiming::FrameTiming()
+{
+    Reset(0);
+}
+
+void FrameTiming::Reset(int64_t interval)
+{
+    _arrival.Reset();
+    _delivery.Reset();
+    _jitter.Reset();
+    _frames.store(0, std::memory_order_relaxed);
+    _untimed.store(0, std::memory_order_relaxed);
+    _early.store(0, std::memory_order_relaxed);
+    _gaps.store(0, std::memory_order_relaxed);
+    _missing.store(0, std::memory_order_relaxed);
+    _interval.store((0 < interval)? interval : 0, std::memory_order_relaxed);
+    _restart.store(false, std::memory_order_relaxed);
+    _nominal = (0 < interval)? interval : 0;
+    _last = 0;
+    _hasLast = false;
+}
+
+void FrameTiming::Arrive(int64_t start, int64_t now, bool discontinuity)
+{
+    _frames.fetch_add(1, std::memory_order_relaxed);
+    int64_t late = now - start;
+    if (late < 0) {
+        _early.fetch_add(1, std::memory_order_relaxed);
+        late = 0;
+    }
+    _arrival.Record((uint64_t)late);
+
+    if (_restart.exchange(false, std::memory_order_acquire) || discontinuity) {
+        _hasLast = false;
+    }
+    int64_t delta = start - _last;
+    if (_hasLast && 0 < delta) {
+        int64_t interval = _interval.load(std::memory_order_relaxed);
+        if (interval == 0) {
+            // The first interval of an unknown rate.
+            interval = delta;
+        } else if (interval*GAP_PERCENT < delta*100) {
+            _gaps.fetch_add(1, std::memory_order_relaxed);
+            _missing.fetch_add(
+                (uint64_t)((delta + interval/2) / interval - 1),
+                std::memory_order_relaxed);
+            // Not a sample of the rate or the jitter.
+            delta = 0;
+        }
+        if (0 < delta) {
+            _jitter.Record((uint64_t)((delta < interval)?
+                                      interval-delta : delta-interval));
+            if (_nominal == 0) {
+                interval += (delta - interval) >> INTERVAL_SHIFT;
+            }
+            _interval.store(interval, std::memory_order_relaxed);
+        }
+    }
+    _last = start;
+    _hasLast = true;
+}
+
+void FrameTiming::Deliver(int64_t start, int64_t now)
+{
+    int64_t late = now - start;
+    _delivery.Record((uint64_t)((0 < late)? late : 0));
+}
+
+bool FrameTiming::GetStats(FrameTimingStats* stats)
+{
+    stats->frames = _frames.load(std::memory_order_relaxed);
+    stats->untimed = _untimed.load(std::memory_order_relaxed);
+    stats->early = _early.load(std::memory_order_relaxed);
+    stats->gaps = _gaps.load(std::memory_order_relaxed);
+    stats->missing = _missing.load(std::memory_order_relaxed);
+    stats->interval = _interval.load(std::memory_order_relaxed);
+    _arrival.GetStats(&stats->arrival);
+    _delivery.GetStats(&stats->delivery);
+    _jitter.GetStats(&stats->jitter);
+    return true;
+}
+#endif
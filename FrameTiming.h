@@ -0,0 +1,105 @@
+// -*- tab-width: 4; mode: c++ -*-
+//  FrameTiming.h
+//
+//  Comparing the time stamps of the frames with the clock.
+//
+//  Compiles out with -DNO_STAGE_TIMING, like the stage timers.
+//
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include "StageTimer.h"
+
+//  FrameTimingStats: in nanoseconds.
+//
+struct FrameTimingStats
+{
+    uint64_t frames;            // time-stamped frames.
+    uint64_t untimed;           // frames without a time stamp.
+    uint64_t early;             // frames that came before their time.
+    uint64_t gaps;              // breaks in the frame times.
+    uint64_t missing;           // frames that would fill the breaks.
+    int64_t interval;           // nominal (or estimated) frame interval.
+    StageStats arrival;         // lateness when received.
+    StageStats delivery;        // lateness when passed on.
+    StageStats jitter;          // distance of each interval from interval.
+};
+
+
+//  FrameTiming
+//
+//  The lateness of a frame is the stream time minus its start time:
+//  when it arrives, that is the capture latency; when it is passed
+//  on, the processing is added. Consecutive start times give the
+//  jitter, and an interval longer than GAP_PERCENT of the nominal
+//  one is a gap where the capture driver lost frames.
+//
+//  The times are given, not read, so a simulated clock can be used.
+//  Arrive() and Deliver() are called by one thread; Restart() and
+//  GetStats() can be called from any thread.
+//
+class FrameTiming
+{
+public:
+    static const int GAP_PERCENT = 150;
+
+private:
+#ifndef NO_STAGE_TIMING
+    LatencyHistogram _arrival;
+    LatencyHistogram _delivery;
+    LatencyHistogram _jitter;
+    std::atomic<uint64_t> _frames;
+    std::atomic<uint64_t> _untimed;
+    std::atomic<uint64_t> _early;
+    std::atomic<uint64_t> _gaps;
+    std::atomic<uint64_t> _missing;
+    std::atomic<int64_t> _interval;
+    std::atomic<bool> _restart;
+    int64_t _nominal;           // 0 = estimate it.
+    int64_t _last;              // start of the previous frame.
+    bool _hasLast;
+#endif
+
+    FrameTiming(const FrameTiming&);
+    FrameTiming& operator=(const FrameTiming&);
+
+public:
+#ifndef NO_STAGE_TIMING
+    FrameTiming();
+
+    // Reset: clears the counts and sets the nominal interval
+    //   (0 = unknown). Not while frames are coming.
+    void Reset(int64_t interval);
+    // Restart: forgets the previous frame, as after a seek or a
+    //   pause. Can be called from any thread.
+    void Restart()
+        { _restart.store(true, std::memory_order_release); }
+
+    // Arrive: a frame with the start time start came at stream time now.
+    void Arrive(int64_t start, int64_t now, bool discontinuity);
+    // Untimed: a frame came without a time stamp.
+    void Untimed()
+        { _untimed.fetch_add(1, std::memory_order_relaxed); }
+    // Deliver: the frame was passed on at stream time now.
+    void Deliver(int64_t start, int64_t now);
+
+    // GetStats: returns false when the timing is compiled out.
+    bool GetStats(FrameTimingStats* stats);
+    // GetInterval: returns the nominal (or estimated) interval.
+    int64_t GetInterval()
+        { return _interval.load(std::memory_order_relaxed); }
+#else
+    FrameTiming() {}
+    void Reset(int64_t interval) {}
+    void Restart() {}
+    void Arrive(int64_t start, int64_t now, bool discontinuity) {}
+    void Untimed() {}
+    void Deliver(int64_t start, int64_t now) {}
+    bool GetStats(FrameTimingStats* stats)
+        { return false; }
+    int64_t GetInterval()
+        { return 0; }
+#endif
+};
@@ -0,0 +1,649 @@
+// -*- tab-width: 4; mode: c++ -*-
+//  ImageFile.cpp
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "ImageFile.h"
+#include "FiltaaCore.h"
+
+// getLE16, getLE32: read little-endian values.
+static inline uint32_t getLE16(const uint8_t* p)
+{
+    return p[0] | (p[1] << 8);
+}
+static inline uint32_t getLE32(const uint8_t* p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// putBE32: write a big-endian value.
+static inline void putBE32(uint8_t* p, uint32_t v)
+{
+    p[0] = (uint8_t)(v >> 24); p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8); p[3] = (uint8_t)v;
+}
+
+// putLE16, putLE32: write little-endian values.
+static inline void putLE16(uint8_t* p, uint32_t v)
+{
+    p[0] = (uint8_t)v; p[1] = (uint8_t)(v >> 8);
+}
+static inline void putLE32(uint8_t* p, uint32_t v)
+{
+    p[0] = (uint8_t)v; p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16); p[3] = (uint8_t)(v >> 24);
+}
+
+// seekFile: seek to a 64-bit offset.
+static bool seekFile(FILE* fp, int64_t offset)
+{
+#ifdef WINDOWS
+    return _fseeki64(fp, offset, SEEK_SET) == 0;
+#else
+    return fseeko(fp, (off_t)offset, SEEK_SET) == 0;
+#endif
+}
+
+ImageFormat getImageFormat(const char* path)
+{
+    const char* ext = strrchr(path, '.');
+    if (ext == NULL) return IMAGE_UNKNOWN;
+    char s[8];
+    int i;
+    for (i = 0; ext[i+1] != 0 && i < 7; i++) {
+        s[i] = (char)tolower((unsigned char)ext[i+1]);
+    }
+    s[i] = 0;
+    if (strcmp(s, "ppm") == 0) return IMAGE_PPM;
+    if (strcmp(s, "bmp") == 0) return IMAGE_BMP;
+    if (strcmp(s, "pgm") == 0) return IMAGE_PGM;
+    if (strcmp(s, "png") == 0) return IMAGE_PNG;
+    if (strcmp(s, "y4m") == 0) return IMAGE_Y4M;
+    return IMAGE_UNKNOWN;
+}
+
+bool allocImage(Image* img, int width, int height)
+{
+    img->width = width;
+    img->height = height;
+    img->stride = (size_t)width * 3;
+    img->data = (uint8_t*)malloc(img->stride * height);
+    return img->data != NULL;
+}
+
+void freeImage(Image* img)
+{
+    free(img->data);
+    img->data = NULL;
+}
+
+// readPPMToken: reads a number from a PPM header.
+static int readPPMToken(FILE* fp)
+{
+    int c = fgetc(fp);
+    for (;;) {
+        if (c == '#') {
+            while (c != EOF && c != '\n') {
+                c = fgetc(fp);
+            }
+        } else if (c == EOF || !isspace(c)) {
+            break;
+        }
+        c = fgetc(fp);
+    }
+    int v = -1;
+    while (c != EOF && isdigit(c)) {
+        v = ((v < 0)? 0 : v*10) + (c - '0');
+        if (100000 < v) return -1;
+        c = fgetc(fp);
+    }
+    // The single whitespace after the last value is consumed here.
+    return v;
+}
+
+// readPPM: reads a binary PPM.
+static bool readPPM(FILE* fp, Image* img)
+{
+    if (fgetc(fp) != 'P' || fgetc(fp) != '6') return false;
+    int width = readPPMToken(fp);
+    int height = readPPMToken(fp);
+    int maxval = readPPMToken(fp);
+    if (width <= 0 || height <= 0 || maxval != 255) return false;
+    if (!allocImage(img, width, height)) return false;
+
+    for (int y = 0; y < height; y++) {
+        uint8_t* p = img->data + img->stride*y;
+        if (fread(p, 3, width, fp) != (size_t)width) {
+            freeImage(img);
+            return false;
+        }
+        // RGB -> BGR.
+        for (int x = 0; x < width; x++) {
+            uint8_t t = p[0]; p[0] = p[2]; p[2] = t;
+            p += 3;
+        }
+    }
+    return true;
+}
+
+// readBMP: reads an uncompressed 24-bit BMP.
+static bool readBMP(FILE* fp, Image* img)
+{
+    uint8_t hdr[54];
+    if (fread(hdr, sizeof(hdr), 1, fp) != 1) return false;
+    if (hdr[0] != 'B' || hdr[1] != 'M') return false;
+    uint32_t offset = getLE32(hdr+10);
+    int width = (int32_t)getLE32(hdr+18);
+    int height = (int32_t)getLE32(hdr+22);
+    uint32_t bitcount = getLE16(hdr+28);
+    uint32_t compression = getLE32(hdr+30);
+    if (bitcount != 24 || compression != 0) return false;
+    // A negative height means top-down.
+    bool topdown = (height < 0);
+    if (topdown) {
+        height = -height;
+    }
+    if (width <= 0 || height <= 0 || 100000 < width || 100000 < height) {
+        return false;
+    }
+    if (!seekFile(fp, offset)) return false;
+    if (!allocImage(img, width, height)) return false;
+
+    size_t padding = ((width*3 + 3) & ~3) - width*3;
+    for (int y = 0; y < height; y++) {
+        uint8_t* p = img->data + img->stride*(topdown? y : height-1-y);
+        uint8_t pad[4];
+        if (fread(p, 3, width, fp) != (size_t)width ||
+            fread(pad, 1, padding, fp) != padding) {
+            freeImage(img);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool readImage(const char* path, Image* img)
+{
+    FILE* fp = fopen(path, "rb");
+    if (fp == NULL) return false;
+    int c = fgetc(fp);
+    ungetc(c, fp);
+    bool ok = (c == 'P')? readPPM(fp, img) : readBMP(fp, img);
+    fclose(fp);
+    return ok;
+}
+
+// writePPM: writes a binary PPM.
+static bool writePPM(FILE* fp, const Image* img)
+{
+    fprintf(fp, "P6\n%d %d\n255\n", img->width, img->height);
+    uint8_t* row = (uint8_t*)malloc((size_t)img->width * 3);
+    if (row == NULL) return false;
+    bool ok = true;
+    for (int y = 0; y < img->height && ok; y++) {
+        const uint8_t* p = img->data + img->stride*y;
+        for (int x = 0; x < img->width*3; x += 3) {
+            row[x+0] = p[x+2];
+            row[x+1] = p[x+1];
+            row[x+2] = p[x+0];
+        }
+        ok = (fwrite(row, 3, img->width, fp) == (size_t)img->width);
+    }
+    free(row);
+    return ok;
+}
+
+// writeBMP: writes a bottom-up 24-bit BMP.
+static bool writeBMP(FILE* fp, const Image* img)
+{
+    size_t linesize = (img->width*3 + 3) & ~3;
+    uint32_t imagesize = (uint32_t)(linesize * img->height);
+    uint8_t hdr[54];
+    memset(hdr, 0, sizeof(hdr));
+    hdr[0] = 'B'; hdr[1] = 'M';
+    putLE32(hdr+2, sizeof(hdr) + imagesize);
+    putLE32(hdr+10, sizeof(hdr));
+    putLE32(hdr+14, 40);
+    putLE32(hdr+18, img->width);
+    putLE32(hdr+22, img->height);
+    putLE16(hdr+26, 1);
+    putLE16(hdr+28, 24);
+    putLE32(hdr+34, imagesize);
+    if (fwrite(hdr, sizeof(hdr), 1, fp) != 1) return false;
+
+    static const uint8_t pad[4] = {0,0,0,0};
+    size_t padding = linesize - img->width*3;
+    for (int y = img->height-1; 0 <= y; y--) {
+        const uint8_t* p = img->data + img->stride*y;
+        if (fwrite(p, 3, img->width, fp) != (size_t)img->width ||
+            fwrite(pad, 1, padding, fp) != padding) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// writePGM: writes a binary PGM of the luma.
+static bool writePGM(FILE* fp, const Image* img)
+{
+    fprintf(fp, "P5\n%d %d\n255\n", img->width, img->height);
+    uint8_t* row = (uint8_t*)malloc(img->width);
+    if (row == NULL) return false;
+    bool ok = true;
+    for (int y = 0; y < img->height && ok; y++) {
+        const uint8_t* p = img->data + img->stride*y;
+        for (int x = 0; x < img->width; x++) {
+            row[x] = (uint8_t)getLuma(p);
+            p += 3;
+        }
+        ok = (fwrite(row, 1, img->width, fp) == (size_t)img->width);
+    }
+    free(row);
+    return ok;
+}
+
+
+//  Deflate
+//
+//  Only fixed Huffman codes are used. A match is tried at distance
+//  1 (a run) and at the row size (the same bytes as the row above);
+//  for a B/W board this shrinks the data by one or two orders.
+//
+static const int DEFLATE_MIN_MATCH = 3;
+static const int DEFLATE_MAX_MATCH = 258;
+static const size_t DEFLATE_MAX_DISTANCE = 32768;
+static const size_t DEFLATE_MAX_STORED = 65535;
+
+static const uint16_t LENGTH_BASE[29] = {
+    3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,
+    35,43,51,59,67,83,99,115,131,163,195,227,258,
+};
+static const uint8_t LENGTH_EXTRA[29] = {
+    0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,
+    3,3,3,3,4,4,4,4,5,5,5,5,0,
+};
+static const uint16_t DISTANCE_BASE[30] = {
+    1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,
+    257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577,
+};
+static const uint8_t DISTANCE_EXTRA[30] = {
+    0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,
+    7,7,8,8,9,9,10,10,11,11,12,12,13,13,
+};
+
+//  BitWriter: writes bits LSB first, as deflate wants.
+//
+struct BitWriter
+{
+    std::vector<uint8_t>* out;
+    uint32_t bits;
+    int nbits;
+
+    void Put(uint32_t v, int n) {
+        bits |= v << nbits;
+        nbits += n;
+        while (8 <= nbits) {
+            out->push_back((uint8_t)bits);
+            bits >>= 8;
+            nbits -= 8;
+        }
+    }
+    // PutCode: writes a Huffman code, which is MSB first.
+    void PutCode(uint32_t code, int n) {
+        uint32_t r = 0;
+        for (int i = 0; i < n; i++) {
+            r = (r << 1) | ((code >> i) & 1);
+        }
+        Put(r, n);
+    }
+    void Flush() {
+        if (0 < nbits) {
+            out->push_back((uint8_t)bits);
+        }
+        bits = 0;
+        nbits = 0;
+    }
+};
+
+// putLiteral: writes a fixed Huffman code for 0-287.
+static void putLiteral(BitWriter* w, int c)
+{
+    if (c < 144) {
+        w->PutCode(0x30 + c, 8);
+    } else if (c < 256) {
+        w->PutCode(0x190 + (c-144), 9);
+    } else if (c < 280) {
+        w->PutCode(c-256, 7);
+    } else {
+        w->PutCode(0xc0 + (c-280), 8);
+    }
+}
+
+// putMatch: writes a length/distance pair.
+static void putMatch(BitWriter* w, int length, size_t distance)
+{
+    int i = 28;
+    while (length < LENGTH_BASE[i]) i--;
+    putLiteral(w, 257+i);
+    w->Put(length - LENGTH_BASE[i], LENGTH_EXTRA[i]);
+    int j = 29;
+    while (distance < DISTANCE_BASE[j]) j--;
+    w->PutCode(j, 5);
+    w->Put((uint32_t)(distance - DISTANCE_BASE[j]), DISTANCE_EXTRA[j]);
+}
+
+// getMatchLength: count the bytes at p equal to the ones at p-distance.
+static int getMatchLength(const uint8_t* p, size_t left, size_t distance)
+{
+    size_t limit = (left < (size_t)DEFLATE_MAX_MATCH)? left : DEFLATE_MAX_MATCH;
+    size_t n = 0;
+    while (n < limit && p[n] == p[(ptrdiff_t)n - (ptrdiff_t)distance]) n++;
+    return (int)n;
+}
+
+// deflateFixed: compresses data as a single fixed Huffman block.
+static void deflateFixed(
+    std::vector<uint8_t>* out, const uint8_t* data, size_t n, size_t rowbytes)
+{
+    BitWriter w = { out, 0, 0 };
+    // BFINAL=1, BTYPE=01.
+    w.Put(1, 1);
+    w.Put(1, 2);
+    size_t i = 0;
+    while (i < n) {
+        int length = 0;
+        size_t distance = 0;
+        if (1 <= i) {
+            length = getMatchLength(data+i, n-i, 1);
+            distance = 1;
+        }
+        if (rowbytes <= i && rowbytes <= DEFLATE_MAX_DISTANCE) {
+            int k = getMatchLength(data+i, n-i, rowbytes);
+            if (length < k) {
+                length = k;
+                distance = rowbytes;
+            }
+        }
+        if (DEFLATE_MIN_MATCH <= length) {
+            putMatch(&w, length, distance);
+            i += length;
+        } else {
+            putLiteral(&w, data[i]);
+            i++;
+        }
+    }
+    putLiteral(&w, 256);
+    w.Flush();
+}
+
+// deflateStored: stores data without compression.
+static void deflateStored(std::vector<uint8_t>* out, const uint8_t* data, size_t n)
+{
+    size_t i = 0;
+    do {
+        size_t len = n-i;
+        if (DEFLATE_MAX_STORED < len) {
+            len = DEFLATE_MAX_STORED;
+        }
+        uint8_t hdr[5];
+        hdr[0] = (i+len == n)? 1 : 0;
+        putLE16(hdr+1, (uint32_t)len);
+        putLE16(hdr+3, (uint32_t)~len & 0xffff);
+        out->insert(out->end(), hdr, hdr+5);
+        out->insert(out->end(), data+i, data+i+len);
+        i += len;
+    } while (i < n);
+}
+
+// getAdler32: compute the zlib checksum.
+static uint32_t getAdler32(const uint8_t* p, size_t n)
+{
+    uint32_t a = 1, b = 0;
+    while (0 < n) {
+        // 5552 bytes can be summed before b overflows.
+        size_t k = (n < 5552)? n : 5552;
+        n -= k;
+        while (k--) {
+            a += *p++;
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    return (b << 16) | a;
+}
+
+void deflateZlib(
+    std::vector<uint8_t>* out, const uint8_t* data, size_t n, size_t rowbytes)
+{
+    // CMF=0x78 (deflate, 32K window), FLG=0x01 (fastest).
+    size_t start = out->size();
+    out->push_back(0x78);
+    out->push_back(0x01);
+    deflateFixed(out, data, n, rowbytes);
+    if (n + (n/DEFLATE_MAX_STORED+1)*5 < out->size() - start - 2) {
+        out->resize(start+2);
+        deflateStored(out, data, n);
+    }
+    uint8_t adler[4];
+    putBE32(adler, getAdler32(data, n));
+    out->insert(out->end(), adler, adler+4);
+}
+
+
+//  PNG
+//
+// updateCRC32: update the CRC of a PNG chunk.
+static uint32_t updateCRC32(uint32_t crc, const uint8_t* p, size_t n)
+{
+    struct Table {
+        uint32_t t[256];
+        Table() {
+            for (uint32_t i = 0; i < 256; i++) {
+                uint32_t c = i;
+                for (int k = 0; k < 8; k++) {
+                    c = (c & 1)? (0xedb88320 ^ (c >> 1)) : (c >> 1);
+                }
+                t[i] = c;
+            }
+        }
+    };
+    static const Table table;
+    crc = ~crc;
+    while (n--) {
+        crc = table.t[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+// writePNGChunk: writes a chunk with its length and CRC.
+static bool writePNGChunk(FILE* fp, const char* type, const uint8_t* data, size_t n)
+{
+    uint8_t hdr[8];
+    putBE32(hdr, (uint32_t)n);
+    memcpy(hdr+4, type, 4);
+    uint8_t crc[4];
+    putBE32(crc, updateCRC32(updateCRC32(0, hdr+4, 4), data, n));
+    return (fwrite(hdr, 8, 1, fp) == 1 &&
+            (n == 0 || fwrite(data, n, 1, fp) == 1) &&
+            fwrite(crc, 4, 1, fp) == 1);
+}
+
+// writePNG: writes a 1-bit grayscale PNG; dark pixels are black.
+static bool writePNG(FILE* fp, const Image* img)
+{
+    static const uint8_t SIGNATURE[8] = {
+        0x89, 'P', 'N', 'G', 0x0d, 0x0a, 0x1a, 0x0a,
+    };
+    // Each row starts with a filter type (0 = none).
+    size_t rowbytes = 1 + (img->width+7)/8;
+    std::vector<uint8_t> raw(rowbytes * img->height, 0);
+    for (int y = 0; y < img->height; y++) {
+        const uint8_t* p = img->data + img->stride*y;
+        uint8_t* row = &raw[rowbytes*y] + 1;
+        for (int x = 0; x < img->width; x++) {
+            if (128 <= getLuma(p)) {
+                row[x >> 3] |= (0x80 >> (x & 7));
+            }
+            p += 3;
+        }
+    }
+
+    uint8_t ihdr[13];
+    putBE32(ihdr+0, img->width);
+    putBE32(ihdr+4, img->height);
+    ihdr[8] = 1;                // bit depth
+    ihdr[9] = 0;                // grayscale
+    ihdr[10] = 0;               // deflate
+    ihdr[11] = 0;               // adaptive filtering
+    ihdr[12] = 0;               // no interlace
+    std::vector<uint8_t> idat;
+    deflateZlib(&idat, &raw[0], raw.size(), rowbytes);
+
+    return (fwrite(SIGNATURE, sizeof(SIGNATURE), 1, fp) == 1 &&
+            writePNGChunk(fp, "IHDR", ihdr, sizeof(ihdr)) &&
+            writePNGChunk(fp, "IDAT", &idat[0], idat.size()) &&
+            writePNGChunk(fp, "IEND", NULL, 0));
+}
+
+bool writeImage(const char* path, const Image* img, ImageFormat format)
+{
+    FILE* fp = fopen(path, "wb");
+    if (fp == NULL) return false;
+    bool ok = false;
+    switch (format) {
+    case IMAGE_PPM:
+        ok = writePPM(fp, img);
+        break;
+    case IMAGE_BMP:
+        ok = writeBMP(fp, img);
+        break;
+    case IMAGE_PGM:
+        ok = writePGM(fp, img);
+        break;
+    case IMAGE_PNG:
+        ok = writePNG(fp, img);
+        break;
+    default:
+        break;
+    }
+    if (fclose(fp) != 0) {
+        ok = false;
+    }
+    return ok;
+}
+
+
+//  Y4MWriter
+//
+static const char Y4M_FRAME[] = "FRAME\n";
+
+Y4MWriter::Y4MWriter()
+{
+    _fp = NULL;
+    _width = 0;
+    _height = 0;
+    _dataOffset = 0;
+    _frameSize = 0;
+    _buf = NULL;
+}
+
+Y4MWriter::~Y4MWriter()
+{
+    Close();
+}
+
+void Y4MWriter::Close()
+{
+    if (_fp != NULL) {
+        fclose(_fp);
+        _fp = NULL;
+    }
+    free(_buf);
+    _buf = NULL;
+}
+
+bool Y4MWriter::Setup(int width, int height)
+{
+    if (width <= 0 || height <= 0) return false;
+    _width = width;
+    _height = height;
+    _dataOffset = ftell(_fp);
+    _frameSize = (sizeof(Y4M_FRAME)-1) + (size_t)width*height +
+        2*(size_t)((width+1)/2)*((height+1)/2);
+    _buf = (uint8_t*)malloc(_frameSize);
+    return _buf != NULL;
+}
+
+bool Y4MWriter::Create(
+    const char* path, int width, int height, int rateNum, int rateDen)
+{
+    Close();
+    _fp = fopen(path, "wb");
+    if (_fp == NULL) return false;
+
+    if (fprintf(_fp, "YUV4MPEG2 W%d H%d F%d:%d Ip A1:1 C420jpeg\n",
+                width, height, rateNum, rateDen) < 0 ||
+        !Setup(width, height)) {
+        Close();
+        return false;
+    }
+    return true;
+}
+
+bool Y4MWriter::Attach(const char* path, int width, int height)
+{
+    Close();
+    _fp = fopen(path, "r+b");
+    if (_fp == NULL) return false;
+
+    // Skip the header line.
+    int c;
+    while ((c = fgetc(_fp)) != EOF && c != '\n') ;
+    if (c == EOF || !Setup(width, height)) {
+        Close();
+        return false;
+    }
+    return true;
+}
+
+bool Y4MWriter::WriteFrame(int n, const Image* img)
+{
+    if (n < 0) return false;
+    if (img->width != _width || img->height != _height) return false;
+
+    int chromaWidth = (_width+1)/2;
+    int chromaHeight = (_height+1)/2;
+    memcpy(_buf, Y4M_FRAME, sizeof(Y4M_FRAME)-1);
+    uint8_t* ybuf = _buf + sizeof(Y4M_FRAME)-1;
+    uint8_t* ubuf = ybuf + (size_t)_width*_height;
+    uint8_t* vbuf = ubuf + (size_t)chromaWidth*chromaHeight;
+    for (int y = 0; y < _height; y++) {
+        const uint8_t* p = img->data + img->stride*y;
+        uint8_t* yp = ybuf + (size_t)_width*y;
+        for (int x = 0; x < _width; x++) {
+            yp[x] = (uint8_t)(((66*p[2] + 129*p[1] + 25*p[0] + 128) >> 8) + 16);
+            p += 3;
+        }
+    }
+    // Average every 2x2 block for the chroma planes.
+    for (int cy = 0; cy < chromaHeight; cy++) {
+        int y0 = cy*2, y1 = (y0+1 < _height)? y0+1 : y0;
+        const uint8_t* p0 = img->data + img->stride*y0;
+        const uint8_t* p1 = img->data + img->stride*y1;
+        for (int cx = 0; cx < chromaWidth; cx++) {
+            int x0 = cx*6, x1 = (cx*2+1 < _width)? x0+3 : x0;
+            int b = p0[x0+0] + p0[x1+0] + p1[x0+0] + p1[x1+0];
+            int g = p0[x0+1] + p0[x1+1] + p1[x0+1] + p1[x1+1];
+            int r = p0[x0+2] + p0[x1+2] + p1[x0+2] + p1[x1+2];
+            size_t i = (size_t)chromaWidth*cy + cx;
+            ubuf[i] = (uint8_t)(((-38*r - 74*g + 112*b + 512) >> 10) + 128);
+            vbuf[i] = (uint8_t)(((112*r - 94*g - 18*b + 512) >> 10) + 128);
+        }
+    }
+
+    if (!seekFile(_fp, _dataOffset + (int64_t)_frameSize*n)) return false;
+    return fwrite(_buf, _frameSize, 1, _fp) == 1;
+}
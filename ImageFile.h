@@ -0,0 +1,82 @@
+// -*- tab-width: 4; mode: c++ -*-
+//  ImageFile.h
+//
+//  Reading and writing still images, and writing YUV4MPEG2 sequences.
+//  Images are held as 24-bit pixels in B, G, R order, top row first.
+//
+//  PGM and PNG are written in grayscale; a PNG has only 1 bit per
+//  pixel (dark or light), which suits thresholded boards.
+//
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+enum ImageFormat {
+    IMAGE_UNKNOWN = 0,
+    IMAGE_PPM,
+    IMAGE_BMP,
+    IMAGE_PGM,
+    IMAGE_PNG,
+    IMAGE_Y4M,
+};
+
+struct Image
+{
+    uint8_t* data;
+    int width;
+    int height;
+    size_t stride;
+};
+
+// getImageFormat: guess the format from a file name.
+ImageFormat getImageFormat(const char* path);
+
+bool allocImage(Image* img, int width, int height);
+void freeImage(Image* img);
+
+// readImage: reads a binary PPM (P6) or a 24-bit BMP.
+bool readImage(const char* path, Image* img);
+// writeImage: writes an image as a PPM, BMP, PGM or PNG.
+bool writeImage(const char* path, const Image* img, ImageFormat format);
+
+// deflateZlib: compresses data into a zlib stream.
+//   Runs and repeated rows are coded with fixed Huffman codes;
+//   data which does not shrink is stored as is.
+void deflateZlib(std::vector<uint8_t>* out, const uint8_t* data, size_t n,
+                 size_t rowbytes);
+
+
+//  Y4MWriter: writes a 4:2:0 YUV4MPEG2 sequence.
+//
+//  Every frame has the same size, so frames can be written in any
+//  order, and several writers can fill different frames of the
+//  same file at once.
+//
+class Y4MWriter
+{
+private:
+    FILE* _fp;
+    int _width;
+    int _height;
+    long _dataOffset;           // offset of the first frame.
+    size_t _frameSize;          // including the "FRAME\n" line.
+    uint8_t* _buf;
+
+    bool Setup(int width, int height);
+
+public:
+    Y4MWriter();
+    ~Y4MWriter();
+
+    bool Create(const char* path, int width, int height,
+                int rateNum, int rateDen);
+    // Attach: opens a file made by Create() for writing more frames.
+    bool Attach(const char* path, int width, int height);
+    void Close();
+
+    // WriteFrame: converts img and stores it as frame n.
+    bool WriteFrame(int n, const Image* img);
+};
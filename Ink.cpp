@@ -0,0 +1,287 @@
+// -*- tab-width: 4; mode: c++ -*-
+//  Ink.cpp
+//
+
+#include <string.h>
+#include "Ink.h"
+#include "ThreadPool.h"
+
+//  Constants
+//
+// The chroma of the board is sampled every few rows.
+static const int CHROMA_SAMPLE_ROWS = 4;
+// The chroma threshold is this far above most of the board.
+static const int CHROMA_PERMILLE = 900;
+static const int CHROMA_MARGIN = 16;
+static const int MIN_CHROMA = 24;
+static const int MAX_CHROMA = 160;
+static const int DEFAULT_CHROMA = 48;
+
+void initInkPalette(InkPalette* palette)
+{
+    static const uint8_t COLORS[][3] = {
+        { 255, 255, 255 },      // board
+        {   0,   0,   0 },      // black
+        {  32,  32, 208 },      // red
+        { 208,  64,  32 },      // blue
+        {  48, 160,  32 },      // green
+    };
+    palette->count = (int)(sizeof(COLORS) / sizeof(COLORS[0]));
+    memset(palette->colors, 0, sizeof(palette->colors));
+    memcpy(palette->colors, COLORS, sizeof(COLORS));
+}
+
+// getChroma: the spread of the channels of a B,G,R pixel.
+static inline int getChroma(const uint8_t* p)
+{
+    int lo = p[0], hi = p[0];
+    if (p[1] < lo) lo = p[1];
+    if (hi < p[1]) hi = p[1];
+    if (p[2] < lo) lo = p[2];
+    if (hi < p[2]) hi = p[2];
+    return hi - lo;
+}
+
+// getModelLuma: the luma of a pixel with a model chosen at runtime.
+static int getModelLuma(LumaModel model, const uint8_t* p)
+{
+    switch (model) {
+    case LUMA_BT709:
+        return LumaBT709::Get(p);
+    case LUMA_GREEN:
+        return LumaGreen::Get(p);
+    case LUMA_MAX:
+        return LumaMax::Get(p);
+    default:
+        return LumaBT601::Get(p);
+    }
+}
+
+
+//  InkClassifier
+//
+InkClassifier::InkClassifier()
+    : _paletteSerial(1)
+{
+    initInkPalette(&_palette);
+    _paletteBuilt = 0;
+    _lutModel = -1;
+    _lutThreshold = -1;
+    _lutChroma = -1;
+    memset(_lut, 0, sizeof(_lut));
+    memset(_colors, 0, sizeof(_colors));
+    Reset();
+}
+
+void InkClassifier::SetPalette(const InkPalette* palette)
+{
+    _palette = *palette;
+    _paletteSerial.fetch_add(1, std::memory_order_release);
+}
+
+void InkClassifier::Reset()
+{
+    _chromaThreshold = DEFAULT_CHROMA;
+}
+
+// UpdateLut: rebuild the table if anything it depends on has changed.
+void InkClassifier::UpdateLut(LumaModel model, int rawThreshold)
+{
+    uint32_t serial = _paletteSerial.load(std::memory_order_acquire);
+    if (serial == _paletteBuilt && model == _lutModel &&
+        rawThreshold == _lutThreshold && _chromaThreshold == _lutChroma) return;
+
+    InkPalette palette = _palette;
+    int count = palette.count;
+    count = (count < 2)? 2 : (MAX_INKS < count)? MAX_INKS : count;
+    memcpy(_colors, palette.colors, sizeof(_colors));
+
+    // The hue of each colored ink, as its offset from gray.
+    int hues[MAX_INKS][3];
+    int norms[MAX_INKS];
+    for (int i = 2; i < count; i++) {
+        const uint8_t* c = palette.colors[i];
+        int mean = (c[0] + c[1] + c[2]) / 3;
+        int n = 0;
+        for (int j = 0; j < 3; j++) {
+            hues[i][j] = c[j] - mean;
+            n += (hues[i][j] < 0)? -hues[i][j] : hues[i][j];
+        }
+        norms[i] = (n == 0)? 1 : n;
+    }
+
+    const int levels = 1 << LUT_BITS;
+    const int shift = 8 - LUT_BITS;
+    uint8_t* lut = _lut;
+    for (int b = 0; b < levels; b++) {
+        for (int g = 0; g < levels; g++) {
+            for (int r = 0; r < levels; r++) {
+                // The center of the cell.
+                uint8_t p[3];
+                p[0] = (uint8_t)((b << shift) + (1 << (shift-1)));
+                p[1] = (uint8_t)((g << shift) + (1 << (shift-1)));
+                p[2] = (uint8_t)((r << shift) + (1 << (shift-1)));
+                int index = 0;
+                if (_chromaThreshold <= getChroma(p)) {
+                    int mean = (p[0] + p[1] + p[2]) / 3;
+                    int best = 0;
+                    for (int i = 2; i < count; i++) {
+                        int score = 0;
+                        for (int j = 0; j < 3; j++) {
+                            score += (p[j] - mean) * hues[i][j];
+                        }
+                        score /= norms[i];
+                        if (best < score) {
+                            best = score;
+                            index = i;
+                        }
+                    }
+                }
+                if (index == 0 && getModelLuma(model, p) < rawThreshold) {
+                    index = 1;
+                }
+                *lut++ = (uint8_t)index;
+            }
+        }
+    }
+
+    _paletteBuilt = serial;
+    _lutModel = model;
+    _lutThreshold = rawThreshold;
+    _lutChroma = _chromaThreshold;
+}
+
+// UpdateChroma: compute the next chroma threshold.
+void InkClassifier::UpdateChroma()
+{
+    uint32_t hist[256];
+    uint64_t total = 0;
+    for (int i = 0; i < 256; i++) {
+        uint32_t n = 0;
+        for (int band = 0; band < NBANDS; band++) {
+            n += _chromaHists[band][i];
+        }
+        hist[i] = n;
+        total += n;
+    }
+    if (total == 0) return;
+    int chroma = getPercentile(hist, CHROMA_PERMILLE) + CHROMA_MARGIN;
+    _chromaThreshold = ((chroma < MIN_CHROMA)? MIN_CHROMA :
+                        (MAX_CHROMA < chroma)? MAX_CHROMA : chroma);
+}
+
+// ProcessBand: rows [y0,y1).
+template <class Luma>
+void InkClassifier::ProcessBand(
+    int band, int y0, int y1, int width,
+    const uint8_t* src, ptrdiff_t srcStride,
+    uint8_t* dst, ptrdiff_t dstStride,
+    uint8_t* bits, ptrdiff_t bitsStride, int rawThreshold)
+{
+    uint32_t* rawHist = _bandHists[band];
+    uint32_t* chromaHist = _chromaHists[band];
+    memset(rawHist, 0, sizeof(_bandHists[band]));
+    memset(chromaHist, 0, sizeof(_chromaHists[band]));
+
+    const int shift = 8 - LUT_BITS;
+    const uint8_t* lut = _lut;
+    const uint8_t (*colors)[3] = _colors;
+    size_t rowbytes = (width+7) >> 3;
+    for (int y = y0; y < y1; y++) {
+        const uint8_t* p = src + srcStride*y;
+        // The chroma of the board (whatever is not dark) is sampled
+        // before the pixel is written, as src can be dst.
+        bool sample = (y % CHROMA_SAMPLE_ROWS == 0);
+        if (dst != NULL) {
+            uint8_t* q = dst + dstStride*y;
+            uint8_t* row = NULL;
+            if (bits != NULL) {
+                row = bits + bitsStride*y;
+                memset(row, 0, rowbytes);
+            }
+            for (int x = 0; x < width; x++) {
+                int lum = Luma::Get(p);
+                rawHist[lum]++;
+                if (sample && rawThreshold <= lum) {
+                    chromaHist[getChroma(p)]++;
+                }
+                int index = lut[((p[0] >> shift) << (2*LUT_BITS)) |
+                                 ((p[1] >> shift) << LUT_BITS) |
+                                 (p[2] >> shift)];
+                if (index != 0 && row != NULL) {
+                    row[x >> 3] |= (0x80 >> (x & 7));
+                }
+                const uint8_t* c = colors[index];
+                q[0] = c[0];
+                q[1] = c[1];
+                q[2] = c[2];
+                p += 3;
+                q += 3;
+            }
+        } else {
+            for (int x = 0; x < width; x++) {
+                int lum = Luma::Get(p);
+                rawHist[lum]++;
+                if (sample && rawThreshold <= lum) {
+                    chromaHist[getChroma(p)]++;
+                }
+                p += 3;
+            }
+        }
+    }
+}
+
+void InkClassifier::Process(
+    LumaModel model, int rawThreshold,
+    const uint8_t* src, ptrdiff_t srcStride,
+    uint8_t* dst, ptrdiff_t dstStride,
+    int width, int height,
+    uint8_t* bits, ptrdiff_t bitsStride,
+    uint32_t* rawHist, ThreadPool* pool)
+{
+    if (dst != NULL) {
+        UpdateLut(model, rawThreshold);
+    }
+
+    auto bands = [&](int begin, int end) {
+        for (int band = begin; band < end; band++) {
+            int y0 = (int)((int64_t)height*band / NBANDS);
+            int y1 = (int)((int64_t)height*(band+1) / NBANDS);
+            switch (model) {
+            case LUMA_BT709:
+                ProcessBand<LumaBT709>(band, y0, y1, width, src, srcStride,
+                                       dst, dstStride,
+                                       bits, bitsStride, rawThreshold);
+                break;
+            case LUMA_GREEN:
+                ProcessBand<LumaGreen>(band, y0, y1, width, src, srcStride,
+                                       dst, dstStride,
+                                       bits, bitsStride, rawThreshold);
+                break;
+            case LUMA_MAX:
+                ProcessBand<LumaMax>(band, y0, y1, width, src, srcStride,
+                                     dst, dstStride,
+                                     bits, bitsStride, rawThreshold);
+                break;
+            default:
+                ProcessBand<LumaBT601>(band, y0, y1, width, src, srcStride,
+                                       dst, dstStride,
+                                       bits, bitsStride, rawThreshold);
+                break;
+            }
+        }
+    };
+    if (pool != NULL) {
+        pool->ParallelFor(NBANDS, bands);
+    } else {
+        bands(0, NBANDS);
+    }
+
+    memset(rawHist, 0, sizeof(uint32_t)*256);
+    for (int band = 0; band < NBANDS; band++) {
+        for (int i = 0; i < 256; i++) {
+            rawHist[i] += _bandHists[band][i];
+        }
+    }
+    UpdateChroma();
+}
@@ -0,0 +1,99 @@
+// -*- tab-width: 4; mode: c++ -*-
+//  Ink.h
+//
+//  Classifying pixels as board or as one of a few marker colors.
+//
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include "FiltaaCore.h"
+
+class ThreadPool;
+
+const int MAX_INKS = 8;
+
+
+//  InkPalette: the output colors, in B, G, R order.
+//
+//  colors[0] is the board and colors[1] the dark ink, told apart
+//  by luma as in the B/W mode. The others are colored inks, told
+//  apart from the board by chroma and from each other by hue.
+//
+struct InkPalette
+{
+    int count;
+    uint8_t colors[MAX_INKS][3];
+};
+
+// initInkPalette: white board, black, red, blue and green markers.
+void initInkPalette(InkPalette* palette);
+
+
+//  InkClassifier
+//
+//  Every pixel is looked up in a table of 32x32x32 quantized
+//  colors, so the per-pixel cost is about that of the threshold.
+//  The table is rebuilt when the palette, the luma threshold or
+//  the chroma threshold changes. The chroma threshold is taken
+//  from the chroma histogram of the board in the previous frame
+//  (sampled every few rows).
+//
+class InkClassifier
+{
+private:
+    static const int NBANDS = 8;
+    static const int LUT_BITS = 5;
+    static const int LUT_SIZE = 1 << (3*LUT_BITS);
+
+    InkPalette _palette;
+    std::atomic<uint32_t> _paletteSerial;
+    uint32_t _paletteBuilt;
+    int _lutModel;
+    int _lutThreshold;
+    int _lutChroma;
+    uint8_t _lut[LUT_SIZE];     // quantized B,G,R to palette index.
+    uint8_t _colors[MAX_INKS][3];
+
+    int _chromaThreshold;
+    uint32_t _bandHists[NBANDS][256];
+    uint32_t _chromaHists[NBANDS][256];
+
+    InkClassifier(const InkClassifier&);
+    InkClassifier& operator=(const InkClassifier&);
+
+    void UpdateLut(LumaModel model, int rawThreshold);
+    void UpdateChroma();
+    template <class Luma>
+    void ProcessBand(
+        int band, int y0, int y1, int width,
+        const uint8_t* src, ptrdiff_t srcStride,
+        uint8_t* dst, ptrdiff_t dstStride,
+        uint8_t* bits, ptrdiff_t bitsStride, int rawThreshold);
+
+public:
+    InkClassifier();
+
+    // SetPalette: can be called from another thread; the change
+    //   takes effect at the next frame.
+    void SetPalette(const InkPalette* palette);
+    void GetPalette(InkPalette* palette)
+        { *palette = _palette; }
+    int GetChromaThreshold()
+        { return _chromaThreshold; }
+
+    // Reset: forget the previous frame.
+    void Reset();
+    // Process: classifies src into dst as palette colors, setting
+    //   the bits of every ink pixel. dst can be NULL to only take
+    //   the histograms. The histogram of the raw luma is returned
+    //   in rawHist. pool can be NULL.
+    void Process(
+        LumaModel model, int rawThreshold,
+        const uint8_t* src, ptrdiff_t srcStride,
+        uint8_t* dst, ptrdiff_t dstStride,
+        int width, int height,
+        uint8_t* bits, ptrdiff_t bitsStride,
+        uint32_t* rawHist, ThreadPool* pool);
+};
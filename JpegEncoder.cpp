@@ -0,0 +1,549 @@
+// -*- tab-width: 4; mode: c++ -*-
+//  JpegEncoder.cpp
+//
+
+#include <string.h>
+#include "JpegEncoder.h"
+
+// Zigzag position -> natural (row-major) index.
+static const uint8_t NATURAL_ORDER[64] = {
+     0,  1,  8, 16,  9,  2,  3, 10,
+    17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34,
+    27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36,
+    29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46,
+    53, 60, 61, 54, 47, 55, 62, 63,
+};
+
+// The luminance quantization table of the JPEG standard (Annex K).
+static const uint8_t STD_QTABLE[64] = {
+    16,  11,  10,  16,  24,  40,  51,  61,
+    12,  12,  14,  19,  26,  58,  60,  55,
+    14,  13,  16,  24,  40,  57,  69,  56,
+    14,  17,  22,  29,  51,  87,  80,  62,
+    18,  22,  37,  56,  68, 109, 103,  77,
+    24,  35,  55,  64,  81, 104, 113,  92,
+    49,  64,  78,  87, 103, 121, 120, 101,
+    72,  92,  95,  98, 112, 100, 103,  99,
+};
+
+// The luminance Huffman tables of the JPEG standard (Annex K).
+static const uint8_t DC_BITS[16] = {
+    0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0,
+};
+static const uint8_t DC_VALS[12] = {
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11,
+};
+static const uint8_t AC_BITS[16] = {
+    0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d,
+};
+static const uint8_t AC_VALS[162] = {
+    0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12,
+    0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+    0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08,
+    0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+    0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16,
+    0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39,
+    0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+    0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59,
+    0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+    0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79,
+    0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+    0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98,
+    0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+    0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6,
+    0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+    0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4,
+    0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+    0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea,
+    0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa,
+};
+
+// Scale factors of the AAN DCT.
+static const float AAN_SCALES[8] = {
+    1.0f, 1.387039845f, 1.306562965f, 1.175875602f,
+    1.0f, 0.785694958f, 0.541196100f, 0.275899379f,
+};
+
+// HuffmanCodes: code words and lengths indexed by symbol.
+struct HuffmanCodes
+{
+    uint16_t code[256];
+    uint8_t size[256];
+
+    HuffmanCodes(const uint8_t* bits, const uint8_t* vals) {
+        memset(code, 0, sizeof(code));
+        memset(size, 0, sizeof(size));
+        uint16_t c = 0;
+        int k = 0;
+        for (int n = 1; n <= 16; n++) {
+            for (int i = 0; i < bits[n-1]; i++) {
+                code[vals[k]] = c++;
+                size[vals[k]] = n;
+                k++;
+            }
+            c <<= 1;
+        }
+    }
+};
+
+static const HuffmanCodes& getDCCodes()
+{
+    static const HuffmanCodes codes(DC_BITS, DC_VALS);
+    return codes;
+}
+
+static const HuffmanCodes& getACCodes()
+{
+    static const HuffmanCodes codes(AC_BITS, AC_VALS);
+    return codes;
+}
+
+// getCategory: the number of bits needed for a coefficient.
+static inline int getCategory(int v)
+{
+    unsigned int a = (v < 0)? -v : v;
+    int n = 0;
+    while (a) {
+        n++;
+        a >>= 1;
+    }
+    return n;
+}
+
+// quantize: round a scaled coefficient to the nearest integer.
+static inline int16_t quantize(float v)
+{
+    return (int16_t)((int)(v + 16384.5f) - 16384);
+}
+
+// fdct8: one pass of the AAN forward DCT over 8 values.
+static inline void fdct8(float* d, int step)
+{
+    float tmp0 = d[0*step] + d[7*step];
+    float tmp7 = d[0*step] - d[7*step];
+    float tmp1 = d[1*step] + d[6*step];
+    float tmp6 = d[1*step] - d[6*step];
+    float tmp2 = d[2*step] + d[5*step];
+    float tmp5 = d[2*step] - d[5*step];
+    float tmp3 = d[3*step] + d[4*step];
+    float tmp4 = d[3*step] - d[4*step];
+
+    // Even part.
+    float tmp10 = tmp0 + tmp3;
+    float tmp13 = tmp0 - tmp3;
+    float tmp11 = tmp1 + tmp2;
+    float tmp12 = tmp1 - tmp2;
+    d[0*step] = tmp10 + tmp11;
+    d[4*step] = tmp10 - tmp11;
+    float z1 = (tmp12 + tmp13) * 0.707106781f;
+    d[2*step] = tmp13 + z1;
+    d[6*step] = tmp13 - z1;
+
+    // Odd part.
+    tmp10 = tmp4 + tmp5;
+    tmp11 = tmp5 + tmp6;
+    tmp12 = tmp6 + tmp7;
+    float z5 = (tmp10 - tmp12) * 0.382683433f;
+    float z2 = 0.541196100f * tmp10 + z5;
+    float z4 = 1.306562965f * tmp12 + z5;
+    float z3 = tmp11 * 0.707106781f;
+    float z11 = tmp7 + z3;
+    float z13 = tmp7 - z3;
+    d[5*step] = z13 + z2;
+    d[3*step] = z13 - z2;
+    d[1*step] = z11 + z4;
+    d[7*step] = z11 - z4;
+}
+
+// fdct: 2-D forward DCT in place. The output is scaled by the
+//   AAN factors, which are folded into the quantizer.
+static void fdct(float* block)
+{
+    for (int i = 0; i < 8; i++) {
+        fdct8(block + i*8, 1);
+    }
+    for (int i = 0; i < 8; i++) {
+        fdct8(block + i, 8);
+    }
+}
+
+
+//  JpegEncoder
+//
+JpegEncoder::JpegEncoder(int quality)
+{
+    _cache = new CacheEntry[CACHE_SIZE];
+    _levels[0] = 255;
+    _levels[1] = 0;
+    _out = NULL;
+    _bits = 0;
+    _nbits = 0;
+    _lastDC = 0;
+    // A zero DC difference and an EOB.
+    const HuffmanCodes& dc = getDCCodes();
+    const HuffmanCodes& ac = getACCodes();
+    _sameBlockCode = (dc.code[0] << ac.size[0x00]) | ac.code[0x00];
+    _sameBlockBits = dc.size[0] + ac.size[0x00];
+    SetQuality(quality);
+}
+
+JpegEncoder::~JpegEncoder()
+{
+    delete[] _cache;
+}
+
+void JpegEncoder::SetQuality(int quality)
+{
+    if (quality < 1) quality = 1;
+    if (100 < quality) quality = 100;
+    _quality = quality;
+
+    // The scaling of the IJG library.
+    int scale = (quality < 50)? 5000/quality : 200 - quality*2;
+    for (int k = 0; k < 64; k++) {
+        int i = NATURAL_ORDER[k];
+        int q = (STD_QTABLE[i]*scale + 50) / 100;
+        if (q < 1) q = 1;
+        if (255 < q) q = 255;
+        _qtable[k] = (uint8_t)q;
+        _scales[i] = 1.0f / (q * AAN_SCALES[i >> 3] * AAN_SCALES[i & 7] * 8.0f);
+    }
+    for (int level = 0; level < 256; level++) {
+        _uniformDC[level] = quantize((level-128) * 64.0f * _scales[0]);
+    }
+    for (int i = 0; i < CACHE_SIZE; i++) {
+        _cache[i].valid = false;
+    }
+}
+
+void JpegEncoder::SetLevels(uint8_t clear, uint8_t set)
+{
+    if (_levels[0] == clear && _levels[1] == set) return;
+    _levels[0] = clear;
+    _levels[1] = set;
+    for (int i = 0; i < CACHE_SIZE; i++) {
+        _cache[i].valid = false;
+    }
+}
+
+void JpegEncoder::WriteHeaders(int width, int height)
+{
+    static const uint8_t SOI_APP0[] = {
+        0xff, 0xd8,                 // SOI
+        0xff, 0xe0, 0x00, 0x10,     // APP0 (JFIF 1.1, no density)
+        'J', 'F', 'I', 'F', 0x00, 0x01, 0x01,
+        0x00, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00,
+    };
+    std::vector<uint8_t>& out = *_out;
+    out.insert(out.end(), SOI_APP0, SOI_APP0+sizeof(SOI_APP0));
+
+    // DQT
+    static const uint8_t DQT[] = { 0xff, 0xdb, 0x00, 0x43, 0x00 };
+    out.insert(out.end(), DQT, DQT+sizeof(DQT));
+    out.insert(out.end(), _qtable, _qtable+64);
+
+    // SOF0: 8-bit, one component with 1x1 sampling and table 0.
+    uint8_t sof[] = {
+        0xff, 0xc0, 0x00, 0x0b, 0x08,
+        (uint8_t)(height >> 8), (uint8_t)height,
+        (uint8_t)(width >> 8), (uint8_t)width,
+        0x01, 0x01, 0x11, 0x00,
+    };
+    out.insert(out.end(), sof, sof+sizeof(sof));
+
+    // DHT
+    static const uint8_t DHT[] = {
+        0xff, 0xc4, 0x00, 2 + 1+16+sizeof(DC_VALS) + 1+16+sizeof(AC_VALS),
+    };
+    out.insert(out.end(), DHT, DHT+sizeof(DHT));
+    out.push_back(0x00);
+    out.insert(out.end(), DC_BITS, DC_BITS+16);
+    out.insert(out.end(), DC_VALS, DC_VALS+sizeof(DC_VALS));
+    out.push_back(0x10);
+    out.insert(out.end(), AC_BITS, AC_BITS+16);
+    out.insert(out.end(), AC_VALS, AC_VALS+sizeof(AC_VALS));
+
+    // SOS
+    static const uint8_t SOS[] = {
+        0xff, 0xda, 0x00, 0x08, 0x01, 0x01, 0x00, 0x00, 0x3f, 0x00,
+    };
+    out.insert(out.end(), SOS, SOS+sizeof(SOS));
+
+    _pos = out.size();
+    _bits = 0;
+    _nbits = 0;
+    _lastDC = 0;
+}
+
+// Reserve: make room for one more block.
+inline void JpegEncoder::Reserve()
+{
+    size_t size = _out->size();
+    if (size < _pos + MAX_BLOCK_BYTES) {
+        _out->resize((_pos + MAX_BLOCK_BYTES < size*2)? size*2 : _pos + MAX_BLOCK_BYTES);
+    }
+}
+
+// PutBits: append n bits (n <= 32, code < 2^n).
+inline void JpegEncoder::PutBits(uint32_t code, int n)
+{
+    _bits = (_bits << n) | code;
+    _nbits += n;
+    if (32 <= _nbits) {
+        _nbits -= 32;
+        PutBytes((uint32_t)(_bits >> _nbits));
+    }
+}
+
+// PutBytes: append 32 bits, stuffing a zero after each 0xff.
+inline void JpegEncoder::PutBytes(uint32_t word)
+{
+    uint8_t* p = &(*_out)[_pos];
+    uint32_t x = ~word;
+    if (((x - 0x01010101) & ~x & 0x80808080) == 0) {
+        // No 0xff byte.
+        p[0] = (uint8_t)(word >> 24);
+        p[1] = (uint8_t)(word >> 16);
+        p[2] = (uint8_t)(word >> 8);
+        p[3] = (uint8_t)word;
+        _pos += 4;
+        return;
+    }
+    for (int i = 24; 0 <= i; i -= 8) {
+        uint8_t b = (uint8_t)(word >> i);
+        *p++ = b;
+        if (b == 0xff) {
+            *p++ = 0x00;
+        }
+    }
+    _pos = p - &(*_out)[0];
+}
+
+void JpegEncoder::FlushBits()
+{
+    Reserve();
+    // Pad the last byte with 1s.
+    int pad = (8 - (_nbits & 7)) & 7;
+    PutBits((1U << pad)-1, pad);
+    std::vector<uint8_t>& out = *_out;
+    while (_nbits) {
+        _nbits -= 8;
+        uint8_t b = (uint8_t)(_bits >> _nbits);
+        out[_pos++] = b;
+        if (b == 0xff) {
+            out[_pos++] = 0x00;
+        }
+    }
+    out[_pos++] = 0xff;
+    out[_pos++] = 0xd9;             // EOI
+    out.resize(_pos);
+}
+
+void JpegEncoder::BitString::Put(uint32_t code, int n)
+{
+    int i = nbits >> 5;
+    int room = 32 - (nbits & 31);
+    if (n <= room) {
+        if (room == 32) {
+            words[i] = code << (32 - n);
+        } else {
+            words[i] |= code << (room - n);
+        }
+    } else {
+        words[i] |= code >> (n - room);
+        words[i+1] = code << (32 - (n - room));
+    }
+    nbits += n;
+}
+
+void JpegEncoder::EncodeDC(int dc)
+{
+    const HuffmanCodes& codes = getDCCodes();
+    int diff = dc - _lastDC;
+    _lastDC = dc;
+    int n = getCategory(diff);
+    PutBits(codes.code[n], codes.size[n]);
+    if (n) {
+        PutBits((uint32_t)((diff < 0)? diff-1 : diff) & ((1U << n)-1), n);
+    }
+}
+
+void JpegEncoder::EncodeAC(const int16_t* coefs, BitString* ac)
+{
+    const HuffmanCodes& codes = getACCodes();
+    ac->nbits = 0;
+    int run = 0;
+    for (int k = 1; k < 64; k++) {
+        int v = coefs[k];
+        if (v == 0) {
+            run++;
+            continue;
+        }
+        while (16 <= run) {
+            ac->Put(codes.code[0xf0], codes.size[0xf0]);    // ZRL
+            run -= 16;
+        }
+        int n = getCategory(v);
+        int sym = (run << 4) | n;
+        ac->Put(codes.code[sym], codes.size[sym]);
+        ac->Put((uint32_t)((v < 0)? v-1 : v) & ((1U << n)-1), n);
+        run = 0;
+    }
+    if (run) {
+        ac->Put(codes.code[0x00], codes.size[0x00]);        // EOB
+    }
+}
+
+inline void JpegEncoder::PutBitString(const BitString& s)
+{
+    int full = s.nbits >> 5;
+    for (int i = 0; i < full; i++) {
+        PutBits(s.words[i], 32);
+    }
+    int rest = s.nbits & 31;
+    if (rest) {
+        PutBits(s.words[full] >> (32 - rest), rest);
+    }
+}
+
+// EncodeBlock: DCT, quantize and code a block in full.
+void JpegEncoder::EncodeBlock(const float* block)
+{
+    float tmp[64];
+    int16_t coefs[64];
+    BitString ac;
+    memcpy(tmp, block, sizeof(tmp));
+    fdct(tmp);
+    QuantizeBlock(tmp, coefs);
+    EncodeDC(coefs[0]);
+    EncodeAC(coefs, &ac);
+    PutBitString(ac);
+}
+
+// EncodeUniform: a block of a single level has only a DC term.
+inline void JpegEncoder::EncodeUniform(int level)
+{
+    int dc = _uniformDC[level];
+    if (dc == _lastDC) {
+        // The most common case in a row of blank blocks.
+        PutBits(_sameBlockCode, _sameBlockBits);
+    } else {
+        const HuffmanCodes& codes = getACCodes();
+        EncodeDC(dc);
+        PutBits(codes.code[0x00], codes.size[0x00]);
+    }
+}
+
+void JpegEncoder::QuantizeBlock(const float* block, int16_t* coefs)
+{
+    for (int k = 0; k < 64; k++) {
+        int i = NATURAL_ORDER[k];
+        coefs[k] = quantize(block[i] * _scales[i]);
+    }
+}
+
+void JpegEncoder::EncodeGray(
+    std::vector<uint8_t>* out,
+    const uint8_t* src, ptrdiff_t stride,
+    int width, int height)
+{
+    out->clear();
+    if (width <= 0 || height <= 0 || 65535 < width || 65535 < height) return;
+    _out = out;
+    WriteHeaders(width, height);
+
+    for (int by = 0; by < height; by += 8) {
+        const uint8_t* rows[8];
+        for (int y = 0; y < 8; y++) {
+            int sy = (by+y < height)? by+y : height-1;
+            rows[y] = src + stride*sy;
+        }
+        for (int bx = 0; bx < width; bx += 8) {
+            float block[64];
+            int first = rows[0][bx];
+            bool uniform = true;
+            for (int y = 0; y < 8; y++) {
+                const uint8_t* p = rows[y];
+                for (int x = 0; x < 8; x++) {
+                    int sx = (bx+x < width)? bx+x : width-1;
+                    int v = p[sx];
+                    uniform = uniform && (v == first);
+                    block[y*8+x] = (float)(v - 128);
+                }
+            }
+            Reserve();
+            if (uniform) {
+                EncodeUniform(first);
+            } else {
+                EncodeBlock(block);
+            }
+        }
+    }
+    FlushBits();
+    _out = NULL;
+}
+
+void JpegEncoder::EncodeBits(
+    std::vector<uint8_t>* out,
+    const uint8_t* bits, ptrdiff_t stride,
+    int width, int height)
+{
+    out->clear();
+    if (width <= 0 || height <= 0 || 65535 < width || 65535 < height) return;
+    _out = out;
+    WriteHeaders(width, height);
+
+    // A block is 8 pixels wide, which is exactly one byte of a row,
+    // so its 8 bytes make up the key. The padding bits at the right
+    // edge are clear.
+    int nbx = (width+7) >> 3;
+    for (int by = 0; by < height; by += 8) {
+        const uint8_t* rows[8];
+        for (int y = 0; y < 8; y++) {
+            int sy = (by+y < height)? by+y : height-1;
+            rows[y] = bits + stride*sy;
+        }
+        for (int bx = 0; bx < nbx; bx++) {
+            uint64_t key = 0;
+            for (int y = 0; y < 8; y++) {
+                key = (key << 8) | rows[y][bx];
+            }
+            Reserve();
+            if (key == 0) {
+                EncodeUniform(_levels[0]);
+                continue;
+            } else if (key == ~(uint64_t)0) {
+                EncodeUniform(_levels[1]);
+                continue;
+            }
+
+            CacheEntry* entry = &_cache[(key * 0x9e3779b97f4a7c15ULL) >> (64 - CACHE_BITS)];
+            if (!entry->valid || entry->key != key) {
+                float block[64];
+                int16_t coefs[64];
+                for (int y = 0; y < 8; y++) {
+                    uint8_t b = (uint8_t)(key >> (56 - y*8));
+                    for (int x = 0; x < 8; x++) {
+                        int level = _levels[(b >> (7-x)) & 1];
+                        block[y*8+x] = (float)(level - 128);
+                    }
+                }
+                fdct(block);
+                QuantizeBlock(block, coefs);
+                EncodeAC(coefs, &entry->ac);
+                entry->dc = coefs[0];
+                entry->key = key;
+                entry->valid = true;
+            }
+            EncodeDC(entry->dc);
+            PutBitString(entry->ac);
+        }
+    }
+    FlushBits();
+    _out = NULL;
+}
@@ -0,0 +1,95 @@
+// -*- tab-width: 4; mode: c++ -*-
+//  JpegEncoder.h
+//
+//  A baseline JPEG encoder for grayscale (single component) images.
+//
+//  Only the standard luminance Huffman tables are used, so nothing
+//  is computed per image but the DCT. Uniform blocks, which make up
+//  most of a board, skip the DCT and cost a few bits each. For a
+//  bit plane, the coded AC part of each block, which does not
+//  depend on its neighbors, is cached by the bit pattern, so a
+//  repeated pattern is just copied to the output.
+//
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+
+//  JpegEncoder
+//
+class JpegEncoder
+{
+private:
+    static const int CACHE_BITS = 10;
+    static const int CACHE_SIZE = 1 << CACHE_BITS;
+    // The longest AC part: 63 codes of 16+10 bits.
+    static const int AC_WORDS = (63*26+31) / 32;
+    // The most bytes a block can take, with 0xff stuffing.
+    static const int MAX_BLOCK_BYTES = 2*(16+11+63*26+7)/8 + 8;
+
+    //  BitString: coded bits, MSB first.
+    struct BitString {
+        uint32_t words[AC_WORDS];
+        int nbits;
+        void Put(uint32_t code, int n);
+    };
+
+    struct CacheEntry {
+        uint64_t key;
+        bool valid;
+        int dc;                 // the quantized DC term.
+        BitString ac;
+    };
+
+    int _quality;
+    uint8_t _qtable[64];        // in zigzag order.
+    float _scales[64];          // quantizer multipliers, natural order.
+    int _uniformDC[256];        // the DC term of a block of each level.
+    uint32_t _sameBlockCode;    // a uniform block like the previous one.
+    int _sameBlockBits;
+    uint8_t _levels[2];         // gray levels of a clear and a set bit.
+    CacheEntry* _cache;
+
+    // Output state.
+    std::vector<uint8_t>* _out;
+    size_t _pos;
+    uint64_t _bits;
+    int _nbits;
+    int _lastDC;
+
+    JpegEncoder(const JpegEncoder&);
+    JpegEncoder& operator=(const JpegEncoder&);
+
+    void WriteHeaders(int width, int height);
+    void Reserve();
+    void PutBits(uint32_t code, int n);
+    void PutBytes(uint32_t word);
+    void PutBitString(const BitString& s);
+    void FlushBits();
+    void EncodeDC(int dc);
+    void EncodeAC(const int16_t* coefs, BitString* ac);
+    void EncodeBlock(const float* block);
+    void EncodeUniform(int level);
+    void QuantizeBlock(const float* block, int16_t* coefs);
+
+public:
+    explicit JpegEncoder(int quality=75);
+    ~JpegEncoder();
+
+    void SetQuality(int quality);
+    int GetQuality()
+        { return _quality; }
+    // SetLevels: sets the gray levels used by EncodeBits().
+    void SetLevels(uint8_t clear, uint8_t set);
+
+    // EncodeGray: encodes an 8-bit grayscale image.
+    void EncodeGray(std::vector<uint8_t>* out,
+                    const uint8_t* src, ptrdiff_t stride,
+                    int width, int height);
+    // EncodeBits: encodes a bit plane (MSB first).
+    void EncodeBits(std::vector<uint8_t>* out,
+                    const uint8_t* bits, ptrdiff_t stride,
+                    int width, int height);
+};
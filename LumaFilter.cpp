@@ -0,0 +1,314 @@
+// -*- tab-width: 4; mode: c++ -*-
+//  LumaFilter.cpp
+//
+
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "LumaFilter.h"
+
+//  Constants
+//
+static const int MAX_AMOUNT = 500;
+static const int DEFAULT_MOTION = 24;
+
+void initFilterParams(FilterParams* params)
+{
+    params->radius = 0;
+    params->passes = 3;
+    params->amount = 0;
+    params->median = 0;
+    params->temporal = 0;
+    params->motion = DEFAULT_MOTION;
+}
+
+
+//  LumaFilter
+//
+LumaFilter::LumaFilter()
+{
+    _width = 0;
+    _radius = 0;
+    _passes = 1;
+    _amount = 0;
+    _recip = 0;
+    _bias = 0;
+    for (int i = 0; i < MAX_PASSES; i++) {
+        _pass[i].ring = NULL;
+        _pass[i].sums = NULL;
+        _pass[i].out = NULL;
+        _pass[i].rows = 0;
+    }
+    _row = NULL;
+    _input = NULL;
+    _sharp = NULL;
+    _pushed = 0;
+    _emitted = 0;
+}
+
+LumaFilter::~LumaFilter()
+{
+    Release();
+}
+
+bool LumaFilter::Setup(int width)
+{
+    if (width == _width) return true;
+    Release();
+    if (width <= 0) return false;
+
+    bool ok = true;
+    for (int i = 0; i < MAX_PASSES; i++) {
+        _pass[i].ring = (uint8_t*)malloc((size_t)MAX_WINDOW*width);
+        _pass[i].sums = (uint16_t*)malloc(sizeof(uint16_t)*width);
+        _pass[i].out = (uint8_t*)malloc(width);
+        ok = ok && (_pass[i].ring != NULL && _pass[i].sums != NULL &&
+                    _pass[i].out != NULL);
+    }
+    _row = (uint8_t*)malloc(2*width);
+    _input = (uint8_t*)malloc((size_t)MAX_DELAY*width);
+    _sharp = (uint8_t*)malloc(width);
+    if (!ok || _row == NULL || _input == NULL || _sharp == NULL) {
+        Release();
+        return false;
+    }
+    _width = width;
+    return true;
+}
+
+void LumaFilter::Release()
+{
+    for (int i = 0; i < MAX_PASSES; i++) {
+        free(_pass[i].ring);
+        free(_pass[i].sums);
+        free(_pass[i].out);
+        _pass[i].ring = NULL;
+        _pass[i].sums = NULL;
+        _pass[i].out = NULL;
+    }
+    free(_row);
+    free(_input);
+    free(_sharp);
+    _row = NULL;
+    _input = NULL;
+    _sharp = NULL;
+    _width = 0;
+    _radius = 0;
+}
+
+void LumaFilter::Configure(const FilterParams* params)
+{
+    int radius = params->radius;
+    int passes = params->passes;
+    int amount = params->amount;
+    _radius = ((_width == 0 || radius < 0)? 0 :
+               (MAX_RADIUS < radius)? MAX_RADIUS : radius);
+    _passes = (passes < 1)? 1 : (MAX_PASSES < passes)? MAX_PASSES : passes;
+    _amount = (amount < 0)? 0 : (MAX_AMOUNT < amount)? MAX_AMOUNT : amount;
+    _recip = (uint16_t)((65536 + 2*_radius) / (2*_radius+1));
+    _bias = (uint16_t)_radius;
+}
+
+void LumaFilter::Begin()
+{
+    for (int i = 0; i < MAX_PASSES; i++) {
+        _pass[i].rows = 0;
+    }
+    _pushed = 0;
+    _emitted = 0;
+}
+
+// average: divides a window sum by 2*radius+1, rounding.
+//   It is (sum+bias)*recip >> 16, the same as the SSE2 code.
+static inline uint8_t average(uint32_t sum, uint32_t bias, uint32_t recip)
+{
+    return (uint8_t)(((sum + bias) * recip) >> 16);
+}
+
+// BlurRow: the horizontal box, repeating the edge pixels.
+void LumaFilter::BlurRow(uint8_t* dst, const uint8_t* src)
+{
+    int r = _radius;
+    int last = _width-1;
+    uint32_t recip = _recip;
+    uint32_t bias = _bias;
+    uint32_t sum = (r+1) * src[0];
+    for (int k = 1; k <= r; k++) {
+        sum += src[(k < last)? k : last];
+    }
+    // Clamp at the edges only.
+    int x = 0;
+    int left = (r+1 < _width)? r+1 : _width;
+    for (; x < left; x++) {
+        dst[x] = average(sum, bias, recip);
+        int add = x+r+1;
+        sum += src[(add < last)? add : last];
+        sum -= src[0];
+    }
+    int right = _width-r-1;
+    for (; x < right; x++) {
+        dst[x] = average(sum, bias, recip);
+        sum += src[x+r+1];
+        sum -= src[x-r];
+    }
+    for (; x < _width; x++) {
+        dst[x] = average(sum, bias, recip);
+        int sub = x-r;
+        sum += src[last];
+        sum -= src[(0 < sub)? sub : 0];
+    }
+}
+
+// slideSums: sums += row - old; old = row.
+static void slideSums(uint16_t* sums, uint8_t* old, const uint8_t* row, int width)
+{
+    int x = 0;
+#ifdef __SSE2__
+    __m128i zero = _mm_setzero_si128();
+    for (; x+16 <= width; x += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(row+x));
+        __m128i b = _mm_loadu_si128((const __m128i*)(old+x));
+        __m128i lo = _mm_loadu_si128((const __m128i*)(sums+x));
+        __m128i hi = _mm_loadu_si128((const __m128i*)(sums+x+8));
+        lo = _mm_add_epi16(lo, _mm_unpacklo_epi8(a, zero));
+        lo = _mm_sub_epi16(lo, _mm_unpacklo_epi8(b, zero));
+        hi = _mm_add_epi16(hi, _mm_unpackhi_epi8(a, zero));
+        hi = _mm_sub_epi16(hi, _mm_unpackhi_epi8(b, zero));
+        _mm_storeu_si128((__m128i*)(sums+x), lo);
+        _mm_storeu_si128((__m128i*)(sums+x+8), hi);
+        _mm_storeu_si128((__m128i*)(old+x), a);
+    }
+#endif
+    for (; x < width; x++) {
+        sums[x] = (uint16_t)(sums[x] + row[x] - old[x]);
+        old[x] = row[x];
+    }
+}
+
+// averageSums: out = average(sums).
+static void averageSums(uint8_t* out, const uint16_t* sums, int width,
+                        uint16_t bias, uint16_t recip)
+{
+    int x = 0;
+#ifdef __SSE2__
+    __m128i b = _mm_set1_epi16((short)bias);
+    __m128i m = _mm_set1_epi16((short)recip);
+    for (; x+16 <= width; x += 16) {
+        __m128i lo = _mm_loadu_si128((const __m128i*)(sums+x));
+        __m128i hi = _mm_loadu_si128((const __m128i*)(sums+x+8));
+        lo = _mm_mulhi_epu16(_mm_add_epi16(lo, b), m);
+        hi = _mm_mulhi_epu16(_mm_add_epi16(hi, b), m);
+        _mm_storeu_si128((__m128i*)(out+x), _mm_packus_epi16(lo, hi));
+    }
+#endif
+    for (; x < width; x++) {
+        out[x] = average(sums[x], bias, recip);
+    }
+}
+
+// PushPass: adds a row to the vertical box of pass i and returns
+//   the next blurred row, or NULL while the window is filling.
+const uint8_t* LumaFilter::PushPass(int i, const uint8_t* row)
+{
+    Pass* pass = &_pass[i];
+    int window = 2*_radius+1;
+    int width = _width;
+    uint16_t* sums = pass->sums;
+    if (pass->rows == 0) {
+        // The first row stands for the rows above the top.
+        for (int k = 0; k <= _radius; k++) {
+            memcpy(pass->ring + (size_t)k*width, row, width);
+        }
+        memset(pass->ring + (size_t)(_radius+1)*width, 0, (size_t)_radius*width);
+        for (int x = 0; x < width; x++) {
+            sums[x] = (uint16_t)((_radius+1) * row[x]);
+        }
+        pass->rows = _radius+1;
+    } else {
+        uint8_t* old = pass->ring + (size_t)(pass->rows % window)*width;
+        slideSums(sums, old, row, width);
+        pass->rows++;
+    }
+    if (pass->rows < window) return NULL;
+
+    averageSums(pass->out, sums, width, _bias, _recip);
+    return pass->out;
+}
+
+// Feed: pushes a row into pass i and on through the later passes.
+void LumaFilter::Feed(int i, const uint8_t* row, RowFunc func, void* context)
+{
+    const uint8_t* out = PushPass(i, row);
+    if (out == NULL) return;
+    if (i+1 < _passes) {
+        Feed(i+1, out, func, context);
+    } else {
+        Emit(out, func, context);
+    }
+}
+
+// Emit: hands a blurred row, or the mask of its input, to func.
+void LumaFilter::Emit(const uint8_t* blurred, RowFunc func, void* context)
+{
+    if (_amount == 0) {
+        func(context, blurred);
+        return;
+    }
+    int delay = _passes*_radius+1;
+    const uint8_t* src = _input + (size_t)(_emitted % delay)*_width;
+    int amount = _amount*256/100;
+    for (int x = 0; x < _width; x++) {
+        int v = src[x] + (((src[x] - blurred[x]) * amount) >> 8);
+        _sharp[x] = (uint8_t)((v < 0)? 0 : (255 < v)? 255 : v);
+    }
+    _emitted++;
+    func(context, _sharp);
+}
+
+void LumaFilter::Push(const uint8_t* row, RowFunc func, void* context)
+{
+    if (!IsActive()) {
+        func(context, row);
+        return;
+    }
+    if (_amount != 0) {
+        int delay = _passes*_radius+1;
+        memcpy(_input + (size_t)(_pushed % delay)*_width, row, _width);
+    }
+    _pushed++;
+
+    // The horizontal passes, back and forth between two rows.
+    uint8_t* a = _row;
+    uint8_t* b = _row + _width;
+    BlurRow(a, row);
+    for (int i = 1; i < _passes; i++) {
+        BlurRow(b, a);
+        uint8_t* t = a;
+        a = b;
+        b = t;
+    }
+    Feed(0, a, func, context);
+}
+
+void LumaFilter::Finish(RowFunc func, void* context)
+{
+    if (!IsActive() || _pushed == 0) return;
+    // Repeat the bottom row of each pass until it is drained.
+    int window = 2*_radius+1;
+    for (int i = 0; i < _passes; i++) {
+        Pass* pass = &_pass[i];
+        for (int k = 0; k < _radius; k++) {
+            const uint8_t* last = pass->ring +
+                (size_t)((pass->rows-1) % window)*_width;
+            const uint8_t* out = PushPass(i, last);
+            if (out == NULL) continue;
+            if (i+1 < _passes) {
+                Feed(i+1, out, func, context);
+            } else {
+                Emit(out, func, context);
+            }
+        }
+    }
+}
@@ -0,0 +1,113 @@
+// -*- tab-width: 4; mode: c++ -*-
+//  LumaFilter.h
+//
+//  Blurring and sharpening the luma plane, one row at a time.
+//
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+
+//  FilterParams
+//
+//  A box blur repeated a few times approximates a Gaussian: three
+//  passes of radius r are close to a sigma of r. With an amount,
+//  the blur is used as an unsharp mask instead. The temporal average
+//  (see TemporalFilter) and the median (see MedianFilter) come
+//  before either, in this order.
+//
+struct FilterParams
+{
+    int radius;                 // 0 = off.
+    int passes;                 // 1 (box) to 3 (Gaussian).
+    int amount;                 // of the unsharp mask in percent; 0 = blur.
+    int median;                 // 3 or 5 (3x3 or 5x5); 0 = off.
+    int temporal;               // average over 2^temporal frames; 0 = off.
+    int motion;                 // luma change that restarts the average.
+};
+
+// initFilterParams: set the parameters that change nothing.
+void initFilterParams(FilterParams* params);
+
+
+//  LumaFilter
+//
+//  Rows go in with Push() and come out through the callback, in
+//  order, passes*radius rows later; Finish() drains the rest,
+//  repeating the edge rows. Each pass keeps a ring of 2*radius+1
+//  rows and a 16-bit running sum per column, so a pixel costs the
+//  same for any radius and the frame is never stored. The column
+//  sums run along whole rows, 16 columns at a time in SSE2 registers.
+//
+class LumaFilter
+{
+public:
+    static const int MAX_RADIUS = 32;
+    static const int MAX_PASSES = 3;
+    // RowFunc: takes a row coming out, with its context.
+    typedef void (*RowFunc)(void* context, const uint8_t* row);
+
+private:
+    static const int MAX_WINDOW = 2*MAX_RADIUS+1;
+    static const int MAX_DELAY = MAX_PASSES*MAX_RADIUS+1;
+
+    struct Pass {
+        uint8_t* ring;          // [MAX_WINDOW][width]
+        uint16_t* sums;
+        uint8_t* out;
+        int rows;               // pushed since Begin().
+    };
+
+    int _width;
+    int _radius;
+    int _passes;
+    int _amount;
+    uint16_t _recip;            // 65536/(2*radius+1), rounded up.
+    uint16_t _bias;             // radius, to round the averages.
+    Pass _pass[MAX_PASSES];
+    uint8_t* _row;              // the horizontal passes.
+    uint8_t* _input;            // [MAX_DELAY][width] for the mask.
+    uint8_t* _sharp;
+    int _pushed;
+    int _emitted;
+
+    LumaFilter(const LumaFilter&);
+    LumaFilter& operator=(const LumaFilter&);
+
+    void BlurRow(uint8_t* dst, const uint8_t* src);
+    const uint8_t* PushPass(int i, const uint8_t* row);
+    void Feed(int i, const uint8_t* row, RowFunc func, void* context);
+    void Emit(const uint8_t* blurred, RowFunc func, void* context);
+
+    template <class F>
+    static void CallRow(void* context, const uint8_t* row)
+        { (*(const F*)context)(row); }
+    void Push(const uint8_t* row, RowFunc func, void* context);
+    void Finish(RowFunc func, void* context);
+
+public:
+    LumaFilter();
+    ~LumaFilter();
+
+    // Setup: allocates the rings for the largest radius.
+    bool Setup(int width);
+    void Release();
+    int GetWidth()
+        { return _width; }
+
+    // Configure: sets the parameters for the next frame.
+    void Configure(const FilterParams* params);
+    bool IsActive()
+        { return (0 < _radius); }
+
+    // Begin: starts a frame.
+    void Begin();
+    // Push, Finish: func(row) is called for each row coming out.
+    template <class F>
+    void Push(const uint8_t* row, const F& func)
+        { Push(row, &CallRow<F>, (void*)&func); }
+    template <class F>
+    void Finish(const F& func)
+        { Finish(&CallRow<F>, (void*)&func); }
+};
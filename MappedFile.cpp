@@ -0,0 +1,132 @@
+// -*- tab-width: 4; mode: c++ -*-
+//  MappedFile.cpp
+//
+
+#ifdef WINDOWS
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include "MappedFile.h"
+
+
+//  MappedFile
+//
+MappedFile::MappedFile()
+{
+    _data = NULL;
+    _size = 0;
+#ifdef WINDOWS
+    _file = INVALID_HANDLE_VALUE;
+    _mapping = NULL;
+#else
+    _fd = -1;
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+    Close();
+}
+
+#ifdef WINDOWS
+
+bool MappedFile::Open(const char* path)
+{
+    Close();
+    _file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                        OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (_file == INVALID_HANDLE_VALUE) return false;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(_file, &size) || size.QuadPart == 0 ||
+        (ULONGLONG)size.QuadPart != (size_t)size.QuadPart) {
+        Close();
+        return false;
+    }
+    _mapping = CreateFileMapping(_file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (_mapping == NULL) {
+        Close();
+        return false;
+    }
+    _data = (const uint8_t*)MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0);
+    if (_data == NULL) {
+        Close();
+        return false;
+    }
+    _size = (size_t)size.QuadPart;
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if (_data != NULL) {
+        UnmapViewOfFile(_data);
+        _data = NULL;
+    }
+    if (_mapping != NULL) {
+        CloseHandle(_mapping);
+        _mapping = NULL;
+    }
+    if (_file != INVALID_HANDLE_VALUE) {
+        CloseHandle(_file);
+        _file = INVALID_HANDLE_VALUE;
+    }
+    _size = 0;
+}
+
+void MappedFile::Advise(size_t offset, size_t length)
+{
+    // FILE_FLAG_SEQUENTIAL_SCAN already covers this.
+}
+
+#else
+
+bool MappedFile::Open(const char* path)
+{
+    Close();
+    _fd = open(path, O_RDONLY);
+    if (_fd < 0) return false;
+    struct stat st;
+    if (fstat(_fd, &st) != 0 || st.st_size == 0) {
+        Close();
+        return false;
+    }
+    void* p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, _fd, 0);
+    if (p == MAP_FAILED) {
+        Close();
+        return false;
+    }
+    _data = (const uint8_t*)p;
+    _size = st.st_size;
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if (_data != NULL) {
+        munmap((void*)_data, _size);
+        _data = NULL;
+    }
+    if (0 <= _fd) {
+        close(_fd);
+        _fd = -1;
+    }
+    _size = 0;
+}
+
+void MappedFile::Advise(size_t offset, size_t length)
+{
+    if (_data == NULL || _size <= offset) return;
+    // madvise wants a page-aligned start.
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t start = offset & ~(page-1);
+    if (_size - start < length + (offset-start)) {
+        length = _size - offset;
+    }
+    madvise((void*)(_data+start), length + (offset-start), MADV_SEQUENTIAL);
+}
+
+#endif
@@ -0,0 +1,45 @@
+// -*- tab-width: 4; mode: c++ -*-
+//  MappedFile.h
+//
+//  Read-only memory mapping of a whole file.
+//
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+
+//  MappedFile
+//
+class MappedFile
+{
+private:
+    const uint8_t* _data;
+    size_t _size;
+#ifdef WINDOWS
+    void* _file;
+    void* _mapping;
+#else
+    int _fd;
+#endif
+
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+public:
+    MappedFile();
+    ~MappedFile();
+
+    bool Open(const char* path);
+    void Close();
+    bool IsOpen()
+        { return _data != NULL; }
+
+    const uint8_t* GetData() const
+        { return _data; }
+    size_t GetSize() const
+        { return _size; }
+
+    // Advise: tells the kernel that the range will be read sequentially.
+    void Advise(size_t offset, size_t length);
+};
@@ -0,0 +1,340 @@
+// -*- tab-width: 4; mode: c++ -*-
+//  MedianFilter.cpp
+//
+//  The kernels are templates over the vector type: __m128i does
+//  16 pixels at a time and uint8_t does the ones that are left
+//  (or all of them without SSE2).
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "MedianFilter.h"
+
+// vmin, vmax, vload, vstore: the operations of the networks.
+static inline uint8_t vmin(uint8_t a, uint8_t b)
+{
+    return (a < b)? a : b;
+}
+
+static inline uint8_t vmax(uint8_t a, uint8_t b)
+{
+    return (a < b)? b : a;
+}
+
+static inline void vload(uint8_t& v, const uint8_t* p)
+{
+    v = *p;
+}
+
+static inline void vstore(uint8_t* p, uint8_t v)
+{
+    *p = v;
+}
+
+#ifdef __SSE2__
+static inline __m128i vmin(__m128i a, __m128i b)
+{
+    return _mm_min_epu8(a, b);
+}
+
+static inline __m128i vmax(__m128i a, __m128i b)
+{
+    return _mm_max_epu8(a, b);
+}
+
+static inline void vload(__m128i& v, const uint8_t* p)
+{
+    v = _mm_loadu_si128((const __m128i*)p);
+}
+
+static inline void vstore(uint8_t* p, __m128i v)
+{
+    _mm_storeu_si128((__m128i*)p, v);
+}
+#endif
+
+// sort2: a comparator.
+template <class V>
+static inline void sort2(V& a, V& b)
+{
+    V t = vmin(a, b);
+    b = vmax(a, b);
+    a = t;
+}
+
+// median3: the middle of three.
+template <class V>
+static inline V median3(V a, V b, V c)
+{
+    return vmax(vmin(a, b), vmin(vmax(a, b), c));
+}
+
+// sortColumns: sorts each column [x,end) of n rows into cols,
+//   the smallest first. Returns where it stopped.
+template <class V, int N>
+static int sortColumns(
+    uint8_t* const* cols, const uint8_t* const* rows, int x, int end)
+{
+    for (; x+(int)sizeof(V) <= end; x += sizeof(V)) {
+        V v[N];
+        for (int k = 0; k < N; k++) {
+            vload(v[k], rows[k]+x);
+        }
+        if (N == 3) {
+            sort2(v[0], v[1]); sort2(v[1], v[2]); sort2(v[0], v[1]);
+        } else {
+            sort2(v[0], v[1]); sort2(v[3], v[4]); sort2(v[2], v[4]);
+            sort2(v[2], v[3]); sort2(v[0], v[3]); sort2(v[0], v[2]);
+            sort2(v[1], v[4]); sort2(v[1], v[3]); sort2(v[1], v[2]);
+        }
+        for (int k = 0; k < N; k++) {
+            vstore(cols[k]+x, v[k]);
+        }
+    }
+    return x;
+}
+
+// median3x3: the median of three sorted columns is the middle of
+//   the largest low, the middle middle and the smallest high.
+//   cols[k][x-1] and cols[k][x+1] must be valid.
+template <class V>
+static int median3x3(uint8_t* dst, const uint8_t* const* cols, int x, int end)
+{
+    for (; x+(int)sizeof(V) <= end; x += sizeof(V)) {
+        V l0, l1, l2, m0, m1, m2, h0, h1, h2;
+        vload(l0, cols[0]+x-1); vload(l1, cols[0]+x); vload(l2, cols[0]+x+1);
+        vload(m0, cols[1]+x-1); vload(m1, cols[1]+x); vload(m2, cols[1]+x+1);
+        vload(h0, cols[2]+x-1); vload(h1, cols[2]+x); vload(h2, cols[2]+x+1);
+        V lo = vmax(vmax(l0, l1), l2);
+        V mid = median3(m0, m1, m2);
+        V hi = vmin(vmin(h0, h1), h2);
+        vstore(dst+x, median3(lo, mid, hi));
+    }
+    return x;
+}
+
+// median5x5: the median of five sorted columns.
+//   v[5*c+r] is row r of column c. The network is Batcher's merge
+//   sort of 32, less the comparators that never swap when the
+//   columns are sorted (by the 0-1 principle) and those that do not
+//   lead to v[12]. cols[k][x-2] and cols[k][x+2] must be valid.
+template <class V>
+static int median5x5(uint8_t* dst, const uint8_t* const* cols, int x, int end)
+{
+    for (; x+(int)sizeof(V) <= end; x += sizeof(V)) {
+        V v[25];
+        for (int c = 0; c < 5; c++) {
+            for (int r = 0; r < 5; r++) {
+                vload(v[5*c+r], cols[r]+x+c-2);
+            }
+        }
+        sort2(v[4], v[5]); sort2(v[5], v[7]); sort2(v[5], v[6]);
+        sort2(v[0], v[4]); sort2(v[2], v[6]); sort2(v[2], v[4]);
+        sort2(v[1], v[5]); sort2(v[3], v[5]); sort2(v[1], v[2]);
+        sort2(v[3], v[4]); sort2(v[5], v[6]); sort2(v[8], v[10]);
+        sort2(v[9], v[11]); sort2(v[9], v[10]); sort2(v[14], v[15]);
+        sort2(v[12], v[14]); sort2(v[13], v[14]); sort2(v[8], v[12]);
+        sort2(v[10], v[14]); sort2(v[10], v[12]); sort2(v[11], v[15]);
+        sort2(v[11], v[13]); sort2(v[9], v[10]); sort2(v[11], v[12]);
+        sort2(v[13], v[14]); sort2(v[0], v[8]); sort2(v[4], v[12]);
+        sort2(v[4], v[8]); sort2(v[2], v[10]); sort2(v[6], v[14]);
+        sort2(v[6], v[10]); sort2(v[2], v[4]); sort2(v[6], v[8]);
+        sort2(v[10], v[12]); sort2(v[1], v[9]); sort2(v[5], v[13]);
+        sort2(v[5], v[9]); sort2(v[3], v[11]); v[7] = vmin(v[7], v[15]);
+        sort2(v[7], v[11]); sort2(v[3], v[5]); sort2(v[7], v[9]);
+        sort2(v[11], v[13]); sort2(v[1], v[2]); sort2(v[3], v[4]);
+        sort2(v[5], v[6]); sort2(v[7], v[8]); sort2(v[9], v[10]);
+        sort2(v[11], v[12]); v[13] = vmin(v[13], v[14]); sort2(v[16], v[20]);
+        sort2(v[18], v[22]); sort2(v[18], v[20]); sort2(v[17], v[21]);
+        sort2(v[19], v[23]); sort2(v[19], v[21]); sort2(v[17], v[18]);
+        sort2(v[19], v[20]); sort2(v[21], v[22]); sort2(v[20], v[24]);
+        sort2(v[22], v[24]); sort2(v[21], v[22]); sort2(v[23], v[24]);
+        v[16] = vmax(v[0], v[16]); v[8] = vmin(v[8], v[24]);
+        v[16] = vmax(v[8], v[16]); v[20] = vmax(v[4], v[20]);
+        v[12] = vmin(v[12], v[20]); v[12] = vmin(v[12], v[16]);
+        v[18] = vmax(v[2], v[18]); v[10] = vmin(v[10], v[18]);
+        v[6] = vmin(v[6], v[22]); v[10] = vmax(v[6], v[10]);
+        v[12] = vmax(v[10], v[12]); v[17] = vmax(v[1], v[17]);
+        v[17] = vmax(v[9], v[17]); v[21] = vmax(v[5], v[21]);
+        v[13] = vmin(v[13], v[21]); v[13] = vmin(v[13], v[17]);
+        v[19] = vmax(v[3], v[19]); v[11] = vmin(v[11], v[19]);
+        v[7] = vmin(v[7], v[23]); v[11] = vmax(v[7], v[11]);
+        v[11] = vmin(v[11], v[13]); v[12] = vmax(v[11], v[12]);
+        vstore(dst+x, v[12]);
+    }
+    return x;
+}
+
+
+//  MedianFilter
+//
+MedianFilter::MedianFilter()
+{
+    _width = 0;
+    _size = 0;
+    _ring = NULL;
+    _cols = NULL;
+    _out = NULL;
+    _rows = 0;
+}
+
+MedianFilter::~MedianFilter()
+{
+    Release();
+}
+
+bool MedianFilter::Setup(int width)
+{
+    if (width == _width) return true;
+    Release();
+    if (width <= 0) return false;
+
+    size_t stride = width+2*PAD;
+    _ring = (uint8_t*)malloc(MAX_SIZE*stride);
+    _cols = (uint8_t*)malloc(MAX_SIZE*stride);
+    _out = (uint8_t*)malloc(width);
+    if (_ring == NULL || _cols == NULL || _out == NULL) {
+        Release();
+        return false;
+    }
+    _width = width;
+    return true;
+}
+
+void MedianFilter::Release()
+{
+    free(_ring);
+    free(_cols);
+    free(_out);
+    _ring = NULL;
+    _cols = NULL;
+    _out = NULL;
+    _width = 0;
+    _size = 0;
+}
+
+void MedianFilter::Configure(int size)
+{
+    _size = (_width == 0 || size < 3)? 0 : (size < 5)? 3 : 5;
+}
+
+void MedianFilter::Begin()
+{
+    _rows = 0;
+}
+
+// StoreRow: copies a row into slot i with the edge pixels repeated.
+void MedianFilter::StoreRow(int i, const uint8_t* row)
+{
+    uint8_t* slot = GetSlot(i);
+    memset(slot, row[0], PAD);
+    memcpy(slot+PAD, row, _width);
+    memset(slot+PAD+_width, row[_width-1], PAD);
+}
+
+// Filter: the median of the rows in the ring into _out.
+void MedianFilter::Filter()
+{
+    size_t stride = _width+2*PAD;
+    const uint8_t* rows[MAX_SIZE];
+    uint8_t* cols[MAX_SIZE];
+    for (int k = 0; k < _size; k++) {
+        rows[k] = _ring + k*stride;
+        cols[k] = _cols + k*stride;
+    }
+    int x = 0;
+    int end = (int)stride;
+    if (_size == 3) {
+#ifdef __SSE2__
+        x = sortColumns<__m128i, 3>(cols, rows, x, end);
+#endif
+        sortColumns<uint8_t, 3>(cols, rows, x, end);
+    } else {
+#ifdef __SSE2__
+        x = sortColumns<__m128i, 5>(cols, rows, x, end);
+#endif
+        sortColumns<uint8_t, 5>(cols, rows, x, end);
+    }
+
+    // The windows are centered on PAD+x.
+    for (int k = 0; k < _size; k++) {
+        cols[k] += PAD;
+    }
+    x = 0;
+    if (_size == 3) {
+#ifdef __SSE2__
+        x = median3x3<__m128i>(_out, cols, x, _width);
+#endif
+        median3x3<uint8_t>(_out, cols, x, _width);
+    } else {
+#ifdef __SSE2__
+        x = median5x5<__m128i>(_out, cols, x, _width);
+#endif
+        median5x5<uint8_t>(_out, cols, x, _width);
+    }
+}
+
+void MedianFilter::Push(const uint8_t* row, RowFunc func, void* context)
+{
+    if (!IsActive()) {
+        func(context, row);
+        return;
+    }
+    int half = _size/2;
+    if (_rows == 0) {
+        // The first row stands for the rows above the top.
+        for (int k = 0; k <= half; k++) {
+            StoreRow(k, row);
+        }
+        _rows = half+1;
+    } else {
+        StoreRow(_rows, row);
+        _rows++;
+    }
+    if (_rows < _size) return;
+
+    // The median does not care about the order of the rows.
+    Filter();
+    func(context, _out);
+}
+
+void MedianFilter::Finish(RowFunc func, void* context)
+{
+    if (!IsActive() || _rows == 0) return;
+    // Repeat the bottom row until it is drained.
+    int half = _size/2;
+    for (int k = 0; k < half; k++) {
+        StoreRow(_rows, GetSlot(_rows-1)+PAD);
+        _rows++;
+        if (_size <= _rows) {
+            Filter();
+            func(context, _out);
+        }
+    }
+}
+
+void getMedianReference(
+    uint8_t* dst, const uint8_t* src, size_t stride,
+    int width, int height, int size)
+{
+    int half = size/2;
+    uint8_t window[MedianFilter::MAX_SIZE*MedianFilter::MAX_SIZE];
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            int n = 0;
+            for (int dy = -half; dy <= half; dy++) {
+                int sy = (y+dy < 0)? 0 : (height <= y+dy)? height-1 : y+dy;
+                for (int dx = -half; dx <= half; dx++) {
+                    int sx = (x+dx < 0)? 0 : (width <= x+dx)? width-1 : x+dx;
+                    window[n++] = src[stride*sy + sx];
+                }
+            }
+            std::nth_element(window, window+n/2, window+n);
+            dst[stride*y + x] = window[n/2];
+        }
+    }
+}
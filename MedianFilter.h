@@ -0,0 +1,85 @@
+// -*- tab-width: 4; mode: c++ -*-
+//  MedianFilter.h
+//
+//  Removing impulse noise from the luma plane, one row at a time.
+//
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+
+//  MedianFilter
+//
+//  A 3x3 or 5x5 median. Rows go in with Push() and come out
+//  through the callback, in order, size/2 rows later; Finish()
+//  drains the rest, repeating the edge rows (and the edge columns).
+//
+//  Only the last size rows are kept, so the window stays in the
+//  L1 cache. Each column of the window is sorted once per row and
+//  shared by the neighboring windows; the median is then taken from
+//  the sorted columns with min/max networks, which run 16 pixels
+//  at a time in SSE2 registers. The results are exact.
+//
+class MedianFilter
+{
+public:
+    static const int MAX_SIZE = 5;
+    // RowFunc: takes a row coming out, with its context.
+    typedef void (*RowFunc)(void* context, const uint8_t* row);
+
+private:
+    static const int PAD = MAX_SIZE/2;
+
+    int _width;
+    int _size;                  // 0 = off, 3 or 5.
+    uint8_t* _ring;             // [MAX_SIZE][PAD+width+PAD]
+    uint8_t* _cols;             // [MAX_SIZE][PAD+width+PAD] sorted columns.
+    uint8_t* _out;
+    int _rows;                  // pushed since Begin().
+
+    MedianFilter(const MedianFilter&);
+    MedianFilter& operator=(const MedianFilter&);
+
+    uint8_t* GetSlot(int i)
+        { return _ring + (size_t)(i % _size)*(_width+2*PAD); }
+    void StoreRow(int i, const uint8_t* row);
+    void Filter();
+
+    template <class F>
+    static void CallRow(void* context, const uint8_t* row)
+        { (*(const F*)context)(row); }
+    void Push(const uint8_t* row, RowFunc func, void* context);
+    void Finish(RowFunc func, void* context);
+
+public:
+    MedianFilter();
+    ~MedianFilter();
+
+    // Setup: allocates the window for a row width.
+    bool Setup(int width);
+    void Release();
+    int GetWidth()
+        { return _width; }
+
+    // Configure: sets the size (0, 3 or 5) for the next frame.
+    void Configure(int size);
+    bool IsActive()
+        { return (0 < _size); }
+
+    // Begin: starts a frame.
+    void Begin();
+    // Push, Finish: func(row) is called for each row coming out.
+    template <class F>
+    void Push(const uint8_t* row, const F& func)
+        { Push(row, &CallRow<F>, (void*)&func); }
+    template <class F>
+    void Finish(const F& func)
+        { Finish(&CallRow<F>, (void*)&func); }
+};
+
+// getMedianReference: the same median, computed one pixel at a time
+//   by sorting the window, to check MedianFilter against.
+void getMedianReference(
+    uint8_t* dst, const uint8_t* src, size_t stride,
+    int width, int height, int size);
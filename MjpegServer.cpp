@@ -0,0 +1,476 @@
+// -*- tab-width: 4; mode: c++ -*-
+//  MjpegServer.cpp
+//
+
+#ifdef WINDOWS
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <errno.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include "MjpegServer.h"
+
+#ifdef WINDOWS
+static const socket_t NO_SOCKET = (socket_t)INVALID_SOCKET;
+#define SHUT_RDWR SD_BOTH
+#else
+static const socket_t NO_SOCKET = -1;
+#endif
+
+static const char BOUNDARY[] = "webcamooframe";
+
+static const char INDEX_PAGE[] =
+    "<!DOCTYPE html>\n"
+    "<html><head><title>WebCamoo</title>\n"
+    "<style>body{margin:0;background:#444}"
+    "img{display:block;width:100%;height:100vh;object-fit:contain}</style>\n"
+    "</head><body><img src=\"/stream\" alt=\"board\"></body></html>\n";
+
+// closeSocket: close a socket.
+static void closeSocket(socket_t sock)
+{
+#ifdef WINDOWS
+    closesocket((SOCKET)sock);
+#else
+    close(sock);
+#endif
+}
+
+// sendAll: send the whole buffer or fail.
+static bool sendAll(socket_t sock, const void* data, size_t size)
+{
+    const char* p = (const char*)data;
+    while (size) {
+        int n = (size < 0x40000000)? (int)size : 0x40000000;
+#ifdef WINDOWS
+        n = send((SOCKET)sock, p, n, 0);
+#else
+        // Do not die of SIGPIPE when a viewer goes away.
+        n = (int)send(sock, p, n, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+#endif
+        if (n <= 0) return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+// sendText: send a NUL-terminated string.
+static bool sendText(socket_t sock, const char* text)
+{
+    return sendAll(sock, text, strlen(text));
+}
+
+// sendError: send an HTTP error without a body.
+static void sendError(socket_t sock, const char* status)
+{
+    char buf[256];
+    snprintf(buf, sizeof(buf),
+             "HTTP/1.0 %s\r\n"
+             "Content-Length: 0\r\n"
+             "Connection: close\r\n"
+             "\r\n", status);
+    sendText(sock, buf);
+}
+
+// readRequest: read the request line and get the path.
+//   The headers are read up to the blank line and ignored.
+static bool readRequest(socket_t sock, char* path, size_t size)
+{
+    char buf[2048];
+    size_t n = 0;
+    while (n < sizeof(buf)-1) {
+#ifdef WINDOWS
+        int r = recv((SOCKET)sock, buf+n, (int)(sizeof(buf)-1-n), 0);
+#else
+        int r = (int)recv(sock, buf+n, sizeof(buf)-1-n, 0);
+        if (r < 0 && errno == EINTR) continue;
+#endif
+        if (r <= 0) return false;
+        n += r;
+        buf[n] = 0;
+        if (strstr(buf, "\r\n\r\n") != NULL || strstr(buf, "\n\n") != NULL) break;
+    }
+    buf[n] = 0;
+    if (strncmp(buf, "GET ", 4) != 0) return false;
+    const char* p = buf+4;
+    size_t len = strcspn(p, " ?\r\n");
+    if (len == 0 || size <= len) return false;
+    memcpy(path, p, len);
+    path[len] = 0;
+    return true;
+}
+
+
+//  MjpegServer
+//
+MjpegServer::MjpegServer()
+    : _running(false), _producing(false), _head(0), _tail(0),
+      _watching(0), _framesEncoded(0), _framesSent(0), _framesSkipped(0),
+      _lastEncodeTime(0), _maxEncodeTime(0)
+{
+    _width = 0;
+    _height = 0;
+    _rowbytes = 0;
+    _listener = NO_SOCKET;
+    _port = 0;
+    _serial = 0;
+    for (int i = 0; i < NSLOTS; i++) {
+        _slots[i] = NULL;
+    }
+}
+
+MjpegServer::~MjpegServer()
+{
+    Stop();
+}
+
+bool MjpegServer::Start(int port, int width, int height, bool loopback)
+{
+    Stop();
+    if (width <= 0 || height <= 0 || 65535 < width || 65535 < height) return false;
+
+#ifdef WINDOWS
+    WSADATA wsa;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) return false;
+    SOCKET sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (sock == INVALID_SOCKET) {
+        WSACleanup();
+        return false;
+    }
+#else
+    int sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (sock < 0) return false;
+    int on = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+#endif
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((unsigned short)port);
+    addr.sin_addr.s_addr = htonl(loopback? INADDR_LOOPBACK : INADDR_ANY);
+    socklen_t addrlen = sizeof(addr);
+    if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        listen(sock, 16) != 0 ||
+        getsockname(sock, (struct sockaddr*)&addr, &addrlen) != 0) {
+        closeSocket((socket_t)sock);
+#ifdef WINDOWS
+        WSACleanup();
+#endif
+        return false;
+    }
+
+    _rowbytes = (size_t)((width+7) >> 3);
+    for (int i = 0; i < NSLOTS; i++) {
+        _slots[i] = new uint8_t[_rowbytes * height];
+        memset(_slots[i], 0, _rowbytes * height);
+    }
+    _width = width;
+    _height = height;
+    _listener = (socket_t)sock;
+    _port = ntohs(addr.sin_port);
+    _head.store(0);
+    _tail.store(0);
+    _frame.reset();
+    _spare.reset();
+    _serial = 0;
+
+    _running.store(true);
+    _encoderThread = std::thread(&MjpegServer::EncoderLoop, this);
+    _acceptThread = std::thread(&MjpegServer::AcceptLoop, this);
+    return true;
+}
+
+void MjpegServer::Stop()
+{
+    if (!_running.load()) return;
+
+    // Stop accepting frames and wait for the streaming thread
+    // to finish the one it is filling, if any.
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _running.store(false);
+    }
+    while (_producing.load()) {
+        std::this_thread::yield();
+    }
+    _encoderCond.notify_all();
+    _frameCond.notify_all();
+    _acceptThread.join();
+    _encoderThread.join();
+
+    closeSocket(_listener);
+    _listener = NO_SOCKET;
+#ifdef WINDOWS
+    WSACleanup();
+#endif
+    for (int i = 0; i < NSLOTS; i++) {
+        delete[] _slots[i];
+        _slots[i] = NULL;
+    }
+    _frame.reset();
+    _spare.reset();
+    _width = 0;
+    _height = 0;
+}
+
+uint8_t* MjpegServer::BeginFrame(int width, int height)
+{
+    _producing.store(true);
+    // The size is only read once running, as Start() sets it first.
+    if (!_running.load() || _watching.load() == 0 ||
+        _width != width || _height != height) {
+        _producing.store(false);
+        return NULL;
+    }
+    uint32_t head = _head.load(std::memory_order_relaxed);
+    uint32_t tail = _tail.load(std::memory_order_acquire);
+    if (NSLOTS <= head - tail) {
+        // The encoder is behind; the viewers get the next frame.
+        _producing.store(false);
+        return NULL;
+    }
+    return _slots[head % NSLOTS];
+}
+
+void MjpegServer::CommitFrame()
+{
+    uint32_t head = _head.load(std::memory_order_relaxed);
+    _head.store(head+1, std::memory_order_release);
+    _producing.store(false);
+    _encoderCond.notify_one();
+}
+
+void MjpegServer::EncoderLoop()
+{
+    for (;;) {
+        uint32_t tail = _tail.load(std::memory_order_relaxed);
+        uint32_t head = _head.load(std::memory_order_acquire);
+        if (tail == head) {
+            if (!_running.load()) break;
+            // The producer never takes the lock, so a wakeup can be
+            // missed; the timeout bounds the delay.
+            std::unique_lock<std::mutex> lock(_mutex);
+            _encoderCond.wait_for(lock, std::chrono::milliseconds(10));
+            continue;
+        }
+
+        // Reuse the previous buffer unless a client still sends it.
+        FrameBuffer buf;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            buf = std::move(_spare);
+        }
+        if (!buf || buf.use_count() != 1) {
+            buf = std::make_shared<std::vector<uint8_t> >();
+        }
+
+        std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+        _encoder.EncodeBits(buf.get(), _slots[tail % NSLOTS], _rowbytes,
+                            _width, _height);
+        uint64_t t = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - t0).count();
+        _tail.store(tail+1, std::memory_order_release);
+        _lastEncodeTime.store(t);
+        uint64_t m = _maxEncodeTime.load();
+        while (m < t && !_maxEncodeTime.compare_exchange_weak(m, t)) ;
+        _framesEncoded++;
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _spare = std::move(_frame);
+            _frame = buf;
+            // Serial 0 means no frame.
+            if (++_serial == 0) _serial = 1;
+        }
+        _frameCond.notify_all();
+    }
+}
+
+void MjpegServer::AcceptLoop()
+{
+    while (_running.load()) {
+        ReapClients(false);
+
+        // Wake up now and then to check _running.
+        fd_set fds;
+        FD_ZERO(&fds);
+        FD_SET(_listener, &fds);
+        struct timeval tv;
+        tv.tv_sec = 0;
+        tv.tv_usec = 100000;
+        if (select((int)_listener+1, &fds, NULL, NULL, &tv) <= 0) continue;
+
+#ifdef WINDOWS
+        SOCKET s = accept((SOCKET)_listener, NULL, NULL);
+        if (s == INVALID_SOCKET) continue;
+        BOOL nodelay = TRUE;
+#else
+        int s = accept(_listener, NULL, NULL);
+        if (s < 0) continue;
+        int nodelay = 1;
+#endif
+        socket_t sock = (socket_t)s;
+        if (MAX_CLIENTS <= (int)_clients.size()) {
+            sendError(sock, "503 Service Unavailable");
+            closeSocket(sock);
+            continue;
+        }
+        // Frames are sent as soon as they are ready.
+        setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char*)&nodelay, sizeof(nodelay));
+
+        Client* client = new Client();
+        client->sock = sock;
+        client->done.store(false);
+        client->thread = std::thread(&MjpegServer::ServeClient, this, client);
+        _clients.push_back(client);
+    }
+    ReapClients(true);
+}
+
+// ReapClients: join the finished clients, or all of them.
+void MjpegServer::ReapClients(bool all)
+{
+    std::list<Client*>::iterator it = _clients.begin();
+    while (it != _clients.end()) {
+        Client* client = *it;
+        if (all) {
+            // Break off a blocking send().
+            shutdown(client->sock, SHUT_RDWR);
+        } else if (!client->done.load()) {
+            ++it;
+            continue;
+        }
+        client->thread.join();
+        closeSocket(client->sock);
+        delete client;
+        it = _clients.erase(it);
+    }
+}
+
+void MjpegServer::ServeClient(Client* client)
+{
+    socket_t sock = client->sock;
+    char path[256];
+    if (!readRequest(sock, path, sizeof(path))) {
+        sendError(sock, "400 Bad Request");
+    } else if (strcmp(path, "/") == 0) {
+        char buf[256];
+        snprintf(buf, sizeof(buf),
+                 "HTTP/1.0 200 OK\r\n"
+                 "Content-Type: text/html\r\n"
+                 "Content-Length: %u\r\n"
+                 "Connection: close\r\n"
+                 "\r\n", (unsigned)strlen(INDEX_PAGE));
+        if (sendText(sock, buf)) {
+            sendText(sock, INDEX_PAGE);
+        }
+    } else if (strcmp(path, "/stream") == 0) {
+        SendStream(sock);
+    } else if (strcmp(path, "/frame.jpg") == 0) {
+        SendSingle(sock);
+    } else {
+        sendError(sock, "404 Not Found");
+    }
+    shutdown(sock, SHUT_RDWR);
+    client->done.store(true);
+}
+
+// WaitFrame: wait for a frame newer than *serial.
+//   Returns false when stopped or timed out (in msec).
+bool MjpegServer::WaitFrame(uint32_t* serial, FrameBuffer* frame, int timeout)
+{
+    std::chrono::steady_clock::time_point until =
+        std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (_running.load() && _serial == *serial) {
+        if (timeout < 0) {
+            _frameCond.wait(lock);
+        } else if (_frameCond.wait_until(lock, until) == std::cv_status::timeout) {
+            break;
+        }
+    }
+    if (!_running.load() || _serial == *serial) return false;
+    if (*serial != 0 && 1 < _serial - *serial) {
+        _framesSkipped += _serial - *serial - 1;
+    }
+    *serial = _serial;
+    *frame = _frame;
+    return true;
+}
+
+void MjpegServer::SendStream(socket_t sock)
+{
+    char buf[256];
+    snprintf(buf, sizeof(buf),
+             "HTTP/1.0 200 OK\r\n"
+             "Content-Type: multipart/x-mixed-replace; boundary=%s\r\n"
+             "Cache-Control: no-cache, no-store\r\n"
+             "Pragma: no-cache\r\n"
+             "Connection: close\r\n"
+             "\r\n", BOUNDARY);
+    if (!sendText(sock, buf)) return;
+
+    _watching++;
+    uint32_t serial = 0;
+    FrameBuffer frame;
+    while (WaitFrame(&serial, &frame)) {
+        snprintf(buf, sizeof(buf),
+                 "--%s\r\n"
+                 "Content-Type: image/jpeg\r\n"
+                 "Content-Length: %u\r\n"
+                 "\r\n", BOUNDARY, (unsigned)frame->size());
+        if (!sendText(sock, buf) ||
+            !sendAll(sock, &(*frame)[0], frame->size()) ||
+            !sendText(sock, "\r\n")) break;
+        _framesSent++;
+        // Let the encoder reuse the buffer.
+        frame.reset();
+    }
+    _watching--;
+}
+
+void MjpegServer::SendSingle(socket_t sock)
+{
+    // Nothing is encoded while nobody watches, so wait for a
+    // fresh frame; fall back to the last one.
+    uint32_t serial;
+    FrameBuffer frame;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        serial = _serial;
+    }
+    _watching++;
+    if (!WaitFrame(&serial, &frame, 2000)) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        frame = _frame;
+    }
+    _watching--;
+    if (!frame) {
+        sendError(sock, "503 Service Unavailable");
+        return;
+    }
+
+    char buf[256];
+    snprintf(buf, sizeof(buf),
+             "HTTP/1.0 200 OK\r\n"
+             "Content-Type: image/jpeg\r\n"
+             "Content-Length: %u\r\n"
+             "Cache-Control: no-cache, no-store\r\n"
+             "Connection: close\r\n"
+             "\r\n", (unsigned)frame->size());
+    if (sendText(sock, buf)) {
+        sendAll(sock, &(*frame)[0], frame->size());
+        _framesSent++;
+    }
+}
@@ -0,0 +1,138 @@
+// -*- tab-width: 4; mode: c++ -*-
+//  MjpegServer.h
+//
+//  Serving the B/W board as multipart JPEG (MJPEG) over HTTP.
+//
+//  Paths:
+//    /            a page showing the stream.
+//    /stream      multipart/x-mixed-replace of JPEG frames.
+//    /frame.jpg   the next frame as a single JPEG.
+//
+//  Every frame is encoded once by the encoder thread, and the
+//  same buffer is sent to all the clients. Each client has its
+//  own sender thread, which always picks the newest frame when
+//  it is done with the previous one; a slow client just skips
+//  frames and never holds up the others or the stream.
+//
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "JpegEncoder.h"
+
+const int MJPEG_PORT = 8080;
+
+#ifdef WINDOWS
+typedef uintptr_t socket_t;     // SOCKET
+#else
+typedef int socket_t;
+#endif
+
+
+//  MjpegServer
+//
+//  The streaming thread calls BeginFrame() to obtain a pooled bit
+//  plane, fills it and calls CommitFrame(), like BoardRecorder.
+//  BeginFrame() returns NULL when nobody is watching or when the
+//  encoder is still busy, so it costs nothing to leave it on.
+//
+class MjpegServer
+{
+private:
+    static const int NSLOTS = 2;
+    static const int MAX_CLIENTS = 64;
+
+    typedef std::shared_ptr<std::vector<uint8_t> > FrameBuffer;
+
+    struct Client {
+        socket_t sock;
+        std::thread thread;
+        std::atomic<bool> done;
+    };
+
+    int _width;
+    int _height;
+    size_t _rowbytes;
+    socket_t _listener;
+    int _port;
+    std::atomic<bool> _running;
+    std::atomic<bool> _producing;
+
+    // Bit planes from the streaming thread (single producer).
+    uint8_t* _slots[NSLOTS];
+    std::atomic<uint32_t> _head;
+    std::atomic<uint32_t> _tail;
+
+    // The newest encoded frame, guarded by _mutex.
+    FrameBuffer _frame;
+    FrameBuffer _spare;
+    uint32_t _serial;
+
+    JpegEncoder _encoder;
+    std::thread _encoderThread;
+    std::thread _acceptThread;
+    std::list<Client*> _clients;    // used by the accept thread.
+    std::mutex _mutex;
+    std::condition_variable _encoderCond;
+    std::condition_variable _frameCond;
+
+    std::atomic<int> _watching;
+    std::atomic<uint64_t> _framesEncoded;
+    std::atomic<uint64_t> _framesSent;
+    std::atomic<uint64_t> _framesSkipped;
+    std::atomic<uint64_t> _lastEncodeTime;
+    std::atomic<uint64_t> _maxEncodeTime;
+
+    MjpegServer(const MjpegServer&);
+    MjpegServer& operator=(const MjpegServer&);
+
+    void EncoderLoop();
+    void AcceptLoop();
+    void ReapClients(bool all);
+    void ServeClient(Client* client);
+    bool WaitFrame(uint32_t* serial, FrameBuffer* frame, int timeout=-1);
+    void SendStream(socket_t sock);
+    void SendSingle(socket_t sock);
+
+public:
+    MjpegServer();
+    ~MjpegServer();
+
+    // Start: listens on port for frames of the given size.
+    //   With loopback, only local clients can connect.
+    bool Start(int port, int width, int height, bool loopback=false);
+    void Stop();
+    bool IsRunning()
+        { return _running.load(); }
+    int GetPort()
+        { return _port; }
+
+    // BeginFrame: returns a plane of (width+7)/8 bytes per row,
+    //   top row first, a bit set where there is ink; or NULL, also
+    //   unless serving frames of this size.
+    uint8_t* BeginFrame(int width, int height);
+    void CommitFrame();
+
+    // GetClients: returns the clients waiting for frames.
+    int GetClients()
+        { return _watching.load(); }
+    uint64_t GetFramesEncoded()
+        { return _framesEncoded.load(); }
+    uint64_t GetFramesSent()
+        { return _framesSent.load(); }
+    // GetFramesSkipped: frames that clients missed being slow.
+    uint64_t GetFramesSkipped()
+        { return _framesSkipped.load(); }
+    // Encoding times in nanoseconds.
+    uint64_t GetLastEncodeTime()
+        { return _lastEncodeTime.load(); }
+    uint64_t GetMaxEncodeTime()
+        { return _maxEncodeTime.load(); }
+};
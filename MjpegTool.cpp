@@ -0,0 +1,363 @@
+// -*- tab-width: 4; mode: c++ -*-
+//  MjpegTool.cpp
+//
+//  Usage: webcamoo-mjpeg [options] command
+//
+//  Commands:
+//    serve              serve a synthetic board on the port.
+//    load               serve it on a loopback port and watch it
+//                       with many clients at once (load test).
+//    save file.jpg      encode one synthetic frame.
+//
+//  Options:
+//    -p port            port for serve (default 8080).
+//    -s WxH             frame size (default 1920x1080).
+//    -r fps             frame rate (default 30).
+//    -t secs            duration (default 10 for load, forever for serve).
+//    -c clients         clients for load (default 32).
+//    -d msec            delay of the slow clients for load: every
+//                       other client sleeps msec after each frame.
+//
+//  The load test reports the encoding time, which does not depend
+//  on the number of clients, and the frame rate of each client;
+//  the fast clients must keep up with the source however slow the
+//  others are.
+//
+
+#ifndef WINDOWS
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include "MjpegServer.h"
+
+static const char PROGRAM_NAME[] = "webcamoo-mjpeg";
+
+// usage: show the command line syntax.
+static int usage()
+{
+    fprintf(stderr,
+            "usage: %s [-p port] [-s WxH] [-r fps] [-t secs] serve\n"
+            "       %s [-s WxH] [-r fps] [-t secs] [-c clients] [-d msec] load\n"
+            "       %s [-s WxH] save file.jpg\n",
+            PROGRAM_NAME, PROGRAM_NAME, PROGRAM_NAME);
+    return 100;
+}
+
+//  SyntheticBoard: a board with some writing and a moving pen.
+//
+struct SyntheticBoard
+{
+    int width;
+    int height;
+    size_t rowbytes;
+    std::vector<uint8_t> base;
+
+    SyntheticBoard(int w, int h)
+        : width(w), height(h), rowbytes((w+7) >> 3), base(rowbytes*h) {
+        // Lines of "words": short strokes of a few pixels wide.
+        uint32_t seed = 12345;
+        for (int y0 = h/10; y0+h/20 < h; y0 += h/10) {
+            for (int x0 = w/20; x0 < w-w/20; ) {
+                seed = seed*1103515245 + 12345;
+                int len = 8 + (seed >> 16) % 60;
+                int tall = h/40 + (seed >> 8) % (h/40+1);
+                Fill(&base[0], x0, y0, len, 3);
+                Fill(&base[0], x0, y0-tall, 3, tall);
+                Fill(&base[0], x0+len-3, y0-tall/2, 3, tall/2);
+                x0 += len + 12 + (seed >> 24) % 20;
+            }
+        }
+    }
+
+    void Fill(uint8_t* bits, int x0, int y0, int w, int h) {
+        for (int y = y0; y < y0+h; y++) {
+            if (y < 0 || height <= y) continue;
+            for (int x = x0; x < x0+w; x++) {
+                if (x < 0 || width <= x) continue;
+                bits[rowbytes*y + (x >> 3)] |= (0x80 >> (x & 7));
+            }
+        }
+    }
+
+    // Draw: renders frame n.
+    void Draw(uint8_t* bits, uint32_t n) {
+        memcpy(bits, &base[0], base.size());
+        int x = (int)((n*7) % (uint32_t)width);
+        int y = height - height/8 + (int)((n/3) % 16);
+        Fill(bits, x, y, width/30, width/30);
+    }
+};
+
+// getElapsed: seconds since t0.
+static double getElapsed(std::chrono::steady_clock::time_point t0)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+// feedFrames: send synthetic frames to the server at fps.
+static void feedFrames(MjpegServer* server, SyntheticBoard* board,
+                       int fps, double secs, std::atomic<bool>* quit)
+{
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    for (uint32_t n = 0; !quit->load(); n++) {
+        if (0 < secs && secs <= getElapsed(t0)) break;
+        uint8_t* bits = server->BeginFrame(board->width, board->height);
+        if (bits != NULL) {
+            board->Draw(bits, n);
+            server->CommitFrame();
+        }
+        std::this_thread::sleep_until(
+            t0 + std::chrono::microseconds((int64_t)(n+1) * 1000000 / fps));
+    }
+}
+
+static int doServe(int port, int width, int height, int fps, double secs)
+{
+    MjpegServer server;
+    if (!server.Start(port, width, height)) {
+        fprintf(stderr, "%s: cannot listen: %d\n", PROGRAM_NAME, port);
+        return 1;
+    }
+    fprintf(stderr, "%s: serving %dx%d on http://localhost:%d/\n",
+            PROGRAM_NAME, width, height, server.GetPort());
+    SyntheticBoard board(width, height);
+    std::atomic<bool> quit(false);
+    std::thread feeder(feedFrames, &server, &board, fps, secs, &quit);
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    while (secs <= 0 || getElapsed(t0) < secs) {
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        fprintf(stderr, "clients=%d encoded=%llu sent=%llu skipped=%llu encode=%.3fms\n",
+                server.GetClients(),
+                (unsigned long long)server.GetFramesEncoded(),
+                (unsigned long long)server.GetFramesSent(),
+                (unsigned long long)server.GetFramesSkipped(),
+                server.GetLastEncodeTime() / 1e6);
+    }
+    quit.store(true);
+    feeder.join();
+    server.Stop();
+    return 0;
+}
+
+//  LoadClient: a viewer of /stream.
+//
+struct LoadClient
+{
+    int port;
+    int delay;
+    int sock;
+    uint64_t frames;
+    uint64_t bytes;
+    uint64_t bad;
+    bool failed;
+
+    // Run: receive frames until the server closes the connection.
+    void Run() {
+        frames = bytes = bad = 0;
+        failed = true;
+        sock = socket(AF_INET, SOCK_STREAM, 0);
+        if (sock < 0) return;
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons((unsigned short)port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+            close(sock);
+            return;
+        }
+        const char req[] = "GET /stream HTTP/1.0\r\n\r\n";
+        if (send(sock, req, sizeof(req)-1, MSG_NOSIGNAL) != (ssize_t)sizeof(req)-1) {
+            close(sock);
+            return;
+        }
+        failed = false;
+
+        // Parse the parts by their Content-Length.
+        std::string buf;
+        char tmp[65536];
+        bool header = true;
+        for (;;) {
+            size_t end;
+            if (header) {
+                end = buf.find("\r\n\r\n");
+                if (end != std::string::npos) {
+                    buf.erase(0, end+4);
+                    header = false;
+                    continue;
+                }
+            } else {
+                size_t p = buf.find("Content-Length: ");
+                end = buf.find("\r\n\r\n", p);
+                if (p != std::string::npos && end != std::string::npos) {
+                    size_t size = strtoul(buf.c_str()+p+16, NULL, 10);
+                    if (end+4+size <= buf.size()) {
+                        const uint8_t* jpeg = (const uint8_t*)buf.data()+end+4;
+                        if (size < 4 ||
+                            jpeg[0] != 0xff || jpeg[1] != 0xd8 ||
+                            jpeg[size-2] != 0xff || jpeg[size-1] != 0xd9) {
+                            bad++;
+                        }
+                        frames++;
+                        bytes += size;
+                        buf.erase(0, end+4+size);
+                        if (0 < delay) {
+                            std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+                        }
+                        continue;
+                    }
+                }
+            }
+            ssize_t n = recv(sock, tmp, sizeof(tmp), 0);
+            if (n <= 0) break;
+            buf.append(tmp, n);
+        }
+        close(sock);
+    }
+};
+
+static int doLoad(int width, int height, int fps, double secs,
+                  int nclients, int delay)
+{
+    MjpegServer server;
+    if (!server.Start(0, width, height, true)) {
+        fprintf(stderr, "%s: cannot listen\n", PROGRAM_NAME);
+        return 1;
+    }
+    SyntheticBoard board(width, height);
+
+    std::vector<LoadClient> clients(nclients);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < nclients; i++) {
+        clients[i].port = server.GetPort();
+        clients[i].delay = (i & 1)? delay : 0;
+        threads.push_back(std::thread(&LoadClient::Run, &clients[i]));
+    }
+    // Start the source when everyone is watching.
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    while (server.GetClients() < nclients && getElapsed(t0) < 5) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    std::atomic<bool> quit(false);
+    t0 = std::chrono::steady_clock::now();
+    feedFrames(&server, &board, fps, secs, &quit);
+    double elapsed = getElapsed(t0);
+    uint64_t encoded = server.GetFramesEncoded();
+    server.Stop();
+    for (size_t i = 0; i < threads.size(); i++) {
+        threads[i].join();
+    }
+
+    double minFast = 1e9, maxFast = 0, minSlow = 1e9, maxSlow = 0;
+    uint64_t bytes = 0, bad = 0;
+    int failed = 0;
+    for (int i = 0; i < nclients; i++) {
+        const LoadClient& c = clients[i];
+        double rate = c.frames / elapsed;
+        if (c.delay) {
+            if (rate < minSlow) minSlow = rate;
+            if (maxSlow < rate) maxSlow = rate;
+        } else {
+            if (rate < minFast) minFast = rate;
+            if (maxFast < rate) maxFast = rate;
+        }
+        bytes += c.bytes;
+        bad += c.bad;
+        failed += c.failed;
+    }
+    printf("frames: %llu encoded in %.1fs (%.1f fps), %.3fms last, %.3fms max\n",
+           (unsigned long long)encoded, elapsed, encoded / elapsed,
+           server.GetLastEncodeTime() / 1e6, server.GetMaxEncodeTime() / 1e6);
+    printf("clients: %d, %llu frames sent, %llu skipped, %.1f MB/s\n",
+           nclients, (unsigned long long)server.GetFramesSent(),
+           (unsigned long long)server.GetFramesSkipped(),
+           bytes / elapsed / 1e6);
+    if (0 < maxFast) {
+        printf("fast clients: %.1f-%.1f fps\n", minFast, maxFast);
+    }
+    if (0 < maxSlow) {
+        printf("slow clients: %.1f-%.1f fps\n", minSlow, maxSlow);
+    }
+    if (failed || bad) {
+        printf("%d clients failed, %llu bad frames\n", failed, (unsigned long long)bad);
+        return 1;
+    }
+    return 0;
+}
+
+static int doSave(int width, int height, const char* path)
+{
+    SyntheticBoard board(width, height);
+    std::vector<uint8_t> bits(board.base.size());
+    board.Draw(&bits[0], 0);
+
+    JpegEncoder encoder;
+    std::vector<uint8_t> jpeg;
+    // The first round fills the block cache.
+    for (int i = 0; i < 2; i++) {
+        std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+        encoder.EncodeBits(&jpeg, &bits[0], board.rowbytes, width, height);
+        fprintf(stderr, "%s: %u bytes in %.3fms\n", PROGRAM_NAME,
+                (unsigned)jpeg.size(), getElapsed(t0) * 1e3);
+    }
+    FILE* fp = fopen(path, "wb");
+    if (fp == NULL || fwrite(&jpeg[0], 1, jpeg.size(), fp) != jpeg.size()) {
+        fprintf(stderr, "%s: cannot write: %s\n", PROGRAM_NAME, path);
+        if (fp != NULL) fclose(fp);
+        return 1;
+    }
+    fclose(fp);
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    int port = MJPEG_PORT, width = 1920, height = 1080, fps = 30;
+    int nclients = 32, delay = 0;
+    double secs = -1;
+    const char* cmd = NULL;
+    const char* path = NULL;
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        if (i+1 < argc && strcmp(arg, "-p") == 0) {
+            port = atoi(argv[++i]);
+        } else if (i+1 < argc && strcmp(arg, "-s") == 0) {
+            if (sscanf(argv[++i], "%dx%d", &width, &height) != 2) return usage();
+        } else if (i+1 < argc && strcmp(arg, "-r") == 0) {
+            fps = atoi(argv[++i]);
+        } else if (i+1 < argc && strcmp(arg, "-t") == 0) {
+            secs = atof(argv[++i]);
+        } else if (i+1 < argc && strcmp(arg, "-c") == 0) {
+            nclients = atoi(argv[++i]);
+        } else if (i+1 < argc && strcmp(arg, "-d") == 0) {
+            delay = atoi(argv[++i]);
+        } else if (arg[0] != '-' && cmd == NULL) {
+            cmd = arg;
+        } else if (arg[0] != '-' && path == NULL) {
+            path = arg;
+        } else {
+            return usage();
+        }
+    }
+    if (cmd == NULL || width <= 0 || height <= 0 || fps <= 0) return usage();
+
+    if (strcmp(cmd, "serve") == 0) {
+        return doServe(port, width, height, fps, (0 < secs)? secs : 0);
+    } else if (strcmp(cmd, "load") == 0 && 0 < nclients) {
+        return doLoad(width, height, fps, (0 < secs)? secs : 10, nclients, delay);
+    } else if (strcmp(cmd, "save") == 0 && path != NULL) {
+        return doSave(width, height, path);
+    }
+    return usage();
+}
@@ -0,0 +1,129 @@
+// -*- tab-width: 4; mode: c++ -*-
+//  ParamBlock.h
+//
+//  Settings shared between the threads that change them and the
+//  one that streams with them.
+//
+
+#pragma once
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+
+//  ParamBlock: immutable snapshots of T, swapped atomically.
+//
+//  Update() copies the latest snapshot, changes the copy (which is
+//  where the tables derived from the settings are built) and swaps
+//  it in with one exchange. The streaming thread takes the latest
+//  snapshot with Enter() at the start of a frame and lets go of it
+//  with Leave(); it never locks nor waits, and sees the same
+//  settings for the whole frame.
+//
+//  A snapshot swapped out is retired with the epoch it was swapped
+//  out at, and freed by a later Update() once the reader is idle or
+//  has entered a later epoch. There is one reader; the writers are
+//  serialized by a mutex.
+//
+template <class T>
+class ParamBlock
+{
+private:
+    static const uint64_t IDLE = ~(uint64_t)0;
+
+    struct Retired
+    {
+        T* snapshot;
+        uint64_t epoch;         // when it was swapped out.
+    };
+
+    std::atomic<T*> _current;
+    std::atomic<uint64_t> _epoch;
+    std::atomic<uint64_t> _reader;  // the epoch it entered, or IDLE.
+    std::mutex _mutex;
+    std::vector<Retired> _retired;
+
+    ParamBlock(const ParamBlock&);
+    ParamBlock& operator=(const ParamBlock&);
+
+    // Reclaim: frees the snapshots the reader cannot be using.
+    //   Called with _mutex held.
+    void Reclaim()
+        {
+            uint64_t reader = _reader.load();
+            size_t n = 0;
+            for (size_t i = 0; i < _retired.size(); i++) {
+                if (reader == IDLE || _retired[i].epoch < reader) {
+                    delete _retired[i].snapshot;
+                } else {
+                    _retired[n++] = _retired[i];
+                }
+            }
+            _retired.resize(n);
+        }
+
+public:
+    ParamBlock(const T& initial)
+        : _current(new T(initial)), _epoch(0), _reader(IDLE) {}
+    ~ParamBlock()
+        {
+            for (size_t i = 0; i < _retired.size(); i++) {
+                delete _retired[i].snapshot;
+            }
+            delete _current.load();
+        }
+
+    // Get: copies the latest snapshot.
+    void Get(T* value)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            *value = *_current.load();
+        }
+    // Update: publishes a copy of the latest snapshot, as changed
+    //   by change(T*).
+    template <class F>
+    void Update(F change)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            T* snapshot = new T(*_current.load());
+            change(snapshot);
+            Retired old;
+            old.snapshot = _current.exchange(snapshot);
+            old.epoch = _epoch.fetch_add(1);
+            _retired.push_back(old);
+            Reclaim();
+        }
+
+    // Enter: returns the latest snapshot, good until Leave().
+    const T* Enter()
+        {
+            _reader.store(_epoch.load());
+            return _current.load();
+        }
+    void Leave()
+        { _reader.store(IDLE); }
+};
+
+
+//  ParamScope: holds the latest snapshot of a ParamBlock for a block.
+//
+template <class T>
+class ParamScope
+{
+private:
+    ParamBlock<T>* _block;
+    const T* _snapshot;
+
+    ParamScope(const ParamScope&);
+    ParamScope& operator=(const ParamScope&);
+
+public:
+    ParamScope(ParamBlock<T>* block)
+        : _block(block), _snapshot(block->Enter()) {}
+    ~ParamScope()
+        { _block->Leave(); }
+
+    const T* Get()
+        { return _snapshot; }
+};
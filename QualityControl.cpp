@@ -0,0 +1,98 @@
+// -*- tab-width: 4; mode: c++ -*-
+//  QualityControl.cpp
+//
+
+#include "QualityControl.h"
+
+//  Constants
+//
+static const int BUSY_SHIFT = 2;    // average over about 4 frames.
+static const int MIN_RATIO = 100;
+static const int MAX_RATIO = 400;
+
+const char* getQualityName(QualityLevel level)
+{
+    static const char* NAMES[QUALITY_LEVELS] = {
+        "full", "keep threshold", "sampled histogram",
+        "half height", "half rate",
+    };
+    return (0 <= level && level < QUALITY_LEVELS)? NAMES[level] : "?";
+}
+
+
+//  QualityPolicy
+//
+QualityPolicy::QualityPolicy()
+{
+    Reset();
+}
+
+void QualityPolicy::Reset()
+{
+    _level = QUALITY_FULL;
+    _behind = 0;
+    _easy = 0;
+    _hold = 0;
+    _busy = 0;
+    _from = -1;
+    _busyFrom = 0;
+    for (int i = 0; i < QUALITY_LEVELS; i++) {
+        _ratio[i] = DEFAULT_RATIO;
+    }
+    _steps = 0;
+}
+
+void QualityPolicy::Step(int level)
+{
+    _from = _level;
+    _busyFrom = _busy;
+    _level = level;
+    _busy = 0;
+    _behind = 0;
+    _easy = 0;
+    _hold = HOLD_FRAMES;
+    _steps++;
+}
+
+// Learn: compares the time per frame before and after the last step.
+void QualityPolicy::Learn()
+{
+    if (0 <= _from && 0 < _busy && 0 < _busyFrom) {
+        int lower = (_from < _level)? _from : _level;
+        int64_t upper = (_from < _level)? _busyFrom : _busy;
+        int64_t under = (_from < _level)? _busy : _busyFrom;
+        int64_t ratio = upper*100 / under;
+        _ratio[lower] = (int)((ratio < MIN_RATIO)? MIN_RATIO :
+                              (MAX_RATIO < ratio)? MAX_RATIO : ratio);
+    }
+    _from = -1;
+}
+
+QualityLevel QualityPolicy::Update(int64_t busy, int64_t late, int64_t interval)
+{
+    if (interval <= 0) return GetLevel();
+    _busy = (_busy == 0)? busy : _busy + ((busy - _busy) >> BUSY_SHIFT);
+
+    // At half rate, a frame has the time of two.
+    int64_t budget = (QUALITY_HALF_RATE <= _level)? interval*2 : interval;
+    bool behind = (budget*BEHIND_PERCENT < busy*100 ||
+                   budget*LATE_PERCENT < late*100);
+    // What this frame would take a level up.
+    int64_t above = (_level == QUALITY_HALF_RATE)? interval : budget;
+    int64_t guess = (QUALITY_FULL < _level)? busy*_ratio[_level-1]/100 : busy;
+    bool easy = (guess*100 < above*EASY_PERCENT &&
+                 late*100 <= above*SETTLED_PERCENT);
+    _behind = behind? _behind+1 : 0;
+    _easy = easy? _easy+1 : 0;
+
+    if (0 < _hold) {
+        if (--_hold == 0) {
+            Learn();
+        }
+    } else if (DOWN_FRAMES <= _behind && _level < QUALITY_LEVELS-1) {
+        Step(_level+1);
+    } else if (UP_FRAMES <= _easy && QUALITY_FULL < _level) {
+        Step(_level-1);
+    }
+    return GetLevel();
+}
@@ -0,0 +1,87 @@
+// -*- tab-width: 4; mode: c++ -*-
+//  QualityControl.h
+//
+//  Shedding work when the frames cannot be processed in time.
+//
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+//  QualityLevel: each level also does what the ones above it do.
+//
+enum QualityLevel {
+    QUALITY_FULL,
+    QUALITY_KEEP_THRESHOLD,     // the automatic threshold every 8th frame.
+    QUALITY_SAMPLED_HISTOGRAM,  // the histogram of every 4th row.
+    QUALITY_HALF_HEIGHT,        // every other row, doubled.
+    QUALITY_HALF_RATE,          // every other frame dropped.
+    QUALITY_LEVELS
+};
+
+// getQualityName: returns a short name such as "full".
+const char* getQualityName(QualityLevel level);
+
+
+//  QualityPolicy
+//
+//  Steps down a level after DOWN_FRAMES frames in a row that were
+//  behind: busy for more than BEHIND_PERCENT of the time a frame has,
+//  or reported late by the renderer by more than LATE_PERCENT of it.
+//  Steps back up after UP_FRAMES frames in a row that would be easy
+//  even at the level above (busy for less than EASY_PERCENT, and at
+//  most SETTLED_PERCENT late). After a step, HOLD_FRAMES frames are
+//  let through for it to show. The gap between the two keeps it
+//  from going up and down.
+//
+//  How much busier the level above would be is learned from the
+//  steps: the average time per frame before a step is compared with
+//  the one after the hold.
+//
+//  The times are given, not read, so that a simulated load can be
+//  used; it is called by one thread.
+//
+class QualityPolicy
+{
+public:
+    static const int BEHIND_PERCENT = 90;
+    static const int LATE_PERCENT = 50;
+    static const int EASY_PERCENT = 70;
+    static const int SETTLED_PERCENT = 10;
+    static const int DOWN_FRAMES = 3;
+    static const int UP_FRAMES = 60;
+    static const int HOLD_FRAMES = 15;
+    static const int DEFAULT_RATIO = 200;
+
+private:
+    int _level;
+    int _behind;                // frames behind in a row.
+    int _easy;                  // easy frames in a row.
+    int _hold;
+    int64_t _busy;              // average at this level, or 0.
+    int _from;                  // the level before the step, or -1.
+    int64_t _busyFrom;          // the average there.
+    int _ratio[QUALITY_LEVELS]; // time at a level over the next, in percent.
+    uint64_t _steps;
+
+    void Step(int level);
+    void Learn();
+
+public:
+    QualityPolicy();
+
+    void Reset();
+    // Update: a frame took busy nanoseconds, the renderer is late by
+    //   late (or 0), and the frames come every interval. Returns the
+    //   level for the next frame.
+    QualityLevel Update(int64_t busy, int64_t late, int64_t interval);
+    QualityLevel GetLevel()
+        { return (QualityLevel)_level; }
+    // GetRatio: returns how much longer a frame takes at level than
+    //   at the next level down, in percent.
+    int GetRatio(QualityLevel level)
+        { return _ratio[level]; }
+    // GetSteps: returns the number of level changes since Reset().
+    uint64_t GetSteps()
+        { return _steps; }
+};
@@ -0,0 +1,434 @@
+// -*- tab-width: 4; mode: c++ -*-
+//  ReceiveTool.cpp
+//
+//  Usage: webcamoo-receive [-s WxH] [-n frames] [-m scenario,...]
+//                          [-r fps]
+//
+//  Runs Filtaa itself, outside of a filter graph, on the fake
+//  DirectShow objects of mock/MockDShow.h: a source hands it
+//  synthetic whiteboard frames (see WhiteboardGenerator) in samples
+//  of its allocator, and Filtaa::Receive() passes them on to a
+//  renderer. The pins are connected and the allocators negotiated
+//  as in a graph, so this times the whole receive path in each of
+//  the ways the allocators can end up:
+//
+//    in-place   the samples of the source are writable and fit, so
+//               they are transformed where they are.
+//    read-only  the samples of the source are read-only; Filtaa uses
+//               its own allocator and copies every sample.
+//    align-16   the buffers of the source are aligned to 16 bytes,
+//               which Filtaa does not take; it copies as well.
+//    bypass     in-place samples, passed on as they are, without
+//               processing (see Filtaa::SetBypass()).
+//    bypass-ro  read-only samples in bypass; the renderer was given
+//               the allocator of Filtaa, so they are copied.
+//
+//  The first frames of the scenarios must come out the same, and in
+//  bypass the same as they went in; the samples must be copied only
+//  when the source is read-only or not aligned as Filtaa needs. The
+//  time of Receive() and of its stages is printed, or "-" for what
+//  was not timed. Then the processing is switched off and on again,
+//  and the time from the switch to the first processed frame passed
+//  on is printed as well.
+//
+//  By default the samples have no time stamps. With -r, they are
+//  stamped and sent at fps against the clock, and the filter sheds
+//  work when it falls behind, as it would in a graph.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "mock/MockDShow.h"
+#include "Filtaa.h"
+#include "StageTimer.h"
+#include "Whiteboard.h"
+
+static const char PROGRAM_NAME[] = "webcamoo-receive";
+static const int DEFAULT_WIDTH = 1280;
+static const int DEFAULT_HEIGHT = 720;
+static const int DEFAULT_FRAMES = 120;
+static const int SOURCE_FRAMES = 4;     // different frames to send.
+static const int SOURCE_BUFFERS = 3;
+
+//  Scenario
+//
+struct Scenario
+{
+    const char* name;
+    BOOL readOnly;              // the samples of the source.
+    long align;                 // the buffers of the source.
+    BOOL bypass;                // Filtaa passes them on as they are.
+};
+
+static const Scenario SCENARIOS[] = {
+    { "in-place", FALSE, 1, FALSE },
+    { "read-only", TRUE, 1, FALSE },
+    { "align-16", FALSE, 16, FALSE },
+    { "bypass", FALSE, 1, TRUE },
+    { "bypass-ro", TRUE, 1, TRUE },
+};
+static const int NSCENARIOS = (int)(sizeof(SCENARIOS) / sizeof(SCENARIOS[0]));
+
+//  ScenarioResult
+//
+struct ScenarioResult
+{
+    bool copied;                // the renderer got another sample.
+    uint64_t checksum;          // of the first frame.
+    std::vector<uint64_t> times; // of Receive(), but the first.
+    bool staged;                // the stage timers are compiled in.
+    StageStats stages[STAGES];
+    FiltaaStats stats;
+    QualityLevel quality;
+    uint64_t switchLatency;     // from bypass to a processed frame.
+};
+
+// usage: show the command line syntax.
+static int usage()
+{
+    fprintf(stderr,
+            "usage: %s [-s WxH] [-n frames] [-m scenario,...] [-r fps]\n"
+            "  -s WxH        the frame size (default %dx%d).\n"
+            "  -n frames     frames per scenario (default %d).\n"
+            "  -m scenario,... in-place, read-only, align-16, bypass\n"
+            "                and/or bypass-ro; default is all.\n"
+            "  -r fps        stamp the samples and send them at fps.\n",
+            PROGRAM_NAME, DEFAULT_WIDTH, DEFAULT_HEIGHT, DEFAULT_FRAMES);
+    return 100;
+}
+
+// selectScenarios: marks the scenarios in a comma separated list.
+static bool selectScenarios(std::vector<bool>* selected, const char* names)
+{
+    const char* p = names;
+    while (*p) {
+        const char* end = strchr(p, ',');
+        size_t len = (end != NULL)? (size_t)(end-p) : strlen(p);
+        int i;
+        for (i = 0; i < NSCENARIOS; i++) {
+            if (strlen(SCENARIOS[i].name) == len &&
+                strncmp(SCENARIOS[i].name, p, len) == 0) break;
+        }
+        if (i == NSCENARIOS) return false;
+        (*selected)[i] = true;
+        p += len;
+        if (*p == ',') p++;
+    }
+    return true;
+}
+
+// align32: fix the size for 32-bit boundary.
+static inline size_t align32(size_t x)
+{
+    return (((x+3) >> 2) << 2);
+}
+
+// setupMediaType: RGB24 of a size, bottom-up as from a camera.
+static void setupMediaType(AM_MEDIA_TYPE* mt, VIDEOINFOHEADER* vi,
+                           int width, int height, int fps)
+{
+    size_t size = align32(width*3) * height;
+    ZeroMemory(vi, sizeof(*vi));
+    vi->AvgTimePerFrame = (0 < fps)? 10000000/fps : 0;
+    vi->bmiHeader.biSize = sizeof(vi->bmiHeader);
+    vi->bmiHeader.biWidth = width;
+    vi->bmiHeader.biHeight = height;
+    vi->bmiHeader.biPlanes = 1;
+    vi->bmiHeader.biBitCount = 24;
+    vi->bmiHeader.biCompression = BI_RGB;
+    vi->bmiHeader.biSizeImage = (DWORD)size;
+    ZeroMemory(mt, sizeof(*mt));
+    mt->majortype = MEDIATYPE_Video;
+    mt->subtype = MEDIASUBTYPE_RGB24;
+    mt->bFixedSizeSamples = TRUE;
+    mt->lSampleSize = (ULONG)size;
+    mt->formattype = FORMAT_VideoInfo;
+    mt->cbFormat = sizeof(*vi);
+    mt->pbFormat = (BYTE*)vi;
+}
+
+// sendFrame: captures a frame into a sample of the source, as a
+//   camera would, and passes it to Filtaa. Returns the nanoseconds
+//   that Receive() took in *nanos, and whether the renderer got the
+//   very same sample in *same.
+static HRESULT sendFrame(MockAllocator* allocator, IMemInputPin* transport,
+                         MockPin* renderer, const std::vector<uint8_t>& frame,
+                         REFERENCE_TIME t0, REFERENCE_TIME interval,
+                         uint64_t* nanos, bool* same)
+{
+    HRESULT hr;
+    IMediaSample* sample = NULL;
+    hr = allocator->GetBuffer(&sample, NULL, NULL, 0);
+    if (FAILED(hr)) return hr;
+    BYTE* buf = NULL;
+    sample->GetPointer(&buf);
+    memcpy(buf, &frame[0], frame.size());
+    sample->SetActualDataLength((long)frame.size());
+    if (0 < interval) {
+        REFERENCE_TIME t1 = t0+interval;
+        sample->SetTime(&t0, &t1);
+    }
+    uint64_t t = getTimerNanos();
+    hr = transport->Receive(sample);
+    *nanos = getTimerNanos() - t;
+    *same = (renderer->GetLastSample() == sample);
+    sample->Release();
+    return hr;
+}
+
+// runScenario: connects a new Filtaa between a source and a
+//   renderer and sends it the frames.
+static bool runScenario(const Scenario* scenario, AM_MEDIA_TYPE* mt,
+                        const std::vector<std::vector<uint8_t> >& frames,
+                        int nframes, int fps, ScenarioResult* result)
+{
+    HRESULT hr;
+    Filtaa* filter = new Filtaa();
+    MockPin* source = new MockPin(L"Source", PINDIR_OUTPUT);
+    MockPin* renderer = new MockPin(L"Renderer", PINDIR_INPUT);
+    MockClock* clock = new MockClock();
+    MockAllocator* allocator = new MockAllocator();
+    IPin* in = NULL;
+    IPin* out = NULL;
+    IMemInputPin* transport = NULL;
+    REFERENCE_TIME interval = (0 < fps)? 10000000/fps : 0;
+    REFERENCE_TIME tStart = 0;
+    uint64_t nanos = 0;
+    bool same = false;
+    bool ok = false;
+    result->copied = false;
+    result->checksum = 0;
+    result->times.clear();
+    result->switchLatency = 0;
+
+    // Connect as a graph would: the input with the allocator of the
+    // source, then the output.
+    ALLOCATOR_PROPERTIES req = { SOURCE_BUFFERS, (long)mt->lSampleSize,
+                                 scenario->align, 0 };
+    ALLOCATOR_PROPERTIES given = {0};
+    if (FAILED(filter->FindPin(L"In", &in))) goto fail;
+    if (FAILED(filter->FindPin(L"Out", &out))) goto fail;
+    if (FAILED(in->ReceiveConnection(source, mt))) goto fail;
+    if (FAILED(in->QueryInterface(IID_PPV_ARGS(&transport)))) goto fail;
+    if (FAILED(allocator->SetProperties(&req, &given))) goto fail;
+    if (FAILED(transport->NotifyAllocator(allocator, scenario->readOnly))) goto fail;
+    if (FAILED(out->Connect(renderer, NULL))) goto fail;
+    filter->SetSyncSource(clock);
+    filter->SetBypass(scenario->bypass);
+    if (FAILED(allocator->Commit())) goto fail;
+    if (FAILED(filter->Pause())) goto fail;
+    clock->GetTime(&tStart);
+    if (FAILED(filter->Run(tStart))) goto fail;
+
+    for (int n = 0; n < nframes; n++) {
+        if (0 < interval) {
+            // Sent on time.
+            REFERENCE_TIME now;
+            clock->GetTime(&now);
+            if (now-tStart < interval*n) {
+                std::this_thread::sleep_for(
+                    std::chrono::microseconds((interval*n-(now-tStart))/10));
+            }
+        }
+        renderer->SetChecking(n == 0);
+        hr = sendFrame(allocator, transport, renderer, frames[n % frames.size()],
+                       interval*n, interval, &nanos, &same);
+        if (FAILED(hr)) goto fail;
+        if (n == 0) {
+            // The first frame primes the filter; it is not timed.
+            result->checksum = renderer->GetChecksum();
+            filter->ResetStageStats();
+        } else {
+            result->times.push_back(nanos);
+        }
+    }
+    result->copied = !same;
+    ZeroMemory(result->stages, sizeof(result->stages));
+    result->staged = false;
+    for (int i = 0; i < STAGES; i++) {
+        if (filter->GetStageStats((Stage)i, &result->stages[i])) {
+            result->staged = true;
+        }
+    }
+    filter->GetStats(&result->stats);
+    result->quality = filter->GetQuality();
+    ok = (renderer->GetReceived() == result->stats.received - result->stats.dropped);
+
+    // Switching the processing on, from bypass: the first frame
+    // after it is the one the user waits for.
+    filter->SetBypass(TRUE);
+    hr = sendFrame(allocator, transport, renderer, frames[0],
+                   interval*nframes, interval, &nanos, &same);
+    if (FAILED(hr)) goto fail;
+    filter->SetBypass(FALSE);
+    hr = sendFrame(allocator, transport, renderer, frames[1 % frames.size()],
+                   interval*(nframes+1), interval, &nanos, &same);
+    if (FAILED(hr)) goto fail;
+    result->switchLatency = filter->GetSwitchLatency();
+
+fail:
+    filter->Stop();
+    allocator->Decommit();
+    if (out != NULL) {
+        out->Disconnect();
+        out->Release();
+    }
+    renderer->Disconnect();
+    if (transport != NULL) {
+        transport->Release();
+    }
+    if (in != NULL) {
+        in->Disconnect();
+        in->Release();
+    }
+    filter->SetSyncSource(NULL);
+    filter->Release();
+    source->Release();
+    renderer->Release();
+    clock->Release();
+    allocator->Release();
+    return ok;
+}
+
+// median: returns the median of the times, or 0.
+static uint64_t median(std::vector<uint64_t> times)
+{
+    if (times.empty()) return 0;
+    std::sort(times.begin(), times.end());
+    return times[times.size()/2];
+}
+
+// printStage: a column of the table: the median or 95th percentile
+//   of a stage in milliseconds, or "-" if it was not timed.
+static void printStage(const ScenarioResult* r, Stage stage, bool p95)
+{
+    const StageStats* st = &r->stages[stage];
+    if (r->staged && 0 < st->count) {
+        fprintf(stderr, " %8.3f", (p95? st->p95 : st->p50)/1e6);
+    } else {
+        fprintf(stderr, " %8s", "-");
+    }
+}
+
+// printResult: one line of the table.
+static void printResult(const Scenario* scenario, const ScenarioResult* r,
+                        size_t frameSize)
+{
+    // In bypass, the frames are not processed, so not timed.
+    bool timed = (!r->times.empty() &&
+                  (!r->staged || 0 < r->stages[STAGE_FRAME].count));
+    fprintf(stderr, "%s: %-9s  %-4s", PROGRAM_NAME, scenario->name,
+            r->copied? "yes" : "no");
+    if (timed) {
+        uint64_t p50 = median(r->times);
+        double mbps = (0 < p50)? frameSize*1e3/p50 : 0;
+        fprintf(stderr, " %8.3f %8.1f", p50/1e6, mbps);
+    } else {
+        fprintf(stderr, " %8s %8s", "-", "-");
+    }
+    printStage(r, STAGE_COPY, false);
+    printStage(r, STAGE_TRANSFORM, false);
+    printStage(r, STAGE_DELIVER, false);
+    printStage(r, STAGE_FRAME, true);
+    fprintf(stderr, " %8.3f  %llu dropped, %s\n", r->switchLatency/1e6,
+            (unsigned long long)r->stats.dropped, getQualityName(r->quality));
+}
+
+int main(int argc, char* argv[])
+{
+    int width = DEFAULT_WIDTH;
+    int height = DEFAULT_HEIGHT;
+    int nframes = DEFAULT_FRAMES;
+    int fps = 0;
+    std::vector<bool> scenarios(NSCENARIOS, true);
+
+    int i;
+    for (i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        if (arg[0] != '-' || arg[1] == 0) break;
+        if (i+1 < argc && strcmp(arg, "-s") == 0) {
+            if (sscanf(argv[++i], "%dx%d", &width, &height) != 2) return usage();
+            if (width <= 0 || height <= 0) return usage();
+        } else if (i+1 < argc && strcmp(arg, "-n") == 0) {
+            nframes = atoi(argv[++i]);
+            if (nframes < 2) return usage();
+        } else if (i+1 < argc && strcmp(arg, "-m") == 0) {
+            scenarios.assign(NSCENARIOS, false);
+            if (!selectScenarios(&scenarios, argv[++i])) return usage();
+        } else if (i+1 < argc && strcmp(arg, "-r") == 0) {
+            fps = atoi(argv[++i]);
+            if (fps <= 0) return usage();
+        } else {
+            return usage();
+        }
+    }
+    if (i < argc) return usage();
+
+    AM_MEDIA_TYPE mt;
+    VIDEOINFOHEADER vi;
+    setupMediaType(&mt, &vi, width, height, fps);
+    size_t linesize = align32(width*3);
+    WhiteboardGenerator board;
+    if (!board.Setup(width, height)) {
+        fprintf(stderr, "%s: cannot make the frames\n", PROGRAM_NAME);
+        return 1;
+    }
+    std::vector<std::vector<uint8_t> > frames(SOURCE_FRAMES);
+    for (int n = 0; n < SOURCE_FRAMES; n++) {
+        frames[n].assign(mt.lSampleSize, 0);
+        board.Draw(&frames[n][0], linesize, n);
+    }
+
+    if (0 < fps) {
+        fprintf(stderr, "%s: %dx%d, %d frames at %d fps\n",
+                PROGRAM_NAME, width, height, nframes, fps);
+    } else {
+        fprintf(stderr, "%s: %dx%d, %d frames, not stamped\n",
+                PROGRAM_NAME, width, height, nframes);
+    }
+    fprintf(stderr, "%s: %-9s  %-4s %8s %8s %8s %8s %8s %8s %8s\n",
+            PROGRAM_NAME, "scenario", "copy", "ms", "MB/s",
+            "copy", "transform", "deliver", "p95", "switch");
+    int status = 0;
+    bool first = true;
+    uint64_t checksum = 0;
+    uint64_t original = MockPin::Checksum(&frames[0][0], frames[0].size());
+    for (int s = 0; s < NSCENARIOS; s++) {
+        const Scenario* scenario = &SCENARIOS[s];
+        if (!scenarios[s]) continue;
+        ScenarioResult result;
+        if (!runScenario(scenario, &mt, frames, nframes, fps, &result)) {
+            fprintf(stderr, "%s: %s: failed\n", PROGRAM_NAME, scenario->name);
+            status = 1;
+            continue;
+        }
+        printResult(scenario, &result, mt.lSampleSize);
+        // Only the samples that do not suit Filtaa are copied.
+        bool copying = (scenario->readOnly || scenario->align != 1);
+        if (result.copied != copying) {
+            fprintf(stderr, "%s: %s: the samples were %scopied\n",
+                    PROGRAM_NAME, scenario->name, copying? "not " : "");
+            status = 1;
+        }
+        if (scenario->bypass) {
+            if (result.checksum != original) {
+                fprintf(stderr, "%s: %s: the frames were touched\n",
+                        PROGRAM_NAME, scenario->name);
+                status = 1;
+            }
+        } else if (first) {
+            checksum = result.checksum;
+            first = false;
+        } else if (result.checksum != checksum) {
+            fprintf(stderr, "%s: %s: the first frame differs\n",
+                    PROGRAM_NAME, scenario->name);
+            status = 1;
+        }
+    }
+    return status;
+}
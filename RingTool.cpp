@@ -0,0 +1,223 @@
+// -*- tab-width: 4; mode: c++ -*-
+//  RingTool.cpp
+//
+//  Usage: webcamoo-ring [-n name] command ...
+//
+//  Commands:
+//    watch              print the metadata of every frame.
+//    save file.png      save the next frame (.png, .pgm or .bmp).
+//    write [-s WxH] [-f frames] [-r fps]
+//                       publish a synthetic test pattern.
+//    check [-d msec]    read frames of "write" and verify them,
+//                       sleeping msec after each frame to lag.
+//
+//  For a multi-process stress run, start one "write" and any
+//  number of "check" readers at once; every reader must finish
+//  with no torn frames, however much it lags.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "FrameRing.h"
+#include "ImageFile.h"
+
+static const char PROGRAM_NAME[] = "webcamoo-ring";
+
+// usage: show the command line syntax.
+static int usage()
+{
+    fprintf(stderr,
+            "usage: %s [-n name] watch\n"
+            "       %s [-n name] save file.png\n"
+            "       %s [-n name] write [-s WxH] [-f frames] [-r fps]\n"
+            "       %s [-n name] check [-d msec]\n",
+            PROGRAM_NAME, PROGRAM_NAME, PROGRAM_NAME, PROGRAM_NAME);
+    return 100;
+}
+
+// sleepMsec: sleep for a while.
+static void sleepMsec(int msec)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(msec));
+}
+
+// attachRing: wait up to 5 seconds for the writer.
+static bool attachRing(FrameRingReader* reader, const char* name)
+{
+    for (int i = 0; i < 500; i++) {
+        if (reader->Attach(name)) return true;
+        sleepMsec(10);
+    }
+    fprintf(stderr, "%s: cannot attach: %s\n", PROGRAM_NAME, name);
+    return false;
+}
+
+// getPatternByte: the byte of row y in a test frame.
+static inline uint8_t getPatternByte(uint32_t frame, int y)
+{
+    return (uint8_t)(frame*7 + y);
+}
+
+static int doWatch(const char* name)
+{
+    FrameRingReader reader;
+    if (!attachRing(&reader, name)) return 1;
+    std::vector<uint8_t> buf((size_t)reader.GetStride() * reader.GetHeight());
+    printf("# %dx%d\n", reader.GetWidth(), reader.GetHeight());
+    while (!reader.IsClosed()) {
+        FrameInfo info;
+        if (!reader.Read(&buf[0], &info)) {
+            sleepMsec(1);
+            continue;
+        }
+        printf("frame=%u time=%lld threshold=%u mean=%u ink=%u lost=%llu\n",
+               info.frame, (long long)info.timestamp, info.threshold,
+               info.meanLuma, info.inkPixels,
+               (unsigned long long)reader.GetLost());
+        fflush(stdout);
+    }
+    return 0;
+}
+
+static int doSave(const char* name, const char* path)
+{
+    ImageFormat format = getImageFormat(path);
+    FrameRingReader reader;
+    if (!attachRing(&reader, name)) return 1;
+    Image img;
+    if (!allocImage(&img, reader.GetWidth(), reader.GetHeight())) return 1;
+    FrameInfo info;
+    while (!reader.Read(img.data, &info)) {
+        if (reader.IsClosed()) {
+            freeImage(&img);
+            return 1;
+        }
+        sleepMsec(1);
+    }
+    bool ok = writeImage(path, &img, format);
+    freeImage(&img);
+    if (!ok) {
+        fprintf(stderr, "%s: cannot write: %s\n", PROGRAM_NAME, path);
+        return 1;
+    }
+    return 0;
+}
+
+static int doWrite(const char* name, int width, int height, int nframes, int fps)
+{
+    FrameRingWriter writer;
+    if (!writer.Open(name, width, height)) {
+        fprintf(stderr, "%s: cannot create: %s\n", PROGRAM_NAME, name);
+        return 1;
+    }
+    // Give the readers time to attach.
+    sleepMsec(200);
+
+    size_t stride = (size_t)width * 3;
+    std::vector<uint8_t> frame(stride * height);
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    for (int n = 0; n < nframes; n++) {
+        for (int y = 0; y < height; y++) {
+            memset(&frame[stride*y], getPatternByte(n, y), stride);
+        }
+        FrameInfo info;
+        memset(&info, 0, sizeof(info));
+        info.timestamp = (int64_t)n * 10000000 / ((0 < fps)? fps : 30);
+        writer.Publish(&frame[0], stride, width, height, &info);
+        if (0 < fps) {
+            std::this_thread::sleep_until(
+                t0 + std::chrono::microseconds((int64_t)(n+1) * 1000000 / fps));
+        }
+    }
+    double secs = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - t0).count();
+    fprintf(stderr, "%s: wrote %d frames, %.1f fps\n",
+            PROGRAM_NAME, nframes, (0 < secs)? nframes/secs : 0.0);
+    writer.Close();
+    return 0;
+}
+
+static int doCheck(const char* name, int delay)
+{
+    FrameRingReader reader;
+    if (!attachRing(&reader, name)) return 1;
+    int height = reader.GetHeight();
+    size_t stride = reader.GetStride();
+    std::vector<uint8_t> buf(stride * height);
+
+    uint64_t nread = 0, torn = 0;
+    int64_t last = -1;
+    while (!reader.IsClosed()) {
+        FrameInfo info;
+        if (!reader.Read(&buf[0], &info)) {
+            sleepMsec(1);
+            continue;
+        }
+        nread++;
+        if ((int64_t)info.frame <= last) {
+            torn++;
+        }
+        last = info.frame;
+        for (int y = 0; y < height; y++) {
+            uint8_t b = getPatternByte(info.frame, y);
+            const uint8_t* p = &buf[stride*y];
+            if (p[0] != b || p[stride-1] != b || p[stride/2] != b) {
+                torn++;
+                break;
+            }
+        }
+        if (0 < delay) {
+            sleepMsec(delay);
+        }
+    }
+    printf("%s: read %llu frames, lost %llu, torn %llu\n",
+           PROGRAM_NAME, (unsigned long long)nread,
+           (unsigned long long)reader.GetLost(), (unsigned long long)torn);
+    return (torn == 0)? 0 : 1;
+}
+
+int main(int argc, char* argv[])
+{
+    const char* name = FRAME_RING_NAME;
+    int i = 1;
+    if (i+1 < argc && strcmp(argv[i], "-n") == 0) {
+        name = argv[i+1];
+        i += 2;
+    }
+    if (argc <= i) return usage();
+    const char* cmd = argv[i++];
+
+    int width = 640, height = 480, nframes = 1000, fps = 0, delay = 0;
+    const char* path = NULL;
+    for (; i < argc; i++) {
+        const char* arg = argv[i];
+        if (i+1 < argc && strcmp(arg, "-s") == 0) {
+            if (sscanf(argv[++i], "%dx%d", &width, &height) != 2) return usage();
+        } else if (i+1 < argc && strcmp(arg, "-f") == 0) {
+            nframes = atoi(argv[++i]);
+        } else if (i+1 < argc && strcmp(arg, "-r") == 0) {
+            fps = atoi(argv[++i]);
+        } else if (i+1 < argc && strcmp(arg, "-d") == 0) {
+            delay = atoi(argv[++i]);
+        } else if (arg[0] != '-' && path == NULL) {
+            path = arg;
+        } else {
+            return usage();
+        }
+    }
+
+    if (strcmp(cmd, "watch") == 0) {
+        return doWatch(name);
+    } else if (strcmp(cmd, "save") == 0 && path != NULL) {
+        return doSave(name, path);
+    } else if (strcmp(cmd, "write") == 0) {
+        return doWrite(name, width, height, nframes, fps);
+    } else if (strcmp(cmd, "check") == 0) {
+        return doCheck(name, delay);
+    }
+    return usage();
+}
@@ -0,0 +1,157 @@
+// -*- tab-width: 4; mode: c++ -*-
+//  Snapshot.cpp
+//
+
+#include <string.h>
+#include <chrono>
+#include "Snapshot.h"
+
+
+//  SnapshotWriter
+//
+SnapshotWriter::SnapshotWriter()
+    : _requested(false), _saved(0), _failed(0),
+      _lastCopyTime(0), _maxCopyTime(0)
+{
+    for (int i = 0; i < NSLOTS; i++) {
+        Slot* slot = &_slots[i];
+        slot->image.data = NULL;
+        slot->image.width = 0;
+        slot->image.height = 0;
+        slot->image.stride = 0;
+        slot->path[0] = 0;
+        slot->format = IMAGE_UNKNOWN;
+        slot->state = SLOT_FREE;
+    }
+    _path[0] = 0;
+    _format = IMAGE_UNKNOWN;
+    _quit = false;
+    _writer = std::thread(&SnapshotWriter::WriterLoop, this);
+}
+
+SnapshotWriter::~SnapshotWriter()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _quit = true;
+    }
+    _cond.notify_all();
+    _writer.join();
+    for (int i = 0; i < NSLOTS; i++) {
+        freeImage(&_slots[i].image);
+    }
+}
+
+bool SnapshotWriter::Request(const char* path, int width, int height)
+{
+    ImageFormat format = getImageFormat(path);
+    if (format != IMAGE_PNG && format != IMAGE_PGM && format != IMAGE_BMP) {
+        return false;
+    }
+    if (width <= 0 || height <= 0) return false;
+    size_t length = strlen(path);
+    if (MAX_PATH_LENGTH <= length) return false;
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_requested.load()) return false;
+    // Make the free buffers ready for this frame size.
+    bool ready = false;
+    for (int i = 0; i < NSLOTS; i++) {
+        Slot* slot = &_slots[i];
+        if (slot->state != SLOT_FREE) continue;
+        if (slot->image.width != width || slot->image.height != height) {
+            freeImage(&slot->image);
+            if (!allocImage(&slot->image, width, height)) {
+                slot->image.width = slot->image.height = 0;
+                continue;
+            }
+            // Touch the pages now so that Capture() does not fault.
+            memset(slot->image.data, 0, slot->image.stride*height);
+        }
+        ready = true;
+    }
+    if (!ready) return false;
+    memcpy(_path, path, length+1);
+    _format = format;
+    _requested.store(true);
+    return true;
+}
+
+void SnapshotWriter::Capture(
+    const uint8_t* src, ptrdiff_t stride, int width, int height)
+{
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+
+    Slot* slot = NULL;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!_requested.load()) return;
+        for (int i = 0; i < NSLOTS; i++) {
+            Slot* s = &_slots[i];
+            if (s->state == SLOT_FREE &&
+                s->image.width == width && s->image.height == height) {
+                slot = s;
+                break;
+            }
+        }
+        if (slot == NULL) {
+            // The frame size has changed since Request().
+            _requested.store(false);
+            _failed++;
+            return;
+        }
+        slot->state = SLOT_FILLING;
+        // Not a std::string, so that nothing is allocated here.
+        strcpy(slot->path, _path);
+        slot->format = _format;
+        _requested.store(false);
+    }
+
+    // Copy the rows top-down; this is the only per-pixel work here.
+    size_t rowsize = (size_t)width * 3;
+    for (int y = 0; y < height; y++) {
+        memcpy(slot->image.data + slot->image.stride*y, src + stride*y, rowsize);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        slot->state = SLOT_QUEUED;
+    }
+    _cond.notify_one();
+
+    uint64_t t = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - t0).count();
+    _lastCopyTime.store(t);
+    uint64_t m = _maxCopyTime.load();
+    while (m < t && !_maxCopyTime.compare_exchange_weak(m, t)) ;
+}
+
+void SnapshotWriter::WriterLoop()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    for (;;) {
+        Slot* slot = NULL;
+        for (int i = 0; i < NSLOTS; i++) {
+            if (_slots[i].state == SLOT_QUEUED) {
+                slot = &_slots[i];
+                break;
+            }
+        }
+        if (slot == NULL) {
+            if (_quit) break;
+            _cond.wait(lock);
+            continue;
+        }
+
+        slot->state = SLOT_WRITING;
+        lock.unlock();
+        bool ok = writeImage(slot->path, &slot->image, slot->format);
+        if (ok) {
+            _saved++;
+        } else {
+            _failed++;
+        }
+        lock.lock();
+        slot->state = SLOT_FREE;
+    }
+}
@@ -0,0 +1,85 @@
+// -*- tab-width: 4; mode: c++ -*-
+//  Snapshot.h
+//
+//  Saving still images of the live stream in the background.
+//
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "ImageFile.h"
+
+
+//  SnapshotWriter: encodes and writes snapshots from a background thread.
+//
+//  The UI thread calls Request(). The streaming thread checks
+//  IsRequested() on every frame (a single atomic load) and, when
+//  set, calls Capture(), which copies the frame into a pooled
+//  buffer and returns. Encoding and writing happen on the
+//  writer thread.
+//
+class SnapshotWriter
+{
+private:
+    static const int NSLOTS = 2;
+    static const size_t MAX_PATH_LENGTH = 260;
+
+    enum SlotState {
+        SLOT_FREE = 0,
+        SLOT_FILLING,               // being copied by Capture().
+        SLOT_QUEUED,
+        SLOT_WRITING,
+    };
+    struct Slot {
+        Image image;
+        char path[MAX_PATH_LENGTH];
+        ImageFormat format;
+        SlotState state;
+    };
+
+    Slot _slots[NSLOTS];
+    std::atomic<bool> _requested;
+    char _path[MAX_PATH_LENGTH];    // guarded by _mutex.
+    ImageFormat _format;            // guarded by _mutex.
+    bool _quit;
+
+    std::thread _writer;
+    std::mutex _mutex;
+    std::condition_variable _cond;
+
+    std::atomic<uint64_t> _saved;
+    std::atomic<uint64_t> _failed;
+    std::atomic<uint64_t> _lastCopyTime;
+    std::atomic<uint64_t> _maxCopyTime;
+
+    void WriterLoop();
+
+public:
+    SnapshotWriter();
+    ~SnapshotWriter();
+
+    // Request: asks for the next frame to be saved as path.
+    //   The format comes from the extension (.png, .pgm or .bmp).
+    //   The buffers are allocated here for the given frame size.
+    bool Request(const char* path, int width, int height);
+    bool IsRequested()
+        { return _requested.load(std::memory_order_relaxed); }
+
+    // Capture: copies a frame for a pending request.
+    //   stride can be negative for a bottom-up bitmap.
+    void Capture(const uint8_t* src, ptrdiff_t stride, int width, int height);
+
+    uint64_t GetSaved()
+        { return _saved.load(); }
+    uint64_t GetFailed()
+        { return _failed.load(); }
+    // Copy times of Capture() in nanoseconds.
+    uint64_t GetLastCopyTime()
+        { return _lastCopyTime.load(); }
+    uint64_t GetMaxCopyTime()
+        { return _maxCopyTime.load(); }
+};
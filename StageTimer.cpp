@@ -0,0 +1,132 @@
+// -*- tab-width: 4; mode: c++ -*-
+//  StageTimer.cpp
+//
+
+#include "StageTimer.h"
+
+//  Constants
+//
+static const int OVERHEAD_SCOPES = 100000;
+
+const char* getStageName(Stage stage)
+{
+    static const char* NAMES[STAGES] = {
+        "copy", "transform", "otsu", "deliver", "frame",
+    };
+    return (0 <= stage && stage < STAGES)? NAMES[stage] : "?";
+}
+
+
+#ifndef NO_STAGE_TIMING
+//  LatencyHistogram
+//
+LatencyHistogram::LatencyHistogram()
+{
+    Reset();
+}
+
+void LatencyHistogram::Reset()
+{
+    for (int i = 0; i < NBUCKETS; i++) {
+        _buckets[i].store(0, std::memory_order_relaxed);
+    }
+    _count.store(0, std::memory_order_relaxed);
+    _max.store(0, std::memory_order_relaxed);
+}
+
+// GetBucket: values below 32 have a bucket each; above, the top
+//   SUB_BITS+1 bits choose the bucket.
+int LatencyHistogram::GetBucket(uint64_t value)
+{
+    const uint64_t subs = 1 << SUB_BITS;
+    if (value < subs) return (int)value;
+    int msb;
+#ifdef __GNUC__
+    msb = 63 - __builtin_clzll(value);
+#else
+    msb = 0;
+    while (value >> (msb+1)) {
+        msb++;
+    }
+#endif
+    if (MAX_BITS <= msb) return NBUCKETS-1;
+    int shift = msb - SUB_BITS;
+    return ((shift+1) << SUB_BITS) + (int)((value >> shift) & (subs-1));
+}
+
+// GetBucketValue: the middle of bucket i.
+uint64_t LatencyHistogram::GetBucketValue(int i)
+{
+    int group = i >> SUB_BITS;
+    if (group == 0) return (uint64_t)i;
+    int shift = group-1;
+    uint64_t low = (uint64_t)((1 << SUB_BITS) + (i & ((1 << SUB_BITS)-1))) << shift;
+    return low + (((uint64_t)1 << shift) >> 1);
+}
+
+void LatencyHistogram::Record(uint64_t value)
+{
+    _buckets[GetBucket(value)].fetch_add(1, std::memory_order_relaxed);
+    _count.fetch_add(1, std::memory_order_relaxed);
+    uint64_t m = _max.load(std::memory_order_relaxed);
+    while (m < value &&
+           !_max.compare_exchange_weak(m, value, std::memory_order_relaxed)) ;
+}
+
+void LatencyHistogram::GetStats(StageStats* stats)
+{
+    // A copy, so that the percentiles agree with each other while
+    // frames are still being recorded.
+    uint32_t counts[NBUCKETS];
+    uint64_t total = 0;
+    for (int i = 0; i < NBUCKETS; i++) {
+        counts[i] = _buckets[i].load(std::memory_order_relaxed);
+        total += counts[i];
+    }
+    stats->count = _count.load(std::memory_order_relaxed);
+    stats->max = _max.load(std::memory_order_relaxed);
+
+    static const int PERMILLES[3] = { 500, 950, 990 };
+    uint64_t* values[3] = { &stats->p50, &stats->p95, &stats->p99 };
+    uint64_t sum = 0;
+    int i = 0;
+    for (int k = 0; k < 3; k++) {
+        uint64_t target = (total * PERMILLES[k] + 999) / 1000;
+        while (i < NBUCKETS-1 && sum + counts[i] < target) {
+            sum += counts[i];
+            i++;
+        }
+        uint64_t v = (total == 0)? 0 : GetBucketValue(i);
+        *values[k] = (stats->max < v)? stats->max : v;
+    }
+}
+
+
+//  StageTimers
+//
+void StageTimers::Reset()
+{
+    for (int i = 0; i < STAGES; i++) {
+        _hists[i].Reset();
+    }
+}
+
+bool StageTimers::GetStats(Stage stage, StageStats* stats)
+{
+    if (stage < 0 || STAGES <= stage) return false;
+    _hists[stage].GetStats(stats);
+    return true;
+}
+#endif
+
+double measureStageOverhead()
+{
+    StageTimers* timers = new StageTimers();
+    uint64_t t0 = getTimerNanos();
+    for (int i = 0; i < OVERHEAD_SCOPES; i++) {
+        StageScope scope(timers, STAGE_FRAME);
+    }
+    uint64_t t1 = getTimerNanos();
+    delete timers;
+    return (double)(t1 - t0) / OVERHEAD_SCOPES;
+}
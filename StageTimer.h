@@ -0,0 +1,154 @@
+// -*- tab-width: 4; mode: c++ -*-
+//  StageTimer.h
+//
+//  Timing the stages of the frame path.
+//
+//  The timers compile out completely with -DNO_STAGE_TIMING:
+//  StageScope is then empty and StageTimers keeps nothing.
+//  A timed stage is also recorded in the trace (TraceLog.h).
+//
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include "TraceLog.h"
+
+//  Stage: the parts of the frame path that are timed.
+//
+enum Stage {
+    STAGE_COPY,                 // copying the sample (or reading the frame).
+    STAGE_TRANSFORM,            // FiltaaCore::Process().
+    STAGE_OTSU,                 // the automatic threshold.
+    STAGE_DELIVER,              // passing the sample on (or writing it).
+    STAGE_FRAME,                // all of the above.
+    STAGES
+};
+
+// getStageName: returns a short name such as "copy".
+const char* getStageName(Stage stage);
+
+//  StageStats: a summary of the timings of a stage, in nanoseconds.
+//
+struct StageStats
+{
+    uint64_t count;
+    uint64_t p50;
+    uint64_t p95;
+    uint64_t p99;
+    uint64_t max;
+};
+
+// getTimerNanos: a monotonic clock.
+static inline uint64_t getTimerNanos()
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+//  LatencyHistogram
+//
+//  Log-linear buckets: every power of two is split into 16, so a
+//  percentile is within 1/16 of the truth from nanoseconds to
+//  minutes, in 600 counters. Recording is a relaxed increment and
+//  can be done from any thread; reading never blocks it.
+//
+class LatencyHistogram
+{
+public:
+    static const int SUB_BITS = 4;
+    static const int MAX_BITS = 40;
+    static const int NBUCKETS = (MAX_BITS-SUB_BITS+1) << SUB_BITS;
+
+private:
+    std::atomic<uint32_t> _buckets[NBUCKETS];
+    std::atomic<uint64_t> _count;
+    std::atomic<uint64_t> _max;
+
+    LatencyHistogram(const LatencyHistogram&);
+    LatencyHistogram& operator=(const LatencyHistogram&);
+
+    static int GetBucket(uint64_t value);
+    static uint64_t GetBucketValue(int i);
+
+public:
+    LatencyHistogram();
+
+    void Reset();
+    void Record(uint64_t value);
+    // GetStats: takes the percentiles of what has been recorded.
+    void GetStats(StageStats* stats);
+};
+
+
+//  StageTimers: a histogram per stage.
+//
+class StageTimers
+{
+private:
+#ifndef NO_STAGE_TIMING
+    LatencyHistogram _hists[STAGES];
+#endif
+
+    StageTimers(const StageTimers&);
+    StageTimers& operator=(const StageTimers&);
+
+public:
+    StageTimers() {}
+
+#ifndef NO_STAGE_TIMING
+    void Reset();
+    void Record(Stage stage, uint64_t nanos)
+        { _hists[stage].Record(nanos); }
+    // GetStats: returns false when the timers are compiled out.
+    bool GetStats(Stage stage, StageStats* stats);
+#else
+    void Reset() {}
+    void Record(Stage stage, uint64_t nanos) {}
+    bool GetStats(Stage stage, StageStats* stats)
+        { return false; }
+#endif
+};
+
+
+//  StageScope: times its own lifetime as a stage.
+//
+//  timers can be NULL.
+//
+#ifndef NO_STAGE_TIMING
+class StageScope
+{
+private:
+    StageTimers* _timers;
+    Stage _stage;
+    uint64_t _t0;
+
+    StageScope(const StageScope&);
+    StageScope& operator=(const StageScope&);
+
+public:
+    StageScope(StageTimers* timers, Stage stage)
+        : _timers(timers), _stage(stage)
+        { _t0 = (timers != NULL)? getTimerNanos() : 0; }
+    ~StageScope()
+        {
+            if (_timers != NULL) {
+                uint64_t t1 = getTimerNanos();
+                _timers->Record(_stage, t1 - _t0);
+                traceRecord(getStageName(_stage), _t0, t1);
+            }
+        }
+};
+#else
+class StageScope
+{
+public:
+    StageScope(StageTimers* timers, Stage stage) {}
+};
+#endif
+
+// measureStageOverhead: returns the cost of a StageScope in
+//   nanoseconds, measured over many of them.
+double measureStageOverhead();
@@ -0,0 +1,124 @@
+// -*- tab-width: 4; mode: c++ -*-
+//  TemporalFilter.cpp
+//
+
+#include <stdlib.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "TemporalFilter.h"
+
+//  Constants
+//
+static const int MAX_MOTION = 255;
+
+
+//  TemporalFilter
+//
+TemporalFilter::TemporalFilter()
+{
+    _width = 0;
+    _height = 0;
+    _strength = 0;
+    _motion = 0;
+    _acc = NULL;
+    _primed = false;
+}
+
+TemporalFilter::~TemporalFilter()
+{
+    Release();
+}
+
+bool TemporalFilter::Setup(int width, int height)
+{
+    if (width == _width && height == _height) return true;
+    Release();
+    if (width <= 0 || height <= 0) return false;
+
+    _acc = (uint16_t*)malloc(sizeof(uint16_t)*width*height);
+    if (_acc == NULL) return false;
+    _width = width;
+    _height = height;
+    return true;
+}
+
+void TemporalFilter::Release()
+{
+    free(_acc);
+    _acc = NULL;
+    _width = 0;
+    _height = 0;
+    _strength = 0;
+    _primed = false;
+}
+
+void TemporalFilter::Configure(int strength, int motion)
+{
+    strength = ((_acc == NULL || strength < 0)? 0 :
+                (MAX_STRENGTH < strength)? MAX_STRENGTH : strength);
+    if (_strength == 0) {
+        // The accumulators are stale.
+        _primed = false;
+    }
+    _strength = strength;
+    _motion = (motion < 0)? 0 : (MAX_MOTION < motion)? MAX_MOTION : motion;
+}
+
+// Blend: the average is acc += (lum - acc) / 2^strength, computed
+//   as acc - (acc >> strength) + (lum << (8-strength)), which stays
+//   within 16 bits without a sign.
+void TemporalFilter::Blend(uint8_t* row, int y)
+{
+    uint16_t* acc = _acc + (size_t)y*_width;
+    int width = _width;
+    int x = 0;
+    if (!_primed) {
+        for (; x < width; x++) {
+            acc[x] = (uint16_t)(row[x] << 8);
+        }
+        return;
+    }
+
+    int s = _strength;
+    int gate = _motion;
+#ifdef __SSE2__
+    __m128i zero = _mm_setzero_si128();
+    __m128i shift = _mm_cvtsi32_si128(s);
+    __m128i gain = _mm_cvtsi32_si128(8-s);
+    __m128i limit = _mm_set1_epi16((short)gate);
+    __m128i half = _mm_set1_epi16(128);
+    for (; x+16 <= width; x += 16) {
+        __m128i lum = _mm_loadu_si128((const __m128i*)(row+x));
+        __m128i out[2];
+        for (int k = 0; k < 2; k++) {
+            __m128i v = (k == 0)? _mm_unpacklo_epi8(lum, zero) :
+                _mm_unpackhi_epi8(lum, zero);
+            __m128i a = _mm_loadu_si128((const __m128i*)(acc+x+8*k));
+            __m128i mean = _mm_srli_epi16(a, 8);
+            __m128i d = _mm_or_si128(_mm_subs_epu16(v, mean),
+                                     _mm_subs_epu16(mean, v));
+            __m128i moved = _mm_cmpgt_epi16(d, limit);
+            __m128i ema = _mm_add_epi16(_mm_sub_epi16(a, _mm_srl_epi16(a, shift)),
+                                        _mm_sll_epi16(v, gain));
+            a = _mm_or_si128(_mm_and_si128(moved, _mm_slli_epi16(v, 8)),
+                             _mm_andnot_si128(moved, ema));
+            _mm_storeu_si128((__m128i*)(acc+x+8*k), a);
+            out[k] = _mm_srli_epi16(_mm_add_epi16(a, half), 8);
+        }
+        _mm_storeu_si128((__m128i*)(row+x), _mm_packus_epi16(out[0], out[1]));
+    }
+#endif
+    for (; x < width; x++) {
+        int v = row[x];
+        int a = acc[x];
+        int d = v - (a >> 8);
+        if (gate < d || d < -gate) {
+            a = v << 8;
+        } else {
+            a = a - (a >> s) + (v << (8-s));
+        }
+        acc[x] = (uint16_t)a;
+        row[x] = (uint8_t)((a + 128) >> 8);
+    }
+}
@@ -0,0 +1,69 @@
+// -*- tab-width: 4; mode: c++ -*-
+//  TemporalFilter.h
+//
+//  Averaging the luma plane over frames.
+//
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+
+//  TemporalFilter
+//
+//  Every pixel keeps an exponential moving average of its luma in
+//  a 16-bit accumulator (8.8 fixed point), so the noise of a still
+//  board is averaged over about 2^strength frames. A pixel that
+//  moves further than the motion gate from its average starts over
+//  from the new value, so writing and erasing leave no ghosts.
+//
+//  The plane is allocated by Setup() for a frame size, and each
+//  row is blended in place while it is still in the cache, 16
+//  pixels at a time with SSE2.
+//
+class TemporalFilter
+{
+public:
+    static const int MAX_STRENGTH = 4;
+
+private:
+    int _width;
+    int _height;
+    int _strength;              // 0 = off.
+    int _motion;
+    uint16_t* _acc;             // [height][width]
+    bool _primed;               // _acc holds the previous frame.
+
+    TemporalFilter(const TemporalFilter&);
+    TemporalFilter& operator=(const TemporalFilter&);
+
+public:
+    TemporalFilter();
+    ~TemporalFilter();
+
+    // Setup: allocates the accumulators for a frame size.
+    bool Setup(int width, int height);
+    void Release();
+    int GetWidth()
+        { return _width; }
+    int GetHeight()
+        { return _height; }
+    // GetMemorySize: returns the bytes of the accumulators.
+    size_t GetMemorySize()
+        { return sizeof(uint16_t)*_width*_height; }
+
+    // Configure: sets the strength (0 to MAX_STRENGTH) and the
+    //   motion gate (in luma levels) for the next frame.
+    void Configure(int strength, int motion);
+    bool IsActive()
+        { return (0 < _strength); }
+
+    // Reset: forget the previous frames.
+    void Reset()
+        { _primed = false; }
+    // Blend: averages row y in place.
+    void Blend(uint8_t* row, int y);
+    // End: ends a frame.
+    void End()
+        { _primed = true; }
+};
@@ -0,0 +1,193 @@
+// -*- tab-width: 4; mode: c++ -*-
+//  ThreadPool.cpp
+//
+
+#include "ThreadPool.h"
+
+
+// The pool and the worker index of the current thread.
+static thread_local ThreadPool* t_pool = NULL;
+static thread_local int t_index = -1;
+
+
+//  ThreadPool
+//
+ThreadPool::ThreadPool(int nthreads)
+    : _queued(0), _pending(0), _next(0)
+{
+    if (nthreads <= 0) {
+        nthreads = (int)std::thread::hardware_concurrency();
+        if (nthreads <= 0) {
+            nthreads = 1;
+        }
+    }
+    _quit = false;
+    for (int i = 0; i < nthreads; i++) {
+        _queues.push_back(new Queue());
+    }
+    for (int i = 0; i < nthreads; i++) {
+        _threads.push_back(std::thread(&ThreadPool::WorkerLoop, this, i));
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    Wait();
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _quit = true;
+    }
+    _wake.notify_all();
+    for (size_t i = 0; i < _threads.size(); i++) {
+        _threads[i].join();
+    }
+    for (size_t i = 0; i < _queues.size(); i++) {
+        delete _queues[i];
+    }
+}
+
+// Self: returns the worker index of the calling thread, or -1.
+int ThreadPool::Self()
+{
+    return (t_pool == this)? t_index : -1;
+}
+
+// CallTask: runs a Task of Submit() and frees it.
+void ThreadPool::CallTask(void* context, int begin, int end)
+{
+    Task* task = (Task*)context;
+    (*task)();
+    delete task;
+}
+
+// Push: adds a slot to our own deque, or to the next one.
+void ThreadPool::Push(const Slot& slot)
+{
+    int self = Self();
+    int i = (0 <= self)? self : (int)(_next.fetch_add(1) % _queues.size());
+    _pending.fetch_add(1);
+    {
+        Queue* q = _queues[i];
+        std::lock_guard<std::mutex> lock(q->mutex);
+        size_t size = q->slots.size();
+        if (q->count == size) {
+            std::vector<Slot> slots(2*size);
+            for (size_t k = 0; k < size; k++) {
+                slots[k] = q->slots[(q->head+k) % size];
+            }
+            q->slots.swap(slots);
+            q->head = 0;
+            size = q->slots.size();
+        }
+        q->slots[(q->head+q->count) % size] = slot;
+        q->count++;
+    }
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _queued.fetch_add(1);
+    }
+    _wake.notify_one();
+}
+
+void ThreadPool::Submit(const Task& task)
+{
+    Slot slot;
+    slot.func = CallTask;
+    slot.context = new Task(task);
+    slot.begin = 0;
+    slot.end = 0;
+    slot.left = NULL;
+    Push(slot);
+}
+
+// TakeTask: pops a task from our own deque or steals one.
+bool ThreadPool::TakeTask(int self, Slot* slot)
+{
+    int n = (int)_queues.size();
+    if (0 <= self) {
+        Queue* q = _queues[self];
+        std::lock_guard<std::mutex> lock(q->mutex);
+        if (0 < q->count) {
+            q->count--;
+            *slot = q->slots[(q->head+q->count) % q->slots.size()];
+            _queued.fetch_sub(1);
+            return true;
+        }
+    }
+    int start = (0 <= self)? self+1 : 0;
+    for (int k = 0; k < n; k++) {
+        Queue* q = _queues[(start+k) % n];
+        std::lock_guard<std::mutex> lock(q->mutex);
+        if (0 < q->count) {
+            *slot = q->slots[q->head];
+            q->head = (q->head+1) % q->slots.size();
+            q->count--;
+            _queued.fetch_sub(1);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ThreadPool::RunOne(int self)
+{
+    Slot slot;
+    if (_queued.load() == 0 || !TakeTask(self, &slot)) return false;
+    slot.func(slot.context, slot.begin, slot.end);
+    // The ParallelFor() can return as soon as left is 0.
+    if (slot.left != NULL) {
+        slot.left->fetch_sub(1);
+    }
+    _pending.fetch_sub(1);
+    return true;
+}
+
+void ThreadPool::WorkerLoop(int index)
+{
+    t_pool = this;
+    t_index = index;
+    for (;;) {
+        if (RunOne(index)) continue;
+        std::unique_lock<std::mutex> lock(_mutex);
+        _wake.wait(lock, [this]{ return _quit || 0 < _queued.load(); });
+        if (_quit) break;
+    }
+}
+
+void ThreadPool::Wait()
+{
+    int self = Self();
+    while (0 < _pending.load()) {
+        if (!RunOne(self)) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+// ParallelRange: ParallelFor() with the function and its context.
+void ThreadPool::ParallelRange(int n, RangeFunc func, void* context, int grain)
+{
+    if (n <= 0) return;
+    if (grain < 1) {
+        grain = 1;
+    }
+    // The caller takes the first chunk itself.
+    int first = (n < grain)? n : grain;
+    std::atomic<int> left((n-first+grain-1)/grain);
+    for (int i = first; i < n; i += grain) {
+        Slot slot;
+        slot.func = func;
+        slot.context = context;
+        slot.begin = i;
+        slot.end = (n < i+grain)? n : i+grain;
+        slot.left = &left;
+        Push(slot);
+    }
+    func(context, 0, first);
+    int self = Self();
+    while (0 < left.load()) {
+        if (!RunOne(self)) {
+            std::this_thread::yield();
+        }
+    }
+}
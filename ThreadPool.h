@@ -0,0 +1,97 @@
+// -*- tab-width: 4; mode: c++ -*-
+//  ThreadPool.h
+//
+//  A work-stealing thread pool.
+//
+//  Every worker has its own deque. A worker pops its newest task
+//  first and, when its deque is empty, steals the oldest task of
+//  another worker. Threads that wait for tasks (Wait() and
+//  ParallelFor()) run pending tasks instead of sleeping.
+//
+//  The deques are rings of fixed-size slots, made when the pool is,
+//  and a chunk of ParallelFor() is a slot that points to the range
+//  function of the caller; so ParallelFor() does not allocate, as
+//  long as no deque outgrows its slots. Submit() copies its task.
+//
+
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+//  ThreadPool
+//
+class ThreadPool
+{
+public:
+    typedef std::function<void()> Task;
+    // RangeFunc: runs [begin,end) of a ParallelFor() with its context.
+    typedef void (*RangeFunc)(void* context, int begin, int end);
+
+private:
+    static const int QUEUE_SLOTS = 256;
+
+    // Slot: a chunk of a ParallelFor(), or with no left, a Task of
+    //   Submit() as the context.
+    struct Slot {
+        RangeFunc func;
+        void* context;
+        int begin;
+        int end;
+        std::atomic<int>* left;     // the chunks not done yet.
+    };
+    // Queue: a ring of slots, grown only when full.
+    struct Queue {
+        std::mutex mutex;
+        std::vector<Slot> slots;
+        size_t head;
+        size_t count;
+
+        Queue() : slots(QUEUE_SLOTS), head(0), count(0) {}
+    };
+
+    std::vector<Queue*> _queues;
+    std::vector<std::thread> _threads;
+    std::atomic<int> _queued;       // tasks waiting in the deques.
+    std::atomic<int> _pending;      // tasks not finished yet.
+    std::atomic<unsigned> _next;
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    bool _quit;
+
+    ThreadPool(const ThreadPool&);
+    ThreadPool& operator=(const ThreadPool&);
+
+    template <class F>
+    static void CallRange(void* context, int begin, int end)
+        { (*(const F*)context)(begin, end); }
+    static void CallTask(void* context, int begin, int end);
+
+    void Push(const Slot& slot);
+    void ParallelRange(int n, RangeFunc func, void* context, int grain);
+    void WorkerLoop(int index);
+    bool TakeTask(int self, Slot* slot);
+    bool RunOne(int self);
+    int Self();
+
+public:
+    // nthreads = 0 uses one thread per CPU.
+    explicit ThreadPool(int nthreads=0);
+    ~ThreadPool();
+
+    int GetThreadCount()
+        { return (int)_threads.size(); }
+
+    void Submit(const Task& task);
+    // Wait: runs tasks until everything submitted has finished.
+    void Wait();
+    // ParallelFor: calls func(begin, end) over [0,n) in chunks of
+    //   grain and returns when all of them are done.
+    template <class F>
+    void ParallelFor(int n, const F& func, int grain=1)
+        { ParallelRange(n, &CallRange<F>, (void*)&func, grain); }
+};
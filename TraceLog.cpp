@@ -0,0 +1,178 @@
+// -*- tab-width: 4; mode: c++ -*-
+//  TraceLog.cpp
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include "TraceLog.h"
+#include "StageTimer.h"
+
+//  Constants
+//
+static const int TRACE_THREADS = 16;
+static const int TRACE_EVENTS = 8192; // per thread; a power of two.
+
+
+#ifndef NO_TRACING
+//  TraceRing
+//
+//  Written by the thread that holds it, read by writeTrace().
+//  An event is filled in before head moves past it, and the reader
+//  drops whatever may have been overwritten while it was copying.
+//
+struct TraceRing
+{
+    std::atomic<bool> used;
+    std::atomic<uint64_t> head;
+    TraceEvent events[TRACE_EVENTS];
+};
+
+// The rings are static, so no thread ever allocates one.
+static TraceRing rings[TRACE_THREADS];
+static std::atomic<uint32_t> threadSerial(0);
+static std::atomic<uint64_t> lost(0);
+
+//  TraceThread: the ring of the current thread, given back when
+//  the thread exits. The events stay there for the next owner.
+//
+struct TraceThread
+{
+    TraceRing* ring;
+    uint32_t serial;
+    bool tried;
+
+    ~TraceThread()
+        {
+            if (ring != NULL) {
+                ring->used.store(false, std::memory_order_release);
+            }
+        }
+};
+static thread_local TraceThread current = { NULL, 0, false };
+
+// getRing: takes a free ring for the current thread.
+static TraceRing* getRing()
+{
+    if (current.ring != NULL) return current.ring;
+    if (current.tried) return NULL;
+    current.tried = true;
+    current.serial = threadSerial.fetch_add(1, std::memory_order_relaxed) + 1;
+    for (int i = 0; i < TRACE_THREADS; i++) {
+        bool expected = false;
+        if (rings[i].used.compare_exchange_strong(
+                expected, true, std::memory_order_acquire)) {
+            current.ring = &rings[i];
+            break;
+        }
+    }
+    return current.ring;
+}
+
+void traceRecord(const char* name, uint64_t begin, uint64_t end)
+{
+    TraceRing* ring = getRing();
+    if (ring == NULL) {
+        lost.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    TraceEvent* event = &ring->events[head & (TRACE_EVENTS-1)];
+    event->name = name;
+    event->begin = begin;
+    event->end = end;
+    event->thread = current.serial;
+    ring->head.store(head+1, std::memory_order_release);
+}
+
+TraceScope::TraceScope(const char* name)
+    : _name(name), _t0(getTimerNanos())
+{
+}
+
+TraceScope::~TraceScope()
+{
+    traceRecord(_name, _t0, getTimerNanos());
+}
+
+// copyRing: copies the events that are safe to read; returns
+//   the number copied.
+static int copyRing(TraceEvent* dst, TraceRing* ring)
+{
+    uint64_t head = ring->head.load(std::memory_order_acquire);
+    uint64_t first = (TRACE_EVENTS < head)? head-TRACE_EVENTS : 0;
+    for (uint64_t i = first; i < head; i++) {
+        dst[i-first] = ring->events[i & (TRACE_EVENTS-1)];
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    // The owner may have overwritten the oldest ones meanwhile;
+    // the slot of head itself may be half written.
+    uint64_t head2 = ring->head.load(std::memory_order_relaxed);
+    uint64_t safe = (TRACE_EVENTS <= head2)? head2-TRACE_EVENTS+1 : 0;
+    int skip = (int)((first < safe)? safe-first : 0);
+    int n = (int)(head-first);
+    if (n <= skip) return 0;
+    for (int i = skip; i < n; i++) {
+        dst[i-skip] = dst[i];
+    }
+    return n-skip;
+}
+
+bool writeTrace(const char* path)
+{
+    TraceEvent* events = (TraceEvent*)malloc(sizeof(TraceEvent)*TRACE_EVENTS);
+    if (events == NULL) return false;
+    FILE* fp = fopen(path, "w");
+    if (fp == NULL) {
+        free(events);
+        return false;
+    }
+
+    // Times are written in microseconds from the first event.
+    uint64_t origin = UINT64_MAX;
+    for (int i = 0; i < TRACE_THREADS; i++) {
+        int n = copyRing(events, &rings[i]);
+        for (int j = 0; j < n; j++) {
+            if (events[j].begin < origin) origin = events[j].begin;
+        }
+    }
+
+    fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    bool first = true;
+    for (int i = 0; i < TRACE_THREADS; i++) {
+        int n = copyRing(events, &rings[i]);
+        for (int j = 0; j < n; j++) {
+            const TraceEvent* e = &events[j];
+            // Clamp the events that came after the first pass.
+            uint64_t begin = (origin < e->begin)? e->begin-origin : 0;
+            uint64_t dur = (e->begin < e->end)? e->end-e->begin : 0;
+            fprintf(fp, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,"
+                    "\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                    first? "" : ",\n", e->name, e->thread,
+                    begin/1e3, dur/1e3);
+            first = false;
+        }
+    }
+    fprintf(fp, "\n]}\n");
+    free(events);
+    bool ok = (ferror(fp) == 0);
+    if (fclose(fp) != 0) ok = false;
+    return ok;
+}
+
+uint64_t getTraceLost()
+{
+    return lost.load(std::memory_order_relaxed);
+}
+
+#else
+bool writeTrace(const char* path)
+{
+    return false;
+}
+
+uint64_t getTraceLost()
+{
+    return 0;
+}
+#endif
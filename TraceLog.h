@@ -0,0 +1,68 @@
+// -*- tab-width: 4; mode: c++ -*-
+//  TraceLog.h
+//
+//  Recording what the frame path does, for a trace viewer.
+//
+//  Each thread appends its events to a ring of its own, so recording
+//  takes no lock and allocates nothing; the oldest events are
+//  overwritten. writeTrace() dumps the rings as Chrome trace-event
+//  JSON (chrome://tracing, Perfetto).
+//
+//  The recording compiles out with -DNO_TRACING.
+//
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+//  TraceEvent: a span of time on a thread.
+//
+struct TraceEvent
+{
+    const char* name;           // a string literal.
+    uint64_t begin;             // getTimerNanos().
+    uint64_t end;
+    uint32_t thread;            // numbered from 1 as threads appear.
+};
+
+#ifndef NO_TRACING
+// traceRecord: appends an event to the ring of the calling thread.
+//   name must stay valid until the trace is written.
+void traceRecord(const char* name, uint64_t begin, uint64_t end);
+#else
+static inline void traceRecord(const char* name, uint64_t begin, uint64_t end) {}
+#endif
+
+// writeTrace: writes the events in the rings as JSON.
+//   Can be called from any thread while the others record; returns
+//   false on an error or when the recording is compiled out.
+bool writeTrace(const char* path);
+
+// getTraceLost: returns the number of events dropped because every
+//   ring was taken by a live thread.
+uint64_t getTraceLost();
+
+
+//  TraceScope: records its own lifetime as an event.
+//
+#ifndef NO_TRACING
+class TraceScope
+{
+private:
+    const char* _name;
+    uint64_t _t0;
+
+    TraceScope(const TraceScope&);
+    TraceScope& operator=(const TraceScope&);
+
+public:
+    TraceScope(const char* name);
+    ~TraceScope();
+};
+#else
+class TraceScope
+{
+public:
+    TraceScope(const char* name) {}
+};
+#endif
@@ -0,0 +1,393 @@
+// -*- tab-width: 4; mode: c++ -*-
+//  VideoFile.cpp
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <thread>
+#include "VideoFile.h"
+
+static const char Y4M_MAGIC[] = "YUV4MPEG2 ";
+static const char Y4M_FRAME[] = "FRAME";
+static const size_t Y4M_MAX_LINE = 1024;
+// The 8-bit 4:2:0 color spaces, which differ only in chroma siting.
+static const char* Y4M_420_TAGS[] = {
+    "C420", "C420jpeg", "C420paldv", "C420mpeg2", NULL,
+};
+
+// clip8: limit a value to 0-255.
+static inline uint8_t clip8(int v)
+{
+    return (uint8_t)((v < 0)? 0 : (255 < v)? 255 : v);
+}
+
+// isTag: checks if a header token of n chars is one of tags.
+static bool isTag(const char* p, size_t n, const char* const* tags)
+{
+    for (int i = 0; tags[i] != NULL; i++) {
+        if (strlen(tags[i]) == n && strncmp(p, tags[i], n) == 0) return true;
+    }
+    return false;
+}
+
+// putYUV: convert a BT.601 (limited range) pixel to B,G,R.
+static inline void putYUV(uint8_t* p, int y, int u, int v)
+{
+    int c = 298*(y-16) + 128;
+    int d = u - 128;
+    int e = v - 128;
+    p[0] = clip8((c + 516*d) >> 8);
+    p[1] = clip8((c - 100*d - 208*e) >> 8);
+    p[2] = clip8((c + 409*e) >> 8);
+}
+
+VideoFormat getVideoFormat(const char* path)
+{
+    const char* ext = strrchr(path, '.');
+    if (ext == NULL) return VIDEO_UNKNOWN;
+    char s[8];
+    int i;
+    for (i = 0; ext[i+1] != 0 && i < 7; i++) {
+        s[i] = (char)tolower((unsigned char)ext[i+1]);
+    }
+    s[i] = 0;
+    if (strcmp(s, "bgr") == 0) return VIDEO_BGR24;
+    if (strcmp(s, "rgb") == 0) return VIDEO_RGB24;
+    if (strcmp(s, "yuy2") == 0 || strcmp(s, "yuyv") == 0) return VIDEO_YUY2;
+    return VIDEO_UNKNOWN;
+}
+
+bool getVideoSize(const char* path, int* width, int* height)
+{
+    // Take the last "WxH" in the name.
+    bool found = false;
+    for (const char* p = path; *p != 0; p++) {
+        if (!isdigit((unsigned char)*p)) continue;
+        if (p != path && isdigit((unsigned char)p[-1])) continue;
+        char* end;
+        long w = strtol(p, &end, 10);
+        if (*end != 'x' || !isdigit((unsigned char)end[1])) continue;
+        long h = strtol(end+1, &end, 10);
+        if (0 < w && w <= 100000 && 0 < h && h <= 100000) {
+            *width = (int)w;
+            *height = (int)h;
+            found = true;
+        }
+    }
+    return found;
+}
+
+
+//  VideoFile
+//
+VideoFile::VideoFile()
+{
+    _format = VIDEO_UNKNOWN;
+    _width = 0;
+    _height = 0;
+    _chromaWidth = 0;
+    _chromaHeight = 0;
+    _rateNum = 30;
+    _rateDen = 1;
+    _frameSize = 0;
+    _speed = 1.0;
+    _position = 0;
+    _started = false;
+}
+
+VideoFile::~VideoFile()
+{
+    Close();
+}
+
+void VideoFile::Close()
+{
+    _file.Close();
+    _offsets.clear();
+    _format = VIDEO_UNKNOWN;
+}
+
+bool VideoFile::ParseY4MHeader(const char* line, size_t length)
+{
+    _width = _height = 0;
+    _rateNum = 30;
+    _rateDen = 1;
+    _format = VIDEO_I420;
+    size_t i = sizeof(Y4M_MAGIC)-1;
+    while (i < length) {
+        while (i < length && line[i] == ' ') i++;
+        size_t end = i;
+        while (end < length && line[end] != ' ') end++;
+        const char* p = line+i;
+        size_t n = end-i;
+        switch (*p) {
+        case 'W':
+            _width = atoi(p+1);
+            break;
+        case 'H':
+            _height = atoi(p+1);
+            break;
+        case 'F':
+            {
+                char* q;
+                long num = strtol(p+1, &q, 10);
+                long den = (*q == ':')? strtol(q+1, NULL, 10) : 0;
+                if (0 < num && 0 < den) {
+                    _rateNum = (int)num;
+                    _rateDen = (int)den;
+                }
+            }
+            break;
+        case 'C':
+            // Only 8-bit samples are supported (not C420p10 etc.)
+            if (isTag(p, n, Y4M_420_TAGS)) {
+                _format = VIDEO_I420;
+            } else if (n == 4 && strncmp(p, "C444", 4) == 0) {
+                _format = VIDEO_I444;
+            } else if (n == 5 && strncmp(p, "Cmono", 5) == 0) {
+                _format = VIDEO_GRAY;
+            } else {
+                return false;
+            }
+            break;
+        }
+        i = end;
+    }
+    if (_width <= 0 || _height <= 0 || 100000 < _width || 100000 < _height) {
+        return false;
+    }
+    switch (_format) {
+    case VIDEO_I420:
+        _chromaWidth = (_width+1)/2;
+        _chromaHeight = (_height+1)/2;
+        break;
+    case VIDEO_I444:
+        _chromaWidth = _width;
+        _chromaHeight = _height;
+        break;
+    default:
+        _chromaWidth = _chromaHeight = 0;
+        break;
+    }
+    _frameSize = (size_t)_width*_height + 2*(size_t)_chromaWidth*_chromaHeight;
+    return true;
+}
+
+// IndexY4MFrames: find every frame from offset.
+//   Frame headers can carry parameters, so each one is skipped
+//   individually; this touches one line per frame.
+bool VideoFile::IndexY4MFrames(size_t offset)
+{
+    const uint8_t* data = _file.GetData();
+    size_t size = _file.GetSize();
+    _offsets.clear();
+    while (offset + sizeof(Y4M_FRAME)-1 <= size) {
+        if (memcmp(data+offset, Y4M_FRAME, sizeof(Y4M_FRAME)-1) != 0) break;
+        size_t limit = size - offset;
+        if (Y4M_MAX_LINE < limit) {
+            limit = Y4M_MAX_LINE;
+        }
+        const uint8_t* nl = (const uint8_t*)memchr(data+offset, '\n', limit);
+        if (nl == NULL) break;
+        size_t payload = (nl+1) - data;
+        if (size - payload < _frameSize) break;
+        _offsets.push_back(payload);
+        offset = payload + _frameSize;
+    }
+    return !_offsets.empty();
+}
+
+bool VideoFile::SetupRaw(VideoFormat format, int width, int height)
+{
+    _format = format;
+    _width = width;
+    _height = height;
+    _chromaWidth = _chromaHeight = 0;
+    switch (format) {
+    case VIDEO_BGR24:
+    case VIDEO_RGB24:
+        _frameSize = (size_t)width*height*3;
+        break;
+    case VIDEO_YUY2:
+        if (width & 1) return false;
+        _frameSize = (size_t)width*height*2;
+        break;
+    default:
+        return false;
+    }
+    _offsets.clear();
+    size_t size = _file.GetSize();
+    for (size_t offset = 0; _frameSize <= size - offset; offset += _frameSize) {
+        _offsets.push_back(offset);
+    }
+    return !_offsets.empty();
+}
+
+bool VideoFile::Open(const char* path)
+{
+    Close();
+    if (!_file.Open(path)) return false;
+
+    const char* data = (const char*)_file.GetData();
+    size_t size = _file.GetSize();
+    if (sizeof(Y4M_MAGIC)-1 <= size &&
+        memcmp(data, Y4M_MAGIC, sizeof(Y4M_MAGIC)-1) == 0) {
+        size_t limit = (size < Y4M_MAX_LINE)? size : Y4M_MAX_LINE;
+        const char* nl = (const char*)memchr(data, '\n', limit);
+        if (nl == NULL || !ParseY4MHeader(data, nl-data) ||
+            !IndexY4MFrames((nl+1) - data)) {
+            Close();
+            return false;
+        }
+    } else {
+        int width, height;
+        VideoFormat format = getVideoFormat(path);
+        if (format == VIDEO_UNKNOWN ||
+            !getVideoSize(path, &width, &height) ||
+            !SetupRaw(format, width, height)) {
+            Close();
+            return false;
+        }
+    }
+
+    _file.Advise(0, _file.GetSize());
+    Rewind(0);
+    return true;
+}
+
+bool VideoFile::OpenRaw(
+    const char* path, VideoFormat format,
+    int width, int height, int rateNum, int rateDen)
+{
+    Close();
+    if (width <= 0 || height <= 0 || rateNum <= 0 || rateDen <= 0) return false;
+    if (!_file.Open(path)) return false;
+    if (!SetupRaw(format, width, height)) {
+        Close();
+        return false;
+    }
+    _rateNum = rateNum;
+    _rateDen = rateDen;
+    _file.Advise(0, _file.GetSize());
+    Rewind(0);
+    return true;
+}
+
+bool VideoFile::GetFrame(int n, VideoFrame* frame) const
+{
+    if (n < 0 || GetFrameCount() <= n) return false;
+    const uint8_t* p = _file.GetData() + _offsets[n];
+    size_t lumaSize = (size_t)_width*_height;
+    size_t chromaSize = (size_t)_chromaWidth*_chromaHeight;
+    switch (_format) {
+    case VIDEO_I420:
+    case VIDEO_I444:
+    case VIDEO_GRAY:
+        frame->planes[0] = p;
+        frame->planes[1] = (chromaSize)? p+lumaSize : NULL;
+        frame->planes[2] = (chromaSize)? p+lumaSize+chromaSize : NULL;
+        frame->strides[0] = _width;
+        frame->strides[1] = frame->strides[2] = _chromaWidth;
+        break;
+    case VIDEO_YUY2:
+        frame->planes[0] = p;
+        frame->planes[1] = frame->planes[2] = NULL;
+        frame->strides[0] = (size_t)_width*2;
+        frame->strides[1] = frame->strides[2] = 0;
+        break;
+    default:
+        frame->planes[0] = p;
+        frame->planes[1] = frame->planes[2] = NULL;
+        frame->strides[0] = (size_t)_width*3;
+        frame->strides[1] = frame->strides[2] = 0;
+        break;
+    }
+    frame->timestamp = (int64_t)n * 10000000 * _rateDen / _rateNum;
+    return true;
+}
+
+bool VideoFile::ReadFrame(int n, uint8_t* dst, ptrdiff_t dstStride) const
+{
+    VideoFrame frame;
+    if (!GetFrame(n, &frame)) return false;
+    ConvertFrame(&frame, dst, dstStride);
+    return true;
+}
+
+void VideoFile::ConvertFrame(
+    const VideoFrame* frame, uint8_t* dst, ptrdiff_t dstStride) const
+{
+    // Chroma subsampling shifts.
+    int hs = (_chromaWidth == _width)? 0 : 1;
+    int vs = (_chromaHeight == _height)? 0 : 1;
+    for (int y = 0; y < _height; y++) {
+        const uint8_t* src = frame->planes[0] + frame->strides[0]*y;
+        uint8_t* p = dst + dstStride*y;
+        switch (_format) {
+        case VIDEO_I420:
+        case VIDEO_I444:
+            {
+                const uint8_t* up = frame->planes[1] + frame->strides[1]*(y >> vs);
+                const uint8_t* vp = frame->planes[2] + frame->strides[2]*(y >> vs);
+                for (int x = 0; x < _width; x++) {
+                    putYUV(p, src[x], up[x >> hs], vp[x >> hs]);
+                    p += 3;
+                }
+            }
+            break;
+        case VIDEO_GRAY:
+            for (int x = 0; x < _width; x++) {
+                p[0] = p[1] = p[2] = clip8((298*(src[x]-16) + 128) >> 8);
+                p += 3;
+            }
+            break;
+        case VIDEO_YUY2:
+            for (int x = 0; x < _width; x += 2) {
+                putYUV(p, src[0], src[1], src[3]);
+                putYUV(p+3, src[2], src[1], src[3]);
+                src += 4;
+                p += 6;
+            }
+            break;
+        case VIDEO_RGB24:
+            for (int x = 0; x < _width; x++) {
+                p[0] = src[2];
+                p[1] = src[1];
+                p[2] = src[0];
+                src += 3;
+                p += 3;
+            }
+            break;
+        default:
+            memcpy(p, src, (size_t)_width*3);
+            break;
+        }
+    }
+}
+
+void VideoFile::Rewind(int n)
+{
+    _position = n;
+    _started = false;
+}
+
+bool VideoFile::NextFrame(VideoFrame* frame)
+{
+    if (!GetFrame(_position, frame)) return false;
+
+    if (0 < _speed) {
+        if (!_started) {
+            _started = true;
+            _startTime = std::chrono::steady_clock::now() -
+                std::chrono::nanoseconds((int64_t)(frame->timestamp*100 / _speed));
+        } else {
+            // Timestamps are in 100ns units.
+            std::chrono::nanoseconds delay((int64_t)(frame->timestamp*100 / _speed));
+            std::this_thread::sleep_until(_startTime + delay);
+        }
+    }
+
+    _position++;
+    return true;
+}
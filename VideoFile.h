@@ -0,0 +1,120 @@
+// -*- tab-width: 4; mode: c++ -*-
+//  VideoFile.h
+//
+//  Reading uncompressed video (YUV4MPEG2 or raw frames) through
+//  a memory mapping.
+//
+//  Raw files have no header; the format comes from the extension
+//  (.bgr, .rgb, .yuy2/.yuyv) and the size from the name, as in
+//  "lecture_640x480.yuy2".
+//
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <chrono>
+#include <vector>
+#include "MappedFile.h"
+
+enum VideoFormat {
+    VIDEO_UNKNOWN = 0,
+    VIDEO_I420,                 // Y4M 4:2:0 planes.
+    VIDEO_I444,                 // Y4M 4:4:4 planes.
+    VIDEO_GRAY,                 // Y4M mono.
+    VIDEO_BGR24,                // packed B,G,R, top row first.
+    VIDEO_RGB24,                // packed R,G,B, top row first.
+    VIDEO_YUY2,                 // packed Y0,U,Y1,V.
+};
+
+//  VideoFrame: a frame pointing into the mapping.
+//
+struct VideoFrame
+{
+    const uint8_t* planes[3];
+    size_t strides[3];
+    int64_t timestamp;          // in 100ns units.
+};
+
+// getVideoFormat: guess a raw format from a file name.
+VideoFormat getVideoFormat(const char* path);
+// getVideoSize: find "WxH" in a file name.
+bool getVideoSize(const char* path, int* width, int* height);
+
+
+//  VideoFile
+//
+//  Frames are handed out without copying. ConvertFrame() turns
+//  a frame into 24-bit B,G,R; it does not modify the object, so
+//  several threads can read different frames at once.
+//
+class VideoFile
+{
+private:
+    MappedFile _file;
+    VideoFormat _format;
+    int _width;
+    int _height;
+    int _chromaWidth;
+    int _chromaHeight;
+    int _rateNum;
+    int _rateDen;
+    size_t _frameSize;          // payload size of a frame.
+    std::vector<uint64_t> _offsets;
+
+    // Pacing.
+    double _speed;
+    int _position;              // next frame for NextFrame().
+    bool _started;
+    std::chrono::steady_clock::time_point _startTime;
+
+    bool ParseY4MHeader(const char* line, size_t length);
+    bool IndexY4MFrames(size_t offset);
+    bool SetupRaw(VideoFormat format, int width, int height);
+
+public:
+    VideoFile();
+    ~VideoFile();
+
+    // Open: opens a Y4M file, or a raw file named as above.
+    bool Open(const char* path);
+    bool OpenRaw(const char* path, VideoFormat format,
+                 int width, int height, int rateNum=30, int rateDen=1);
+    void Close();
+    bool IsOpen() const
+        { return _format != VIDEO_UNKNOWN; }
+
+    VideoFormat GetFormat() const
+        { return _format; }
+    int GetWidth() const
+        { return _width; }
+    int GetHeight() const
+        { return _height; }
+    int GetRateNum() const
+        { return _rateNum; }
+    int GetRateDen() const
+        { return _rateDen; }
+    int GetFrameCount() const
+        { return (int)_offsets.size(); }
+    size_t GetFrameSize() const
+        { return _frameSize; }
+    // GetFrameTime: returns the duration of a frame in 100ns units.
+    int64_t GetFrameTime() const
+        { return (int64_t)10000000 * _rateDen / _rateNum; }
+
+    // GetFrame: points frame at the data of frame n.
+    bool GetFrame(int n, VideoFrame* frame) const;
+    // ConvertFrame: converts a frame into B,G,R pixels.
+    //   dstStride can be negative for a bottom-up bitmap.
+    void ConvertFrame(
+        const VideoFrame* frame, uint8_t* dst, ptrdiff_t dstStride) const;
+    // ReadFrame: converts frame n.
+    bool ReadFrame(int n, uint8_t* dst, ptrdiff_t dstStride) const;
+
+    // Sequential playback.
+    //   speed 1.0 plays in real time, 2.0 twice as fast, and 0
+    //   returns frames as fast as they are asked for.
+    void SetSpeed(double speed)
+        { _speed = speed; }
+    void Rewind(int n=0);
+    bool NextFrame(VideoFrame* frame);
+};
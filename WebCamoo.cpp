@@ -14,22 +14,38 @@
 // Copyright (c) Microsoft Corporation. All rights reserved.
 // --- End of Microsoft Credit ---
 
-#define _WIN32_WINNT 0x0500
+#define _WIN32_WINNT 0x0501
 
 #include <windows.h>
 #include <dbt.h>
 #include <dshow.h>
+#include <commdlg.h>
 #include <stdio.h>
 #include <strsafe.h>
 
 #include "WebCamoo.h"
 #include "Filtaa.h"
+#include "BoardSource.h"
+#include "Batch.h"
+#include "FrameRing.h"
+#include "MjpegServer.h"
+#include "TraceLog.h"
 
 
 //  Constants
 //
 const LPCWSTR APPLICATION_NAME = L"WebCamoo";
 const int THRESHOLD_DELTA = 5;
+const int BRIGHTNESS_DELTA = 8;
+const int CONTRAST_DELTA = 10;
+const int SMOOTH_RADIUS = 1;
+const int SHARPEN_RADIUS = 2;
+const int SHARPEN_AMOUNT = 100;
+const int DENOISE_SIZE = 3;
+const int TEMPORAL_STRENGTH = 2;
+const int STATUS_HEIGHT = 20;
+const UINT STATUS_TIMER_ID = 1;
+const UINT STATUS_INTERVAL = 1000; // msec.
 
 // Application-defined message to notify app of filtergraph events.
 const UINT WM_GRAPHNOTIFY = WM_APP+1;
@@ -132,6 +148,22 @@ static BOOL toggleMenuItemChecked(HMENU hMenu, UINT id)
     return FALSE;
 }
 
+static void setMenuItemChecked(HMENU hMenu, UINT id, BOOL checked)
+{
+    hMenu = findSubMenu(hMenu, id);
+    MENUITEMINFO mii = {0};
+    mii.cbSize = sizeof(mii);
+    mii.fMask = MIIM_STATE;
+    if (GetMenuItemInfo(hMenu, id, FALSE, &mii)) {
+        if (checked) {
+            mii.fState |= MFS_CHECKED;
+        } else {
+            mii.fState &= ~MFS_CHECKED;
+        }
+        SetMenuItemInfo(hMenu, id, FALSE, &mii);
+    }
+}
+
 static void setMenuItemDisabled(HMENU hMenu, UINT id, BOOL disabled)
 {
     hMenu = findSubMenu(hMenu, id);
@@ -419,6 +451,7 @@ class WebCamoo
     IBaseFilter* _pVideoSink;
     IBaseFilter* _pAudioSink;
     Filtaa* _pFiltaa;
+    BoardSource* _pReplay;
     IMediaEventEx* _pMediaEvent;
 
     IVideoWindow* _pVideoWindow;
@@ -433,6 +466,10 @@ class WebCamoo
     IMoniker* _pVideoMoniker;
     IMoniker* _pAudioMoniker;
 
+    HWND _hStatus;
+    DWORD _statusTick;
+    FiltaaStats _statusStats;
+
     void UpdateDeviceMenuItems();
     void UpdateDeviceMenuChecks();
     void UpdateOutputMenu();
@@ -443,9 +480,13 @@ class WebCamoo
     HRESULT BuildAudioFilterGraph();
     HRESULT SelectVideo(IMoniker* pVideoMoniker);
     HRESULT SelectAudio(IMoniker* pAudioMoniker);
+    HRESULT SelectReplay(const char* path);
 
     HRESULT ResizeVideoWindow(void);
     HRESULT HandleGraphEvent(void);
+    void ShowStatusBar(BOOL show);
+    void UpdateStatusBar(void);
+    uint64_t GetDroppedFrames(void);
 
     HRESULT OpenVideoFilterProperties();
     HRESULT OpenVideoPinProperties();
@@ -473,6 +514,7 @@ WebCamoo::WebCamoo()
     _pVideoSink = NULL;
     _pAudioSink = NULL;
     _pFiltaa = new Filtaa();
+    _pReplay = NULL;
     _pMediaEvent = NULL;
 
     _pVideoWindow = NULL;
@@ -486,6 +528,10 @@ WebCamoo::WebCamoo()
     _notify = NULL;
     _pVideoMoniker = NULL;
     _pAudioMoniker = NULL;
+
+    _hStatus = NULL;
+    _statusTick = 0;
+    ZeroMemory(&_statusStats, sizeof(_statusStats));
 }
 
 HRESULT WebCamoo::InitializeCOM()
@@ -649,7 +695,9 @@ void WebCamoo::UpdateDeviceMenuChecks()
         GetMenuItemInfo(_deviceMenu, i, TRUE, &mii);
         BOOL checked;
         if (mii.wID == IDM_DEVICE_VIDEO_NONE) {
-            checked = (_pVideoMoniker == NULL);
+            checked = (_pVideoMoniker == NULL && _pReplay == NULL);
+        } else if (mii.wID == IDM_REPLAY_FILE) {
+            checked = (_pReplay != NULL);
         } else if (mii.wID == IDM_DEVICE_AUDIO_NONE) {
             checked = (_pAudioMoniker == NULL);
         } else if (IDM_DEVICE_VIDEO_START <= mii.wID &&
@@ -674,17 +722,76 @@ void WebCamoo::UpdateOutputMenu()
         setMenuItemDisabled(_hMenu, IDM_KEEP_ASPECT_RATIO, TRUE);
         setMenuItemDisabled(_hMenu, IDM_RESET_WINDOW_SIZE, TRUE);
         setMenuItemDisabled(_hMenu, IDM_THRESHOLDING, TRUE);
+        setMenuItemDisabled(_hMenu, IDM_GRAYSCALE, TRUE);
+        setMenuItemDisabled(_hMenu, IDM_CLAHE, TRUE);
+        setMenuItemDisabled(_hMenu, IDM_INK_COLORS, TRUE);
         setMenuItemDisabled(_hMenu, IDM_AUTO_THRESHOLD, TRUE);
         setMenuItemDisabled(_hMenu, IDM_INC_THRESHOLD, TRUE);
         setMenuItemDisabled(_hMenu, IDM_DEC_THRESHOLD, TRUE);
+        setMenuItemDisabled(_hMenu, IDM_INC_BRIGHTNESS, TRUE);
+        setMenuItemDisabled(_hMenu, IDM_DEC_BRIGHTNESS, TRUE);
+        setMenuItemDisabled(_hMenu, IDM_INC_CONTRAST, TRUE);
+        setMenuItemDisabled(_hMenu, IDM_DEC_CONTRAST, TRUE);
+        setMenuItemDisabled(_hMenu, IDM_RESET_TONE, TRUE);
+        setMenuItemDisabled(_hMenu, IDM_SMOOTH, TRUE);
+        setMenuItemDisabled(_hMenu, IDM_SHARPEN, TRUE);
+        setMenuItemDisabled(_hMenu, IDM_DENOISE, TRUE);
+        setMenuItemDisabled(_hMenu, IDM_TEMPORAL, TRUE);
+        for (int i = 0; i < LUMA_MODELS; i++) {
+            setMenuItemDisabled(_hMenu, IDM_LUMA_BT601+i, TRUE);
+        }
+        setMenuItemDisabled(_hMenu, IDM_RECORD, TRUE);
+        setMenuItemDisabled(_hMenu, IDM_SNAPSHOT, TRUE);
+        setMenuItemDisabled(_hMenu, IDM_SHARE, TRUE);
+        setMenuItemDisabled(_hMenu, IDM_SERVE, TRUE);
     } else {
         setMenuItemDisabled(_hMenu, IDM_KEEP_ASPECT_RATIO, FALSE);
         setMenuItemDisabled(_hMenu, IDM_RESET_WINDOW_SIZE, FALSE);
         setMenuItemDisabled(_hMenu, IDM_THRESHOLDING, FALSE);
         BOOL thresholding = isMenuItemChecked(_hMenu, IDM_THRESHOLDING);
+        setMenuItemDisabled(_hMenu, IDM_GRAYSCALE, !thresholding);
+        setMenuItemDisabled(_hMenu, IDM_CLAHE, !thresholding);
+        setMenuItemDisabled(_hMenu, IDM_INK_COLORS, !thresholding);
         setMenuItemDisabled(_hMenu, IDM_AUTO_THRESHOLD, !thresholding);
         setMenuItemDisabled(_hMenu, IDM_INC_THRESHOLD, !thresholding);
         setMenuItemDisabled(_hMenu, IDM_DEC_THRESHOLD, !thresholding);
+        setMenuItemDisabled(_hMenu, IDM_INC_BRIGHTNESS, !thresholding);
+        setMenuItemDisabled(_hMenu, IDM_DEC_BRIGHTNESS, !thresholding);
+        setMenuItemDisabled(_hMenu, IDM_INC_CONTRAST, !thresholding);
+        setMenuItemDisabled(_hMenu, IDM_DEC_CONTRAST, !thresholding);
+        setMenuItemDisabled(_hMenu, IDM_RESET_TONE, !thresholding);
+        setMenuItemDisabled(_hMenu, IDM_SMOOTH, !thresholding);
+        setMenuItemDisabled(_hMenu, IDM_SHARPEN, !thresholding);
+        setMenuItemDisabled(_hMenu, IDM_DENOISE, !thresholding);
+        setMenuItemDisabled(_hMenu, IDM_TEMPORAL, !thresholding);
+        for (int i = 0; i < LUMA_MODELS; i++) {
+            setMenuItemDisabled(_hMenu, IDM_LUMA_BT601+i, !thresholding);
+        }
+        setMenuItemDisabled(_hMenu, IDM_RECORD, !thresholding);
+        setMenuItemDisabled(_hMenu, IDM_SNAPSHOT, !thresholding);
+        setMenuItemDisabled(_hMenu, IDM_SHARE, !thresholding);
+        setMenuItemDisabled(_hMenu, IDM_SERVE, !thresholding);
+    }
+    setMenuItemChecked(_hMenu, IDM_RECORD, _pFiltaa->IsRecording());
+    setMenuItemChecked(_hMenu, IDM_SHARE, _pFiltaa->IsSharing());
+    setMenuItemChecked(_hMenu, IDM_SERVE, _pFiltaa->IsServing());
+    setMenuItemChecked(_hMenu, IDM_GRAYSCALE,
+                       _pFiltaa->GetOutputMode() == OUTPUT_GRAY);
+    setMenuItemChecked(_hMenu, IDM_CLAHE,
+                       _pFiltaa->GetOutputMode() == OUTPUT_CLAHE);
+    setMenuItemChecked(_hMenu, IDM_INK_COLORS,
+                       _pFiltaa->GetOutputMode() == OUTPUT_INK);
+    FilterParams filter;
+    _pFiltaa->GetFilter(&filter);
+    setMenuItemChecked(_hMenu, IDM_SMOOTH,
+                       0 < filter.radius && filter.amount == 0);
+    setMenuItemChecked(_hMenu, IDM_SHARPEN,
+                       0 < filter.radius && 0 < filter.amount);
+    setMenuItemChecked(_hMenu, IDM_DENOISE, 0 < filter.median);
+    setMenuItemChecked(_hMenu, IDM_TEMPORAL, 0 < filter.temporal);
+    int model = _pFiltaa->GetLumaModel();
+    for (int i = 0; i < LUMA_MODELS; i++) {
+        setMenuItemChecked(_hMenu, IDM_LUMA_BT601+i, (i == model));
     }
 }
 
@@ -692,6 +799,7 @@ void WebCamoo::UpdateOutputMenu()
 HRESULT WebCamoo::UpdatePlayState(FILTER_STATE state)
 {
     HRESULT hr = S_OK;
+    TraceScope trace("UpdatePlayState");
 
     if (state != _state) {
         IMediaControl* pMC = NULL;
@@ -722,9 +830,16 @@ HRESULT WebCamoo::UpdatePlayState(FILTER_STATE state)
 HRESULT WebCamoo::ClearVideoFilterGraph()
 {
     log(L"ClearVideoFilterGraph");
+    TraceScope trace("ClearVideoFilterGraph");
 
     if (_pVideoWindow == NULL) return S_OK;
 
+    // Filtaa is leaving the graph; finish the recording and sharing.
+    HRESULT hr = _pFiltaa->StopRecording();
+    log(L"StopRecording: hr=%08x", hr);
+    _pFiltaa->StopSharing();
+    _pFiltaa->StopServing();
+
     _pVideoWindow->put_Visible(OAFALSE);
     _pVideoWindow->Release();
     _pVideoWindow = NULL;
@@ -754,36 +869,44 @@ HRESULT WebCamoo::BuildVideoFilterGraph()
 {
     HRESULT hr = S_OK;
     log(L"BuildVideoFilterGraph");
+    TraceScope trace("BuildVideoFilterGraph");
 
     if (_pVideoWindow != NULL) return S_OK;
 
     BOOL thresholding = isMenuItemChecked(_hMenu, IDM_THRESHOLDING);
+    // A replay source has a single uncategorized pin.
+    const GUID* category = (_pReplay != NULL)? NULL : &PIN_CATEGORY_PREVIEW;
     if (_pVideoSrc != NULL &&
         _pVideoSink != NULL) {
         // Add Capture filter to our graph.
         hr = _pGraph->AddFilter(_pVideoSink, L"VideoSink");
         if (FAILED(hr)) return hr;
-        if (thresholding) {
-            IBaseFilter* pFilter = NULL;
-            hr = _pFiltaa->QueryInterface(IID_PPV_ARGS(&pFilter));
+        // Filtaa is always put in, and bypassed when not thresholding,
+        // so that IDM_THRESHOLDING does not rebuild the graph.
+        _pFiltaa->SetBypass(!thresholding);
+        IBaseFilter* pFilter = NULL;
+        hr = _pFiltaa->QueryInterface(IID_PPV_ARGS(&pFilter));
+        if (SUCCEEDED(hr)) {
+            hr = _pGraph->AddFilter(pFilter, L"Filtaa");
             if (SUCCEEDED(hr)) {
-                hr = _pGraph->AddFilter(pFilter, L"Filtaa");
-                if (SUCCEEDED(hr)) {
-                    hr = _pCapture->RenderStream(
-                        &PIN_CATEGORY_PREVIEW, &MEDIATYPE_Video,
-                        _pVideoSrc, pFilter, _pVideoSink);
+                hr = _pCapture->RenderStream(
+                    category, &MEDIATYPE_Video,
+                    _pVideoSrc, pFilter, _pVideoSink);
+                if (FAILED(hr) && !thresholding) {
+                    // It cannot take the format; do without it.
+                    _pGraph->RemoveFilter(pFilter);
                 }
-                pFilter->Release();
             }
-            if (FAILED(hr)) return hr;
-        } else {
+            pFilter->Release();
+        }
+        if (FAILED(hr) && !thresholding) {
             // Render the preview pin on the video capture filter.
             // Use this instead of _pGraph->RenderFile.
             hr = _pCapture->RenderStream(
-                &PIN_CATEGORY_PREVIEW, &MEDIATYPE_Video,
+                category, &MEDIATYPE_Video,
                 _pVideoSrc, NULL, _pVideoSink);
-            if (FAILED(hr)) return hr;
         }
+        if (FAILED(hr)) return hr;
 
         // Obtain interfaces for Video Window.
         hr = _pVideoSink->QueryInterface(
@@ -848,6 +971,7 @@ HRESULT WebCamoo::SelectVideo(IMoniker* pMoniker)
         _pGraph->RemoveFilter(_pVideoSrc);
         _pVideoSrc->Release();
         _pVideoSrc = NULL;
+        _pReplay = NULL;
     }
 
     if (pMoniker != NULL) {
@@ -865,6 +989,29 @@ HRESULT WebCamoo::SelectVideo(IMoniker* pMoniker)
     return hr;
 }
 
+HRESULT WebCamoo::SelectReplay(const char* path)
+{
+    HRESULT hr;
+    log(L"SelectReplay: %S", path);
+
+    SelectVideo(NULL);
+
+    BoardSource* pReplay = new BoardSource();
+    pReplay->SetRealtime(!isMenuItemChecked(_hMenu, IDM_REPLAY_FAST));
+    hr = pReplay->Open(path);
+    if (SUCCEEDED(hr)) {
+        hr = _pGraph->AddFilter(pReplay, L"VideoSrc");
+    }
+    if (FAILED(hr)) {
+        pReplay->Release();
+        return hr;
+    }
+
+    _pVideoSrc = pReplay;
+    _pReplay = pReplay;
+    return hr;
+}
+
 HRESULT WebCamoo::SelectAudio(IMoniker* pMoniker)
 {
     HRESULT hr;
@@ -908,6 +1055,17 @@ HRESULT WebCamoo::InitializeWindow(HWND hWnd)
     dev.dbcc_classguid = AM_KSCATEGORY_CAPTURE;
     _notify = RegisterDeviceNotification(hWnd, &dev, DEVICE_NOTIFY_WINDOW_HANDLE);
 
+    // Create the status bar (hidden).
+    _hStatus = CreateWindow(
+        L"STATIC", L"",
+        WS_CHILD | WS_CLIPSIBLINGS | SS_SUNKEN | SS_LEFTNOWORDWRAP,
+        0, 0, 0, 0,
+        hWnd, NULL, (HINSTANCE)GetWindowLongPtr(hWnd, GWLP_HINSTANCE), NULL);
+    if (_hStatus != NULL) {
+        SendMessage(_hStatus, WM_SETFONT,
+                    (WPARAM)GetStockObject(DEFAULT_GUI_FONT), FALSE);
+    }
+
     // Set the window handle used to process graph events.
     hr = _pMediaEvent->SetNotifyWindow(
         (OAHWND)hWnd, WM_GRAPHNOTIFY, 0);
@@ -942,6 +1100,12 @@ void WebCamoo::UninitializeWindow(void)
         _notify = NULL;
     }
 
+    KillTimer(_hWnd, STATUS_TIMER_ID);
+    if (_hStatus != NULL) {
+        DestroyWindow(_hStatus);
+        _hStatus = NULL;
+    }
+
     if (_deviceMenu != NULL) {
         ResetCaptureDevices(_deviceMenu);
         _deviceMenu = NULL;
@@ -954,11 +1118,18 @@ void WebCamoo::UninitializeWindow(void)
 HRESULT WebCamoo::ResizeVideoWindow(void)
 {
     HRESULT hr;
-    if (_videoWidth == 0 || _videoHeight == 0 || _pVideoWindow == NULL) return S_OK;
 
-    // Resize the video preview window to match owner window size
+    // Keep the status bar at the bottom.
     RECT rc;
     GetClientRect(_hWnd, &rc);
+    if (_hStatus != NULL && IsWindowVisible(_hStatus)) {
+        rc.bottom = max2(rc.top, rc.bottom-STATUS_HEIGHT);
+        MoveWindow(_hStatus, rc.left, rc.bottom,
+                   rwidth(&rc), STATUS_HEIGHT, TRUE);
+    }
+    if (_videoWidth == 0 || _videoHeight == 0 || _pVideoWindow == NULL) return S_OK;
+
+    // Resize the video preview window to match owner window size
     BOOL keepRatio = isMenuItemChecked(_hMenu, IDM_KEEP_ASPECT_RATIO);
     if (keepRatio) {
         int w0 = rwidth(&rc);
@@ -993,6 +1164,97 @@ HRESULT WebCamoo::ResizeVideoWindow(void)
     return S_OK;
 }
 
+void WebCamoo::ShowStatusBar(BOOL show)
+{
+    if (_hStatus == NULL) return;
+    if (show) {
+        // Start counting from now.
+        _pFiltaa->GetStats(&_statusStats);
+        _statusTick = GetTickCount();
+        SetWindowText(_hStatus, L"");
+        ShowWindow(_hStatus, SW_SHOW);
+        SetTimer(_hWnd, STATUS_TIMER_ID, STATUS_INTERVAL, NULL);
+    } else {
+        KillTimer(_hWnd, STATUS_TIMER_ID);
+        ShowWindow(_hStatus, SW_HIDE);
+    }
+    ResizeVideoWindow();
+}
+
+// UpdateStatusBar: shows the rates and the latency since the last
+//   update. Called on a timer, not per frame; the Filtaa counters
+//   are read without locking, so the streaming thread never waits.
+void WebCamoo::UpdateStatusBar(void)
+{
+    if (_hStatus == NULL) return;
+
+    FiltaaStats stats;
+    _pFiltaa->GetStats(&stats);
+    DWORD tick = GetTickCount();
+    DWORD elapsed = tick - _statusTick;
+    double captured = 0, processed = 0;
+    // The counters restart when the input is reconnected.
+    if (0 < elapsed &&
+        _statusStats.received <= stats.received &&
+        _statusStats.processed <= stats.processed) {
+        captured = (stats.received - _statusStats.received) * 1000.0 / elapsed;
+        processed = (stats.processed - _statusStats.processed) * 1000.0 / elapsed;
+    }
+    _statusStats = stats;
+    _statusTick = tick;
+
+    WCHAR latency[32] = L"-";
+    StageStats transform;
+    if (_pFiltaa->GetStageStats(STAGE_TRANSFORM, &transform) &&
+        0 < transform.count) {
+        StringCchPrintfW(latency, _countof(latency), L"%.2f ms",
+                         transform.p99 / 1e6);
+    }
+    // The timers would otherwise keep every frame since the input
+    // was connected, and a slow spell would hardly move the p99.
+    _pFiltaa->ResetStageStats();
+    WCHAR threshold[32] = L"-";
+    if (isMenuItemChecked(_hMenu, IDM_THRESHOLDING)) {
+        StringCchPrintfW(threshold, _countof(threshold), L"%d",
+                         stats.threshold);
+    }
+
+    WCHAR text[256];
+    StringCchPrintfW(
+        text, _countof(text),
+        L" Capture: %.1f fps   Processed: %.1f fps   Dropped: %lu"
+        L"   Threshold: %s   p99 (last %us): %s   Quality: %S",
+        captured, processed,
+        (unsigned long)(stats.dropped + GetDroppedFrames()),
+        threshold, STATUS_INTERVAL/1000, latency,
+        getQualityName(_pFiltaa->GetQuality()));
+    if (_pFiltaa->IsRecording() && _pFiltaa->IsRecordingFailed()) {
+        StringCchCatW(text, _countof(text), L"   Recording: write failed");
+    }
+    SetWindowText(_hStatus, text);
+}
+
+// GetDroppedFrames: the frames dropped by the capture driver.
+uint64_t WebCamoo::GetDroppedFrames(void)
+{
+    if (_pVideoSrc == NULL || _pReplay != NULL) return 0;
+
+    uint64_t dropped = 0;
+    IAMDroppedFrames* pDropped = NULL;
+    HRESULT hr = _pCapture->FindInterface(
+        &PIN_CATEGORY_CAPTURE, &MEDIATYPE_Video, _pVideoSrc,
+        IID_IAMDroppedFrames, (void**)&pDropped);
+    if (SUCCEEDED(hr)) {
+        long n = 0;
+        hr = pDropped->GetNumDropped(&n);
+        if (SUCCEEDED(hr) && 0 < n) {
+            dropped = n;
+        }
+        pDropped->Release();
+    }
+    return dropped;
+}
+
 HRESULT WebCamoo::HandleGraphEvent(void)
 {
     LONG evCode;
@@ -1158,6 +1420,88 @@ void WebCamoo::DoCommand(UINT cmd)
                   _hWnd, aboutDialogProc);
         break;
 
+    case IDM_RECORD:
+        if (_pFiltaa->IsRecording()) {
+            HRESULT hr = _pFiltaa->StopRecording();
+            log(L"StopRecording: hr=%08x", hr);
+            if (FAILED(hr)) {
+                MessageBox(_hWnd,
+                           L"The recording could not be written completely.",
+                           L"WebCamoo", MB_OK | MB_ICONWARNING);
+            }
+        } else {
+            SYSTEMTIME st;
+            GetLocalTime(&st);
+            char path[MAX_PATH];
+            StringCchPrintfA(path, _countof(path),
+                             "board-%04d%02d%02d-%02d%02d%02d.wcb",
+                             st.wYear, st.wMonth, st.wDay,
+                             st.wHour, st.wMinute, st.wSecond);
+            HRESULT hr = _pFiltaa->StartRecording(path);
+            log(L"StartRecording: hr=%08x", hr);
+        }
+        UpdateOutputMenu();
+        break;
+
+    case IDM_SHARE:
+        // Other processes can read the frames with FrameRingReader.
+        if (_pFiltaa->IsSharing()) {
+            _pFiltaa->StopSharing();
+        } else {
+            HRESULT hr = _pFiltaa->StartSharing(FRAME_RING_NAME);
+            log(L"StartSharing: hr=%08x", hr);
+        }
+        UpdateOutputMenu();
+        break;
+
+    case IDM_SERVE:
+        // Browsers can watch http://<host>:8080/ while it is on.
+        if (_pFiltaa->IsServing()) {
+            _pFiltaa->StopServing();
+        } else {
+            HRESULT hr = _pFiltaa->StartServing(MJPEG_PORT);
+            log(L"StartServing: hr=%08x, port=%d", hr, MJPEG_PORT);
+        }
+        UpdateOutputMenu();
+        break;
+
+    case IDM_SNAPSHOT:
+        // The frame is saved by Filtaa in the background.
+        {
+            // PNG is written in 1 bit, which only fits the B/W mode;
+            // the gray modes need PGM and the ink colors BMP.
+            OutputMode mode = _pFiltaa->GetOutputMode();
+            const char* ext = ((mode == OUTPUT_BW)? "png" :
+                               (mode == OUTPUT_INK)? "bmp" : "pgm");
+            SYSTEMTIME st;
+            GetLocalTime(&st);
+            char path[MAX_PATH];
+            StringCchPrintfA(path, _countof(path),
+                             "board-%04d%02d%02d-%02d%02d%02d-%03d.%s",
+                             st.wYear, st.wMonth, st.wDay,
+                             st.wHour, st.wMinute, st.wSecond,
+                             st.wMilliseconds, ext);
+            HRESULT hr = _pFiltaa->SaveSnapshot(path);
+            log(L"SaveSnapshot: hr=%08x, last copy=%uus", hr,
+                (UINT)(_pFiltaa->GetSnapshotCopyTime() / 1000));
+        }
+        break;
+
+    case IDM_SAVE_TRACE:
+        // Open it in chrome://tracing or Perfetto.
+        {
+            SYSTEMTIME st;
+            GetLocalTime(&st);
+            char path[MAX_PATH];
+            StringCchPrintfA(path, _countof(path),
+                             "trace-%04d%02d%02d-%02d%02d%02d.json",
+                             st.wYear, st.wMonth, st.wDay,
+                             st.wHour, st.wMinute, st.wSecond);
+            BOOL ok = writeTrace(path);
+            log(L"SaveTrace: ok=%d, lost=%u", ok, (UINT)getTraceLost());
+        }
+        break;
+
     case IDM_TOGGLE_MENUBAR:
         if (GetMenu(_hWnd) == NULL) {
             SetMenu(_hWnd, _hMenu);
@@ -1176,19 +1520,57 @@ void WebCamoo::DoCommand(UINT cmd)
             RECT rw, rc;
             GetWindowRect(_hWnd, &rw);
             GetClientRect(_hWnd, &rc);
+            int status = (isMenuItemChecked(hMenu, IDM_STATUS_BAR)?
+                          STATUS_HEIGHT : 0);
             MoveWindow(_hWnd, rw.left, rw.top,
                        _videoWidth+(rwidth(&rw)-rwidth(&rc)),
-                       _videoHeight+(rheight(&rw)-rheight(&rc)),
+                       _videoHeight+status+(rheight(&rw)-rheight(&rc)),
                        TRUE);
         }
         break;
 
+    case IDM_STATUS_BAR:
+        toggleMenuItemChecked(hMenu, cmd);
+        ShowStatusBar(isMenuItemChecked(hMenu, cmd));
+        break;
+
     case IDM_THRESHOLDING:
-        UpdatePlayState(State_Stopped);
         toggleMenuItemChecked(hMenu, cmd);
-        ClearVideoFilterGraph();
-        BuildVideoFilterGraph();
-        UpdatePlayState(State_Running);
+        if (_pFiltaa->GetMediaType() != NULL) {
+            // Filtaa is in the graph; it switches on the next frame.
+            BOOL thresholding = isMenuItemChecked(hMenu, cmd);
+            if (!thresholding) {
+                // Nothing is processed; finish the recording and sharing.
+                _pFiltaa->StopRecording();
+                _pFiltaa->StopSharing();
+                _pFiltaa->StopServing();
+            }
+            _pFiltaa->SetBypass(!thresholding);
+            log(L"SetBypass: %d, last switch=%uus", !thresholding,
+                (UINT)(_pFiltaa->GetSwitchLatency() / 1000));
+        } else {
+            // It could not be connected; try again.
+            UpdatePlayState(State_Stopped);
+            ClearVideoFilterGraph();
+            BuildVideoFilterGraph();
+            UpdatePlayState(State_Running);
+        }
+        UpdateOutputMenu();
+        break;
+
+    case IDM_GRAYSCALE:
+    case IDM_CLAHE:
+    case IDM_INK_COLORS:
+        // The B/W bits are still recorded and served as they are.
+        {
+            OutputMode mode = ((cmd == IDM_CLAHE)? OUTPUT_CLAHE :
+                               (cmd == IDM_INK_COLORS)? OUTPUT_INK :
+                               OUTPUT_GRAY);
+            if (_pFiltaa->GetOutputMode() == mode) {
+                mode = OUTPUT_BW;
+            }
+            _pFiltaa->SetOutputMode(mode);
+        }
         UpdateOutputMenu();
         break;
 
@@ -1234,6 +1616,95 @@ void WebCamoo::DoCommand(UINT cmd)
         UpdateOutputMenu();
         break;
 
+    case IDM_INC_BRIGHTNESS:
+    case IDM_DEC_BRIGHTNESS:
+    case IDM_INC_CONTRAST:
+    case IDM_DEC_CONTRAST:
+    case IDM_RESET_TONE:
+        // The tone table is rebuilt by Filtaa at the next frame.
+        {
+            ToneParams tone;
+            _pFiltaa->GetTone(&tone);
+            switch (cmd) {
+            case IDM_INC_BRIGHTNESS:
+                tone.brightness = min2(tone.brightness+BRIGHTNESS_DELTA, 255);
+                break;
+            case IDM_DEC_BRIGHTNESS:
+                tone.brightness = max2(-255, tone.brightness-BRIGHTNESS_DELTA);
+                break;
+            case IDM_INC_CONTRAST:
+                tone.contrast = min2(tone.contrast+CONTRAST_DELTA, 100);
+                break;
+            case IDM_DEC_CONTRAST:
+                tone.contrast = max2(-100, tone.contrast-CONTRAST_DELTA);
+                break;
+            default:
+                initToneParams(&tone);
+                break;
+            }
+            log(L"brightness=%d, contrast=%d", tone.brightness, tone.contrast);
+            _pFiltaa->SetTone(&tone);
+        }
+        break;
+
+    case IDM_SMOOTH:
+    case IDM_SHARPEN:
+        // Either one, or neither when it is on already.
+        {
+            FilterParams filter;
+            _pFiltaa->GetFilter(&filter);
+            bool sharpen = (cmd == IDM_SHARPEN);
+            bool on = (0 < filter.radius && (0 < filter.amount) == sharpen);
+            FilterParams blur;
+            initFilterParams(&blur);
+            if (!on) {
+                blur.radius = sharpen? SHARPEN_RADIUS : SMOOTH_RADIUS;
+                blur.amount = sharpen? SHARPEN_AMOUNT : 0;
+            }
+            filter.radius = blur.radius;
+            filter.passes = blur.passes;
+            filter.amount = blur.amount;
+            log(L"filter: radius=%d, amount=%d", filter.radius, filter.amount);
+            _pFiltaa->SetFilter(&filter);
+        }
+        UpdateOutputMenu();
+        break;
+
+    case IDM_DENOISE:
+        {
+            FilterParams filter;
+            _pFiltaa->GetFilter(&filter);
+            filter.median = (0 < filter.median)? 0 : DENOISE_SIZE;
+            log(L"filter: median=%d", filter.median);
+            _pFiltaa->SetFilter(&filter);
+        }
+        UpdateOutputMenu();
+        break;
+
+    case IDM_TEMPORAL:
+        {
+            FilterParams filter;
+            _pFiltaa->GetFilter(&filter);
+            filter.temporal = (0 < filter.temporal)? 0 : TEMPORAL_STRENGTH;
+            log(L"filter: temporal=%d, motion=%d", filter.temporal, filter.motion);
+            _pFiltaa->SetFilter(&filter);
+        }
+        UpdateOutputMenu();
+        break;
+
+    case IDM_LUMA_BT601:
+    case IDM_LUMA_BT709:
+    case IDM_LUMA_GREEN:
+    case IDM_LUMA_MAX:
+        // Filtaa switches to the kernel of the model at the next frame.
+        {
+            LumaModel model = (LumaModel)(cmd - IDM_LUMA_BT601);
+            log(L"luma=%S", getLumaModelName(model));
+            _pFiltaa->SetLumaModel(model);
+        }
+        UpdateOutputMenu();
+        break;
+
     case IDM_OPEN_VIDEO_FILTER_PROPERTIES:
         OpenVideoFilterProperties();
         break;
@@ -1246,6 +1717,42 @@ void WebCamoo::DoCommand(UINT cmd)
         OpenAudioFilterProperties();
         break;
 
+    case IDM_REPLAY_FILE:
+        {
+            char path[MAX_PATH] = "";
+            OPENFILENAMEA ofn = {0};
+            ofn.lStructSize = sizeof(ofn);
+            ofn.hwndOwner = _hWnd;
+            ofn.lpstrFilter =
+                "Board Files (*.wcb)\0*.wcb\0"
+                "Video Files (*.y4m;*.bgr;*.rgb;*.yuy2)\0*.y4m;*.bgr;*.rgb;*.yuy2\0"
+                "All Files (*.*)\0*.*\0";
+            ofn.lpstrFile = path;
+            ofn.nMaxFile = _countof(path);
+            ofn.Flags = OFN_FILEMUSTEXIST | OFN_HIDEREADONLY;
+            if (GetOpenFileNameA(&ofn)) {
+                UpdatePlayState(State_Stopped);
+                ClearVideoFilterGraph();
+                SelectReplay(path);
+                UpdateDeviceMenuChecks();
+                BuildVideoFilterGraph();
+                UpdatePlayState(State_Running);
+                UpdateOutputMenu();
+            }
+        }
+        break;
+
+    case IDM_REPLAY_FAST:
+        toggleMenuItemChecked(hMenu, cmd);
+        if (_pReplay != NULL) {
+            // Restart the replay with the new pacing.
+            UpdatePlayState(State_Stopped);
+            _pReplay->SetRealtime(!isMenuItemChecked(hMenu, cmd));
+            UpdatePlayState(State_Running);
+            UpdateOutputMenu();
+        }
+        break;
+
     case IDM_DEVICE_VIDEO_NONE:
         UpdatePlayState(State_Stopped);
         ClearVideoFilterGraph();
@@ -1328,6 +1835,12 @@ void WebCamoo::HandleMessage(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
         HandleGraphEvent();
         break;
 
+    case WM_TIMER:
+        if (wParam == STATUS_TIMER_ID) {
+            UpdateStatusBar();
+        }
+        break;
+
     case WM_INITMENU:
         UpdateDeviceMenuChecks();
         break;
@@ -1395,6 +1908,31 @@ static LRESULT CALLBACK WndMainProc(
 }
 
 
+// runBatch: runs the batch mode on the console of the parent process.
+static int runBatch(int argc, LPWSTR* argv)
+{
+    if (AttachConsole(ATTACH_PARENT_PROCESS)) {
+        freopen("CONOUT$", "w", stdout);
+        freopen("CONOUT$", "w", stderr);
+    }
+
+    char** args = new char*[argc+1];
+    for (int i = 0; i < argc; i++) {
+        int n = WideCharToMultiByte(CP_ACP, 0, argv[i], -1, NULL, 0, NULL, NULL);
+        args[i] = new char[n];
+        WideCharToMultiByte(CP_ACP, 0, argv[i], -1, args[i], n, NULL, NULL);
+    }
+    args[argc] = NULL;
+
+    int status = BatchMain(argc, args);
+
+    for (int i = 0; i < argc; i++) {
+        delete[] args[i];
+    }
+    delete[] args;
+    return status;
+}
+
 int WebCamooMain(
     HINSTANCE hInstance,
     HINSTANCE hPrevInstance,
@@ -1403,6 +1941,11 @@ int WebCamooMain(
 {
     HRESULT hr;
 
+    // "WebCamoo -batch ..." processes files without a window.
+    if (2 <= argc && lstrcmpi(argv[1], L"-batch") == 0) {
+        return runBatch(argc-1, argv+1);
+    }
+
     // Initialize COM.
     hr = CoInitializeEx(NULL, COINIT_APARTMENTTHREADED);
     if (FAILED(hr)) exit(111);
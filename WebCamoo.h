@@ -22,10 +22,17 @@
 #define IDD_ABOUT 102
 #define IDM_MENU 103
 #define IDM_EXIT 1001
+#define IDM_RECORD 1002
+#define IDM_SNAPSHOT 1003
+#define IDM_SHARE 1004
+#define IDM_SERVE 1005
+#define IDM_SAVE_TRACE 1006
 #define IDM_ABOUT 9001
 #define IDM_OPEN_VIDEO_FILTER_PROPERTIES 2001
 #define IDM_OPEN_VIDEO_PIN_PROPERTIES 2002
 #define IDM_OPEN_AUDIO_FILTER_PROPERTIES 2003
+#define IDM_REPLAY_FILE 2004
+#define IDM_REPLAY_FAST 2005
 #define IDM_TOGGLE_MENUBAR 3001
 #define IDM_KEEP_ASPECT_RATIO 3002
 #define IDM_RESET_WINDOW_SIZE 3003
@@ -33,5 +40,22 @@
 #define IDM_AUTO_THRESHOLD 3005
 #define IDM_INC_THRESHOLD 3006
 #define IDM_DEC_THRESHOLD 3007
+#define IDM_INC_BRIGHTNESS 3008
+#define IDM_DEC_BRIGHTNESS 3009
+#define IDM_INC_CONTRAST 3010
+#define IDM_DEC_CONTRAST 3011
+#define IDM_RESET_TONE 3012
+#define IDM_LUMA_BT601 3013
+#define IDM_LUMA_BT709 3014
+#define IDM_LUMA_GREEN 3015
+#define IDM_LUMA_MAX 3016
+#define IDM_GRAYSCALE 3017
+#define IDM_CLAHE 3018
+#define IDM_INK_COLORS 3019
+#define IDM_SMOOTH 3020
+#define IDM_SHARPEN 3021
+#define IDM_DENOISE 3022
+#define IDM_TEMPORAL 3023
+#define IDM_STATUS_BAR 3024
 #define IDM_DEVICE_VIDEO_NONE 10000
 #define IDM_DEVICE_AUDIO_NONE 20000
@@ -0,0 +1,284 @@
+// -*- tab-width: 4; mode: c++ -*-
+//  Whiteboard.cpp
+//
+
+#include "Whiteboard.h"
+
+//  Constants
+//
+// The reflectance of the board and the inks, B, G, R.
+static const uint8_t INK_COLORS[][3] = {
+    { 236, 240, 238 },          // the board.
+    {  38,  36,  40 },          // black.
+    { 150,  62,  30 },          // blue.
+    {  45,  40, 172 },          // red.
+    {  70, 140,  42 },          // green.
+};
+enum {
+    INK_BOARD, INK_BLACK, INK_BLUE, INK_RED, INK_GREEN,
+};
+static const uint8_t SHIRT_COLOR[3] = { 92, 62, 50 };
+static const uint8_t SKIN_COLOR[3] = { 118, 146, 188 };
+// cos and sin of 16 directions, times 256.
+static const int DIRECTIONS[16][2] = {
+    { 256, 0 }, { 237, 98 }, { 181, 181 }, { 98, 237 },
+    { 0, 256 }, { -98, 237 }, { -181, 181 }, { -237, 98 },
+    { -256, 0 }, { -237, -98 }, { -181, -181 }, { -98, -237 },
+    { 0, -256 }, { 98, -237 }, { 181, -181 }, { 237, -98 },
+};
+static const int PRESENTER_PERIOD = 240; // frames to walk across.
+
+
+// nextRandom: steps the generator and returns 16 random bits.
+static inline uint32_t nextRandom(uint32_t* seed)
+{
+    *seed = *seed*1103515245 + 12345;
+    return (*seed >> 16) & 0xffff;
+}
+
+// isqrt: returns the integer square root.
+static uint32_t isqrt(uint64_t v)
+{
+    uint64_t r = 0;
+    uint64_t bit = (uint64_t)1 << 62;
+    while (v < bit) bit >>= 2;
+    while (bit != 0) {
+        if (r+bit <= v) {
+            v -= r+bit;
+            r = (r >> 1) + bit;
+        } else {
+            r >>= 1;
+        }
+        bit >>= 2;
+    }
+    return (uint32_t)r;
+}
+
+static inline uint8_t clampByte(int v)
+{
+    return (uint8_t)((v < 0)? 0 : (255 < v)? 255 : v);
+}
+
+
+//  WhiteboardGenerator
+//
+WhiteboardGenerator::WhiteboardGenerator()
+    : _width(0), _height(0), _seed(0), _radius(1)
+{
+}
+
+// DrawSegment: a stroke of the pen, with soft edges.
+void WhiteboardGenerator::DrawSegment(int x0, int y0, int x1, int y1, int color)
+{
+    int r = _radius+1;
+    int left = ((x0 < x1)? x0 : x1) - r;
+    int right = ((x0 < x1)? x1 : x0) + r;
+    int top = ((y0 < y1)? y0 : y1) - r;
+    int bottom = ((y0 < y1)? y1 : y0) + r;
+    if (left < 0) left = 0;
+    if (_width <= right) right = _width-1;
+    if (top < 0) top = 0;
+    if (_height <= bottom) bottom = _height-1;
+
+    // The distances are in 1/16 pixels.
+    int64_t vx = x1-x0, vy = y1-y0;
+    int64_t len2 = vx*vx + vy*vy;
+    for (int y = top; y <= bottom; y++) {
+        for (int x = left; x <= right; x++) {
+            int64_t t = (x-x0)*vx + (y-y0)*vy;
+            if (t < 0 || len2 == 0) t = 0;
+            if (len2 < t) t = len2;
+            int64_t dx = (int64_t)x*16 - x0*16;
+            int64_t dy = (int64_t)y*16 - y0*16;
+            if (0 < len2) {
+                dx -= vx*t*16/len2;
+                dy -= vy*t*16/len2;
+            }
+            int d = (int)isqrt((uint64_t)(dx*dx + dy*dy));
+            int cov = (_radius*16 + 8 - d) * 16;
+            if (cov <= 0) continue;
+            if (255 < cov) cov = 255;
+            size_t i = (size_t)_width*y + x;
+            if (_ink[i] < cov) {
+                _ink[i] = (uint8_t)cov;
+                _color[i] = (uint8_t)color;
+            }
+        }
+    }
+}
+
+void WhiteboardGenerator::DrawBox(int x0, int y0, int x1, int y1, int color)
+{
+    DrawSegment(x0, y0, x1, y0, color);
+    DrawSegment(x1, y0, x1, y1, color);
+    DrawSegment(x1, y1, x0, y1, color);
+    DrawSegment(x0, y1, x0, y0, color);
+}
+
+// DrawText: a line of words, each glyph two or three strokes
+//   between the points of a 3x3 grid.
+void WhiteboardGenerator::DrawText(int x, int y, int width, int size, int color,
+                                   uint32_t* seed)
+{
+    int cell = size*6/10;
+    int end = x+width;
+    while (x+cell <= end) {
+        int letters = 2 + nextRandom(seed) % 6;
+        for (int i = 0; i < letters && x+cell <= end; i++) {
+            int strokes = 2 + nextRandom(seed) % 2;
+            for (int j = 0; j < strokes; j++) {
+                int a = nextRandom(seed) % 9;
+                int b = (a + 1 + nextRandom(seed) % 8) % 9;
+                int jx = (int)(nextRandom(seed) % (size/8+1)) - size/16;
+                int jy = (int)(nextRandom(seed) % (size/8+1)) - size/16;
+                DrawSegment(x + (a%3)*cell/2 + jx, y + (a/3)*size/2 + jy,
+                            x + (b%3)*cell/2, y + (b/3)*size/2, color);
+            }
+            x += cell + size/5;
+        }
+        x += cell;
+    }
+}
+
+// DrawScribble: a freehand curve.
+void WhiteboardGenerator::DrawScribble(int x, int y, int size, int color,
+                                       uint32_t* seed)
+{
+    int dir = nextRandom(seed) % 16;
+    int step = size/6 + 1;
+    for (int i = 0; i < 32; i++) {
+        int turn = nextRandom(seed) % 3;
+        dir = (dir + 15 + turn) % 16;
+        int nx = x + DIRECTIONS[dir][0]*step/256;
+        int ny = y + DIRECTIONS[dir][1]*step/256;
+        DrawSegment(x, y, nx, ny, color);
+        x = nx;
+        y = ny;
+    }
+}
+
+bool WhiteboardGenerator::Setup(int width, int height, uint32_t seed)
+{
+    if (width <= 0 || height <= 0) return false;
+    size_t pixels = (size_t)width*height;
+    _width = width;
+    _height = height;
+    _seed = seed;
+    _radius = (400 <= height)? height/400 : 1;
+    _light.assign(pixels, 0);
+    _glare.assign(pixels, 0);
+    _ink.assign(pixels, 0);
+    _color.assign(pixels, INK_BOARD);
+
+    // Darker towards the lower left, with a glare spot up right.
+    int gx = width*7/10, gy = height*3/10;
+    int64_t gr2 = (int64_t)(height/4)*(height/4);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            size_t i = (size_t)width*y + x;
+            _light[i] = (uint8_t)(250 - (width-1-x)*50/width - y*45/height);
+            int64_t dx = x-gx, dy = y-gy;
+            int64_t d2 = dx*dx + dy*dy;
+            if (d2 < gr2) {
+                int64_t t = 256 - d2*256/gr2;
+                _glare[i] = (uint8_t)(t*t*70/65536);
+            }
+        }
+    }
+
+    // Text on the left, headed in red and partly in blue.
+    int size = height/28 + 4;
+    int margin = width/24;
+    int line = 0;
+    for (int y = height/10; y+size < height*9/10; y += size*2, line++) {
+        int color = (line == 0)? INK_RED : (line % 4 == 3)? INK_BLUE : INK_BLACK;
+        int span = width*55/100 - margin;
+        int len = span/2 + (int)(nextRandom(&seed) % (span/2));
+        DrawText(margin, y, len, size, color, &seed);
+    }
+    // Two boxes with an arrow between them, and a green sketch.
+    int bx = width*62/100, bw = width*14/100, bh = height/7;
+    int by0 = height/8, by1 = height*5/12;
+    DrawBox(bx, by0, bx+bw, by0+bh, INK_BLACK);
+    DrawBox(bx+bw/2, by1, bx+bw*3/2, by1+bh, INK_BLUE);
+    DrawText(bx+size/2, by0+bh/3, bw-size, size, INK_BLACK, &seed);
+    DrawText(bx+bw/2+size/2, by1+bh/3, bw-size, size, INK_BLUE, &seed);
+    int ax = bx+bw*3/4, ay = by0+bh;
+    DrawSegment(ax, ay, ax, by1, INK_RED);
+    DrawSegment(ax, by1, ax-size/2, by1-size/2, INK_RED);
+    DrawSegment(ax, by1, ax+size/2, by1-size/2, INK_RED);
+    DrawScribble(width*70/100, height*3/4, size*3, INK_GREEN, &seed);
+    DrawSegment(margin, height*9/10, width*40/100, height*9/10, INK_RED);
+    return true;
+}
+
+void WhiteboardGenerator::Draw(uint8_t* dst, size_t stride, uint32_t n)
+{
+    uint32_t seed = _seed ^ (n*0x9e3779b9u);
+
+    // The presenter: a head and shoulders crossing the frame.
+    int bodyW = _width/6;
+    int cx = -bodyW + (int)((int64_t)(n % PRESENTER_PERIOD) *
+                            (_width + 2*bodyW) / PRESENTER_PERIOD);
+    int headR = bodyW/4;
+    int headY = _height*33/100;
+    int torsoY = _height*45/100;
+    int cornerR = bodyW/4;
+
+    for (int y = 0; y < _height; y++) {
+        // The span of the presenter on this row.
+        int half = -1;
+        bool skin = false;
+        if (torsoY <= y) {
+            half = bodyW/2;
+            int dy = torsoY + cornerR - y;
+            if (0 < dy) {
+                half -= cornerR - (int)isqrt((uint64_t)cornerR*cornerR - (uint64_t)dy*dy);
+            }
+        }
+        int hy = y - headY;
+        if (-headR < hy && hy < headR) {
+            int h = (int)isqrt((uint64_t)headR*headR - (uint64_t)hy*hy);
+            if (half < h) {
+                half = h;
+                skin = true;
+            }
+        } else if (headY <= y && y < torsoY && half < bodyW/10) {
+            half = bodyW/10;
+            skin = true;
+        }
+
+        const uint8_t* light = &_light[(size_t)_width*y];
+        const uint8_t* glare = &_glare[(size_t)_width*y];
+        const uint8_t* ink = &_ink[(size_t)_width*y];
+        const uint8_t* color = &_color[(size_t)_width*y];
+        uint8_t* q = dst + stride*y;
+        for (int x = 0; x < _width; x++) {
+            int v[3];
+            int dx = x - cx;
+            if (-half <= dx && dx <= half) {
+                // Shaded towards the edges.
+                const uint8_t* c = skin? SKIN_COLOR : SHIRT_COLOR;
+                int shade = 256 - ((dx < 0)? -dx : dx)*96/(half+1);
+                for (int k = 0; k < 3; k++) {
+                    v[k] = c[k]*shade >> 8;
+                }
+            } else {
+                const uint8_t* board = INK_COLORS[INK_BOARD];
+                const uint8_t* pen = INK_COLORS[color[x]];
+                int a = ink[x];
+                for (int k = 0; k < 3; k++) {
+                    int refl = (board[k]*(255-a) + pen[k]*a) / 255;
+                    v[k] = refl*light[x]/255 + glare[x];
+                }
+            }
+            // Sensor noise: about +-7 levels, a little more in blue.
+            uint32_t r = nextRandom(&seed);
+            int noise = ((int)(r & 15) + (int)((r >> 4) & 15) - 15) / 2;
+            q[0] = clampByte(v[0] + noise + (int)((r >> 8) & 3) - 1);
+            q[1] = clampByte(v[1] + noise);
+            q[2] = clampByte(v[2] + noise + (int)((r >> 10) & 3) - 2);
+            q += 3;
+        }
+    }
+}
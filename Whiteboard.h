@@ -0,0 +1,56 @@
+// -*- tab-width: 4; mode: c++ -*-
+//  Whiteboard.h
+//
+//  Synthetic camera frames of a whiteboard, for the benchmarks.
+//
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+//  WhiteboardGenerator
+//
+//  The board is lit unevenly (darker towards one corner) and has a
+//  glare spot. It is covered with handwritten lines, boxes and lines
+//  of text-like glyphs in black, blue, red and green ink. Every
+//  frame adds sensor noise and a presenter walking across in front
+//  of the board.
+//
+//  Only integer arithmetic is used, so a frame depends on nothing
+//  but the size, the seed and its number: every machine benchmarks
+//  the same pixels. Pixels are B, G, R.
+//
+class WhiteboardGenerator
+{
+private:
+    int _width;
+    int _height;
+    uint32_t _seed;
+    int _radius;                    // of the pen.
+    std::vector<uint8_t> _light;    // [height][width] brightness of the board.
+    std::vector<uint8_t> _glare;    // [height][width] added on top of it.
+    std::vector<uint8_t> _ink;      // [height][width] coverage of the ink.
+    std::vector<uint8_t> _color;    // [height][width] index of the ink color.
+
+    WhiteboardGenerator(const WhiteboardGenerator&);
+    WhiteboardGenerator& operator=(const WhiteboardGenerator&);
+
+    void DrawSegment(int x0, int y0, int x1, int y1, int color);
+    void DrawBox(int x0, int y0, int x1, int y1, int color);
+    void DrawText(int x, int y, int width, int size, int color, uint32_t* seed);
+    void DrawScribble(int x, int y, int size, int color, uint32_t* seed);
+
+public:
+    WhiteboardGenerator();
+
+    // Setup: draws the board for a frame size.
+    bool Setup(int width, int height, uint32_t seed=12345);
+    int GetWidth()
+        { return _width; }
+    int GetHeight()
+        { return _height; }
+
+    // Draw: renders frame n with stride bytes between rows.
+    void Draw(uint8_t* dst, size_t stride, uint32_t n);
+};
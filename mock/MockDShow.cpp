@@ -0,0 +1,542 @@
+// -*- tab-width: 4; mode: c++ -*-
+//  mock/MockDShow.cpp
+//
+
+#include <chrono>
+#include "MockDShow.h"
+
+//  GUIDs
+//
+//  The values of the real ones, though only their being different
+//  matters here.
+//
+const IID IID_IUnknown =
+    { 0x00000000, 0x0000, 0x0000, { 0xc0,0x00,0x00,0x00,0x00,0x00,0x00,0x46 } };
+const IID IID_IPersist =
+    { 0x0000010c, 0x0000, 0x0000, { 0xc0,0x00,0x00,0x00,0x00,0x00,0x00,0x46 } };
+const IID IID_IReferenceClock =
+    { 0x56a86897, 0x0ad4, 0x11ce, { 0xb0,0x3a,0x00,0x20,0xaf,0x0b,0xa7,0x70 } };
+const IID IID_IMediaFilter =
+    { 0x56a86899, 0x0ad4, 0x11ce, { 0xb0,0x3a,0x00,0x20,0xaf,0x0b,0xa7,0x70 } };
+const IID IID_IBaseFilter =
+    { 0x56a86895, 0x0ad4, 0x11ce, { 0xb0,0x3a,0x00,0x20,0xaf,0x0b,0xa7,0x70 } };
+const IID IID_IFilterGraph =
+    { 0x56a8689f, 0x0ad4, 0x11ce, { 0xb0,0x3a,0x00,0x20,0xaf,0x0b,0xa7,0x70 } };
+const IID IID_IEnumPins =
+    { 0x56a86892, 0x0ad4, 0x11ce, { 0xb0,0x3a,0x00,0x20,0xaf,0x0b,0xa7,0x70 } };
+const IID IID_IEnumMediaTypes =
+    { 0x89c31040, 0x846b, 0x11ce, { 0x97,0xd3,0x00,0xaa,0x00,0x55,0x59,0x5a } };
+const IID IID_IPin =
+    { 0x56a86891, 0x0ad4, 0x11ce, { 0xb0,0x3a,0x00,0x20,0xaf,0x0b,0xa7,0x70 } };
+const IID IID_IMediaSample =
+    { 0x56a8689a, 0x0ad4, 0x11ce, { 0xb0,0x3a,0x00,0x20,0xaf,0x0b,0xa7,0x70 } };
+const IID IID_IMemAllocator =
+    { 0x56a8689c, 0x0ad4, 0x11ce, { 0xb0,0x3a,0x00,0x20,0xaf,0x0b,0xa7,0x70 } };
+const IID IID_IMemInputPin =
+    { 0x56a8689d, 0x0ad4, 0x11ce, { 0xb0,0x3a,0x00,0x20,0xaf,0x0b,0xa7,0x70 } };
+const IID IID_IQualityControl =
+    { 0x56a868a5, 0x0ad4, 0x11ce, { 0xb0,0x3a,0x00,0x20,0xaf,0x0b,0xa7,0x70 } };
+
+const GUID MEDIATYPE_Video =
+    { 0x73646976, 0x0000, 0x0010, { 0x80,0x00,0x00,0xaa,0x00,0x38,0x9b,0x71 } };
+const GUID MEDIASUBTYPE_RGB24 =
+    { 0xe436eb7d, 0x524f, 0x11ce, { 0x9f,0x53,0x00,0x20,0xaf,0x0b,0xa7,0x70 } };
+const GUID MEDIASUBTYPE_RGB555 =
+    { 0xe436eb7c, 0x524f, 0x11ce, { 0x9f,0x53,0x00,0x20,0xaf,0x0b,0xa7,0x70 } };
+const GUID MEDIASUBTYPE_RGB565 =
+    { 0xe436eb7b, 0x524f, 0x11ce, { 0x9f,0x53,0x00,0x20,0xaf,0x0b,0xa7,0x70 } };
+const GUID FORMAT_VideoInfo =
+    { 0x05589f80, 0xc356, 0x11ce, { 0xbf,0x01,0x00,0xaa,0x00,0x55,0x59,0x5a } };
+const CLSID CLSID_MemoryAllocator =
+    { 0x1e651cc0, 0xb199, 0x11d0, { 0x82,0x12,0x00,0xc0,0x4f,0xc3,0x2c,0x45 } };
+
+
+// The COM runtime.
+
+LPVOID CoTaskMemAlloc(SIZE_T cb)
+{
+    return malloc(cb);
+}
+
+void CoTaskMemFree(LPVOID pv)
+{
+    free(pv);
+}
+
+// CoCreateInstance: only knows the memory allocator.
+HRESULT CoCreateInstance(REFCLSID rclsid, IUnknown* pUnkOuter, DWORD dwClsContext,
+                         REFIID riid, LPVOID* ppv)
+{
+    if (ppv == NULL) return E_POINTER;
+    *ppv = NULL;
+    if (rclsid != CLSID_MemoryAllocator) return CLASS_E_CLASSNOTAVAILABLE;
+    MockAllocator* allocator = new MockAllocator();
+    HRESULT hr = allocator->QueryInterface(riid, ppv);
+    allocator->Release();
+    return hr;
+}
+
+// freeMediaType: frees a media type and its format.
+static void freeMediaType(AM_MEDIA_TYPE* mt)
+{
+    if (mt == NULL) return;
+    CoTaskMemFree(mt->pbFormat);
+    CoTaskMemFree(mt);
+}
+
+// dupMediaType: returns a copy of a media type, or NULL.
+static AM_MEDIA_TYPE* dupMediaType(const AM_MEDIA_TYPE* src)
+{
+    AM_MEDIA_TYPE* dst = (AM_MEDIA_TYPE*)CoTaskMemAlloc(sizeof(*dst));
+    if (dst == NULL) return NULL;
+    *dst = *src;
+    dst->pbFormat = NULL;
+    if (src->cbFormat) {
+        dst->pbFormat = (BYTE*)CoTaskMemAlloc(src->cbFormat);
+        if (dst->pbFormat == NULL) {
+            CoTaskMemFree(dst);
+            return NULL;
+        }
+        memcpy(dst->pbFormat, src->pbFormat, src->cbFormat);
+    }
+    return dst;
+}
+
+
+//  MockSample
+//
+MockSample::MockSample(MockAllocator* allocator, BYTE* buf, long size)
+{
+    _refCount = 0;
+    _allocator = allocator;
+    _buf = buf;
+    _size = size;
+    _mt = NULL;
+    Clear();
+}
+
+MockSample::~MockSample()
+{
+    freeMediaType(_mt);
+}
+
+void MockSample::Clear()
+{
+    _length = 0;
+    _tStart = _tEnd = 0;
+    _timed = false;
+    _mStart = _mEnd = 0;
+    _mediaTimed = false;
+    _syncPoint = FALSE;
+    _preroll = FALSE;
+    _discontinuity = FALSE;
+    freeMediaType(_mt);
+    _mt = NULL;
+}
+
+STDMETHODIMP MockSample::QueryInterface(REFIID iid, void** ppvObject)
+{
+    if (ppvObject == NULL) return E_POINTER;
+    if (iid == IID_IUnknown || iid == IID_IMediaSample) {
+        *ppvObject = (IMediaSample*)this;
+    } else {
+        *ppvObject = NULL;
+        return E_NOINTERFACE;
+    }
+    AddRef();
+    return S_OK;
+}
+
+STDMETHODIMP_(ULONG) MockSample::Release()
+{
+    _refCount--;
+    if (_refCount) return _refCount;
+    _allocator->ReleaseBuffer(this);
+    return 0;
+}
+
+STDMETHODIMP MockSample::GetPointer(BYTE** ppBuffer)
+{
+    if (ppBuffer == NULL) return E_POINTER;
+    *ppBuffer = _buf;
+    return S_OK;
+}
+
+STDMETHODIMP MockSample::GetTime(REFERENCE_TIME* pTimeStart, REFERENCE_TIME* pTimeEnd)
+{
+    if (pTimeStart == NULL || pTimeEnd == NULL) return E_POINTER;
+    if (!_timed) return VFW_E_SAMPLE_TIME_NOT_SET;
+    *pTimeStart = _tStart;
+    *pTimeEnd = _tEnd;
+    return S_OK;
+}
+
+STDMETHODIMP MockSample::SetTime(REFERENCE_TIME* pTimeStart, REFERENCE_TIME* pTimeEnd)
+{
+    _timed = (pTimeStart != NULL);
+    _tStart = (pTimeStart != NULL)? *pTimeStart : 0;
+    _tEnd = (pTimeEnd != NULL)? *pTimeEnd : _tStart+1;
+    return S_OK;
+}
+
+STDMETHODIMP MockSample::SetActualDataLength(long len)
+{
+    if (len < 0 || _size < len) return E_INVALIDARG;
+    _length = len;
+    return S_OK;
+}
+
+// GetMediaType: S_FALSE unless the type changes with this sample.
+STDMETHODIMP MockSample::GetMediaType(AM_MEDIA_TYPE** ppMediaType)
+{
+    if (ppMediaType == NULL) return E_POINTER;
+    *ppMediaType = NULL;
+    if (_mt == NULL) return S_FALSE;
+    *ppMediaType = dupMediaType(_mt);
+    return (*ppMediaType != NULL)? S_OK : E_OUTOFMEMORY;
+}
+
+STDMETHODIMP MockSample::SetMediaType(AM_MEDIA_TYPE* pMediaType)
+{
+    freeMediaType(_mt);
+    _mt = NULL;
+    if (pMediaType == NULL) return S_OK;
+    _mt = dupMediaType(pMediaType);
+    return (_mt != NULL)? S_OK : E_OUTOFMEMORY;
+}
+
+STDMETHODIMP MockSample::GetMediaTime(LONGLONG* pTimeStart, LONGLONG* pTimeEnd)
+{
+    if (pTimeStart == NULL || pTimeEnd == NULL) return E_POINTER;
+    if (!_mediaTimed) return VFW_E_MEDIA_TIME_NOT_SET;
+    *pTimeStart = _mStart;
+    *pTimeEnd = _mEnd;
+    return S_OK;
+}
+
+STDMETHODIMP MockSample::SetMediaTime(LONGLONG* pTimeStart, LONGLONG* pTimeEnd)
+{
+    _mediaTimed = (pTimeStart != NULL && pTimeEnd != NULL);
+    _mStart = _mediaTimed? *pTimeStart : 0;
+    _mEnd = _mediaTimed? *pTimeEnd : 0;
+    return S_OK;
+}
+
+
+//  MockAllocator
+//
+MockAllocator::MockAllocator()
+{
+    _refCount = 0;
+    ZeroMemory(&_props, sizeof(_props));
+    _committed = false;
+    _buffers = 0;
+    AddRef();
+}
+
+MockAllocator::~MockAllocator()
+{
+    Free();
+}
+
+// Free: frees the samples and their memory.
+//   Samples still out are lost with it, as in the real one.
+void MockAllocator::Free()
+{
+    for (size_t i = 0; i < _samples.size(); i++) {
+        delete _samples[i];
+    }
+    for (size_t i = 0; i < _memory.size(); i++) {
+        free(_memory[i]);
+    }
+    _samples.clear();
+    _free.clear();
+    _memory.clear();
+}
+
+STDMETHODIMP MockAllocator::QueryInterface(REFIID iid, void** ppvObject)
+{
+    if (ppvObject == NULL) return E_POINTER;
+    if (iid == IID_IUnknown || iid == IID_IMemAllocator) {
+        *ppvObject = (IMemAllocator*)this;
+    } else {
+        *ppvObject = NULL;
+        return E_NOINTERFACE;
+    }
+    AddRef();
+    return S_OK;
+}
+
+// SetProperties: takes the request as it is, with at least one
+//   buffer aligned to at least one byte.
+STDMETHODIMP MockAllocator::SetProperties(
+    ALLOCATOR_PROPERTIES* pRequest, ALLOCATOR_PROPERTIES* pActual)
+{
+    if (pRequest == NULL || pActual == NULL) return E_POINTER;
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_committed) return E_UNEXPECTED;
+    if (pRequest->cbBuffer < 0 || pRequest->cbPrefix < 0) return E_INVALIDARG;
+    _props = *pRequest;
+    if (_props.cBuffers < 1) _props.cBuffers = 1;
+    if (_props.cbAlign < 1) _props.cbAlign = 1;
+    // The alignment has to be a power of two.
+    if (_props.cbAlign & (_props.cbAlign-1)) return E_INVALIDARG;
+    *pActual = _props;
+    return S_OK;
+}
+
+STDMETHODIMP MockAllocator::GetProperties(ALLOCATOR_PROPERTIES* pProps)
+{
+    if (pProps == NULL) return E_POINTER;
+    std::lock_guard<std::mutex> lock(_mutex);
+    *pProps = _props;
+    return S_OK;
+}
+
+// Commit: allocates the buffers, so that the data (not the
+//   prefix) is aligned.
+STDMETHODIMP MockAllocator::Commit()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_committed) return S_OK;
+    if (_props.cbBuffer <= 0) return VFW_E_SIZENOTSET;
+    if (_free.size() < _samples.size()) return E_UNEXPECTED;
+    Free();
+    for (long i = 0; i < _props.cBuffers; i++) {
+        size_t size = _props.cbPrefix + _props.cbBuffer + _props.cbAlign;
+        BYTE* mem = (BYTE*)malloc(size);
+        if (mem == NULL) {
+            Free();
+            return E_OUTOFMEMORY;
+        }
+        _memory.push_back(mem);
+        uintptr_t p = (uintptr_t)mem + _props.cbPrefix;
+        p = (p + _props.cbAlign-1) & ~(uintptr_t)(_props.cbAlign-1);
+        MockSample* sample = new MockSample(this, (BYTE*)p, _props.cbBuffer);
+        _samples.push_back(sample);
+        _free.push_back(sample);
+    }
+    _committed = true;
+    return S_OK;
+}
+
+// Decommit: GetBuffer() fails from now on; the memory is kept
+//   for the samples still out.
+STDMETHODIMP MockAllocator::Decommit()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _committed = false;
+    _released.notify_all();
+    return S_OK;
+}
+
+STDMETHODIMP MockAllocator::GetBuffer(
+    IMediaSample** ppBuffer, REFERENCE_TIME* pStartTime,
+    REFERENCE_TIME* pEndTime, DWORD dwFlags)
+{
+    if (ppBuffer == NULL) return E_POINTER;
+    *ppBuffer = NULL;
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (_committed && _free.empty()) {
+        _released.wait(lock);
+    }
+    if (!_committed) return VFW_E_NOT_COMMITTED;
+    MockSample* sample = _free.back();
+    _free.pop_back();
+    _buffers++;
+    lock.unlock();
+
+    sample->Clear();
+    sample->AddRef();
+    *ppBuffer = sample;
+    return S_OK;
+}
+
+STDMETHODIMP MockAllocator::ReleaseBuffer(IMediaSample* pBuffer)
+{
+    if (pBuffer == NULL) return E_POINTER;
+    std::lock_guard<std::mutex> lock(_mutex);
+    _free.push_back((MockSample*)pBuffer);
+    _released.notify_one();
+    return S_OK;
+}
+
+
+//  MockPin
+//
+MockPin::MockPin(LPCWSTR name, PIN_DIRECTION direction)
+{
+    _refCount = 0;
+    _name = name;
+    _direction = direction;
+    _connected = NULL;
+    _allocator = NULL;
+    _readOnly = FALSE;
+    _received = 0;
+    _last = NULL;
+    _checking = false;
+    _checksum = 0;
+    AddRef();
+}
+
+MockPin::~MockPin()
+{
+    Disconnect();
+}
+
+STDMETHODIMP MockPin::QueryInterface(REFIID iid, void** ppvObject)
+{
+    if (ppvObject == NULL) return E_POINTER;
+    if (iid == IID_IUnknown) {
+        *ppvObject = (IPin*)this;
+    } else if (iid == IID_IPin) {
+        *ppvObject = (IPin*)this;
+    } else if (iid == IID_IMemInputPin && _direction == PINDIR_INPUT) {
+        *ppvObject = (IMemInputPin*)this;
+    } else {
+        *ppvObject = NULL;
+        return E_NOINTERFACE;
+    }
+    AddRef();
+    return S_OK;
+}
+
+STDMETHODIMP MockPin::ReceiveConnection(IPin* pConnector, const AM_MEDIA_TYPE* pmt)
+{
+    if (pConnector == NULL || pmt == NULL) return E_POINTER;
+    if (_direction != PINDIR_INPUT) return E_UNEXPECTED;
+    if (_connected != NULL) return VFW_E_ALREADY_CONNECTED;
+    _connected = pConnector;
+    _connected->AddRef();
+    return S_OK;
+}
+
+STDMETHODIMP MockPin::Disconnect()
+{
+    if (_allocator != NULL) {
+        _allocator->Release();
+        _allocator = NULL;
+    }
+    if (_connected == NULL) return S_FALSE;
+    _connected->Release();
+    _connected = NULL;
+    return S_OK;
+}
+
+STDMETHODIMP MockPin::ConnectedTo(IPin** ppPin)
+{
+    if (ppPin == NULL) return E_POINTER;
+    *ppPin = _connected;
+    if (_connected == NULL) return VFW_E_NOT_CONNECTED;
+    (*ppPin)->AddRef();
+    return S_OK;
+}
+
+STDMETHODIMP MockPin::QueryPinInfo(PIN_INFO* pInfo)
+{
+    if (pInfo == NULL) return E_POINTER;
+    ZeroMemory(pInfo, sizeof(*pInfo));
+    pInfo->dir = _direction;
+    StringCchCopy(pInfo->achName, _countof(pInfo->achName), _name);
+    return S_OK;
+}
+
+STDMETHODIMP MockPin::QueryDirection(PIN_DIRECTION* pPinDir)
+{
+    if (pPinDir == NULL) return E_POINTER;
+    *pPinDir = _direction;
+    return S_OK;
+}
+
+// GetAllocator: the renderer has no allocator of its own.
+STDMETHODIMP MockPin::GetAllocator(IMemAllocator** ppAllocator)
+{
+    if (ppAllocator == NULL) return E_POINTER;
+    return CoCreateInstance(
+        CLSID_MemoryAllocator, 0, CLSCTX_INPROC_SERVER,
+        IID_PPV_ARGS(ppAllocator));
+}
+
+STDMETHODIMP MockPin::NotifyAllocator(IMemAllocator* pAllocator, BOOL bReadOnly)
+{
+    if (pAllocator == NULL) return E_POINTER;
+    pAllocator->AddRef();
+    if (_allocator != NULL) {
+        _allocator->Release();
+    }
+    _allocator = pAllocator;
+    _readOnly = bReadOnly;
+    return S_OK;
+}
+
+STDMETHODIMP MockPin::Receive(IMediaSample* pSample)
+{
+    if (pSample == NULL) return E_POINTER;
+    if (_direction != PINDIR_INPUT) return E_UNEXPECTED;
+    _received++;
+    _last = pSample;
+    if (_checking) {
+        BYTE* buf = NULL;
+        HRESULT hr = pSample->GetPointer(&buf);
+        if (FAILED(hr)) return hr;
+        _checksum = Checksum(buf, pSample->GetActualDataLength());
+    }
+    return S_OK;
+}
+
+uint64_t MockPin::Checksum(const BYTE* buf, size_t length)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < length; i++) {
+        h = (h ^ buf[i]) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+STDMETHODIMP MockPin::ReceiveMultiple(
+    IMediaSample** pSamples, long nSamples, long* nSamplesProcessed)
+{
+    HRESULT hr = S_OK;
+    if (pSamples == NULL) return E_POINTER;
+    long n = 0;
+    for (long i = 0; i < nSamples; i++) {
+        hr = Receive(pSamples[i]);
+        if (FAILED(hr)) break;
+        n++;
+    }
+    if (nSamplesProcessed != NULL) {
+        *nSamplesProcessed = n;
+    }
+    return hr;
+}
+
+
+//  MockClock
+//
+MockClock::MockClock()
+{
+    _refCount = 0;
+    AddRef();
+}
+
+STDMETHODIMP MockClock::QueryInterface(REFIID iid, void** ppvObject)
+{
+    if (ppvObject == NULL) return E_POINTER;
+    if (iid == IID_IUnknown || iid == IID_IReferenceClock) {
+        *ppvObject = (IReferenceClock*)this;
+    } else {
+        *ppvObject = NULL;
+        return E_NOINTERFACE;
+    }
+    AddRef();
+    return S_OK;
+}
+
+// GetTime: in 100ns units.
+STDMETHODIMP MockClock::GetTime(REFERENCE_TIME* pTime)
+{
+    if (pTime == NULL) return E_POINTER;
+    *pTime = (REFERENCE_TIME)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count() / 100;
+    return S_OK;
+}
@@ -0,0 +1,275 @@
+// -*- tab-width: 4; mode: c++ -*-
+//  mock/MockDShow.h
+//
+//  Fake DirectShow objects, to run Filtaa outside of a filter graph
+//  (see ReceiveTool.cpp). With the headers in this directory on the
+//  include path, Filtaa.cpp compiles natively; MockDShow.cpp has the
+//  GUIDs and the COM functions it links against.
+//
+//  Only one thread streams; the allocator is the only object that
+//  can be called from more than one.
+//
+
+#pragma once
+#include <windows.h>
+#include <dshow.h>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+class MockAllocator;
+
+
+//  MockSample: a buffer of a MockAllocator.
+//
+//  Returns itself to the allocator when released.
+//
+class MockSample : public IMediaSample
+{
+private:
+    int _refCount;
+    MockAllocator* _allocator;
+    BYTE* _buf;
+    long _size;
+    long _length;
+    REFERENCE_TIME _tStart, _tEnd;
+    bool _timed;
+    LONGLONG _mStart, _mEnd;
+    bool _mediaTimed;
+    BOOL _syncPoint;
+    BOOL _preroll;
+    BOOL _discontinuity;
+    AM_MEDIA_TYPE* _mt;         // a type change, or NULL.
+
+    MockSample(const MockSample&);
+    MockSample& operator=(const MockSample&);
+
+public:
+    MockSample(MockAllocator* allocator, BYTE* buf, long size);
+    virtual ~MockSample();
+
+    // Clear: forgets the properties, before the sample is reused.
+    void Clear();
+
+    // IUnknown methods
+    STDMETHODIMP QueryInterface(REFIID iid, void** ppvObject);
+    STDMETHODIMP_(ULONG) AddRef() {
+        _refCount++; return _refCount;
+    }
+    STDMETHODIMP_(ULONG) Release();
+
+    // IMediaSample methods
+    STDMETHODIMP GetPointer(BYTE** ppBuffer);
+    STDMETHODIMP_(long) GetSize()
+        { return _size; }
+    STDMETHODIMP GetTime(REFERENCE_TIME* pTimeStart, REFERENCE_TIME* pTimeEnd);
+    STDMETHODIMP SetTime(REFERENCE_TIME* pTimeStart, REFERENCE_TIME* pTimeEnd);
+    STDMETHODIMP IsSyncPoint()
+        { return _syncPoint? S_OK : S_FALSE; }
+    STDMETHODIMP SetSyncPoint(BOOL bIsSyncPoint)
+        { _syncPoint = bIsSyncPoint; return S_OK; }
+    STDMETHODIMP IsPreroll()
+        { return _preroll? S_OK : S_FALSE; }
+    STDMETHODIMP SetPreroll(BOOL bIsPreroll)
+        { _preroll = bIsPreroll; return S_OK; }
+    STDMETHODIMP_(long) GetActualDataLength()
+        { return _length; }
+    STDMETHODIMP SetActualDataLength(long len);
+    STDMETHODIMP GetMediaType(AM_MEDIA_TYPE** ppMediaType);
+    STDMETHODIMP SetMediaType(AM_MEDIA_TYPE* pMediaType);
+    STDMETHODIMP IsDiscontinuity()
+        { return _discontinuity? S_OK : S_FALSE; }
+    STDMETHODIMP SetDiscontinuity(BOOL bDiscontinuity)
+        { _discontinuity = bDiscontinuity; return S_OK; }
+    STDMETHODIMP GetMediaTime(LONGLONG* pTimeStart, LONGLONG* pTimeEnd);
+    STDMETHODIMP SetMediaTime(LONGLONG* pTimeStart, LONGLONG* pTimeEnd);
+};
+
+
+//  MockAllocator: a fixed pool of samples, as CLSID_MemoryAllocator.
+//
+//  GetBuffer() waits for a sample to be released when all of them
+//  are out, as the real one does.
+//
+class MockAllocator : public IMemAllocator
+{
+private:
+    int _refCount;
+    ALLOCATOR_PROPERTIES _props;
+    bool _committed;
+    std::vector<BYTE*> _memory;
+    std::vector<MockSample*> _samples;
+    std::vector<MockSample*> _free;
+    std::mutex _mutex;
+    std::condition_variable _released;
+    uint64_t _buffers;          // GetBuffer() calls that got one.
+
+    MockAllocator(const MockAllocator&);
+    MockAllocator& operator=(const MockAllocator&);
+
+    void Free();
+
+public:
+    MockAllocator();
+    virtual ~MockAllocator();
+
+    // GetBufferCount: returns how many samples were handed out.
+    uint64_t GetBufferCount()
+        { return _buffers; }
+
+    // IUnknown methods
+    STDMETHODIMP QueryInterface(REFIID iid, void** ppvObject);
+    STDMETHODIMP_(ULONG) AddRef() {
+        _refCount++; return _refCount;
+    }
+    STDMETHODIMP_(ULONG) Release() {
+        _refCount--;
+        if (_refCount) return _refCount;
+        delete this;
+        return 0;
+    }
+
+    // IMemAllocator methods
+    STDMETHODIMP SetProperties(ALLOCATOR_PROPERTIES* pRequest, ALLOCATOR_PROPERTIES* pActual);
+    STDMETHODIMP GetProperties(ALLOCATOR_PROPERTIES* pProps);
+    STDMETHODIMP Commit();
+    STDMETHODIMP Decommit();
+    STDMETHODIMP GetBuffer(IMediaSample** ppBuffer, REFERENCE_TIME* pStartTime,
+                           REFERENCE_TIME* pEndTime, DWORD dwFlags);
+    STDMETHODIMP ReleaseBuffer(IMediaSample* pBuffer);
+};
+
+
+//  MockPin: the output pin of a source, or the input pin of a
+//  renderer that takes the samples and does nothing with them.
+//
+//  A renderer pin counts what it receives and, when asked, keeps
+//  a checksum of the last sample.
+//
+class MockPin : public IPin, public IMemInputPin
+{
+private:
+    int _refCount;
+    LPCWSTR _name;
+    PIN_DIRECTION _direction;
+    IPin* _connected;
+    IMemAllocator* _allocator;
+    BOOL _readOnly;
+    uint64_t _received;
+    IMediaSample* _last;        // not held; only to compare.
+    bool _checking;
+    uint64_t _checksum;
+
+    MockPin(const MockPin&);
+    MockPin& operator=(const MockPin&);
+
+public:
+    MockPin(LPCWSTR name, PIN_DIRECTION direction);
+    virtual ~MockPin();
+
+    IMemAllocator* GetNotifiedAllocator()
+        { return _allocator; }
+    BOOL IsReadOnly()
+        { return _readOnly; }
+    uint64_t GetReceived()
+        { return _received; }
+    // GetLastSample: returns the last sample taken, which may be gone.
+    IMediaSample* GetLastSample()
+        { return _last; }
+    // SetChecking: starts or stops taking the checksum.
+    void SetChecking(bool checking)
+        { _checking = checking; }
+    // GetChecksum: returns the hash of the last sample taken.
+    uint64_t GetChecksum()
+        { return _checksum; }
+    // Checksum: the FNV-1a hash of some bytes.
+    static uint64_t Checksum(const BYTE* buf, size_t length);
+
+    // IUnknown methods
+    STDMETHODIMP QueryInterface(REFIID iid, void** ppvObject);
+    STDMETHODIMP_(ULONG) AddRef() {
+        _refCount++; return _refCount;
+    }
+    STDMETHODIMP_(ULONG) Release() {
+        _refCount--;
+        if (_refCount) return _refCount;
+        delete this;
+        return 0;
+    }
+
+    // IPin methods
+    STDMETHODIMP Connect(IPin* pReceivePin, const AM_MEDIA_TYPE* pmt)
+        { return E_NOTIMPL; }
+    STDMETHODIMP ReceiveConnection(IPin* pConnector, const AM_MEDIA_TYPE* pmt);
+    STDMETHODIMP Disconnect();
+    STDMETHODIMP ConnectedTo(IPin** ppPin);
+    STDMETHODIMP ConnectionMediaType(AM_MEDIA_TYPE* pmt)
+        { return E_NOTIMPL; }
+    STDMETHODIMP QueryPinInfo(PIN_INFO* pInfo);
+    STDMETHODIMP QueryDirection(PIN_DIRECTION* pPinDir);
+    STDMETHODIMP QueryId(LPWSTR* Id)
+        { return E_NOTIMPL; }
+    STDMETHODIMP QueryAccept(const AM_MEDIA_TYPE* pmt)
+        { return S_OK; }
+    STDMETHODIMP EnumMediaTypes(IEnumMediaTypes** ppEnum)
+        { return E_NOTIMPL; }
+    STDMETHODIMP QueryInternalConnections(IPin**, ULONG*)
+        { return E_NOTIMPL; }
+    STDMETHODIMP EndOfStream()
+        { return S_OK; }
+    STDMETHODIMP BeginFlush()
+        { return S_OK; }
+    STDMETHODIMP EndFlush()
+        { return S_OK; }
+    STDMETHODIMP NewSegment(REFERENCE_TIME tStart, REFERENCE_TIME tStop, double dRate)
+        { return S_OK; }
+
+    // IMemInputPin methods
+    STDMETHODIMP GetAllocator(IMemAllocator** ppAllocator);
+    STDMETHODIMP NotifyAllocator(IMemAllocator* pAllocator, BOOL bReadOnly);
+    STDMETHODIMP GetAllocatorRequirements(ALLOCATOR_PROPERTIES* pProps)
+        { return E_NOTIMPL; }
+    STDMETHODIMP Receive(IMediaSample* pSample);
+    STDMETHODIMP ReceiveMultiple(IMediaSample** pSamples, long nSamples, long* nSamplesProcessed);
+    STDMETHODIMP ReceiveCanBlock()
+        { return S_FALSE; }
+};
+
+
+//  MockClock: the reference clock, from the monotonic clock.
+//
+class MockClock : public IReferenceClock
+{
+private:
+    int _refCount;
+
+    MockClock(const MockClock&);
+    MockClock& operator=(const MockClock&);
+
+public:
+    MockClock();
+    virtual ~MockClock() {}
+
+    // IUnknown methods
+    STDMETHODIMP QueryInterface(REFIID iid, void** ppvObject);
+    STDMETHODIMP_(ULONG) AddRef() {
+        _refCount++; return _refCount;
+    }
+    STDMETHODIMP_(ULONG) Release() {
+        _refCount--;
+        if (_refCount) return _refCount;
+        delete this;
+        return 0;
+    }
+
+    // IReferenceClock methods
+    STDMETHODIMP GetTime(REFERENCE_TIME* pTime);
+    STDMETHODIMP AdviseTime(REFERENCE_TIME baseTime, REFERENCE_TIME streamTime,
+                            HANDLE hEvent, DWORD_PTR* pdwAdviseCookie)
+        { return E_NOTIMPL; }
+    STDMETHODIMP AdvisePeriodic(REFERENCE_TIME startTime, REFERENCE_TIME periodTime,
+                                HANDLE hSemaphore, DWORD_PTR* pdwAdviseCookie)
+        { return E_NOTIMPL; }
+    STDMETHODIMP Unadvise(DWORD_PTR dwAdviseCookie)
+        { return E_NOTIMPL; }
+};
@@ -0,0 +1,234 @@
+// -*- tab-width: 4; mode: c++ -*-
+//  mock/dshow.h
+//
+//  A stand-in for the DirectShow interfaces that Filtaa uses and
+//  implements. The methods are in the order of the real vtables.
+//
+
+#pragma once
+#include <windows.h>
+#include <strsafe.h>
+
+typedef LONGLONG REFERENCE_TIME;
+enum FILTER_STATE {
+    State_Stopped, State_Paused, State_Running
+};
+enum PIN_DIRECTION {
+    PINDIR_INPUT, PINDIR_OUTPUT
+};
+
+#define MAX_PIN_NAME 128
+#define MAX_FILTER_NAME 128
+
+#define VFW_E_NOT_CONNECTED ((HRESULT)0x80040209L)
+#define VFW_E_ALREADY_CONNECTED ((HRESULT)0x80040204L)
+#define VFW_E_NO_ACCEPTABLE_TYPES ((HRESULT)0x80040207L)
+#define VFW_E_TYPE_NOT_ACCEPTED ((HRESULT)0x8004022AL)
+#define VFW_E_NOT_STOPPED ((HRESULT)0x80040224L)
+#define VFW_E_NOT_FOUND ((HRESULT)0x80040216L)
+#define VFW_E_NOT_COMMITTED ((HRESULT)0x80040211L)
+#define VFW_E_SIZENOTSET ((HRESULT)0x80040212L)
+#define VFW_E_SAMPLE_TIME_NOT_SET ((HRESULT)0x80040249L)
+#define VFW_E_MEDIA_TIME_NOT_SET ((HRESULT)0x80040251L)
+
+struct AM_MEDIA_TYPE
+{
+    GUID majortype;
+    GUID subtype;
+    BOOL bFixedSizeSamples;
+    BOOL bTemporalCompression;
+    ULONG lSampleSize;
+    GUID formattype;
+    IUnknown* pUnk;
+    ULONG cbFormat;
+    BYTE* pbFormat;
+};
+
+struct ALLOCATOR_PROPERTIES
+{
+    long cBuffers;
+    long cbBuffer;
+    long cbAlign;
+    long cbPrefix;
+};
+
+struct VIDEOINFOHEADER
+{
+    RECT rcSource;
+    RECT rcTarget;
+    DWORD dwBitRate;
+    DWORD dwBitErrorRate;
+    REFERENCE_TIME AvgTimePerFrame;
+    BITMAPINFOHEADER bmiHeader;
+};
+
+struct IBaseFilter;
+struct IPin;
+struct IFilterGraph;
+
+struct PIN_INFO
+{
+    IBaseFilter* pFilter;
+    PIN_DIRECTION dir;
+    WCHAR achName[MAX_PIN_NAME];
+};
+
+struct FILTER_INFO
+{
+    WCHAR achName[MAX_FILTER_NAME];
+    IFilterGraph* pGraph;
+};
+
+struct IPersist : public IUnknown
+{
+    virtual HRESULT GetClassID(CLSID* pClassID) = 0;
+};
+
+struct IReferenceClock : public IUnknown
+{
+    virtual HRESULT GetTime(REFERENCE_TIME* pTime) = 0;
+    virtual HRESULT AdviseTime(REFERENCE_TIME baseTime, REFERENCE_TIME streamTime,
+                               HANDLE hEvent, DWORD_PTR* pdwAdviseCookie) = 0;
+    virtual HRESULT AdvisePeriodic(REFERENCE_TIME startTime, REFERENCE_TIME periodTime,
+                                   HANDLE hSemaphore, DWORD_PTR* pdwAdviseCookie) = 0;
+    virtual HRESULT Unadvise(DWORD_PTR dwAdviseCookie) = 0;
+};
+
+struct IMediaFilter : public IPersist
+{
+    virtual HRESULT Stop() = 0;
+    virtual HRESULT Pause() = 0;
+    virtual HRESULT Run(REFERENCE_TIME tStart) = 0;
+    virtual HRESULT GetState(DWORD dwMilliSecsTimeout, FILTER_STATE* pState) = 0;
+    virtual HRESULT SetSyncSource(IReferenceClock* pClock) = 0;
+    virtual HRESULT GetSyncSource(IReferenceClock** pClock) = 0;
+};
+
+struct IEnumPins : public IUnknown
+{
+    virtual HRESULT Next(ULONG n, IPin** ppPins, ULONG* pFetched) = 0;
+    virtual HRESULT Skip(ULONG n) = 0;
+    virtual HRESULT Reset() = 0;
+    virtual HRESULT Clone(IEnumPins** ppEnum) = 0;
+};
+
+struct IEnumMediaTypes : public IUnknown
+{
+    virtual HRESULT Next(ULONG n, AM_MEDIA_TYPE** ppMediaTypes, ULONG* pFetched) = 0;
+    virtual HRESULT Skip(ULONG n) = 0;
+    virtual HRESULT Reset() = 0;
+    virtual HRESULT Clone(IEnumMediaTypes** ppEnum) = 0;
+};
+
+struct IBaseFilter : public IMediaFilter
+{
+    virtual HRESULT EnumPins(IEnumPins** ppEnum) = 0;
+    virtual HRESULT FindPin(LPCWSTR Id, IPin** ppPin) = 0;
+    virtual HRESULT QueryFilterInfo(FILTER_INFO* pInfo) = 0;
+    virtual HRESULT JoinFilterGraph(IFilterGraph* pGraph, LPCWSTR pName) = 0;
+    virtual HRESULT QueryVendorInfo(LPWSTR* pVendorInfo) = 0;
+};
+
+struct IFilterGraph : public IUnknown
+{
+    virtual HRESULT AddFilter(IBaseFilter* pFilter, LPCWSTR pName) = 0;
+    virtual HRESULT RemoveFilter(IBaseFilter* pFilter) = 0;
+    virtual HRESULT Disconnect(IPin* ppin) = 0;
+};
+
+struct IPin : public IUnknown
+{
+    virtual HRESULT Connect(IPin* pReceivePin, const AM_MEDIA_TYPE* pmt) = 0;
+    virtual HRESULT ReceiveConnection(IPin* pConnector, const AM_MEDIA_TYPE* pmt) = 0;
+    virtual HRESULT Disconnect() = 0;
+    virtual HRESULT ConnectedTo(IPin** pPin) = 0;
+    virtual HRESULT ConnectionMediaType(AM_MEDIA_TYPE* pmt) = 0;
+    virtual HRESULT QueryPinInfo(PIN_INFO* pInfo) = 0;
+    virtual HRESULT QueryDirection(PIN_DIRECTION* pPinDir) = 0;
+    virtual HRESULT QueryId(LPWSTR* Id) = 0;
+    virtual HRESULT QueryAccept(const AM_MEDIA_TYPE* pmt) = 0;
+    virtual HRESULT EnumMediaTypes(IEnumMediaTypes** ppEnum) = 0;
+    virtual HRESULT QueryInternalConnections(IPin** apPin, ULONG* nPin) = 0;
+    virtual HRESULT EndOfStream() = 0;
+    virtual HRESULT BeginFlush() = 0;
+    virtual HRESULT EndFlush() = 0;
+    virtual HRESULT NewSegment(REFERENCE_TIME tStart, REFERENCE_TIME tStop, double dRate) = 0;
+};
+
+struct IMediaSample : public IUnknown
+{
+    virtual HRESULT GetPointer(BYTE** ppBuffer) = 0;
+    virtual long GetSize() = 0;
+    virtual HRESULT GetTime(REFERENCE_TIME* pTimeStart, REFERENCE_TIME* pTimeEnd) = 0;
+    virtual HRESULT SetTime(REFERENCE_TIME* pTimeStart, REFERENCE_TIME* pTimeEnd) = 0;
+    virtual HRESULT IsSyncPoint() = 0;
+    virtual HRESULT SetSyncPoint(BOOL bIsSyncPoint) = 0;
+    virtual HRESULT IsPreroll() = 0;
+    virtual HRESULT SetPreroll(BOOL bIsPreroll) = 0;
+    virtual long GetActualDataLength() = 0;
+    virtual HRESULT SetActualDataLength(long len) = 0;
+    virtual HRESULT GetMediaType(AM_MEDIA_TYPE** ppMediaType) = 0;
+    virtual HRESULT SetMediaType(AM_MEDIA_TYPE* pMediaType) = 0;
+    virtual HRESULT IsDiscontinuity() = 0;
+    virtual HRESULT SetDiscontinuity(BOOL bDiscontinuity) = 0;
+    virtual HRESULT GetMediaTime(LONGLONG* pTimeStart, LONGLONG* pTimeEnd) = 0;
+    virtual HRESULT SetMediaTime(LONGLONG* pTimeStart, LONGLONG* pTimeEnd) = 0;
+};
+
+struct IMemAllocator : public IUnknown
+{
+    virtual HRESULT SetProperties(ALLOCATOR_PROPERTIES* pRequest, ALLOCATOR_PROPERTIES* pActual) = 0;
+    virtual HRESULT GetProperties(ALLOCATOR_PROPERTIES* pProps) = 0;
+    virtual HRESULT Commit() = 0;
+    virtual HRESULT Decommit() = 0;
+    virtual HRESULT GetBuffer(IMediaSample** ppBuffer, REFERENCE_TIME* pStartTime,
+                              REFERENCE_TIME* pEndTime, DWORD dwFlags) = 0;
+    virtual HRESULT ReleaseBuffer(IMediaSample* pBuffer) = 0;
+};
+
+struct IMemInputPin : public IUnknown
+{
+    virtual HRESULT GetAllocator(IMemAllocator** ppAllocator) = 0;
+    virtual HRESULT NotifyAllocator(IMemAllocator* pAllocator, BOOL bReadOnly) = 0;
+    virtual HRESULT GetAllocatorRequirements(ALLOCATOR_PROPERTIES* pProps) = 0;
+    virtual HRESULT Receive(IMediaSample* pSample) = 0;
+    virtual HRESULT ReceiveMultiple(IMediaSample** pSamples, long nSamples, long* nSamplesProcessed) = 0;
+    virtual HRESULT ReceiveCanBlock() = 0;
+};
+
+enum QualityMessageType {
+    Famine, Flood
+};
+struct Quality
+{
+    QualityMessageType Type;
+    long Proportion;
+    REFERENCE_TIME Late;
+    REFERENCE_TIME TimeStamp;
+};
+
+struct IQualityControl : public IUnknown
+{
+    virtual HRESULT Notify(IBaseFilter* pSelf, Quality q) = 0;
+    virtual HRESULT SetSink(IQualityControl* piqc) = 0;
+};
+
+MOCK_UUIDOF(IPersist)
+MOCK_UUIDOF(IReferenceClock)
+MOCK_UUIDOF(IMediaFilter)
+MOCK_UUIDOF(IBaseFilter)
+MOCK_UUIDOF(IFilterGraph)
+MOCK_UUIDOF(IEnumPins)
+MOCK_UUIDOF(IEnumMediaTypes)
+MOCK_UUIDOF(IPin)
+MOCK_UUIDOF(IMediaSample)
+MOCK_UUIDOF(IMemAllocator)
+MOCK_UUIDOF(IMemInputPin)
+MOCK_UUIDOF(IQualityControl)
+
+extern const GUID MEDIATYPE_Video;
+extern const GUID MEDIASUBTYPE_RGB24;
+extern const GUID MEDIASUBTYPE_RGB555;
+extern const GUID MEDIASUBTYPE_RGB565;
+extern const GUID FORMAT_VideoInfo;
+extern const CLSID CLSID_MemoryAllocator;
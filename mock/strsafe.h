@@ -0,0 +1,30 @@
+// -*- tab-width: 4; mode: c++ -*-
+//  mock/strsafe.h
+//
+//  A stand-in for the string functions that Filtaa uses.
+//
+
+#pragma once
+#include <windows.h>
+
+#define STRSAFE_E_INSUFFICIENT_BUFFER ((HRESULT)0x8007007AL)
+
+// StringCchCopy: copies src into n characters, truncating it.
+inline HRESULT StringCchCopy(LPWSTR dst, size_t n, LPCWSTR src)
+{
+    if (n == 0) return E_INVALIDARG;
+    size_t len = wcslen(src);
+    if (n <= len) {
+        wmemcpy(dst, src, n-1);
+        dst[n-1] = L'\0';
+        return STRSAFE_E_INSUFFICIENT_BUFFER;
+    }
+    wmemcpy(dst, src, len+1);
+    return S_OK;
+}
+
+// StringCbCopy: the same, in bytes.
+inline HRESULT StringCbCopy(LPWSTR dst, size_t cb, LPCWSTR src)
+{
+    return StringCchCopy(dst, cb/sizeof(WCHAR), src);
+}
@@ -0,0 +1,126 @@
+// -*- tab-width: 4; mode: c++ -*-
+//  mock/windows.h
+//
+//  A stand-in for the Win32 and COM declarations that Filtaa uses,
+//  so that it compiles natively (see MockDShow.h). Only what Filtaa
+//  needs is here; the types have the sizes of their Win32 originals
+//  where Filtaa depends on them.
+//
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+
+typedef int32_t HRESULT;
+typedef int32_t LONG;
+typedef uint32_t ULONG;
+typedef uint32_t DWORD;
+typedef uint16_t WORD;
+typedef uint8_t BYTE;
+typedef int BOOL;
+typedef int64_t LONGLONG;
+typedef uintptr_t DWORD_PTR;
+typedef size_t SIZE_T;
+typedef wchar_t WCHAR;
+typedef WCHAR* LPWSTR;
+typedef const WCHAR* LPCWSTR;
+typedef void* LPVOID;
+typedef void* HANDLE;
+
+#define TRUE 1
+#define FALSE 0
+#define STDMETHODIMP HRESULT
+#define STDMETHODIMP_(t) t
+
+#define S_OK ((HRESULT)0)
+#define S_FALSE ((HRESULT)1)
+#define E_NOTIMPL ((HRESULT)0x80004001L)
+#define E_NOINTERFACE ((HRESULT)0x80004002L)
+#define E_POINTER ((HRESULT)0x80004003L)
+#define E_FAIL ((HRESULT)0x80004005L)
+#define E_UNEXPECTED ((HRESULT)0x8000FFFFL)
+#define E_OUTOFMEMORY ((HRESULT)0x8007000EL)
+#define E_INVALIDARG ((HRESULT)0x80070057L)
+#define CLASS_E_CLASSNOTAVAILABLE ((HRESULT)0x80040111L)
+#define SUCCEEDED(hr) (0 <= (HRESULT)(hr))
+#define FAILED(hr) ((HRESULT)(hr) < 0)
+
+#define CopyMemory(d,s,n) memcpy((d),(s),(n))
+#define ZeroMemory(d,n) memset((d),0,(n))
+#define _countof(a) (sizeof(a)/sizeof((a)[0]))
+#define lstrlen(s) ((int)wcslen(s))
+#define lstrcmp(a,b) wcscmp((a),(b))
+#define swprintf_s swprintf
+
+//  GUID
+//
+struct GUID
+{
+    uint32_t Data1;
+    uint16_t Data2;
+    uint16_t Data3;
+    uint8_t Data4[8];
+};
+typedef GUID IID;
+typedef GUID CLSID;
+typedef const IID& REFIID;
+typedef const CLSID& REFCLSID;
+inline bool operator==(const GUID& a, const GUID& b)
+    { return memcmp(&a, &b, sizeof(GUID)) == 0; }
+inline bool operator!=(const GUID& a, const GUID& b)
+    { return !(a == b); }
+
+struct RECT
+{
+    LONG left, top, right, bottom;
+};
+
+struct BITMAPINFOHEADER
+{
+    DWORD biSize;
+    LONG biWidth;
+    LONG biHeight;
+    WORD biPlanes;
+    WORD biBitCount;
+    DWORD biCompression;
+    DWORD biSizeImage;
+    LONG biXPelsPerMeter;
+    LONG biYPelsPerMeter;
+    DWORD biClrUsed;
+    DWORD biClrImportant;
+};
+#define BI_RGB 0
+
+//  IUnknown
+//
+struct IUnknown
+{
+    virtual HRESULT QueryInterface(REFIID iid, void** ppvObject) = 0;
+    virtual ULONG AddRef() = 0;
+    virtual ULONG Release() = 0;
+};
+
+extern const IID IID_IUnknown;
+
+// IID_PPV_ARGS: the IID of the interface pp points to, and pp.
+//   The IIDs are looked up with mockUuidOf<T>(), which MOCK_UUIDOF
+//   defines for each interface.
+template <class T> const IID& mockUuidOf();
+template <class P> struct mockPointee;
+template <class T> struct mockPointee<T**> { typedef T type; };
+#define IID_PPV_ARGS(pp) \
+    mockUuidOf<mockPointee<decltype(pp)>::type>(), (void**)(pp)
+#define MOCK_UUIDOF(T) \
+    extern const IID IID_##T; \
+    template <> inline const IID& mockUuidOf<T>() { return IID_##T; }
+MOCK_UUIDOF(IUnknown)
+
+// The COM runtime (see MockDShow.cpp).
+#define CLSCTX_INPROC_SERVER 1
+LPVOID CoTaskMemAlloc(SIZE_T cb);
+void CoTaskMemFree(LPVOID pv);
+HRESULT CoCreateInstance(REFCLSID rclsid, IUnknown* pUnkOuter, DWORD dwClsContext,
+                         REFIID riid, LPVOID* ppv);